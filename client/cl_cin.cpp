@@ -170,10 +170,10 @@ void SCR_StopCinematic (void)
 		R_SetPalette(NULL);
 		cl.cinematicpalette_active = false;
 	}
-	if (cl.cinematic_file)
+	if (cl.cinematic_stream)
 	{
-		fclose (cl.cinematic_file);
-		cl.cinematic_file = NULL;
+		FS_CloseStream (cl.cinematic_stream);
+		cl.cinematic_stream = NULL;
 	}
 	if (cin.hnodes1)
 	{
@@ -206,6 +206,19 @@ void SCR_FinishCinematic (void)
 
 //==========================================================================
 
+/*
+==================
+SCR_ReadCinematic
+
+Reads from the cinematic stream, dropping if it comes up short
+==================
+*/
+static void SCR_ReadCinematic (void *buffer, int length)
+{
+	if (FS_ReadStream (cl.cinematic_stream, buffer, length) != length)
+		Com_Error (ERR_DROP, "SCR_ReadCinematic: truncated cinematic");
+}
+
 /*
 ==================
 SmallestNode1
@@ -263,7 +276,7 @@ void Huff1TableInit (void)
 		memset (cin.h_used,0,sizeof(cin.h_used));
 
 		// read a row of counts
-		FS_Read (counts, sizeof(counts), cl.cinematic_file);
+		SCR_ReadCinematic (counts, sizeof(counts));
 		for (j=0 ; j<256 ; j++)
 			cin.h_count[j] = counts[j];
 
@@ -430,7 +443,6 @@ byte *SCR_ReadNextFrame (void)
 {
 	int		r;
 	int		command;
-	byte	samples[22050/14*4];
 	byte	compressed[0x20000];
 	unsigned int		size;
 	byte	*pic;
@@ -438,11 +450,8 @@ byte *SCR_ReadNextFrame (void)
 	int		start, end, count;
 
 	// read the next frame
-	r = fread (&command, 4, 1, cl.cinematic_file);
-	if (r == 0)		// we'll give it one more chance
-		r = fread (&command, 4, 1, cl.cinematic_file);
-
-	if (r != 1)
+	r = FS_ReadStream (cl.cinematic_stream, &command, 4);
+	if (r != 4)
 		return NULL;
 	command = LittleLong(command);
 	if (command == 2)
@@ -450,25 +459,24 @@ byte *SCR_ReadNextFrame (void)
 
 	if (command == 1)
 	{	// read palette
-		FS_Read (cl.cinematicpalette, sizeof(cl.cinematicpalette), cl.cinematic_file);
+		SCR_ReadCinematic (cl.cinematicpalette, sizeof(cl.cinematicpalette));
 		cl.cinematicpalette_active=0;	// dubious....  exposes an edge case
 	}
 
 	// decompress the next frame
-	FS_Read (&size, 4, cl.cinematic_file);
+	SCR_ReadCinematic (&size, 4);
 	size = LittleLong(size);
 	if (size > sizeof(compressed) || size < 1)
 		Com_Error (ERR_DROP, "Bad compressed frame size");
-	FS_Read (compressed, size, cl.cinematic_file);
+	SCR_ReadCinematic (compressed, size);
 
 	// read sound
 	start = cl.cinematicframe*cin.s_rate/14;
 	end = (cl.cinematicframe+1)*cin.s_rate/14;
 	count = end - start;
 
-	FS_Read (samples, count*cin.s_width*cin.s_channels, cl.cinematic_file);
-
-	S_RawSamples (count, cin.s_rate, cin.s_width, cin.s_channels, samples);
+	if (S_RawSamplesFromStream (cl.cinematic_stream, count, cin.s_rate, cin.s_width, cin.s_channels) != count)
+		Com_Error (ERR_DROP, "SCR_ReadNextFrame: truncated cinematic");
 
 	in.data = compressed;
 	in.count = size;
@@ -612,8 +620,8 @@ void SCR_PlayCinematic (char *arg)
 	}
 
 	Com_sprintf (name, sizeof(name), "video/%s", arg);
-	FS_FOpenFile (name, &cl.cinematic_file);
-	if (!cl.cinematic_file)
+	cl.cinematic_stream = FS_OpenStream (name);
+	if (!cl.cinematic_stream)
 	{
 //		Com_Error (ERR_DROP, "Cinematic %s not found.\n", name);
 		SCR_FinishCinematic ();
@@ -625,16 +633,16 @@ void SCR_PlayCinematic (char *arg)
 
 	cls.state = ca_active;
 
-	FS_Read (&width, 4, cl.cinematic_file);
-	FS_Read (&height, 4, cl.cinematic_file);
+	SCR_ReadCinematic (&width, 4);
+	SCR_ReadCinematic (&height, 4);
 	cin.width = LittleLong(width);
 	cin.height = LittleLong(height);
 
-	FS_Read (&cin.s_rate, 4, cl.cinematic_file);
+	SCR_ReadCinematic (&cin.s_rate, 4);
 	cin.s_rate = LittleLong(cin.s_rate);
-	FS_Read (&cin.s_width, 4, cl.cinematic_file);
+	SCR_ReadCinematic (&cin.s_width, 4);
 	cin.s_width = LittleLong(cin.s_width);
-	FS_Read (&cin.s_channels, 4, cl.cinematic_file);
+	SCR_ReadCinematic (&cin.s_channels, 4);
 	cin.s_channels = LittleLong(cin.s_channels);
 
 	Huff1TableInit ();
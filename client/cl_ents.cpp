@@ -318,6 +318,24 @@ void CL_ParseDelta (entity_state_t *from, entity_state_t *to, int number, int bi
 		to->solid = MSG_ReadShort (&net_message);
 }
 
+/*
+==================
+CL_ParseDeltaBits
+
+CL_ParseDelta for svc_bitentities
+==================
+*/
+static void CL_ParseDeltaBits (entity_state_t *from, entity_state_t *to, int number, int bits)
+{
+	// set everything to the state we are delta'ing from
+	*to = *from;
+
+	VectorCopy (from->origin, to->old_origin);
+	to->number = number;
+
+	MSG_ReadDeltaEntityBits (&net_message, to, bits);
+}
+
 /*
 ==================
 CL_DeltaEntity
@@ -326,7 +344,7 @@ Parses deltas from the given base and adds the resulting entity
 to the current frame
 ==================
 */
-void CL_DeltaEntity (frame_t *frame, int newnum, entity_state_t *old, int bits)
+void CL_DeltaEntity (frame_t *frame, int newnum, entity_state_t *old, int bits, qboolean bitpacked)
 {
 	centity_t	*ent;
 	entity_state_t	*state;
@@ -337,7 +355,10 @@ void CL_DeltaEntity (frame_t *frame, int newnum, entity_state_t *old, int bits)
 	cl.parse_entities++;
 	frame->num_entities++;
 
-	CL_ParseDelta (old, state, newnum, bits);
+	if (bitpacked)
+		CL_ParseDeltaBits (old, state, newnum, bits);
+	else
+		CL_ParseDelta (old, state, newnum, bits);
 
 	// some data changes will force no lerping
 	if (state->modelindex != ent->current.modelindex
@@ -383,16 +404,17 @@ void CL_DeltaEntity (frame_t *frame, int newnum, entity_state_t *old, int bits)
 ==================
 CL_ParsePacketEntities
 
-An svc_packetentities has just been parsed, deal with the
-rest of the data stream.
+An svc_packetentities or svc_bitentities has just been parsed, deal
+with the rest of the data stream.
 ==================
 */
-void CL_ParsePacketEntities (frame_t *oldframe, frame_t *newframe)
+void CL_ParsePacketEntities (frame_t *oldframe, frame_t *newframe, qboolean bitpacked)
 {
 	int			newnum;
 	unsigned int			bits;
 	entity_state_t	*oldstate;
 	int			oldindex, oldnum;
+	int			lastnum;
 
 	newframe->parse_entities = cl.parse_entities;
 	newframe->num_entities = 0;
@@ -412,9 +434,13 @@ void CL_ParsePacketEntities (frame_t *oldframe, frame_t *newframe)
 		}
 	}
 
+	lastnum = 0;
 	while (1)
 	{
-		newnum = CL_ParseEntityBits (&bits);
+		if (bitpacked)
+			newnum = MSG_ReadEntityBits (&net_message, &lastnum, &bits);
+		else
+			newnum = CL_ParseEntityBits (&bits);
 		if (newnum >= MAX_EDICTS)
 			Com_Error (ERR_DROP,"CL_ParsePacketEntities: bad number:%i", newnum);
 
@@ -428,7 +454,7 @@ void CL_ParsePacketEntities (frame_t *oldframe, frame_t *newframe)
 		{	// one or more entities from the old packet are unchanged
 			if (cl_shownet->value == 3)
 				Com_Printf ("   unchanged: %i\n", oldnum);
-			CL_DeltaEntity (newframe, oldnum, oldstate, 0);
+			CL_DeltaEntity (newframe, oldnum, oldstate, 0, bitpacked);
 			
 			oldindex++;
 
@@ -464,7 +490,7 @@ void CL_ParsePacketEntities (frame_t *oldframe, frame_t *newframe)
 		{	// delta from previous state
 			if (cl_shownet->value == 3)
 				Com_Printf ("   delta: %i\n", newnum);
-			CL_DeltaEntity (newframe, newnum, oldstate, bits);
+			CL_DeltaEntity (newframe, newnum, oldstate, bits, bitpacked);
 
 			oldindex++;
 
@@ -482,7 +508,7 @@ void CL_ParsePacketEntities (frame_t *oldframe, frame_t *newframe)
 		{	// delta from baseline
 			if (cl_shownet->value == 3)
 				Com_Printf ("   baseline: %i\n", newnum);
-			CL_DeltaEntity (newframe, newnum, &cl_entities[newnum].baseline, bits);
+			CL_DeltaEntity (newframe, newnum, &cl_entities[newnum].baseline, bits, bitpacked);
 			continue;
 		}
 
@@ -493,7 +519,7 @@ void CL_ParsePacketEntities (frame_t *oldframe, frame_t *newframe)
 	{	// one or more entities from the old packet are unchanged
 		if (cl_shownet->value == 3)
 			Com_Printf ("   unchanged: %i\n", oldnum);
-		CL_DeltaEntity (newframe, oldnum, oldstate, 0);
+		CL_DeltaEntity (newframe, oldnum, oldstate, 0, bitpacked);
 		
 		oldindex++;
 
@@ -657,6 +683,193 @@ void CL_FireEntityEvents (frame_t *frame)
 }
 
 
+/*
+=================================================================
+
+NET STATS
+
+Between net_stats start and net_stats stop, every valid frame's packet
+entities are encoded again both ways, so the byte protocol can be
+compared with svc_bitentities on the same frames.  Playing a recorded
+demo back gives a repeatable figure.  Nothing is measured otherwise.
+
+=================================================================
+*/
+
+typedef struct
+{
+	int		frames;
+	int		msgbytes;		// whole messages the frames came in
+	int		received;		// packet entities as they arrived
+	int		bytecoded;		// the same entities as svc_packetentities
+	int		bitpacked;		// and as svc_bitentities
+} netstats_t;
+
+static netstats_t	cl_netstats;
+static qboolean		cl_netstatsactive;
+
+/*
+=================
+CL_MeasurePacketEntities
+
+Writes the delta from oldframe to newframe as the server would have,
+in both encodings.  Only the sizes are kept.
+=================
+*/
+static void CL_MeasurePacketEntities (frame_t *oldframe, frame_t *newframe, int received)
+{
+	static byte		buf[2][MAX_EDICTS*48 + 16];
+	sizebuf_t		msg[2];
+	entity_state_t	*oldent, *newent;
+	int		oldindex, newindex;
+	int		oldnum, newnum;
+	int		from_num_entities;
+	int		maxclients;
+	int		lastnum;
+
+	SZ_Init (&msg[0], buf[0], sizeof(buf[0]));
+	SZ_Init (&msg[1], buf[1], sizeof(buf[1]));
+	MSG_WriteByte (&msg[0], svc_packetentities);
+	MSG_WriteByte (&msg[1], svc_bitentities);
+	lastnum = 0;
+
+	maxclients = atoi (cl.configstrings[CS_MAXCLIENTS]);
+	from_num_entities = oldframe ? oldframe->num_entities : 0;
+	oldent = newent = NULL;
+
+	newindex = 0;
+	oldindex = 0;
+	while (newindex < newframe->num_entities || oldindex < from_num_entities)
+	{
+		if (newindex >= newframe->num_entities)
+			newnum = 9999;
+		else
+		{
+			newent = &cl_parse_entities[(newframe->parse_entities+newindex) & (MAX_PARSE_ENTITIES-1)];
+			newnum = newent->number;
+		}
+
+		if (oldindex >= from_num_entities)
+			oldnum = 9999;
+		else
+		{
+			oldent = &cl_parse_entities[(oldframe->parse_entities+oldindex) & (MAX_PARSE_ENTITIES-1)];
+			oldnum = oldent->number;
+		}
+
+		if (newnum == oldnum)
+		{
+			MSG_WriteDeltaEntity (oldent, newent, &msg[0], false, newnum <= maxclients);
+			MSG_WriteDeltaEntityBits (oldent, newent, &msg[1], false, newnum <= maxclients, &lastnum);
+			oldindex++;
+			newindex++;
+		}
+		else if (newnum < oldnum)
+		{
+			MSG_WriteDeltaEntity (&cl_entities[newnum].baseline, newent, &msg[0], true, true);
+			MSG_WriteDeltaEntityBits (&cl_entities[newnum].baseline, newent, &msg[1], true, true, &lastnum);
+			newindex++;
+		}
+		else
+		{	// the old entity isn't present in the new message
+			if (oldnum >= 256)
+			{
+				MSG_WriteByte (&msg[0], (U_REMOVE|U_MOREBITS1) & 255);
+				MSG_WriteByte (&msg[0], U_NUMBER16 >> 8);
+				MSG_WriteShort (&msg[0], oldnum);
+			}
+			else
+			{
+				MSG_WriteByte (&msg[0], U_REMOVE);
+				MSG_WriteByte (&msg[0], oldnum);
+			}
+			MSG_WriteRemoveEntityBits (&msg[1], oldnum, &lastnum);
+			oldindex++;
+		}
+	}
+
+	MSG_WriteShort (&msg[0], 0);
+	MSG_WriteEntityBitsEnd (&msg[1]);
+
+	cl_netstats.frames++;
+	cl_netstats.msgbytes += net_message.cursize;
+	cl_netstats.received += received;
+	cl_netstats.bytecoded += msg[0].cursize;
+	cl_netstats.bitpacked += msg[1].cursize;
+}
+
+/*
+=================
+CL_PrintNetStats
+
+Prints the bytes per second since measuring started, and starts over
+=================
+*/
+static void CL_PrintNetStats (void)
+{
+	netstats_t	*ns;
+	float		seconds;
+	int			other;
+
+	ns = &cl_netstats;
+	if (!ns->frames)
+	{
+		Com_Printf ("No frames measured\n");
+		return;
+	}
+
+	seconds = ns->frames * 0.1;	// ten server frames a second
+	other = ns->msgbytes - ns->received;
+
+	Com_Printf ("%i frames, %.1f seconds of game time\n", ns->frames, seconds);
+	Com_Printf ("packet entities: %i bytes/s received, %i byte coded, %i bit packed (%i%%)\n",
+		(int)(ns->received / seconds), (int)(ns->bytecoded / seconds), (int)(ns->bitpacked / seconds),
+		ns->bytecoded ? ns->bitpacked * 100 / ns->bytecoded : 0);
+	Com_Printf ("whole frames: %i bytes/s byte coded, %i bit packed\n",
+		(int)((other + ns->bytecoded) / seconds), (int)((other + ns->bitpacked) / seconds));
+
+	memset (ns, 0, sizeof(*ns));
+}
+
+/*
+=================
+CL_NetStats_f
+
+net_stats start|stop, or with no argument, prints what has been
+measured since the last print and keeps measuring
+=================
+*/
+void CL_NetStats_f (void)
+{
+	if (Cmd_Argc() == 2 && !strcmp (Cmd_Argv(1), "start"))
+	{
+		memset (&cl_netstats, 0, sizeof(cl_netstats));
+		cl_netstatsactive = true;
+		Com_Printf ("Measuring packet entities.\n");
+		return;
+	}
+
+	if (Cmd_Argc() == 2 && !strcmp (Cmd_Argv(1), "stop"))
+	{
+		if (!cl_netstatsactive)
+		{
+			Com_Printf ("Not measuring.\n");
+			return;
+		}
+		cl_netstatsactive = false;
+		CL_PrintNetStats ();
+		return;
+	}
+
+	if (Cmd_Argc() != 1 || !cl_netstatsactive)
+	{
+		Com_Printf ("usage: net_stats start|stop, or net_stats while measuring\n");
+		return;
+	}
+
+	CL_PrintNetStats ();
+}
+
 /*
 ================
 CL_ParseFrame
@@ -667,6 +880,7 @@ void CL_ParseFrame (void)
 	int			cmd;
 	int			len;
 	frame_t		*old;
+	int			start;
 
 	memset (&cl.frame, 0, sizeof(cl.frame));
 
@@ -734,11 +948,15 @@ void CL_ParseFrame (void)
 	CL_ParsePlayerstate (old, &cl.frame);
 
 	// read packet entities
+	start = net_message.readcount;
 	cmd = MSG_ReadByte (&net_message);
 	SHOWNET(svc_strings[cmd]);
-	if (cmd != svc_packetentities)
+	if (cmd != svc_packetentities && cmd != svc_bitentities)
 		Com_Error (ERR_DROP, "CL_ParseFrame: not packetentities");
-	CL_ParsePacketEntities (old, &cl.frame);
+	CL_ParsePacketEntities (old, &cl.frame, cmd == svc_bitentities);
+
+	if (cl.frame.valid && cl_netstatsactive)
+		CL_MeasurePacketEntities (old, &cl.frame, net_message.readcount - start);
 
 #if 0
 	if (cmd == svc_packetentities2)
@@ -21,6 +21,11 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "client.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CL_PARTICLES_SSE
+#include <emmintrin.h>
+#endif
+
 void CL_LogoutEffect (vec3_t org, int type);
 void CL_ItemRespawnParticles (vec3_t org);
 
@@ -858,35 +863,90 @@ void CL_AddDLights (void)
 
 PARTICLE MANAGEMENT
 
+Live particles are kept as a structure of arrays so CL_AddParticles can
+move PARTICLE_BATCH of them per pass with vector math.  Spawners still
+fill in a cparticle_t from CL_AllocParticle; those are queued and copied
+into the arrays when the next update starts.  A faded particle is removed
+by moving the last one into its slot, so the arrays never have holes.
+
 ==============================================================
 */
 
-/*
-// THIS HAS BEEN RELOCATED TO CLIENT.H
-typedef struct particle_s
-{
-	struct particle_s	*next;
+#define	PARTICLE_BATCH		8
+#define	PARTICLE_FIELDS		14		// time, org[3], vel[3], accel[3], color, alpha, alphavel
 
-	float		time;
+typedef struct
+{
+	int		numparticles;
+	int		maxparticles;
+	int		stride;				// floats per field, padded to a whole batch
+
+	float	*base;				// PARTICLE_FIELDS arrays of stride floats
+	float	*time;
+	float	*org[3];
+	float	*vel[3];
+	float	*accel[3];
+	float	*color;
+	float	*alpha;
+	float	*alphavel;
+
+	int		*dead;				// scratch for CL_UpdateParticles
+} particlepool_t;
+
+// one batch worth of results, ready to be copied into the refdef
+typedef struct
+{
+	float	org[3][PARTICLE_BATCH];
+	float	alpha[PARTICLE_BATCH];
+	int		color[PARTICLE_BATCH];
+} particlebatch_t;
 
-	vec3_t		org;
-	vec3_t		vel;
-	vec3_t		accel;
-	float		color;
-	float		colorvel;
-	float		alpha;
-	float		alphavel;
-} cparticle_t;
+#define	PARTICLE_STRIDE(n)	(((n) + 2*PARTICLE_BATCH - 1) & ~(PARTICLE_BATCH - 1))
+#define	PARTICLE_DATASIZE(n)	((PARTICLE_FIELDS*PARTICLE_STRIDE(n) + 4) * sizeof(float) + (n) * sizeof(int))
 
+static particlepool_t	cl_particles;
+static byte				cl_particledata[PARTICLE_DATASIZE(MAX_PARTICLES)];
 
-#define	PARTICLE_GRAVITY	40
-*/
+static cparticle_t		cl_newparticles[MAX_PARTICLES];
+static int				cl_numnewparticles;
 
-cparticle_t	*active_particles, *free_particles;
+/*
+===============
+CL_SetupParticlePool
 
-cparticle_t	particles[MAX_PARTICLES];
-int			cl_numparticles = MAX_PARTICLES;
+Carves the field arrays out of data, which must hold PARTICLE_DATASIZE(max)
+zeroed bytes.  Each array starts 16 byte aligned and has room for a full
+batch past the last particle, so the update never needs a scalar tail.
+===============
+*/
+static void CL_SetupParticlePool (particlepool_t *pool, void *data, int max)
+{
+	float	*f;
+	int		i;
 
+	pool->numparticles = 0;
+	pool->maxparticles = max;
+	pool->stride = PARTICLE_STRIDE(max);
+
+	f = (float *)(((uintptr_t)data + 15) & ~(uintptr_t)15);
+	pool->base = f;
+	pool->time = f;
+	f += pool->stride;
+	for (i=0 ; i<3 ; i++, f += pool->stride)
+		pool->org[i] = f;
+	for (i=0 ; i<3 ; i++, f += pool->stride)
+		pool->vel[i] = f;
+	for (i=0 ; i<3 ; i++, f += pool->stride)
+		pool->accel[i] = f;
+	pool->color = f;
+	f += pool->stride;
+	pool->alpha = f;
+	f += pool->stride;
+	pool->alphavel = f;
+	f += pool->stride;
+
+	pool->dead = (int *)f;
+}
 
 /*
 ===============
@@ -895,14 +955,58 @@ CL_ClearParticles
 */
 void CL_ClearParticles (void)
 {
-	int		i;
-	
-	free_particles = &particles[0];
-	active_particles = NULL;
+	memset (cl_particledata, 0, sizeof(cl_particledata));
+	CL_SetupParticlePool (&cl_particles, cl_particledata, MAX_PARTICLES);
+	cl_numnewparticles = 0;
+}
+
+/*
+===============
+CL_AllocParticle
+
+Returns a cleared particle for the caller to fill in, or NULL if the
+pool is full.  It goes live at the start of the next CL_AddParticles.
+===============
+*/
+cparticle_t *CL_AllocParticle (void)
+{
+	cparticle_t	*p;
 
-	for (i=0 ;i<cl_numparticles ; i++)
-		particles[i].next = &particles[i+1];
-	particles[cl_numparticles-1].next = NULL;
+	if (cl_particles.numparticles + cl_numnewparticles >= cl_particles.maxparticles)
+		return NULL;
+
+	p = &cl_newparticles[cl_numnewparticles++];
+	memset (p, 0, sizeof(*p));
+	return p;
+}
+
+/*
+===============
+CL_InsertParticles
+
+Moves the particles spawned since the last update into the pool
+===============
+*/
+static void CL_InsertParticles (particlepool_t *pool)
+{
+	cparticle_t	*p;
+	int			i, j, n;
+
+	for (i=0, p=cl_newparticles ; i<cl_numnewparticles ; i++, p++)
+	{
+		n = pool->numparticles++;
+		pool->time[n] = p->time;
+		for (j=0 ; j<3 ; j++)
+		{
+			pool->org[j][n] = p->org[j];
+			pool->vel[j][n] = p->vel[j];
+			pool->accel[j][n] = p->accel[j];
+		}
+		pool->color[n] = p->color;
+		pool->alpha[n] = p->alpha;
+		pool->alphavel[n] = p->alphavel;
+	}
+	cl_numnewparticles = 0;
 }
 
 
@@ -921,12 +1025,9 @@ void CL_ParticleEffect (vec3_t org, vec3_t dir, int color, int count)
 
 	for (i=0 ; i<count ; i++)
 	{
-		if (!free_particles)
+		p = CL_AllocParticle ();
+		if (!p)
 			return;
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
 
 		p->time = cl.time;
 		p->color = color + (rand()&7);
@@ -960,12 +1061,9 @@ void CL_ParticleEffect2 (vec3_t org, vec3_t dir, int color, int count)
 
 	for (i=0 ; i<count ; i++)
 	{
-		if (!free_particles)
+		p = CL_AllocParticle ();
+		if (!p)
 			return;
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
 
 		p->time = cl.time;
 		p->color = color;
@@ -1000,12 +1098,9 @@ void CL_ParticleEffect3 (vec3_t org, vec3_t dir, int color, int count)
 
 	for (i=0 ; i<count ; i++)
 	{
-		if (!free_particles)
+		p = CL_AllocParticle ();
+		if (!p)
 			return;
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
 
 		p->time = cl.time;
 		p->color = color;
@@ -1037,12 +1132,9 @@ void CL_TeleporterParticles (entity_state_t *ent)
 
 	for (i=0 ; i<8 ; i++)
 	{
-		if (!free_particles)
+		p = CL_AllocParticle ();
+		if (!p)
 			return;
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
 
 		p->time = cl.time;
 		p->color = 0xdb;
@@ -1078,12 +1170,9 @@ void CL_LogoutEffect (vec3_t org, int type)
 
 	for (i=0 ; i<500 ; i++)
 	{
-		if (!free_particles)
+		p = CL_AllocParticle ();
+		if (!p)
 			return;
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
 
 		p->time = cl.time;
 
@@ -1123,12 +1212,9 @@ void CL_ItemRespawnParticles (vec3_t org)
 
 	for (i=0 ; i<64 ; i++)
 	{
-		if (!free_particles)
+		p = CL_AllocParticle ();
+		if (!p)
 			return;
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
 
 		p->time = cl.time;
 
@@ -1162,12 +1248,9 @@ void CL_ExplosionParticles (vec3_t org)
 
 	for (i=0 ; i<256 ; i++)
 	{
-		if (!free_particles)
+		p = CL_AllocParticle ();
+		if (!p)
 			return;
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
 
 		p->time = cl.time;
 		p->color = 0xe0 + (rand()&7);
@@ -1201,12 +1284,9 @@ void CL_BigTeleportParticles (vec3_t org)
 
 	for (i=0 ; i<4096 ; i++)
 	{
-		if (!free_particles)
+		p = CL_AllocParticle ();
+		if (!p)
 			return;
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
 
 		p->time = cl.time;
 
@@ -1249,12 +1329,9 @@ void CL_BlasterParticles (vec3_t org, vec3_t dir)
 	count = 40;
 	for (i=0 ; i<count ; i++)
 	{
-		if (!free_particles)
+		p = CL_AllocParticle ();
+		if (!p)
 			return;
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
 
 		p->time = cl.time;
 		p->color = 0xe0 + (rand()&7);
@@ -1302,12 +1379,9 @@ void CL_BlasterTrail (vec3_t start, vec3_t end)
 	{
 		len -= dec;
 
-		if (!free_particles)
+		p = CL_AllocParticle ();
+		if (!p)
 			return;
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
 		VectorClear (p->accel);
 		
 		p->time = cl.time;
@@ -1352,12 +1426,9 @@ void CL_QuadTrail (vec3_t start, vec3_t end)
 	{
 		len -= dec;
 
-		if (!free_particles)
+		p = CL_AllocParticle ();
+		if (!p)
 			return;
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
 		VectorClear (p->accel);
 		
 		p->time = cl.time;
@@ -1402,12 +1473,9 @@ void CL_FlagTrail (vec3_t start, vec3_t end, float color)
 	{
 		len -= dec;
 
-		if (!free_particles)
+		p = CL_AllocParticle ();
+		if (!p)
 			return;
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
 		VectorClear (p->accel);
 		
 		p->time = cl.time;
@@ -1470,16 +1538,12 @@ void CL_DiminishingTrail (vec3_t start, vec3_t end, centity_t *old, int flags)
 	{
 		len -= dec;
 
-		if (!free_particles)
-			return;
-
 		// drop less particles as it flies
 		if ((rand()&1023) < old->trailcount)
 		{
-			p = free_particles;
-			free_particles = p->next;
-			p->next = active_particles;
-			active_particles = p;
+			p = CL_AllocParticle ();
+			if (!p)
+				return;
 			VectorClear (p->accel);
 		
 			p->time = cl.time;
@@ -1577,15 +1641,11 @@ void CL_RocketTrail (vec3_t start, vec3_t end, centity_t *old)
 	{
 		len -= dec;
 
-		if (!free_particles)
-			return;
-
 		if ( (rand()&7) == 0)
 		{
-			p = free_particles;
-			free_particles = p->next;
-			p->next = active_particles;
-			active_particles = p;
+			p = CL_AllocParticle ();
+			if (!p)
+				return;
 			
 			VectorClear (p->accel);
 			p->time = cl.time;
@@ -1632,13 +1692,9 @@ void CL_RailTrail (vec3_t start, vec3_t end)
 
 	for (i=0 ; i<len ; i++)
 	{
-		if (!free_particles)
+		p = CL_AllocParticle ();
+		if (!p)
 			return;
-
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
 		
 		p->time = cl.time;
 		VectorClear (p->accel);
@@ -1670,12 +1726,9 @@ void CL_RailTrail (vec3_t start, vec3_t end)
 	{
 		len -= dec;
 
-		if (!free_particles)
+		p = CL_AllocParticle ();
+		if (!p)
 			return;
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
 
 		p->time = cl.time;
 		VectorClear (p->accel);
@@ -1722,12 +1775,9 @@ void CL_IonripperTrail (vec3_t start, vec3_t ent)
 	{
 		len -= dec;
 
-		if (!free_particles)
+		p = CL_AllocParticle ();
+		if (!p)
 			return;
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
 		VectorClear (p->accel);
 
 		p->time = cl.time;
@@ -1783,14 +1833,10 @@ void CL_BubbleTrail (vec3_t start, vec3_t end)
 
 	for (i=0 ; i<len ; i+=dec)
 	{
-		if (!free_particles)
+		p = CL_AllocParticle ();
+		if (!p)
 			return;
 
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
-
 		VectorClear (p->accel);
 		p->time = cl.time;
 
@@ -1852,12 +1898,9 @@ void CL_FlyParticles (vec3_t origin, int count)
 		forward[1] = cp*sy;
 		forward[2] = -sp;
 
-		if (!free_particles)
+		p = CL_AllocParticle ();
+		if (!p)
 			return;
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
 
 		p->time = cl.time;
 
@@ -1949,12 +1992,9 @@ void CL_BfgParticles (entity_t *ent)
 		forward[1] = cp*sy;
 		forward[2] = -sp;
 
-		if (!free_particles)
+		p = CL_AllocParticle ();
+		if (!p)
 			return;
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
 
 		p->time = cl.time;
 
@@ -2008,12 +2048,9 @@ void CL_TrapParticles (entity_t *ent)
 	{
 		len -= dec;
 
-		if (!free_particles)
+		cparticle_t *p = CL_AllocParticle ();
+		if (!p)
 			return;
-		cparticle_t *p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
 		VectorClear (p->accel);
 		
 		p->time = cl.time;
@@ -2046,12 +2083,9 @@ void CL_TrapParticles (entity_t *ent)
 		for (int j=-2 ; j<=2 ; j+=4)
 			for (int k=-2 ; k<=4 ; k+=4)
 			{
-				if (!free_particles)
+				cparticle_t *p = CL_AllocParticle ();
+				if (!p)
 					return;
-				cparticle_t *p = free_particles;
-				free_particles = p->next;
-				p->next = active_particles;
-				active_particles = p;
 
 				p->time = cl.time;
 				p->color = 0xe0 + (rand()&3);
@@ -2091,12 +2125,9 @@ void CL_BFGExplosionParticles (vec3_t org)
 
 	for (i=0 ; i<256 ; i++)
 	{
-		if (!free_particles)
+		p = CL_AllocParticle ();
+		if (!p)
 			return;
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
 
 		p->time = cl.time;
 		p->color = 0xd0 + (rand()&7);
@@ -2133,12 +2164,9 @@ void CL_TeleportParticles (vec3_t org)
 		for (j=-16 ; j<=16 ; j+=4)
 			for (k=-16 ; k<=32 ; k+=4)
 			{
-				if (!free_particles)
+				p = CL_AllocParticle ();
+				if (!p)
 					return;
-				p = free_particles;
-				free_particles = p->next;
-				p->next = active_particles;
-				active_particles = p;
 
 				p->time = cl.time;
 				p->color = 7 + (rand()&7);
@@ -2166,71 +2194,256 @@ void CL_TeleportParticles (vec3_t org)
 
 /*
 ===============
-CL_AddParticles
+CL_UpdateBatch
+
+Runs the batch of particles starting at first forward to now, leaving the
+drawing values in b.  Returns a bit for each particle that has faded out.
+
+Particles with INSTANT_PARTICLE alphavel (heat beams) are drawn once at
+their spawn alpha and position, then zeroed so they are freed next update.
 ===============
 */
-void CL_AddParticles (void)
+static int CL_UpdateBatch (particlepool_t *pool, int first, float now, particlebatch_t *b)
 {
-	cparticle_t		*p, *next;
-	float			alpha;
-	float			time = 0.0f, time2;
-	vec3_t			org;
-	int				color;
-	cparticle_t		*active, *tail;
+	float	t, t2, a;
+	int		i, j, n;
+	int		dead;
 
-	active = NULL;
-	tail = NULL;
-
-	for (p=active_particles ; p ; p=next)
+	dead = 0;
+	for (i=0 ; i<PARTICLE_BATCH ; i++)
 	{
-		next = p->next;
-
-		// PMM - added INSTANT_PARTICLE handling for heat beam
-		if (p->alphavel != INSTANT_PARTICLE)
+		n = first + i;
+		if (pool->alphavel[n] != INSTANT_PARTICLE)
 		{
-			time = (cl.time - p->time)*0.001;
-			alpha = p->alpha + time*p->alphavel;
-			if (alpha <= 0)
-			{	// faded out
-				p->next = free_particles;
-				free_particles = p;
-				continue;
-			}
+			t = (now - pool->time[n]) * 0.001f;
+			a = pool->alpha[n] + t*pool->alphavel[n];
+			if (a <= 0)
+				dead |= 1<<i;
 		}
 		else
 		{
-			alpha = p->alpha;
+			t = 0;
+			a = pool->alpha[n];
+			pool->alpha[n] = 0;
+			pool->alphavel[n] = 0;
 		}
 
-		p->next = NULL;
-		if (!tail)
-			active = tail = p;
+		if (a > 1.0)
+			a = 1;
+		b->alpha[i] = a;
+		b->color[i] = pool->color[n];
+
+		t2 = t*t;
+		for (j=0 ; j<3 ; j++)
+			b->org[j][i] = pool->org[j][n] + pool->vel[j][n]*t + pool->accel[j][n]*t2;
+	}
+
+	return dead;
+}
+
+#ifdef CL_PARTICLES_SSE
+/*
+===============
+CL_UpdateBatchSSE
+
+CL_UpdateBatch four particles at a time
+===============
+*/
+static int CL_UpdateBatchSSE (particlepool_t *pool, int first, float now, particlebatch_t *b)
+{
+	__m128	vnow, msec, one, zero, instant;
+	__m128	inst, t, t2, a, a0, av;
+	int		i, j, n;
+	int		dead;
+
+	vnow = _mm_set1_ps (now);
+	msec = _mm_set1_ps (0.001f);
+	one = _mm_set1_ps (1.0f);
+	zero = _mm_setzero_ps ();
+	instant = _mm_set1_ps (INSTANT_PARTICLE);
+
+	dead = 0;
+	for (i=0 ; i<PARTICLE_BATCH ; i+=4)
+	{
+		n = first + i;
+
+		av = _mm_load_ps (pool->alphavel + n);
+		a0 = _mm_load_ps (pool->alpha + n);
+		inst = _mm_cmpeq_ps (av, instant);
+
+		t = _mm_mul_ps (_mm_sub_ps (vnow, _mm_load_ps (pool->time + n)), msec);
+		t = _mm_andnot_ps (inst, t);
+		a = _mm_add_ps (a0, _mm_mul_ps (t, av));
+
+		dead |= _mm_movemask_ps (_mm_andnot_ps (inst, _mm_cmple_ps (a, zero))) << i;
+		_mm_store_ps (pool->alpha + n, _mm_andnot_ps (inst, a0));
+		_mm_store_ps (pool->alphavel + n, _mm_andnot_ps (inst, av));
+
+		_mm_store_ps (b->alpha + i, _mm_min_ps (a, one));
+		_mm_store_si128 ((__m128i *)(b->color + i), _mm_cvttps_epi32 (_mm_load_ps (pool->color + n)));
+
+		t2 = _mm_mul_ps (t, t);
+		for (j=0 ; j<3 ; j++)
+			_mm_store_ps (b->org[j] + i, _mm_add_ps (_mm_load_ps (pool->org[j] + n),
+				_mm_add_ps (_mm_mul_ps (_mm_load_ps (pool->vel[j] + n), t),
+				_mm_mul_ps (_mm_load_ps (pool->accel[j] + n), t2))));
+	}
+
+	return dead;
+}
+#endif
+
+/*
+===============
+CL_UpdateParticles
+
+Moves every particle in the pool forward to now and writes up to room of
+the live ones to out, returning how many were written.  Faded particles
+are removed from the pool.
+===============
+*/
+static int CL_UpdateParticles (particlepool_t *pool, float now, particle_t *out, int room, qboolean simd)
+{
+	particlebatch_t	b;
+	particle_t		*p;
+	int				first, count, i, j, f;
+	int				dead, numdead, written, last;
+
+	numdead = 0;
+	written = 0;
+	for (first=0 ; first<pool->numparticles ; first+=PARTICLE_BATCH)
+	{
+#ifdef CL_PARTICLES_SSE
+		if (simd)
+			dead = CL_UpdateBatchSSE (pool, first, now, &b);
 		else
+#endif
+			dead = CL_UpdateBatch (pool, first, now, &b);
+
+		count = pool->numparticles - first;
+		if (count > PARTICLE_BATCH)
+			count = PARTICLE_BATCH;
+		for (i=0 ; i<count ; i++)
 		{
-			tail->next = p;
-			tail = p;
+			if (dead & (1<<i))
+			{
+				pool->dead[numdead++] = first + i;
+				continue;
+			}
+			if (written == room)
+				continue;
+			p = &out[written++];
+			for (j=0 ; j<3 ; j++)
+				p->origin[j] = b.org[j][i];
+			p->color = b.color[i];
+			p->alpha = b.alpha[i];
 		}
+	}
+
+	// fill each hole from the end; going from the highest index down means
+	// the particle moved in has always been updated and is still alive
+	while (numdead)
+	{
+		i = pool->dead[--numdead];
+		last = --pool->numparticles;
+		if (i == last)
+			continue;
+		for (f=0 ; f<PARTICLE_FIELDS ; f++)
+			pool->base[f*pool->stride + i] = pool->base[f*pool->stride + last];
+	}
+
+	return written;
+}
 
-		if (alpha > 1.0)
-			alpha = 1;
-		color = p->color;
+/*
+===============
+CL_AddParticles
+===============
+*/
+void CL_AddParticles (void)
+{
+	particle_t	*out;
+	int			room;
 
-		time2 = time * time;
+	CL_InsertParticles (&cl_particles);
 
-		org[0] = p->org[0] + p->vel[0]*time + p->accel[0]*time2;
-		org[1] = p->org[1] + p->vel[1]*time + p->accel[1]*time2;
-		org[2] = p->org[2] + p->vel[2]*time + p->accel[2]*time2;
+	out = V_BeginParticles (&room);
+#ifdef CL_PARTICLES_SSE
+	V_EndParticles (CL_UpdateParticles (&cl_particles, cl.time, out, room, true));
+#else
+	V_EndParticles (CL_UpdateParticles (&cl_particles, cl.time, out, room, false));
+#endif
+}
 
-		V_AddParticle (org, color, alpha);
-		// PMM
-		if (p->alphavel == INSTANT_PARTICLE)
+/*
+===============
+CL_ParticleBench_f
+
+particlebench [count] [frames]
+
+Times the particle update over a pool of long lived particles, with and
+without the vector path
+===============
+*/
+void CL_ParticleBench_f (void)
+{
+	particlepool_t	pool;
+	particle_t		*out;
+	void			*data;
+	int				count, frames;
+	int				i, j, start, scalar;
+#ifdef CL_PARTICLES_SSE
+	int				sse;
+#endif
+
+	count = Cmd_Argc() > 1 ? atoi (Cmd_Argv(1)) : 65536;
+	frames = Cmd_Argc() > 2 ? atoi (Cmd_Argv(2)) : 100;
+	if (count < 1 || frames < 1)
+	{
+		Com_Printf ("usage: particlebench [count] [frames]\n");
+		return;
+	}
+
+	data = Z_Malloc (PARTICLE_DATASIZE(count));
+	out = (particle_t *)Z_Malloc (count * sizeof(particle_t));
+	CL_SetupParticlePool (&pool, data, count);
+
+	// everything spawned within the last second and fading slowly enough
+	// that nothing is removed while the benchmark runs
+	for (i=0 ; i<count ; i++)
+	{
+		pool.time[i] = -(rand()%1000);
+		for (j=0 ; j<3 ; j++)
 		{
-			p->alphavel = 0.0;
-			p->alpha = 0.0;
+			pool.org[j][i] = crand()*1024;
+			pool.vel[j][i] = crand()*64;
+			pool.accel[j][i] = 0;
 		}
+		pool.accel[2][i] = -PARTICLE_GRAVITY;
+		pool.color[i] = 0xe0 + (rand()&7);
+		pool.alpha[i] = 1.0;
+		pool.alphavel[i] = -0.5;
 	}
-
-	active_particles = active;
+	pool.numparticles = count;
+
+	start = Sys_Milliseconds ();
+	for (i=0 ; i<frames ; i++)
+		CL_UpdateParticles (&pool, 0, out, count, false);
+	scalar = Sys_Milliseconds () - start;
+
+#ifdef CL_PARTICLES_SSE
+	start = Sys_Milliseconds ();
+	for (i=0 ; i<frames ; i++)
+		CL_UpdateParticles (&pool, 0, out, count, true);
+	sse = Sys_Milliseconds () - start;
+
+	Com_Printf ("%i particles, %i frames: scalar %i ms, sse %i ms\n", count, frames, scalar, sse);
+#else
+	Com_Printf ("%i particles, %i frames: scalar %i ms\n", count, frames, scalar);
+#endif
+
+	Z_Free (out);
+	Z_Free (data);
 }
 
 
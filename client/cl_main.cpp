@@ -56,6 +56,7 @@ cvar_t	*cl_add_entities;
 cvar_t	*cl_add_blend;
 
 cvar_t	*cl_shownet;
+cvar_t	*cl_bitentities;
 cvar_t	*cl_showmiss;
 cvar_t	*cl_showclamp;
 
@@ -200,6 +201,10 @@ void CL_Record_f (void)
 		Com_Printf ("ERROR: couldn't open.\n");
 		return;
 	}
+
+	// so demomap can find it without a rescan
+	FS_AddLocalFile (name);
+
 	cls.demorecording = true;
 
 	// don't start saving messages until a non-delta compressed message is received
@@ -436,8 +441,10 @@ void CL_SendConnectPacket (void)
 	port = Cvar_VariableValue ("qport");
 	userinfo_modified = false;
 
-	Netchan_OutOfBandPrint (NS_CLIENT, adr, "connect %i %i %i \"%s\"\n",
-		PROTOCOL_VERSION, port, cls.challenge, Cvar_Userinfo() );
+	// servers that don't know the extensions ignore the last argument
+	Netchan_OutOfBandPrint (NS_CLIENT, adr, "connect %i %i %i \"%s\" %i\n",
+		PROTOCOL_VERSION, port, cls.challenge, Cvar_Userinfo(),
+		cl_bitentities->value ? PROTOCOL_EXT_BITENTITIES : 0 );
 }
 
 /*
@@ -1460,6 +1467,7 @@ void CL_InitLocal (void)
 	m_side = Cvar_Get ("m_side", "1", 0);
 
 	cl_shownet = Cvar_Get ("cl_shownet", "0", 0);
+	cl_bitentities = Cvar_Get ("cl_bitentities", "1", CVAR_ARCHIVE);
 	cl_showmiss = Cvar_Get ("cl_showmiss", "0", 0);
 	cl_showclamp = Cvar_Get ("showclamp", "0", 0);
 	cl_timeout = Cvar_Get ("cl_timeout", "120", 0);
@@ -1504,6 +1512,8 @@ void CL_InitLocal (void)
 	Cmd_AddCommand ("disconnect", CL_Disconnect_f);
 	Cmd_AddCommand ("record", CL_Record_f);
 	Cmd_AddCommand ("stop", CL_Stop_f);
+	Cmd_AddCommand ("net_stats", CL_NetStats_f);
+	Cmd_AddCommand ("particlebench", CL_ParticleBench_f);
 
 	Cmd_AddCommand ("quit", CL_Quit_f);
 
@@ -21,10 +21,6 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "client.h"
 
-extern cparticle_t *active_particles, *free_particles;
-extern cparticle_t particles[MAX_PARTICLES];
-extern int cl_numparticles;
-
 extern void MakeNormalVectors(vec3_t forward, vec3_t right, vec3_t up);
 
 /*
@@ -129,11 +125,8 @@ void CL_DebugTrail(vec3_t start, vec3_t end) {
   while (len > 0) {
     len -= dec;
 
-    if (!free_particles) return;
-    p = free_particles;
-    free_particles = p->next;
-    p->next = active_particles;
-    active_particles = p;
+    p = CL_AllocParticle();
+    if (!p) return;
 
     p->time = cl.time;
     VectorClear(p->accel);
@@ -178,11 +171,8 @@ void CL_SmokeTrail(vec3_t start, vec3_t end, int colorStart, int colorRun,
   while (len > 0) {
     len -= spacing;
 
-    if (!free_particles) return;
-    p = free_particles;
-    free_particles = p->next;
-    p->next = active_particles;
-    active_particles = p;
+    p = CL_AllocParticle();
+    if (!p) return;
     VectorClear(p->accel);
 
     p->time = cl.time;
@@ -217,13 +207,9 @@ void CL_ForceWall(vec3_t start, vec3_t end, int color) {
   while (len > 0) {
     len -= 4;
 
-    if (!free_particles) return;
-
     if (frand() > 0.3) {
-      p = free_particles;
-      free_particles = p->next;
-      p->next = active_particles;
-      active_particles = p;
+      p = CL_AllocParticle();
+      if (!p) return;
       VectorClear(p->accel);
 
       p->time = cl.time;
@@ -254,12 +240,8 @@ void CL_FlameEffects(centity_t *ent, vec3_t origin) {
   count = rand() & 0xF;
 
   for (n = 0; n < count; n++) {
-    if (!free_particles) return;
-
-    p = free_particles;
-    free_particles = p->next;
-    p->next = active_particles;
-    active_particles = p;
+    p = CL_AllocParticle();
+    if (!p) return;
 
     VectorClear(p->accel);
     p->time = cl.time;
@@ -278,11 +260,8 @@ void CL_FlameEffects(centity_t *ent, vec3_t origin) {
   count = rand() & 0x7;
 
   for (n = 0; n < count; n++) {
-    if (!free_particles) return;
-    p = free_particles;
-    free_particles = p->next;
-    p->next = active_particles;
-    active_particles = p;
+    p = CL_AllocParticle();
+    if (!p) return;
     VectorClear(p->accel);
 
     p->time = cl.time;
@@ -309,11 +288,8 @@ void CL_GenericParticleEffect(vec3_t org, vec3_t dir, int color, int count,
   float d;
 
   for (i = 0; i < count; i++) {
-    if (!free_particles) return;
-    p = free_particles;
-    free_particles = p->next;
-    p->next = active_particles;
-    active_particles = p;
+    p = CL_AllocParticle();
+    if (!p) return;
 
     p->time = cl.time;
     if (numcolors > 1)
@@ -360,12 +336,8 @@ void CL_BubbleTrail2(vec3_t start, vec3_t end, int dist) {
   VectorScale(vec, dec, vec);
 
   for (i = 0; i < len; i += dec) {
-    if (!free_particles) return;
-
-    p = free_particles;
-    free_particles = p->next;
-    p->next = active_particles;
-    active_particles = p;
+    p = CL_AllocParticle();
+    if (!p) return;
 
     VectorClear(p->accel);
     p->time = cl.time;
@@ -427,12 +399,8 @@ void CL_Heatbeam(vec3_t start, vec3_t end) {
 #else
     k = 1;
 #endif
-      if (!free_particles) return;
-
-      p = free_particles;
-      free_particles = p->next;
-      p->next = active_particles;
-      active_particles = p;
+      p = CL_AllocParticle();
+      if (!p) return;
 
       p->time = cl.time;
       VectorClear(p->accel);
@@ -515,12 +483,8 @@ void CL_Heatbeam(vec3_t start, vec3_t forward) {
       break;
 
     for (rot = 0; rot < M_PI * 2; rot += rstep) {
-      if (!free_particles) return;
-
-      p = free_particles;
-      free_particles = p->next;
-      p->next = active_particles;
-      active_particles = p;
+      p = CL_AllocParticle();
+      if (!p) return;
 
       p->time = cl.time;
       VectorClear(p->accel);
@@ -585,12 +549,8 @@ void CL_Heatbeam(vec3_t start, vec3_t end) {
   VectorMA(move, -0.5, up, move);
 
   for (i = 0; i < 8; i++) {
-    if (!free_particles) return;
-
-    p = free_particles;
-    free_particles = p->next;
-    p->next = active_particles;
-    active_particles = p;
+    p = CL_AllocParticle();
+    if (!p) return;
 
     p->time = cl.time;
     VectorClear(p->accel);
@@ -627,13 +587,9 @@ void CL_Heatbeam(vec3_t start, vec3_t end) {
 
                   for (rot = 0; rot < M_PI*2; rot += rstep)
                   {
-                          if (!free_particles)
+                          p = CL_AllocParticle ();
+                          if (!p)
                                   return;
-
-                          p = free_particles;
-                          free_particles = p->next;
-                          p->next = active_particles;
-                          active_particles = p;
                           
                           p->time = cl.time;
                           VectorClear (p->accel);
@@ -693,11 +649,8 @@ void CL_ParticleSteamEffect(vec3_t org, vec3_t dir, int color, int count,
   MakeNormalVectors(dir, r, u);
 
   for (i = 0; i < count; i++) {
-    if (!free_particles) return;
-    p = free_particles;
-    free_particles = p->next;
-    p->next = active_particles;
-    active_particles = p;
+    p = CL_AllocParticle();
+    if (!p) return;
 
     p->time = cl.time;
     p->color = color + (rand() & 7);
@@ -736,11 +689,8 @@ void CL_ParticleSteamEffect2(cl_sustain_t *self)
   MakeNormalVectors(dir, r, u);
 
   for (i = 0; i < self->count; i++) {
-    if (!free_particles) return;
-    p = free_particles;
-    free_particles = p->next;
-    p->next = active_particles;
-    active_particles = p;
+    p = CL_AllocParticle();
+    if (!p) return;
 
     p->time = cl.time;
     p->color = self->color + (rand() & 7);
@@ -794,11 +744,8 @@ void CL_TrackerTrail(vec3_t start, vec3_t end, int particleColor) {
   while (len > 0) {
     len -= dec;
 
-    if (!free_particles) return;
-    p = free_particles;
-    free_particles = p->next;
-    p->next = active_particles;
-    active_particles = p;
+    p = CL_AllocParticle();
+    if (!p) return;
     VectorClear(p->accel);
 
     p->time = cl.time;
@@ -825,11 +772,8 @@ void CL_Tracker_Shell(vec3_t origin) {
   cparticle_t *p;
 
   for (i = 0; i < 300; i++) {
-    if (!free_particles) return;
-    p = free_particles;
-    free_particles = p->next;
-    p->next = active_particles;
-    active_particles = p;
+    p = CL_AllocParticle();
+    if (!p) return;
     VectorClear(p->accel);
 
     p->time = cl.time;
@@ -853,11 +797,8 @@ void CL_MonsterPlasma_Shell(vec3_t origin) {
   cparticle_t *p;
 
   for (i = 0; i < 40; i++) {
-    if (!free_particles) return;
-    p = free_particles;
-    free_particles = p->next;
-    p->next = active_particles;
-    active_particles = p;
+    p = CL_AllocParticle();
+    if (!p) return;
     VectorClear(p->accel);
 
     p->time = cl.time;
@@ -887,11 +828,8 @@ void CL_Widowbeamout(cl_sustain_t *self) {
   ratio = 1.0 - (((float)self->endtime - (float)cl.time) / 2100.0);
 
   for (i = 0; i < 300; i++) {
-    if (!free_particles) return;
-    p = free_particles;
-    free_particles = p->next;
-    p->next = active_particles;
-    active_particles = p;
+    p = CL_AllocParticle();
+    if (!p) return;
     VectorClear(p->accel);
 
     p->time = cl.time;
@@ -921,11 +859,8 @@ void CL_Nukeblast(cl_sustain_t *self) {
   ratio = 1.0 - (((float)self->endtime - (float)cl.time) / 1000.0);
 
   for (i = 0; i < 700; i++) {
-    if (!free_particles) return;
-    p = free_particles;
-    free_particles = p->next;
-    p->next = active_particles;
-    active_particles = p;
+    p = CL_AllocParticle();
+    if (!p) return;
     VectorClear(p->accel);
 
     p->time = cl.time;
@@ -952,11 +887,8 @@ void CL_WidowSplash(vec3_t org) {
   vec3_t dir;
 
   for (i = 0; i < 256; i++) {
-    if (!free_particles) return;
-    p = free_particles;
-    free_particles = p->next;
-    p->next = active_particles;
-    active_particles = p;
+    p = CL_AllocParticle();
+    if (!p) return;
 
     p->time = cl.time;
     p->color = colortable[rand() & 3];
@@ -981,11 +913,8 @@ void CL_Tracker_Explode(vec3_t origin) {
   cparticle_t *p;
 
   for (i = 0; i < 300; i++) {
-    if (!free_particles) return;
-    p = free_particles;
-    free_particles = p->next;
-    p->next = active_particles;
-    active_particles = p;
+    p = CL_AllocParticle();
+    if (!p) return;
     VectorClear(p->accel);
 
     p->time = cl.time;
@@ -1029,11 +958,8 @@ void CL_TagTrail(vec3_t start, vec3_t end, float color) {
   while (len >= 0) {
     len -= dec;
 
-    if (!free_particles) return;
-    p = free_particles;
-    free_particles = p->next;
-    p->next = active_particles;
-    active_particles = p;
+    p = CL_AllocParticle();
+    if (!p) return;
     VectorClear(p->accel);
 
     p->time = cl.time;
@@ -1061,11 +987,8 @@ void CL_ColorExplosionParticles(vec3_t org, int color, int run) {
   cparticle_t *p;
 
   for (i = 0; i < 128; i++) {
-    if (!free_particles) return;
-    p = free_particles;
-    free_particles = p->next;
-    p->next = active_particles;
-    active_particles = p;
+    p = CL_AllocParticle();
+    if (!p) return;
 
     p->time = cl.time;
     p->color = color + (rand() % run);
@@ -1098,11 +1021,8 @@ void CL_ParticleSmokeEffect(vec3_t org, vec3_t dir, int color, int count,
   MakeNormalVectors(dir, r, u);
 
   for (i = 0; i < count; i++) {
-    if (!free_particles) return;
-    p = free_particles;
-    free_particles = p->next;
-    p->next = active_particles;
-    active_particles = p;
+    p = CL_AllocParticle();
+    if (!p) return;
 
     p->time = cl.time;
     p->color = color + (rand() & 7);
@@ -1139,11 +1059,8 @@ void CL_BlasterParticles2(vec3_t org, vec3_t dir, unsigned int color) {
 
   count = 40;
   for (i = 0; i < count; i++) {
-    if (!free_particles) return;
-    p = free_particles;
-    free_particles = p->next;
-    p->next = active_particles;
-    active_particles = p;
+    p = CL_AllocParticle();
+    if (!p) return;
 
     p->time = cl.time;
     p->color = color + (rand() & 7);
@@ -1188,11 +1105,8 @@ void CL_BlasterTrail2(vec3_t start, vec3_t end) {
   while (len > 0) {
     len -= dec;
 
-    if (!free_particles) return;
-    p = free_particles;
-    free_particles = p->next;
-    p->next = active_particles;
-    active_particles = p;
+    p = CL_AllocParticle();
+    if (!p) return;
     VectorClear(p->accel);
 
     p->time = cl.time;
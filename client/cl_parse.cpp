@@ -47,7 +47,8 @@ const char *svc_strings[256] =
 	"svc_playerinfo",
 	"svc_packetentities",
 	"svc_deltapacketentities",
-	"svc_frame"
+	"svc_frame",
+	"svc_bitentities"
 };
 
 //=============================================================================
@@ -170,6 +171,44 @@ void	CL_Download_f (void)
 	cls.downloadnumber++;
 }
 
+/*
+======================
+CL_PrefetchConfigstrings
+
+Lets the filesystem start inflating a precache list in the
+background before we walk through and register it
+======================
+*/
+void CL_PrefetchConfigstrings (int start, int max)
+{
+	static char	names[MAX_MODELS > MAX_SOUNDS ? MAX_MODELS : MAX_SOUNDS][MAX_QPATH];
+	const char	*list[MAX_MODELS > MAX_SOUNDS ? MAX_MODELS : MAX_SOUNDS];
+	const char	*name;
+	int			i, count;
+
+	count = 0;
+	for (i=1 ; i<max && cl.configstrings[start+i][0] ; i++)
+	{
+		name = cl.configstrings[start+i];
+		if (name[0] == '*')
+			continue;	// inline models and sexed sounds
+		if (name[0] == '#')
+		{
+			if (start != CS_SOUNDS)
+				continue;	// player weapon models
+			Com_sprintf (names[count], sizeof(names[count]), "%s", name + 1);
+		}
+		else if (start == CS_SOUNDS)
+			Com_sprintf (names[count], sizeof(names[count]), "sound/%s", name);
+		else
+			Com_sprintf (names[count], sizeof(names[count]), "%s", name);
+		list[count] = names[count];
+		count++;
+	}
+
+	FS_Prefetch (list, count);
+}
+
 /*
 ======================
 CL_RegisterSounds
@@ -179,6 +218,8 @@ void CL_RegisterSounds (void)
 {
 	int		i;
 
+	CL_PrefetchConfigstrings (CS_SOUNDS, MAX_SOUNDS);
+
 	S_BeginRegistration ();
 	CL_RegisterTEntSounds ();
 	for (i=1 ; i<MAX_SOUNDS ; i++)
@@ -273,6 +314,8 @@ void CL_ParseDownload (void)
 		r = rename (oldn, newn);
 		if (r)
 			Com_Printf ("failed to rename.\n");
+		else
+			FS_Rescan ();	// make it visible to the filesystem
 
 		cls.download = NULL;
 		cls.downloadpercent = 0;
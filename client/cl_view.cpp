@@ -102,6 +102,26 @@ void V_AddParticle (vec3_t org, int color, float alpha)
 	p->alpha = alpha;
 }
 
+/*
+=====================
+V_BeginParticles
+
+Returns the next free slot in the particle list and how many follow it,
+so a batch of particles can be written in place.  V_EndParticles says
+how many were actually used.
+=====================
+*/
+particle_t *V_BeginParticles (int *room)
+{
+	*room = MAX_PARTICLES - r_numparticles;
+	return &r_particles[r_numparticles];
+}
+
+void V_EndParticles (int count)
+{
+	r_numparticles += count;
+}
+
 /*
 =====================
 V_AddLight
@@ -261,6 +281,8 @@ void CL_PrepRefresh (void)
 	SCR_AddDirtyPoint (0, 0);
 	SCR_AddDirtyPoint (viddef.width-1, viddef.height-1);
 
+	CL_PrefetchConfigstrings (CS_MODELS, MAX_MODELS);
+
 	// let the render dll load the map
 	strcpy (mapname, cl.configstrings[CS_MODELS+1] + 5);	// skip "maps/"
 	mapname[strlen(mapname)-4] = 0;		// cut off ".bsp"
@@ -346,6 +368,9 @@ void CL_PrepRefresh (void)
 	// the renderer can now free unneeded stuff
 	Mod_EndRegistration ();
 
+	// anything prefetched that wasn't registered by now never will be
+	FS_CancelPrefetch ();
+
 	// clear any lines of console text
 	Con_ClearNotify ();
 
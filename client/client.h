@@ -140,7 +140,7 @@ typedef struct
 	//
 	// non-gameserver infornamtion
 	// FIXME: move this cinematic stuff into the cin_t structure
-	FILE		*cinematic_file;
+	FileStream	*cinematic_stream;
 	int			cinematictime;		// cls.realtime for first cinematic frame
 	int			cinematicframe;
 	unsigned char		cinematicpalette[768];
@@ -353,10 +353,10 @@ void CL_ParticleEffect3 (vec3_t org, vec3_t dir, int color, int count);
 
 // ========
 // PGM
+// what the spawners fill in; CL_AllocParticle hands these out and the
+// next CL_AddParticles moves them into the live particle arrays
 typedef struct particle_s
 {
-	struct particle_s	*next;
-
 	float		time;
 
 	vec3_t		org;
@@ -417,6 +417,7 @@ void CL_WidowSplash (vec3_t org);
 int CL_ParseEntityBits (unsigned *bits);
 void CL_ParseDelta (entity_state_t *from, entity_state_t *to, int number, int bits);
 void CL_ParseFrame (void);
+void CL_NetStats_f (void);
 
 void CL_ParseTEnt (void);
 void CL_ParseConfigString (void);
@@ -439,6 +440,7 @@ void CL_AddLightStyles (void);
 
 void CL_PrepRefresh (void);
 void CL_RegisterSounds (void);
+void CL_PrefetchConfigstrings (int start, int max);
 
 void CL_Quit_f (void);
 
@@ -521,6 +523,8 @@ void V_Init (void);
 void V_RenderView( float stereo_separation );
 void V_AddEntity (entity_t *ent);
 void V_AddParticle (vec3_t org, int color, float alpha);
+particle_t *V_BeginParticles (int *room);
+void V_EndParticles (int count);
 void V_AddLight (vec3_t org, float intensity, float r, float g, float b);
 void V_AddLightStyle (int style, float r, float g, float b);
 
@@ -548,7 +552,9 @@ void CL_RocketTrail (vec3_t start, vec3_t end, centity_t *old);
 void CL_DiminishingTrail (vec3_t start, vec3_t end, centity_t *old, int flags);
 void CL_FlyEffect (centity_t *ent, vec3_t origin);
 void CL_BfgParticles (entity_t *ent);
+cparticle_t *CL_AllocParticle (void);
 void CL_AddParticles (void);
+void CL_ParticleBench_f (void);
 void CL_EntityEvent (entity_state_t *ent);
 // RAFAEL
 void CL_TrapParticles (entity_t *ent);
@@ -998,6 +998,44 @@ void S_RawSamples (int samples, int rate, int width, int channels, byte *data)
 	}
 }
 
+/*
+============
+S_RawSamplesFromStream
+
+Feeds raw samples straight out of a stream a block at a time,
+so long sources never need to be resident all at once. Returns
+the number of samples that were actually available
+============
+*/
+int S_RawSamplesFromStream (FileStream *stream, int samples, int rate, int width, int channels)
+{
+	byte	block[4096*4];
+	int		sampleSize, count, total, bytes;
+
+	sampleSize = width * channels;
+	if (sampleSize <= 0 || sampleSize > 4)
+		return 0;
+
+	total = 0;
+	while (total < samples)
+	{
+		count = samples - total;
+		if (count > (int)sizeof(block) / sampleSize)
+			count = sizeof(block) / sampleSize;
+
+		// keep reading even with no sound, so the stream stays in step
+		bytes = FS_ReadStream (stream, block, count*sampleSize);
+		count = bytes / sampleSize;
+		if (!count)
+			break;
+
+		S_RawSamples (count, rate, width, channels, block);
+		total += count;
+	}
+
+	return total;
+}
+
 //=============================================================================
 
 /*
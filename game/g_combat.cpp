@@ -33,6 +33,9 @@ qboolean CanDamage (edict_t *targ, edict_t *inflictor)
 {
 	vec3_t	dest;
 	trace_t	trace;
+	trace_req_t	reqs[4];
+	trace_t	traces[4];
+	int		i;
 
 // bmodels need special checking because their origin is 0,0,0
 	if (targ->movetype == MOVETYPE_PUSH)
@@ -51,33 +54,24 @@ qboolean CanDamage (edict_t *targ, edict_t *inflictor)
 	if (trace.fraction == 1.0)
 		return true;
 
-	VectorCopy (targ->s.origin, dest);
-	dest[0] += 15.0;
-	dest[1] += 15.0;
-	trace = gi.trace (inflictor->s.origin, vec3_origin, vec3_origin, dest, inflictor, MASK_SOLID);
-	if (trace.fraction == 1.0)
-		return true;
-
-	VectorCopy (targ->s.origin, dest);
-	dest[0] += 15.0;
-	dest[1] -= 15.0;
-	trace = gi.trace (inflictor->s.origin, vec3_origin, vec3_origin, dest, inflictor, MASK_SOLID);
-	if (trace.fraction == 1.0)
-		return true;
-
-	VectorCopy (targ->s.origin, dest);
-	dest[0] -= 15.0;
-	dest[1] += 15.0;
-	trace = gi.trace (inflictor->s.origin, vec3_origin, vec3_origin, dest, inflictor, MASK_SOLID);
-	if (trace.fraction == 1.0)
-		return true;
+	// try the four corners together
+	for (i=0 ; i<4 ; i++)
+	{
+		VectorCopy (inflictor->s.origin, reqs[i].start);
+		VectorCopy (targ->s.origin, reqs[i].end);
+		reqs[i].end[0] += (i & 2) ? -15.0 : 15.0;
+		reqs[i].end[1] += (i & 1) ? -15.0 : 15.0;
+		VectorClear (reqs[i].mins);
+		VectorClear (reqs[i].maxs);
+		reqs[i].headnode = 0;
+		reqs[i].contentmask = MASK_SOLID;
+		reqs[i].passent = inflictor;
+	}
+	gi.tracebatch (reqs, traces, 4);
 
-	VectorCopy (targ->s.origin, dest);
-	dest[0] -= 15.0;
-	dest[1] -= 15.0;
-	trace = gi.trace (inflictor->s.origin, vec3_origin, vec3_origin, dest, inflictor, MASK_SOLID);
-	if (trace.fraction == 1.0)
-		return true;
+	for (i=0 ; i<4 ; i++)
+		if (traces[i].fraction == 1.0)
+			return true;
 
 
 	return false;
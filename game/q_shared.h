@@ -284,6 +284,7 @@ void *Hunk_Begin( size_t maxsize);
 void *Hunk_Alloc( size_t size);
 void Hunk_Free(void *buf);
 int Hunk_End();
+size_t Hunk_Reserved( void *base );
 
 // directory searching
 #define SFF_ARCH 0x01
@@ -498,6 +499,15 @@ typedef struct {
   struct edict_s *ent;  // not set by CM_*() functions
 } trace_t;
 
+// one trace of a batch, see CM_BoxTraceBatch and game_import_t tracebatch
+typedef struct {
+  vec3_t start, end;
+  vec3_t mins, maxs;
+  int headnode;             // only used by CM_BoxTraceBatch
+  int contentmask;
+  struct edict_s *passent;  // only used by the game's tracebatch
+} trace_req_t;
+
 // pmove_state_t is the information necessary for client side movement
 // prediction
 typedef enum {
@@ -32,58 +32,133 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 //===============================================================================
 
-byte *membase;
-int maxhunksize;
-int curhunksize;
+/*
+A hunk starts out as a single chunk sized from the caller's estimate, and
+grows by chaining on further chunks as needed. Chunks are never moved,
+so pointers into the hunk stay valid.
+*/
 
-void *Hunk_Begin (int maxsize)
+#define	HUNK_MIN_GROW	0x40000		// smallest chunk added once the first is full
+
+typedef struct hunkchunk_s
 {
-	// reserve a huge chunk of memory, but don't commit any yet
-	maxhunksize = maxsize + sizeof(int);
-	curhunksize = 0;
-	membase = mmap(0, maxhunksize, PROT_READ|PROT_WRITE, 
+	struct hunkchunk_s	*next;
+	size_t				size;		// usable bytes after the header
+	size_t				used;
+	size_t				reserved;	// first chunk only, bytes held by the whole hunk
+} hunkchunk_t;
+
+static hunkchunk_t	*hunkbase;
+static hunkchunk_t	*hunkcurrent;
+static size_t		curhunksize;
+
+static hunkchunk_t *Hunk_NewChunk (size_t size)
+{
+	hunkchunk_t *chunk;
+
+	// reserve the address space, pages are only committed as they're touched
+	chunk = mmap(0, sizeof(hunkchunk_t) + size, PROT_READ|PROT_WRITE,
 		MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
-	if (membase == NULL || membase == (byte *)-1)
-		Sys_Error("unable to virtual allocate %d bytes", maxsize);
+	if (chunk == NULL || chunk == (hunkchunk_t *)-1)
+		Sys_Error("unable to virtual allocate %d bytes", (int)size);
+
+	chunk->next = NULL;
+	chunk->size = size;
+	chunk->used = 0;
+	chunk->reserved = 0;
+	return chunk;
+}
+
+void *Hunk_Begin (size_t maxsize)
+{
+	// maxsize is only an estimate now, so start with a chunk that size
+	curhunksize = 0;
+	hunkbase = hunkcurrent = Hunk_NewChunk((maxsize+31)&~31);
+	hunkbase->reserved = hunkbase->size;
 
-	*((int *)membase) = curhunksize;
+	if (mem_tracing)
+		Mem_Trace (MEM_TRACE_HUNK_BEGIN, MEM_TRACE_SITE, maxsize, 0);
 
-	return membase + sizeof(int);
+	return hunkbase + 1;
 }
 
-void *Hunk_Alloc (int size)
+void *Hunk_Alloc (size_t size)
 {
 	byte *buf;
+	size_t grow;
+
+	if (!hunkcurrent)
+		Sys_Error("Hunk_Alloc: no hunk begun");
 
 	// round to cacheline
 	size = (size+31)&~31;
-	if (curhunksize + size > maxhunksize)
-		Sys_Error("Hunk_Alloc overflow");
-	buf = membase + sizeof(int) + curhunksize;
+
+	if (hunkcurrent->used + size > hunkcurrent->size)
+	{
+		// grow by at least a quarter of what's held so far, so big models don't end up with lots of chunks
+		grow = hunkbase->reserved / 4;
+		if (grow < HUNK_MIN_GROW)
+			grow = HUNK_MIN_GROW;
+		if (grow < size)
+			grow = size;
+
+		hunkcurrent->next = Hunk_NewChunk(grow);
+		hunkcurrent = hunkcurrent->next;
+		hunkbase->reserved += grow;
+	}
+
+	buf = (byte *)(hunkcurrent + 1) + hunkcurrent->used;
+	hunkcurrent->used += size;
 	curhunksize += size;
+	if (mem_tracing)
+		Mem_Trace (MEM_TRACE_HUNK_ALLOC, MEM_TRACE_SITE, size, 0);
 	return buf;
 }
 
 int Hunk_End (void)
 {
-	byte *n;
+	hunkchunk_t *n;
+
+	if (!hunkcurrent)
+		Sys_Error("Hunk_End: no hunk begun");
 
-	n = mremap(membase, maxhunksize, curhunksize + sizeof(int), 0);
-	if (n != membase)
+	// shrink the last chunk down to what was used, in place
+	n = mremap(hunkcurrent, sizeof(hunkchunk_t) + hunkcurrent->size, sizeof(hunkchunk_t) + hunkcurrent->used, 0);
+	if (n != hunkcurrent)
 		Sys_Error("Hunk_End:  Could not remap virtual block (%d)", errno);
-	*((int *)membase) = curhunksize + sizeof(int);
-	
+	hunkbase->reserved -= hunkcurrent->size - hunkcurrent->used;
+	hunkcurrent->size = hunkcurrent->used;
+
+	hunkbase = hunkcurrent = NULL;
+
 	return curhunksize;
 }
 
+/*
+================
+Hunk_Reserved
+
+Bytes held by a finished hunk, including whatever it didn't use.
+================
+*/
+size_t Hunk_Reserved (void *base)
+{
+	if (!base)
+		return 0;
+
+	return ((hunkchunk_t *)base - 1)->reserved;
+}
+
 void Hunk_Free (void *base)
 {
-	byte *m;
+	hunkchunk_t *chunk, *next;
 
 	if (base) {
-		m = ((byte *)base) - sizeof(int);
-		if (munmap(m, *((int *)m)))
-			Sys_Error("Hunk_Free: munmap failed (%d)", errno);
+		for (chunk = (hunkchunk_t *)base - 1; chunk; chunk = next) {
+			next = chunk->next;
+			if (munmap(chunk, sizeof(hunkchunk_t) + chunk->size))
+				Sys_Error("Hunk_Free: munmap failed (%d)", errno);
+		}
 	}
 }
 
@@ -21,10 +21,21 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "qcommon.h"
 
+#include <thread>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define CM_TRACE_SSE
+#include <xmmintrin.h>
+#endif
+
+// the plane is stored in the node, so walking the tree doesn't touch
+// map_planes at all, and the padding keeps nodes from straddling cache lines
 typedef struct
 {
-	cplane_t	*plane;
+	cplane_t	plane;
 	int			children[2];		// negative numbers are leafs
+	int			pad;
 } cnode_t;
 
 typedef struct
@@ -47,7 +58,6 @@ typedef struct
 	int			contents;
 	int			numsides;
 	int			firstbrushside;
-	int			checkcount;		// to avoid repeated testings
 } cbrush_t;
 
 typedef struct
@@ -58,34 +68,42 @@ typedef struct
 	int		floodvalid;
 } carea_t;
 
-int			checkcount;
-
 char		map_name[MAX_QPATH];
+int			cm_mapsequence;		// bumped whenever a new map is loaded
 
+// the collision arrays are allocated to fit each map, plus room for the box hull
 int			numbrushsides;
-cbrushside_t map_brushsides[MAX_MAP_BRUSHSIDES];
+cbrushside_t *map_brushsides;
 
 int			numtexinfo;
 mapsurface_t	map_surfaces[MAX_MAP_TEXINFO];
 
 int			numplanes;
-cplane_t	map_planes[MAX_MAP_PLANES+6];		// extra for box hull
+cplane_t	*map_planes;
 
 int			numnodes;
-cnode_t		map_nodes[MAX_MAP_NODES+6];		// extra for box hull
+cnode_t		*map_nodes;		// depth first from each model's headnode
 
 int			numleafs = 1;	// allow leaf funcs to be called without a map
-cleaf_t		map_leafs[MAX_MAP_LEAFS];
+cleaf_t		*map_leafs;
 int			emptyleaf, solidleaf;
 
 int			numleafbrushes;
-unsigned short	map_leafbrushes[MAX_MAP_LEAFBRUSHES];
+unsigned short	*map_leafbrushes;
 
 int			numcmodels;
 cmodel_t	map_cmodels[MAX_MAP_MODELS];
 
 int			numbrushes;
-cbrush_t	map_brushes[MAX_MAP_BRUSHES];
+cbrush_t	*map_brushes;
+
+// room after each array for the box hull
+#define	BOX_PLANES		12
+#define	BOX_NODES		6
+#define	BOX_LEAFS		1
+#define	BOX_LEAFBRUSHES	1
+#define	BOX_BRUSHES		1
+#define	BOX_BRUSHSIDES	6
 
 int			numvisibility;
 byte		map_visibility[MAX_MAP_VISIBILITY];
@@ -110,8 +128,10 @@ qboolean	portalopen[MAX_MAP_AREAPORTALS];
 
 
 cvar_t		*map_noareas;
+static cvar_t	*cm_vismatrix;
 
 void	CM_InitBoxHull (void);
+static void	CM_InitVisCache (void);
 void	FloodAreaConnections (void);
 
 
@@ -127,7 +147,19 @@ int		c_traces, c_brush_traces;
 ===============================================================================
 */
 
-byte	*cmod_base;
+/*
+=================
+CMod_Alloc
+=================
+*/
+static void *CMod_Alloc (void *old, int count, int size)
+{
+	if (old)
+		Z_Free (old);
+	return Z_Malloc (count * size);
+}
+
+const byte	*cmod_base;
 
 /*
 =================
@@ -136,11 +168,11 @@ CMod_LoadSubmodels
 */
 void CMod_LoadSubmodels (lump_t *l)
 {
-	dmodel_t	*in;
+	const dmodel_t	*in;
 	cmodel_t	*out;
 	int			i, j, count;
 
-	in = (dmodel_t *)(cmod_base + l->fileofs);
+	in = (const dmodel_t *)(cmod_base + l->fileofs);
 	if (l->filelen % sizeof(*in))
 		Com_Error (ERR_DROP, "MOD_LoadBmodel: funny lump size");
 	count = l->filelen / sizeof(*in);
@@ -174,11 +206,11 @@ CMod_LoadSurfaces
 */
 void CMod_LoadSurfaces (lump_t *l)
 {
-	texinfo_t	*in;
+	const texinfo_t	*in;
 	mapsurface_t	*out;
 	int			i, count;
 
-	in = (texinfo_t *)(cmod_base + l->fileofs);
+	in = (const texinfo_t *)(cmod_base + l->fileofs);
 	if (l->filelen % sizeof(*in))
 		Com_Error (ERR_DROP, "MOD_LoadBmodel: funny lump size");
 	count = l->filelen / sizeof(*in);
@@ -206,14 +238,33 @@ CMod_LoadNodes
 
 =================
 */
+static int CMod_NumberNodes_r (const dnode_t *nodes, int num, int *remap, int next)
+{
+	int			j, child;
+
+	if (remap[num] != -1)
+		return next;
+	remap[num] = next++;
+
+	for (j=0 ; j<2 ; j++)
+	{
+		child = LittleLong (nodes[num].children[j]);
+		if (child >= 0)
+			next = CMod_NumberNodes_r (nodes, child, remap, next);
+	}
+
+	return next;
+}
+
 void CMod_LoadNodes (lump_t *l)
 {
-	dnode_t		*in;
+	const dnode_t		*in;
 	int			child;
 	cnode_t		*out;
-	int			i, j, count;
+	int			i, j, count, num, next;
+	int			*remap;
 	
-	in = (dnode_t *)(cmod_base + l->fileofs);
+	in = (const dnode_t *)(cmod_base + l->fileofs);
 	if (l->filelen % sizeof(*in))
 		Com_Error (ERR_DROP, "MOD_LoadBmodel: funny lump size");
 	count = l->filelen / sizeof(*in);
@@ -223,20 +274,62 @@ void CMod_LoadNodes (lump_t *l)
 	if (count > MAX_MAP_NODES)
 		Com_Error (ERR_DROP, "Map has too many nodes");
 
-	out = map_nodes;
+	for (i=0 ; i<count ; i++)
+	{
+		num = LittleLong (in[i].planenum);
+		if (num < 0 || num >= numplanes)
+			Com_Error (ERR_DROP, "Map has a bad node plane");
+		for (j=0 ; j<2 ; j++)
+		{
+			child = LittleLong (in[i].children[j]);
+			if (child >= count || -1-child >= numleafs)
+				Com_Error (ERR_DROP, "Map has a bad node child");
+		}
+	}
+
+	// renumber depth first from each model's headnode, so walking down
+	// the tree mostly moves forward through memory
+	remap = static_cast<int *>( Z_Malloc (count * sizeof(int)) );
+	for (i=0 ; i<count ; i++)
+		remap[i] = -1;
+
+	next = 0;
+	for (i=0 ; i<numcmodels ; i++)
+	{
+		num = map_cmodels[i].headnode;
+		if (num >= count)
+			Com_Error (ERR_DROP, "Map has a bad model headnode");
+		if (num >= 0)
+			next = CMod_NumberNodes_r (in, num, remap, next);
+	}
+	for (i=0 ; i<count ; i++)
+	{	// anything no model reaches keeps its place at the end
+		if (remap[i] == -1)
+			remap[i] = next++;
+	}
+
+	map_nodes = static_cast<cnode_t *>( CMod_Alloc (map_nodes, count + BOX_NODES, sizeof(cnode_t)) );
 
 	numnodes = count;
 
-	for (i=0 ; i<count ; i++, out++, in++)
+	for (i=0 ; i<count ; i++, in++)
 	{
-		out->plane = map_planes + LittleLong(in->planenum);
+		out = &map_nodes[remap[i]];
+		out->plane = map_planes[LittleLong(in->planenum)];
 		for (j=0 ; j<2 ; j++)
 		{
 			child = LittleLong (in->children[j]);
-			out->children[j] = child;
+			out->children[j] = child >= 0 ? remap[child] : child;
 		}
 	}
 
+	for (i=0 ; i<numcmodels ; i++)
+	{
+		if (map_cmodels[i].headnode >= 0)
+			map_cmodels[i].headnode = remap[map_cmodels[i].headnode];
+	}
+
+	Z_Free (remap);
 }
 
 /*
@@ -247,11 +340,11 @@ CMod_LoadBrushes
 */
 void CMod_LoadBrushes (lump_t *l)
 {
-	dbrush_t	*in;
+	const dbrush_t	*in;
 	cbrush_t	*out;
 	int			i, count;
 	
-	in = (dbrush_t *)(cmod_base + l->fileofs);
+	in = (const dbrush_t *)(cmod_base + l->fileofs);
 	if (l->filelen % sizeof(*in))
 		Com_Error (ERR_DROP, "MOD_LoadBmodel: funny lump size");
 	count = l->filelen / sizeof(*in);
@@ -259,6 +352,7 @@ void CMod_LoadBrushes (lump_t *l)
 	if (count > MAX_MAP_BRUSHES)
 		Com_Error (ERR_DROP, "Map has too many brushes");
 
+	map_brushes = static_cast<cbrush_t *>( CMod_Alloc (map_brushes, count + BOX_BRUSHES, sizeof(cbrush_t)) );
 	out = map_brushes;
 
 	numbrushes = count;
@@ -281,10 +375,10 @@ void CMod_LoadLeafs (lump_t *l)
 {
 	int			i;
 	cleaf_t		*out;
-	dleaf_t 	*in;
+	const dleaf_t 	*in;
 	int			count;
 	
-	in = (dleaf_t *)(cmod_base + l->fileofs);
+	in = (const dleaf_t *)(cmod_base + l->fileofs);
 	if (l->filelen % sizeof(*in))
 		Com_Error (ERR_DROP, "MOD_LoadBmodel: funny lump size");
 	count = l->filelen / sizeof(*in);
@@ -295,7 +389,8 @@ void CMod_LoadLeafs (lump_t *l)
 	if (count > MAX_MAP_PLANES)
 		Com_Error (ERR_DROP, "Map has too many planes");
 
-	out = map_leafs;	
+	map_leafs = static_cast<cleaf_t *>( CMod_Alloc (map_leafs, count + BOX_LEAFS, sizeof(cleaf_t)) );
+	out = map_leafs;
 	numleafs = count;
 	numclusters = 0;
 
@@ -336,11 +431,11 @@ void CMod_LoadPlanes (lump_t *l)
 {
 	int			i, j;
 	cplane_t	*out;
-	dplane_t 	*in;
+	const dplane_t 	*in;
 	int			count;
 	int			bits;
 	
-	in = (dplane_t *)(cmod_base + l->fileofs);
+	in = (const dplane_t *)(cmod_base + l->fileofs);
 	if (l->filelen % sizeof(*in))
 		Com_Error (ERR_DROP, "MOD_LoadBmodel: funny lump size");
 	count = l->filelen / sizeof(*in);
@@ -351,7 +446,8 @@ void CMod_LoadPlanes (lump_t *l)
 	if (count > MAX_MAP_PLANES)
 		Com_Error (ERR_DROP, "Map has too many planes");
 
-	out = map_planes;	
+	map_planes = static_cast<cplane_t *>( CMod_Alloc (map_planes, count + BOX_PLANES, sizeof(cplane_t)) );
+	out = map_planes;
 	numplanes = count;
 
 	for ( i=0 ; i<count ; i++, in++, out++)
@@ -379,10 +475,10 @@ void CMod_LoadLeafBrushes (lump_t *l)
 {
 	int			i;
 	unsigned short	*out;
-	unsigned short 	*in;
+	const unsigned short 	*in;
 	int			count;
 	
-	in = (unsigned short *)(cmod_base + l->fileofs);
+	in = (const unsigned short *)(cmod_base + l->fileofs);
 	if (l->filelen % sizeof(*in))
 		Com_Error (ERR_DROP, "MOD_LoadBmodel: funny lump size");
 	count = l->filelen / sizeof(*in);
@@ -393,6 +489,7 @@ void CMod_LoadLeafBrushes (lump_t *l)
 	if (count > MAX_MAP_LEAFBRUSHES)
 		Com_Error (ERR_DROP, "Map has too many leafbrushes");
 
+	map_leafbrushes = static_cast<unsigned short *>( CMod_Alloc (map_leafbrushes, count + BOX_LEAFBRUSHES, sizeof(unsigned short)) );
 	out = map_leafbrushes;
 	numleafbrushes = count;
 
@@ -409,11 +506,11 @@ void CMod_LoadBrushSides (lump_t *l)
 {
 	int			i, j;
 	cbrushside_t	*out;
-	dbrushside_t 	*in;
+	const dbrushside_t 	*in;
 	int			count;
 	int			num;
 
-	in = (dbrushside_t *)(cmod_base + l->fileofs);
+	in = (const dbrushside_t *)(cmod_base + l->fileofs);
 	if (l->filelen % sizeof(*in))
 		Com_Error (ERR_DROP, "MOD_LoadBmodel: funny lump size");
 	count = l->filelen / sizeof(*in);
@@ -422,7 +519,8 @@ void CMod_LoadBrushSides (lump_t *l)
 	if (count > MAX_MAP_BRUSHSIDES)
 		Com_Error (ERR_DROP, "Map has too many planes");
 
-	out = map_brushsides;	
+	map_brushsides = static_cast<cbrushside_t *>( CMod_Alloc (map_brushsides, count + BOX_BRUSHSIDES, sizeof(cbrushside_t)) );
+	out = map_brushsides;
 	numbrushsides = count;
 
 	for ( i=0 ; i<count ; i++, in++, out++)
@@ -445,10 +543,10 @@ void CMod_LoadAreas (lump_t *l)
 {
 	int			i;
 	carea_t		*out;
-	darea_t 	*in;
+	const darea_t 	*in;
 	int			count;
 
-	in = (darea_t *)(cmod_base + l->fileofs);
+	in = (const darea_t *)(cmod_base + l->fileofs);
 	if (l->filelen % sizeof(*in))
 		Com_Error (ERR_DROP, "MOD_LoadBmodel: funny lump size");
 	count = l->filelen / sizeof(*in);
@@ -477,10 +575,10 @@ void CMod_LoadAreaPortals (lump_t *l)
 {
 	int			i;
 	dareaportal_t		*out;
-	dareaportal_t 	*in;
+	const dareaportal_t 	*in;
 	int			count;
 
-	in = (dareaportal_t *)(cmod_base + l->fileofs);
+	in = (const dareaportal_t *)(cmod_base + l->fileofs);
 	if (l->filelen % sizeof(*in))
 		Com_Error (ERR_DROP, "MOD_LoadBmodel: funny lump size");
 	count = l->filelen / sizeof(*in);
@@ -538,6 +636,30 @@ void CMod_LoadEntityString (lump_t *l)
 
 
 
+/*
+==================
+CMod_LoadEmpty
+
+Sets up the arrays with just the one empty leaf and the box hull, for
+when there's no map
+==================
+*/
+static void CMod_LoadEmpty (void)
+{
+	map_leafs = static_cast<cleaf_t *>( CMod_Alloc (map_leafs, numleafs + BOX_LEAFS, sizeof(cleaf_t)) );
+	map_leafbrushes = static_cast<unsigned short *>( CMod_Alloc (map_leafbrushes, BOX_LEAFBRUSHES, sizeof(unsigned short)) );
+	map_planes = static_cast<cplane_t *>( CMod_Alloc (map_planes, BOX_PLANES, sizeof(cplane_t)) );
+	map_brushes = static_cast<cbrush_t *>( CMod_Alloc (map_brushes, BOX_BRUSHES, sizeof(cbrush_t)) );
+	map_brushsides = static_cast<cbrushside_t *>( CMod_Alloc (map_brushsides, BOX_BRUSHSIDES, sizeof(cbrushside_t)) );
+	map_nodes = static_cast<cnode_t *>( CMod_Alloc (map_nodes, BOX_NODES, sizeof(cnode_t)) );
+	emptyleaf = solidleaf = 0;
+
+	CM_InitBoxHull ();
+	CM_InitVisCache ();
+
+	cm_mapsequence++;
+}
+
 /*
 ==================
 CM_LoadMap
@@ -547,7 +669,7 @@ Loads in the map and all submodels
 */
 cmodel_t *CM_LoadMap (char *name, qboolean clientload, unsigned *checksum)
 {
-	unsigned		*buf;
+	const unsigned	*buf;
 	int				i;
 	dheader_t		header;
 	int				length;
@@ -570,6 +692,9 @@ cmodel_t *CM_LoadMap (char *name, qboolean clientload, unsigned *checksum)
 	numplanes = 0;
 	numnodes = 0;
 	numleafs = 0;
+	numleafbrushes = 0;
+	numbrushes = 0;
+	numbrushsides = 0;
 	numcmodels = 0;
 	numvisibility = 0;
 	numentitychars = 0;
@@ -582,20 +707,21 @@ cmodel_t *CM_LoadMap (char *name, qboolean clientload, unsigned *checksum)
 		numclusters = 1;
 		numareas = 1;
 		*checksum = 0;
+		CMod_LoadEmpty ();
 		return &map_cmodels[0];			// cinematic servers won't have anything at all
 	}
 
 	//
 	// load the file
 	//
-	length = FS_LoadFile (name, (void **)&buf);
+	length = FS_LoadSharedFile (name, (const void **)&buf);
 	if (!buf)
 		Com_Error (ERR_DROP, "Couldn't load %s", name);
 
 	last_checksum = LittleLong (Com_BlockChecksum (buf, length));
 	*checksum = last_checksum;
 
-	header = *(dheader_t *)buf;
+	header = *(const dheader_t *)buf;
 	for (i=0 ; i<sizeof(dheader_t)/4 ; i++)
 		((int *)&header)[i] = LittleLong ( ((int *)&header)[i]);
 
@@ -603,7 +729,7 @@ cmodel_t *CM_LoadMap (char *name, qboolean clientload, unsigned *checksum)
 		Com_Error (ERR_DROP, "CMod_LoadBrushModel: %s has wrong version number (%i should be %i)"
 		, name, header.version, BSPVERSION);
 
-	cmod_base = (byte *)buf;
+	cmod_base = (const byte *)buf;
 
 	// load into heap
 	CMod_LoadSurfaces (&header.lumps[LUMP_TEXINFO]);
@@ -619,9 +745,12 @@ cmodel_t *CM_LoadMap (char *name, qboolean clientload, unsigned *checksum)
 	CMod_LoadVisibility (&header.lumps[LUMP_VISIBILITY]);
 	CMod_LoadEntityString (&header.lumps[LUMP_ENTITIES]);
 
-	FS_FreeFile (buf);
+	FS_FreeSharedFile (buf);
 
 	CM_InitBoxHull ();
+	CM_InitVisCache ();
+
+	cm_mapsequence++;
 
 	memset (portalopen, 0, sizeof(portalopen));
 	FloodAreaConnections ();
@@ -741,7 +870,6 @@ void CM_InitBoxHull (void)
 
 		// nodes
 		c = &map_nodes[box_headnode+i];
-		c->plane = map_planes + (numplanes+i*2);
 		c->children[side] = -1 - emptyleaf;
 		if (i != 5)
 			c->children[side^1] = box_headnode+i + 1;
@@ -760,6 +888,8 @@ void CM_InitBoxHull (void)
 		p->signbits = 0;
 		VectorClear (p->normal);
 		p->normal[i>>1] = -1;
+
+		c->plane = box_planes[i*2];
 	}	
 }
 
@@ -787,6 +917,9 @@ int	CM_HeadnodeForBox (vec3_t mins, vec3_t maxs)
 	box_planes[10].dist = mins[2];
 	box_planes[11].dist = -mins[2];
 
+	for (int i=0 ; i<BOX_NODES ; i++)
+		map_nodes[box_headnode+i].plane.dist = box_planes[i*2].dist;
+
 	return box_headnode;
 }
 
@@ -806,7 +939,7 @@ int CM_PointLeafnum_r (vec3_t p, int num)
 	while (num >= 0)
 	{
 		node = map_nodes + num;
-		plane = node->plane;
+		plane = &node->plane;
 		
 		if (plane->type < 3)
 			d = p[plane->type] - plane->dist;
@@ -818,8 +951,6 @@ int CM_PointLeafnum_r (vec3_t p, int num)
 			num = node->children[0];
 	}
 
-	c_pointcontents++;		// optimize counter
-
 	return -1 - num;
 }
 
@@ -827,6 +958,9 @@ int CM_PointLeafnum (vec3_t p)
 {
 	if (!numplanes)
 		return 0;		// sound may call this without map loaded
+
+	c_pointcontents++;		// optimize counter
+
 	return CM_PointLeafnum_r (p, 0);
 }
 
@@ -839,12 +973,16 @@ CM_BoxLeafnums
 Fills in a list of all the leafs touched
 =============
 */
-int		leaf_count, leaf_maxcount;
-int		*leaf_list;
-float	*leaf_mins, *leaf_maxs;
-int		leaf_topnode;
-
-void CM_BoxLeafnums_r (int nodenum)
+typedef struct
+{
+	int			count, maxcount;
+	int			*list;
+	float		*mins, *maxs;
+	int			topnode;
+	cplane_t	*boxplanes;		// the box hull's planes, if not the shared ones
+} cmleaflist_t;
+
+void CM_BoxLeafnums_r (cmleaflist_t *ll, int nodenum)
 {
 	cplane_t	*plane;
 	cnode_t		*node;
@@ -854,50 +992,59 @@ void CM_BoxLeafnums_r (int nodenum)
 	{
 		if (nodenum < 0)
 		{
-			if (leaf_count >= leaf_maxcount)
+			if (ll->count >= ll->maxcount)
 			{
 //				Com_Printf ("CM_BoxLeafnums_r: overflow\n");
 				return;
 			}
-			leaf_list[leaf_count++] = -1 - nodenum;
+			ll->list[ll->count++] = -1 - nodenum;
 			return;
 		}
 	
 		node = &map_nodes[nodenum];
-		plane = node->plane;
-//		s = BoxOnPlaneSide (leaf_mins, leaf_maxs, plane);
-		s = BOX_ON_PLANE_SIDE(leaf_mins, leaf_maxs, plane);
+		plane = &node->plane;
+		if (ll->boxplanes && nodenum >= box_headnode)
+			plane = ll->boxplanes + (nodenum - box_headnode)*2;
+//		s = BoxOnPlaneSide (ll->mins, ll->maxs, plane);
+		s = BOX_ON_PLANE_SIDE(ll->mins, ll->maxs, plane);
 		if (s == 1)
 			nodenum = node->children[0];
 		else if (s == 2)
 			nodenum = node->children[1];
 		else
 		{	// go down both
-			if (leaf_topnode == -1)
-				leaf_topnode = nodenum;
-			CM_BoxLeafnums_r (node->children[0]);
+			if (ll->topnode == -1)
+				ll->topnode = nodenum;
+			CM_BoxLeafnums_r (ll, node->children[0]);
 			nodenum = node->children[1];
 		}
 
 	}
 }
 
-int	CM_BoxLeafnums_headnode (vec3_t mins, vec3_t maxs, int *list, int listsize, int headnode, int *topnode)
+static int CM_BoxLeafnums_boxplanes (vec3_t mins, vec3_t maxs, int *list, int listsize, int headnode, int *topnode, cplane_t *boxplanes)
 {
-	leaf_list = list;
-	leaf_count = 0;
-	leaf_maxcount = listsize;
-	leaf_mins = mins;
-	leaf_maxs = maxs;
+	cmleaflist_t	ll;
 
-	leaf_topnode = -1;
+	ll.list = list;
+	ll.count = 0;
+	ll.maxcount = listsize;
+	ll.mins = mins;
+	ll.maxs = maxs;
+	ll.topnode = -1;
+	ll.boxplanes = boxplanes;
 
-	CM_BoxLeafnums_r (headnode);
+	CM_BoxLeafnums_r (&ll, headnode);
 
 	if (topnode)
-		*topnode = leaf_topnode;
+		*topnode = ll.topnode;
 
-	return leaf_count;
+	return ll.count;
+}
+
+int	CM_BoxLeafnums_headnode (vec3_t mins, vec3_t maxs, int *list, int listsize, int headnode, int *topnode)
+{
+	return CM_BoxLeafnums_boxplanes (mins, maxs, list, listsize, headnode, topnode, NULL);
 }
 
 int	CM_BoxLeafnums (vec3_t mins, vec3_t maxs, int *list, int listsize, int *topnode)
@@ -921,6 +1068,8 @@ int CM_PointContents (vec3_t p, int headnode)
 	if (!numnodes)	// map not loaded
 		return 0;
 
+	c_pointcontents++;		// optimize counter
+
 	l = CM_PointLeafnum_r (p, headnode);
 
 	return map_leafs[l].contents;
@@ -956,6 +1105,8 @@ int	CM_TransformedPointContents (vec3_t p, int headnode, vec3_t origin, vec3_t a
 		p_l[2] = DotProduct (temp, up);
 	}
 
+	c_pointcontents++;		// optimize counter
+
 	l = CM_PointLeafnum_r (p_l, headnode);
 
 	return map_leafs[l].contents;
@@ -967,27 +1118,155 @@ int	CM_TransformedPointContents (vec3_t p, int headnode, vec3_t origin, vec3_t a
 
 BOX TRACING
 
+Everything a trace needs to remember lives in a cmtrace_ctx_t, and the map
+itself is only ever read, so traces on different contexts can run on
+different threads at once. CM_BoxTrace, CM_TransformedBoxTrace and
+CM_BoxTraceBatch share a context of their own, and so are still only for
+the main thread.
+
 ===============================================================================
 */
 
 // 1/32 epsilon to keep floating point happy
 #define	DIST_EPSILON	(0.03125)
 
-vec3_t	trace_start, trace_end;
-vec3_t	trace_mins, trace_maxs;
-vec3_t	trace_extents;
+// sweeps traced together by CM_BoxTraceBatchCtx
+#define	CM_TRACE_PACKET	4
+
+struct cmtrace_ctx_s
+{
+	vec3_t		start, end;
+	vec3_t		mins, maxs;
+	vec3_t		extents;
+
+	trace_t		trace;
+	int			contents;
+	qboolean	ispoint;		// optimized case
+
+	// brushes in more than one leaf are only clipped once per trace
+	int			checkcount;
+	int			*brushchecks;
+	int			numbrushchecks;
+	int			mapsequence;
+
+	// set by CM_HeadnodeForBoxCtx, otherwise the shared box hull is used
+	cplane_t	*boxplanes;
+	cplane_t	ownboxplanes[12];
+
+	int			numbrushtraces;
+
+	// one per lane for CM_BoxTraceBatchCtx, made the first time it's used
+	struct cmtrace_ctx_s	*lanes[CM_TRACE_PACKET];
+};
+
+static cmtrace_ctx_t	cm_defaultctx;
+
+static FILE			*cm_tracerecord;	// cm_tracerecord output
+static void CM_RecordTrace (vec3_t start, vec3_t end, vec3_t mins, vec3_t maxs, int headnode, int brushmask);
+
+/*
+==================
+CM_CreateTraceContext
+==================
+*/
+cmtrace_ctx_t *CM_CreateTraceContext (void)
+{
+	cmtrace_ctx_t	*ctx;
+
+	ctx = static_cast<cmtrace_ctx_t *>( calloc (1, sizeof(*ctx)) );
+	if (!ctx)
+		Com_Error (ERR_FATAL, "CM_CreateTraceContext: failed to allocate context");
+
+	return ctx;
+}
+
+/*
+==================
+CM_FreeTraceContext
+==================
+*/
+void CM_FreeTraceContext (cmtrace_ctx_t *ctx)
+{
+	int		i;
+
+	if (!ctx)
+		return;
+
+	for (i=0 ; i<CM_TRACE_PACKET ; i++)
+		CM_FreeTraceContext (ctx->lanes[i]);
+	free (ctx->brushchecks);
+	free (ctx);
+}
+
+/*
+==================
+CM_BeginTrace
+
+Starts a new generation for brush dedup, resizing the context for the
+current map if it's changed since the last trace
+==================
+*/
+static void CM_BeginTrace (cmtrace_ctx_t *ctx)
+{
+	// one extra for the box hull's brush
+	if (ctx->mapsequence != cm_mapsequence || ctx->numbrushchecks < numbrushes + 1)
+	{
+		free (ctx->brushchecks);
+		ctx->numbrushchecks = numbrushes + 1;
+		ctx->brushchecks = static_cast<int *>( calloc (ctx->numbrushchecks, sizeof(int)) );
+		if (!ctx->brushchecks)
+			Com_Error (ERR_FATAL, "CM_BeginTrace: failed to allocate %i brush checks", ctx->numbrushchecks);
+		ctx->mapsequence = cm_mapsequence;
+		ctx->checkcount = 0;
+	}
+
+	if (++ctx->checkcount <= 0)
+	{	// wrapped, so start the generations over
+		memset (ctx->brushchecks, 0, ctx->numbrushchecks * sizeof(int));
+		ctx->checkcount = 1;
+	}
+}
+
+/*
+==================
+CM_HeadnodeForBoxCtx
+
+As CM_HeadnodeForBox, but the box only applies to traces on this context
+==================
+*/
+int	CM_HeadnodeForBoxCtx (cmtrace_ctx_t *ctx, vec3_t mins, vec3_t maxs)
+{
+	int			i;
+	cplane_t	*p;
+
+	for (i=0 ; i<6 ; i++)
+	{
+		p = &ctx->ownboxplanes[i*2];
+		p->type = i>>1;
+		p->signbits = 0;
+		VectorClear (p->normal);
+		p->normal[i>>1] = 1;
+		p->dist = (i & 1) ? mins[i>>1] : maxs[i>>1];
+
+		p = &ctx->ownboxplanes[i*2+1];
+		p->type = 3 + (i>>1);
+		p->signbits = 0;
+		VectorClear (p->normal);
+		p->normal[i>>1] = -1;
+		p->dist = (i & 1) ? -mins[i>>1] : -maxs[i>>1];
+	}
+
+	ctx->boxplanes = ctx->ownboxplanes;
 
-trace_t	trace_trace;
-int		trace_contents;
-qboolean	trace_ispoint;		// optimized case
+	return box_headnode;
+}
 
 /*
 ================
 CM_ClipBoxToBrush
 ================
 */
-void CM_ClipBoxToBrush (vec3_t mins, vec3_t maxs, vec3_t p1, vec3_t p2,
-					  trace_t *trace, cbrush_t *brush)
+void CM_ClipBoxToBrush (cmtrace_ctx_t *ctx, cbrush_t *brush)
 {
 	int			i, j;
 	cplane_t	*plane, *clipplane;
@@ -998,6 +1277,7 @@ void CM_ClipBoxToBrush (vec3_t mins, vec3_t maxs, vec3_t p1, vec3_t p2,
 	qboolean	getout, startout;
 	float		f;
 	cbrushside_t	*side, *leadside;
+	trace_t		*trace = &ctx->trace;
 
 	enterfrac = -1;
 	leavefrac = 1;
@@ -1006,7 +1286,7 @@ void CM_ClipBoxToBrush (vec3_t mins, vec3_t maxs, vec3_t p1, vec3_t p2,
 	if (!brush->numsides)
 		return;
 
-	c_brush_traces++;
+	ctx->numbrushtraces++;
 
 	getout = false;
 	startout = false;
@@ -1016,10 +1296,12 @@ void CM_ClipBoxToBrush (vec3_t mins, vec3_t maxs, vec3_t p1, vec3_t p2,
 	{
 		side = &map_brushsides[brush->firstbrushside+i];
 		plane = side->plane;
+		if (ctx->boxplanes && brush == box_brush)
+			plane = ctx->boxplanes + (plane - box_planes);
 
 		// FIXME: special case for axial
 
-		if (!trace_ispoint)
+		if (!ctx->ispoint)
 		{	// general box case
 
 			// push the plane out apropriately for mins/maxs
@@ -1028,9 +1310,9 @@ void CM_ClipBoxToBrush (vec3_t mins, vec3_t maxs, vec3_t p1, vec3_t p2,
 			for (j=0 ; j<3 ; j++)
 			{
 				if (plane->normal[j] < 0)
-					ofs[j] = maxs[j];
+					ofs[j] = ctx->maxs[j];
 				else
-					ofs[j] = mins[j];
+					ofs[j] = ctx->mins[j];
 			}
 			dist = DotProduct (ofs, plane->normal);
 			dist = plane->dist - dist;
@@ -1040,8 +1322,8 @@ void CM_ClipBoxToBrush (vec3_t mins, vec3_t maxs, vec3_t p1, vec3_t p2,
 			dist = plane->dist;
 		}
 
-		d1 = DotProduct (p1, plane->normal) - dist;
-		d2 = DotProduct (p2, plane->normal) - dist;
+		d1 = DotProduct (ctx->start, plane->normal) - dist;
+		d2 = DotProduct (ctx->end, plane->normal) - dist;
 
 		if (d2 > 0)
 			getout = true;	// endpoint is not in solid
@@ -1100,8 +1382,7 @@ void CM_ClipBoxToBrush (vec3_t mins, vec3_t maxs, vec3_t p1, vec3_t p2,
 CM_TestBoxInBrush
 ================
 */
-void CM_TestBoxInBrush (vec3_t mins, vec3_t maxs, vec3_t p1,
-					  trace_t *trace, cbrush_t *brush)
+void CM_TestBoxInBrush (cmtrace_ctx_t *ctx, cbrush_t *brush)
 {
 	int			i, j;
 	cplane_t	*plane;
@@ -1109,6 +1390,7 @@ void CM_TestBoxInBrush (vec3_t mins, vec3_t maxs, vec3_t p1,
 	vec3_t		ofs;
 	float		d1;
 	cbrushside_t	*side;
+	trace_t		*trace = &ctx->trace;
 
 	if (!brush->numsides)
 		return;
@@ -1117,6 +1399,8 @@ void CM_TestBoxInBrush (vec3_t mins, vec3_t maxs, vec3_t p1,
 	{
 		side = &map_brushsides[brush->firstbrushside+i];
 		plane = side->plane;
+		if (ctx->boxplanes && brush == box_brush)
+			plane = ctx->boxplanes + (plane - box_planes);
 
 		// FIXME: special case for axial
 
@@ -1128,14 +1412,14 @@ void CM_TestBoxInBrush (vec3_t mins, vec3_t maxs, vec3_t p1,
 		for (j=0 ; j<3 ; j++)
 		{
 			if (plane->normal[j] < 0)
-				ofs[j] = maxs[j];
+				ofs[j] = ctx->maxs[j];
 			else
-				ofs[j] = mins[j];
+				ofs[j] = ctx->mins[j];
 		}
 		dist = DotProduct (ofs, plane->normal);
 		dist = plane->dist - dist;
 
-		d1 = DotProduct (p1, plane->normal) - dist;
+		d1 = DotProduct (ctx->start, plane->normal) - dist;
 
 		// if completely in front of face, no intersection
 		if (d1 > 0)
@@ -1155,7 +1439,7 @@ void CM_TestBoxInBrush (vec3_t mins, vec3_t maxs, vec3_t p1,
 CM_TraceToLeaf
 ================
 */
-void CM_TraceToLeaf (int leafnum)
+void CM_TraceToLeaf (cmtrace_ctx_t *ctx, int leafnum)
 {
 	int			k;
 	int			brushnum;
@@ -1163,21 +1447,21 @@ void CM_TraceToLeaf (int leafnum)
 	cbrush_t	*b;
 
 	leaf = &map_leafs[leafnum];
-	if ( !(leaf->contents & trace_contents))
+	if ( !(leaf->contents & ctx->contents))
 		return;
 	// trace line against all brushes in the leaf
 	for (k=0 ; k<leaf->numleafbrushes ; k++)
 	{
 		brushnum = map_leafbrushes[leaf->firstleafbrush+k];
-		b = &map_brushes[brushnum];
-		if (b->checkcount == checkcount)
+		if (ctx->brushchecks[brushnum] == ctx->checkcount)
 			continue;	// already checked this brush in another leaf
-		b->checkcount = checkcount;
+		ctx->brushchecks[brushnum] = ctx->checkcount;
 
-		if ( !(b->contents & trace_contents))
+		b = &map_brushes[brushnum];
+		if ( !(b->contents & ctx->contents))
 			continue;
-		CM_ClipBoxToBrush (trace_mins, trace_maxs, trace_start, trace_end, &trace_trace, b);
-		if (!trace_trace.fraction)
+		CM_ClipBoxToBrush (ctx, b);
+		if (!ctx->trace.fraction)
 			return;
 	}
 
@@ -1189,7 +1473,7 @@ void CM_TraceToLeaf (int leafnum)
 CM_TestInLeaf
 ================
 */
-void CM_TestInLeaf (int leafnum)
+void CM_TestInLeaf (cmtrace_ctx_t *ctx, int leafnum)
 {
 	int			k;
 	int			brushnum;
@@ -1197,21 +1481,21 @@ void CM_TestInLeaf (int leafnum)
 	cbrush_t	*b;
 
 	leaf = &map_leafs[leafnum];
-	if ( !(leaf->contents & trace_contents))
+	if ( !(leaf->contents & ctx->contents))
 		return;
 	// trace line against all brushes in the leaf
 	for (k=0 ; k<leaf->numleafbrushes ; k++)
 	{
 		brushnum = map_leafbrushes[leaf->firstleafbrush+k];
-		b = &map_brushes[brushnum];
-		if (b->checkcount == checkcount)
+		if (ctx->brushchecks[brushnum] == ctx->checkcount)
 			continue;	// already checked this brush in another leaf
-		b->checkcount = checkcount;
+		ctx->brushchecks[brushnum] = ctx->checkcount;
 
-		if ( !(b->contents & trace_contents))
+		b = &map_brushes[brushnum];
+		if ( !(b->contents & ctx->contents))
 			continue;
-		CM_TestBoxInBrush (trace_mins, trace_maxs, trace_start, &trace_trace, b);
-		if (!trace_trace.fraction)
+		CM_TestBoxInBrush (ctx, b);
+		if (!ctx->trace.fraction)
 			return;
 	}
 
@@ -1224,7 +1508,7 @@ CM_RecursiveHullCheck
 
 ==================
 */
-void CM_RecursiveHullCheck (int num, float p1f, float p2f, vec3_t p1, vec3_t p2)
+void CM_RecursiveHullCheck (cmtrace_ctx_t *ctx, int num, float p1f, float p2f, vec3_t p1, vec3_t p2)
 {
 	cnode_t		*node;
 	cplane_t	*plane;
@@ -1236,13 +1520,13 @@ void CM_RecursiveHullCheck (int num, float p1f, float p2f, vec3_t p1, vec3_t p2)
 	int			side;
 	float		midf;
 
-	if (trace_trace.fraction <= p1f)
+	if (ctx->trace.fraction <= p1f)
 		return;		// already hit something nearer
 
 	// if < 0, we are in a leaf node
 	if (num < 0)
 	{
-		CM_TraceToLeaf (-1-num);
+		CM_TraceToLeaf (ctx, -1-num);
 		return;
 	}
 
@@ -1251,42 +1535,44 @@ void CM_RecursiveHullCheck (int num, float p1f, float p2f, vec3_t p1, vec3_t p2)
 	// and the offset for the size of the box
 	//
 	node = map_nodes + num;
-	plane = node->plane;
+	plane = &node->plane;
+	if (ctx->boxplanes && num >= box_headnode)
+		plane = ctx->boxplanes + (num - box_headnode)*2;
 
 	if (plane->type < 3)
 	{
 		t1 = p1[plane->type] - plane->dist;
 		t2 = p2[plane->type] - plane->dist;
-		offset = trace_extents[plane->type];
+		offset = ctx->extents[plane->type];
 	}
 	else
 	{
 		t1 = DotProduct (plane->normal, p1) - plane->dist;
 		t2 = DotProduct (plane->normal, p2) - plane->dist;
-		if (trace_ispoint)
+		if (ctx->ispoint)
 			offset = 0;
 		else
-			offset = fabs(trace_extents[0]*plane->normal[0]) +
-				fabs(trace_extents[1]*plane->normal[1]) +
-				fabs(trace_extents[2]*plane->normal[2]);
+			offset = fabs(ctx->extents[0]*plane->normal[0]) +
+				fabs(ctx->extents[1]*plane->normal[1]) +
+				fabs(ctx->extents[2]*plane->normal[2]);
 	}
 
 
 #if 0
-CM_RecursiveHullCheck (node->children[0], p1f, p2f, p1, p2);
-CM_RecursiveHullCheck (node->children[1], p1f, p2f, p1, p2);
+CM_RecursiveHullCheck (ctx, node->children[0], p1f, p2f, p1, p2);
+CM_RecursiveHullCheck (ctx, node->children[1], p1f, p2f, p1, p2);
 return;
 #endif
 
 	// see which sides we need to consider
 	if (t1 >= offset && t2 >= offset)
 	{
-		CM_RecursiveHullCheck (node->children[0], p1f, p2f, p1, p2);
+		CM_RecursiveHullCheck (ctx, node->children[0], p1f, p2f, p1, p2);
 		return;
 	}
 	if (t1 < -offset && t2 < -offset)
 	{
-		CM_RecursiveHullCheck (node->children[1], p1f, p2f, p1, p2);
+		CM_RecursiveHullCheck (ctx, node->children[1], p1f, p2f, p1, p2);
 		return;
 	}
 
@@ -1322,7 +1608,7 @@ return;
 	for (i=0 ; i<3 ; i++)
 		mid[i] = p1[i] + frac*(p2[i] - p1[i]);
 
-	CM_RecursiveHullCheck (node->children[side], p1f, midf, p1, mid);
+	CM_RecursiveHullCheck (ctx, node->children[side], p1f, midf, p1, mid);
 
 
 	// go past the node
@@ -1335,7 +1621,7 @@ return;
 	for (i=0 ; i<3 ; i++)
 		mid[i] = p1[i] + frac2*(p2[i] - p1[i]);
 
-	CM_RecursiveHullCheck (node->children[side^1], midf, p2f, mid, p2);
+	CM_RecursiveHullCheck (ctx, node->children[side^1], midf, p2f, mid, p2);
 }
 
 
@@ -1344,30 +1630,80 @@ return;
 
 /*
 ==================
-CM_BoxTrace
+CM_InitTrace
+
+Fills in a default trace and sets the context up to sweep start to end,
+returns false if there's no map to trace against
 ==================
 */
-trace_t		CM_BoxTrace (vec3_t start, vec3_t end,
-						  vec3_t mins, vec3_t maxs,
-						  int headnode, int brushmask)
+static qboolean CM_InitTrace (cmtrace_ctx_t *ctx, vec3_t start, vec3_t end,
+						  vec3_t mins, vec3_t maxs, int brushmask)
 {
-	checkcount++;		// for multi-check avoidance
-
-	c_traces++;			// for statistics, may be zeroed
-
 	// fill in a default trace
-	memset (&trace_trace, 0, sizeof(trace_trace));
-	trace_trace.fraction = 1;
-	trace_trace.surface = &(nullsurface.c);
+	memset (&ctx->trace, 0, sizeof(ctx->trace));
+	ctx->trace.fraction = 1;
+	ctx->trace.surface = &(nullsurface.c);
 
 	if (!numnodes)	// map not loaded
-		return trace_trace;
+		return false;
+
+	CM_BeginTrace (ctx);		// for multi-check avoidance
+
+	ctx->contents = brushmask;
+	VectorCopy (start, ctx->start);
+	VectorCopy (end, ctx->end);
+	VectorCopy (mins, ctx->mins);
+	VectorCopy (maxs, ctx->maxs);
+
+	//
+	// check for point special case
+	//
+	if (mins[0] == 0 && mins[1] == 0 && mins[2] == 0
+		&& maxs[0] == 0 && maxs[1] == 0 && maxs[2] == 0)
+	{
+		ctx->ispoint = true;
+		VectorClear (ctx->extents);
+	}
+	else
+	{
+		ctx->ispoint = false;
+		ctx->extents[0] = -mins[0] > maxs[0] ? -mins[0] : maxs[0];
+		ctx->extents[1] = -mins[1] > maxs[1] ? -mins[1] : maxs[1];
+		ctx->extents[2] = -mins[2] > maxs[2] ? -mins[2] : maxs[2];
+	}
+
+	return true;
+}
+
+/*
+==================
+CM_FinishTrace
+==================
+*/
+static void CM_FinishTrace (cmtrace_ctx_t *ctx)
+{
+	if (ctx->trace.fraction == 1)
+	{
+		VectorCopy (ctx->end, ctx->trace.endpos);
+	}
+	else
+	{
+		for (unsigned int i=0 ; i<3 ; i++)
+			ctx->trace.endpos[i] = ctx->start[i] + ctx->trace.fraction * (ctx->end[i] - ctx->start[i]);
+	}
+}
 
-	trace_contents = brushmask;
-	VectorCopy (start, trace_start);
-	VectorCopy (end, trace_end);
-	VectorCopy (mins, trace_mins);
-	VectorCopy (maxs, trace_maxs);
+/*
+==================
+CM_BoxTraceCtx
+==================
+*/
+trace_t		CM_BoxTraceCtx (cmtrace_ctx_t *ctx, vec3_t start, vec3_t end,
+						  vec3_t mins, vec3_t maxs,
+						  int headnode, int brushmask)
+{
+	if (!CM_InitTrace (ctx, start, end, mins, maxs, brushmask))
+		return ctx->trace;
 
 	//
 	// check for position test special case
@@ -1387,55 +1723,55 @@ trace_t		CM_BoxTrace (vec3_t start, vec3_t end,
 			c2[i] += 1;
 		}
 
-		numLeafs = CM_BoxLeafnums_headnode (c1, c2, leafs, 1024, headnode, &topnode);
+		numLeafs = CM_BoxLeafnums_boxplanes (c1, c2, leafs, 1024, headnode, &topnode, ctx->boxplanes);
 		for (i=0 ; i< numLeafs; i++)
 		{
-			CM_TestInLeaf (leafs[i]);
-			if (trace_trace.allsolid)
+			CM_TestInLeaf (ctx, leafs[i]);
+			if (ctx->trace.allsolid)
 				break;
 		}
-		VectorCopy (start, trace_trace.endpos);
-		return trace_trace;
-	}
-
-	//
-	// check for point special case
-	//
-	if (mins[0] == 0 && mins[1] == 0 && mins[2] == 0
-		&& maxs[0] == 0 && maxs[1] == 0 && maxs[2] == 0)
-	{
-		trace_ispoint = true;
-		VectorClear (trace_extents);
-	}
-	else
-	{
-		trace_ispoint = false;
-		trace_extents[0] = -mins[0] > maxs[0] ? -mins[0] : maxs[0];
-		trace_extents[1] = -mins[1] > maxs[1] ? -mins[1] : maxs[1];
-		trace_extents[2] = -mins[2] > maxs[2] ? -mins[2] : maxs[2];
+		VectorCopy (start, ctx->trace.endpos);
+		return ctx->trace;
 	}
 
 	//
 	// general sweeping through world
 	//
-	CM_RecursiveHullCheck (headnode, 0, 1, start, end);
+	CM_RecursiveHullCheck (ctx, headnode, 0, 1, start, end);
 
-	if (trace_trace.fraction == 1)
-	{
-		VectorCopy (end, trace_trace.endpos);
-	}
-	else
-	{
-		for (unsigned int i=0 ; i<3 ; i++)
-			trace_trace.endpos[i] = start[i] + trace_trace.fraction * (end[i] - start[i]);
-	}
-	return trace_trace;
+	CM_FinishTrace (ctx);
+
+	return ctx->trace;
+}
+
+/*
+==================
+CM_BoxTrace
+==================
+*/
+trace_t		CM_BoxTrace (vec3_t start, vec3_t end,
+						  vec3_t mins, vec3_t maxs,
+						  int headnode, int brushmask)
+{
+	trace_t		trace;
+
+	c_traces++;			// for statistics, may be zeroed
+
+	if (cm_tracerecord)
+		CM_RecordTrace (start, end, mins, maxs, headnode, brushmask);
+
+	trace = CM_BoxTraceCtx (&cm_defaultctx, start, end, mins, maxs, headnode, brushmask);
+
+	c_brush_traces += cm_defaultctx.numbrushtraces;
+	cm_defaultctx.numbrushtraces = 0;
+
+	return trace;
 }
 
 
 /*
 ==================
-CM_TransformedBoxTrace
+CM_TransformedBoxTraceCtx
 
 Handles offseting and rotation of the end points for moving and
 rotating entities
@@ -1446,7 +1782,7 @@ rotating entities
 #endif
 
 
-trace_t		CM_TransformedBoxTrace (vec3_t start, vec3_t end,
+trace_t		CM_TransformedBoxTraceCtx (cmtrace_ctx_t *ctx, vec3_t start, vec3_t end,
 						  vec3_t mins, vec3_t maxs,
 						  int headnode, int brushmask,
 						  vec3_t origin, vec3_t angles)
@@ -1485,7 +1821,7 @@ trace_t		CM_TransformedBoxTrace (vec3_t start, vec3_t end,
 	}
 
 	// sweep the box through the model
-	trace = CM_BoxTrace (start_l, end_l, mins, maxs, headnode, brushmask);
+	trace = CM_BoxTraceCtx (ctx, start_l, end_l, mins, maxs, headnode, brushmask);
 
 	if (rotated && trace.fraction != 1.0)
 	{
@@ -1510,34 +1846,806 @@ trace_t		CM_TransformedBoxTrace (vec3_t start, vec3_t end,
 #pragma optimize( "", on )
 #endif
 
+trace_t		CM_TransformedBoxTrace (vec3_t start, vec3_t end,
+						  vec3_t mins, vec3_t maxs,
+						  int headnode, int brushmask,
+						  vec3_t origin, vec3_t angles)
+{
+	trace_t		trace;
+
+	c_traces++;			// for statistics, may be zeroed
+
+	trace = CM_TransformedBoxTraceCtx (&cm_defaultctx, start, end, mins, maxs, headnode, brushmask, origin, angles);
+
+	c_brush_traces += cm_defaultctx.numbrushtraces;
+	cm_defaultctx.numbrushtraces = 0;
+
+	return trace;
+}
 
 
 /*
 ===============================================================================
 
-PVS / PHS
+BATCHED TRACING
+
+Sweeps are pushed through the tree CM_TRACE_PACKET at a time, classifying
+every ray that reaches a node against its plane at once. Each ray still
+makes exactly the choices CM_RecursiveHullCheck would, and clips against
+brushes with its own context, so the results match tracing them one by one.
 
 ===============================================================================
 */
 
-/*
-===================
-CM_DecompressVis
-===================
-*/
-void CM_DecompressVis (byte *in, byte *out)
+typedef struct
 {
-	int		c;
-	byte	*out_p;
-	int		row;
+	// one column per lane
+	float		p1[3][CM_TRACE_PACKET];
+	float		p2[3][CM_TRACE_PACKET];
+	float		p1f[CM_TRACE_PACKET];
+	float		p2f[CM_TRACE_PACKET];
+	int			active;		// mask of the lanes that have been filled in
+} cmpacket_t;
 
-	row = (numclusters+7)>>3;	
-	out_p = out;
+typedef struct
+{
+	cmtrace_ctx_t	*lanes[CM_TRACE_PACKET];
+	float			extents[3][CM_TRACE_PACKET];
+	float			fraction[CM_TRACE_PACKET];	// copy of each lane's trace.fraction
+} cmbatch_t;
 
-	if (!in || !numvisibility)
-	{	// no vis info, so make all visible
-		while (row)
-		{
+static void CM_SetPacketLane (cmpacket_t *pk, int lane, float p1f, float p2f, vec3_t p1, vec3_t p2)
+{
+	int		i;
+
+	for (i=0 ; i<3 ; i++)
+	{
+		pk->p1[i][lane] = p1[i];
+		pk->p2[i][lane] = p2[i];
+	}
+	pk->p1f[lane] = p1f;
+	pk->p2f[lane] = p2f;
+	pk->active |= 1 << lane;
+}
+
+/*
+==================
+CM_ActiveLanes
+
+Returns the mask of lanes that haven't already hit something nearer than
+the start of their segments
+==================
+*/
+static int CM_ActiveLanes (cmbatch_t *batch, const cmpacket_t *pk)
+{
+#ifdef CM_TRACE_SSE
+	return _mm_movemask_ps (_mm_cmpgt_ps (_mm_loadu_ps (batch->fraction), _mm_loadu_ps (pk->p1f)));
+#else
+	int		i, active;
+
+	active = 0;
+	for (i=0 ; i<CM_TRACE_PACKET ; i++)
+		if (batch->fraction[i] > pk->p1f[i])
+			active |= 1 << i;
+	return active;
+#endif
+}
+
+/*
+==================
+CM_ClassifyPacket
+
+Finds each lane's distances to the plane and the offset for its box, and
+returns masks of the lanes entirely in front of and behind it
+==================
+*/
+static void CM_ClassifyPacket (cmbatch_t *batch, const cmpacket_t *pk, cplane_t *plane,
+						  float *t1, float *t2, float *offset, int *front, int *back)
+{
+#ifdef CM_TRACE_SSE
+	__m128	a, b, o, dist, sign;
+
+	dist = _mm_set1_ps (plane->dist);
+	sign = _mm_set1_ps (-0.0f);
+
+	if (plane->type < 3)
+	{
+		a = _mm_sub_ps (_mm_loadu_ps (pk->p1[plane->type]), dist);
+		b = _mm_sub_ps (_mm_loadu_ps (pk->p2[plane->type]), dist);
+		o = _mm_loadu_ps (batch->extents[plane->type]);
+	}
+	else
+	{
+		__m128	nx = _mm_set1_ps (plane->normal[0]);
+		__m128	ny = _mm_set1_ps (plane->normal[1]);
+		__m128	nz = _mm_set1_ps (plane->normal[2]);
+
+		// summed in the same order as DotProduct, so the results are identical
+		a = _mm_add_ps (_mm_add_ps (_mm_mul_ps (nx, _mm_loadu_ps (pk->p1[0])),
+			_mm_mul_ps (ny, _mm_loadu_ps (pk->p1[1]))), _mm_mul_ps (nz, _mm_loadu_ps (pk->p1[2])));
+		a = _mm_sub_ps (a, dist);
+		b = _mm_add_ps (_mm_add_ps (_mm_mul_ps (nx, _mm_loadu_ps (pk->p2[0])),
+			_mm_mul_ps (ny, _mm_loadu_ps (pk->p2[1]))), _mm_mul_ps (nz, _mm_loadu_ps (pk->p2[2])));
+		b = _mm_sub_ps (b, dist);
+
+		// points have zero extents, so this is 0 for them as well
+		o = _mm_add_ps (_mm_add_ps (_mm_andnot_ps (sign, _mm_mul_ps (_mm_loadu_ps (batch->extents[0]), nx)),
+			_mm_andnot_ps (sign, _mm_mul_ps (_mm_loadu_ps (batch->extents[1]), ny))),
+			_mm_andnot_ps (sign, _mm_mul_ps (_mm_loadu_ps (batch->extents[2]), nz)));
+	}
+
+	_mm_storeu_ps (t1, a);
+	_mm_storeu_ps (t2, b);
+	_mm_storeu_ps (offset, o);
+
+	*front = _mm_movemask_ps (_mm_and_ps (_mm_cmpge_ps (a, o), _mm_cmpge_ps (b, o)));
+	o = _mm_xor_ps (o, sign);
+	*back = _mm_movemask_ps (_mm_and_ps (_mm_cmplt_ps (a, o), _mm_cmplt_ps (b, o)));
+#else
+	int		i;
+
+	*front = *back = 0;
+	for (i=0 ; i<CM_TRACE_PACKET ; i++)
+	{
+		if (plane->type < 3)
+		{
+			t1[i] = pk->p1[plane->type][i] - plane->dist;
+			t2[i] = pk->p2[plane->type][i] - plane->dist;
+			offset[i] = batch->extents[plane->type][i];
+		}
+		else
+		{
+			t1[i] = plane->normal[0]*pk->p1[0][i] + plane->normal[1]*pk->p1[1][i] + plane->normal[2]*pk->p1[2][i] - plane->dist;
+			t2[i] = plane->normal[0]*pk->p2[0][i] + plane->normal[1]*pk->p2[1][i] + plane->normal[2]*pk->p2[2][i] - plane->dist;
+			offset[i] = fabs(batch->extents[0][i]*plane->normal[0]) +
+				fabs(batch->extents[1][i]*plane->normal[1]) +
+				fabs(batch->extents[2][i]*plane->normal[2]);
+		}
+
+		if (t1[i] >= offset[i] && t2[i] >= offset[i])
+			*front |= 1 << i;
+		if (t1[i] < -offset[i] && t2[i] < -offset[i])
+			*back |= 1 << i;
+	}
+#endif
+}
+
+/*
+==================
+CM_RecursiveHullCheckPacket
+
+Lanes that stay on one side of a node carry on with their parent's packet,
+only lanes that cross it need new segments
+==================
+*/
+static void CM_RecursiveHullCheckPacket (cmbatch_t *batch, int num, const cmpacket_t *pk, int lanes)
+{
+	cnode_t		*node;
+	float		t1[CM_TRACE_PACKET], t2[CM_TRACE_PACKET], offset[CM_TRACE_PACKET];
+	int			active, front, back, cross, sides[2];
+	cmpacket_t	nearpk, farpk;
+	float		idist, frac, frac2, midf;
+	vec3_t		p1, p2, mid;
+	int			i, j, side;
+
+	active = lanes & CM_ActiveLanes (batch, pk);
+	if (!active)
+		return;		// already hit something nearer
+
+	// once the rays have split up there's nothing to share, so a lone
+	// ray goes on by itself
+	if (!(active & (active - 1)))
+	{
+		for (i=0 ; !(active & (1 << i)) ; i++)
+			;
+		for (j=0 ; j<3 ; j++)
+		{
+			p1[j] = pk->p1[j][i];
+			p2[j] = pk->p2[j][i];
+		}
+		CM_RecursiveHullCheck (batch->lanes[i], num, pk->p1f[i], pk->p2f[i], p1, p2);
+		batch->fraction[i] = batch->lanes[i]->trace.fraction;
+		return;
+	}
+
+	// nothing changes until a leaf is reached, so walk straight down
+	// while all the lanes stay on one side
+	while (num >= 0)
+	{
+		node = map_nodes + num;
+		CM_ClassifyPacket (batch, pk, &node->plane, t1, t2, offset, &front, &back);
+		front &= active;
+		back &= active;
+
+		if (front == active)
+			num = node->children[0];
+		else if (back == active)
+			num = node->children[1];
+		else
+			break;
+	}
+
+	// if < 0, we are in a leaf node
+	if (num < 0)
+	{
+		for (i=0 ; i<CM_TRACE_PACKET ; i++)
+		{
+			if (!(active & (1 << i)))
+				continue;
+			CM_TraceToLeaf (batch->lanes[i], -1-num);
+			batch->fraction[i] = batch->lanes[i]->trace.fraction;
+		}
+		return;
+	}
+
+	// lanes that don't cross keep their segments
+	cross = active & ~(front | back);
+	sides[0] = front;
+	sides[1] = back;
+	nearpk = farpk = *pk;
+
+	for (i=0 ; i<CM_TRACE_PACKET ; i++)
+	{
+		if (!(cross & (1 << i)))
+			continue;
+
+		// put the crosspoint DIST_EPSILON pixels on the near side
+		if (t1[i] < t2[i])
+		{
+			idist = 1.0/(t1[i]-t2[i]);
+			side = 1;
+			frac2 = (t1[i] + offset[i] + DIST_EPSILON)*idist;
+			frac = (t1[i] - offset[i] + DIST_EPSILON)*idist;
+		}
+		else if (t1[i] > t2[i])
+		{
+			idist = 1.0/(t1[i]-t2[i]);
+			side = 0;
+			frac2 = (t1[i] - offset[i] - DIST_EPSILON)*idist;
+			frac = (t1[i] + offset[i] + DIST_EPSILON)*idist;
+		}
+		else
+		{
+			side = 0;
+			frac = 1;
+			frac2 = 0;
+		}
+		sides[side] |= 1 << i;
+
+		for (j=0 ; j<3 ; j++)
+		{
+			p1[j] = pk->p1[j][i];
+			p2[j] = pk->p2[j][i];
+		}
+
+		// move up to the node
+		if (frac < 0)
+			frac = 0;
+		if (frac > 1)
+			frac = 1;
+
+		midf = pk->p1f[i] + (pk->p2f[i] - pk->p1f[i])*frac;
+		for (j=0 ; j<3 ; j++)
+			mid[j] = p1[j] + frac*(p2[j] - p1[j]);
+		CM_SetPacketLane (&nearpk, i, pk->p1f[i], midf, p1, mid);
+
+		// go past the node
+		if (frac2 < 0)
+			frac2 = 0;
+		if (frac2 > 1)
+			frac2 = 1;
+
+		midf = pk->p1f[i] + (pk->p2f[i] - pk->p1f[i])*frac2;
+		for (j=0 ; j<3 ; j++)
+			mid[j] = p1[j] + frac2*(p2[j] - p1[j]);
+		CM_SetPacketLane (&farpk, i, midf, pk->p2f[i], mid, p2);
+	}
+
+	// lanes that go down the same side first stay together, and each lane
+	// finishes its near side before it starts on its far side
+	for (side=0 ; side<2 ; side++)
+	{
+		if (!(sides[side] & cross))
+		{
+			if (sides[side])
+				CM_RecursiveHullCheckPacket (batch, node->children[side], pk, sides[side]);
+			continue;
+		}
+
+		CM_RecursiveHullCheckPacket (batch, node->children[side], &nearpk, sides[side]);
+		CM_RecursiveHullCheckPacket (batch, node->children[side^1], &farpk, sides[side] & cross);
+	}
+}
+
+/*
+==================
+CM_TracePacket
+
+Sweeps up to CM_TRACE_PACKET requests through the tree from headnode, on
+the lane contexts belonging to ctx
+==================
+*/
+static void CM_TracePacket (cmtrace_ctx_t *ctx, const trace_req_t *reqs, trace_t *out, const int *indexes, int count, int headnode)
+{
+	cmbatch_t		batch;
+	cmpacket_t		pk;
+	cmtrace_ctx_t	*lane;
+	const trace_req_t	*r;
+	int				i, j;
+
+	memset (&batch, 0, sizeof(batch));
+	memset (&pk, 0, sizeof(pk));
+
+	for (i=0 ; i<count ; i++)
+	{
+		r = &reqs[indexes[i]];
+		if (!ctx->lanes[i])
+			ctx->lanes[i] = CM_CreateTraceContext ();
+		lane = batch.lanes[i] = ctx->lanes[i];
+
+		CM_InitTrace (lane, (float *)r->start, (float *)r->end, (float *)r->mins, (float *)r->maxs, r->contentmask);
+		for (j=0 ; j<3 ; j++)
+			batch.extents[j][i] = lane->extents[j];
+		batch.fraction[i] = lane->trace.fraction;
+		CM_SetPacketLane (&pk, i, 0, 1, lane->start, lane->end);
+	}
+
+	CM_RecursiveHullCheckPacket (&batch, headnode, &pk, pk.active);
+
+	for (i=0 ; i<count ; i++)
+	{
+		lane = batch.lanes[i];
+		CM_FinishTrace (lane);
+		out[indexes[i]] = lane->trace;
+
+		ctx->numbrushtraces += lane->numbrushtraces;
+		lane->numbrushtraces = 0;
+	}
+}
+
+/*
+==================
+CM_BoxTraceBatchCtx
+
+Results are the same as calling CM_BoxTraceCtx for each request in turn,
+consecutive requests against the same headnode are traced together
+==================
+*/
+void CM_BoxTraceBatchCtx (cmtrace_ctx_t *ctx, const trace_req_t *reqs, trace_t *out, int n)
+{
+	const trace_req_t	*r;
+	int		indexes[CM_TRACE_PACKET];
+	int		i, count, headnode;
+
+	count = 0;
+	headnode = 0;
+
+	for (i=0 ; i<n ; i++)
+	{
+		r = &reqs[i];
+
+		// position tests don't sweep through the tree
+		if (!numnodes || VectorCompare ((float *)r->start, (float *)r->end))
+		{
+			out[i] = CM_BoxTraceCtx (ctx, (float *)r->start, (float *)r->end, (float *)r->mins, (float *)r->maxs, r->headnode, r->contentmask);
+			continue;
+		}
+
+		if (count && r->headnode != headnode)
+		{
+			CM_TracePacket (ctx, reqs, out, indexes, count, headnode);
+			count = 0;
+		}
+
+		headnode = r->headnode;
+		indexes[count++] = i;
+		if (count == CM_TRACE_PACKET)
+		{
+			CM_TracePacket (ctx, reqs, out, indexes, count, headnode);
+			count = 0;
+		}
+	}
+
+	if (count)
+		CM_TracePacket (ctx, reqs, out, indexes, count, headnode);
+}
+
+/*
+==================
+CM_BoxTraceBatch
+==================
+*/
+void CM_BoxTraceBatch (const trace_req_t *reqs, trace_t *out, int n)
+{
+	const trace_req_t	*r;
+	int		i;
+
+	c_traces += n;		// for statistics, may be zeroed
+
+	if (cm_tracerecord)
+	{
+		for (i=0, r=reqs ; i<n ; i++, r++)
+			CM_RecordTrace ((float *)r->start, (float *)r->end, (float *)r->mins, (float *)r->maxs, r->headnode, r->contentmask);
+	}
+
+	CM_BoxTraceBatchCtx (&cm_defaultctx, reqs, out, n);
+
+	c_brush_traces += cm_defaultctx.numbrushtraces;
+	cm_defaultctx.numbrushtraces = 0;
+}
+
+
+/*
+==================
+CM_TraceStress_f
+
+Fires a batch of random traces through the loaded map on one thread, then
+again split across several threads each with their own context, and
+checks that every result matches.
+==================
+*/
+typedef struct
+{
+	vec3_t		start, end;
+	vec3_t		mins, maxs;
+	vec3_t		origin;
+	qboolean	boxhull;		// against a box hull of mins/maxs, rather than the world
+} cmstresstrace_t;
+
+static void CM_StressTrace (cmtrace_ctx_t *ctx, cmstresstrace_t *t, trace_t *out)
+{
+	static vec3_t	zero = {0, 0, 0};
+	static vec3_t	boxmins = {-16, -16, -24}, boxmaxs = {16, 16, 32};
+	int				headnode;
+
+	if (t->boxhull)
+	{
+		headnode = CM_HeadnodeForBoxCtx (ctx, boxmins, boxmaxs);
+		*out = CM_TransformedBoxTraceCtx (ctx, t->start, t->end, t->mins, t->maxs, headnode, MASK_ALL, t->origin, zero);
+	}
+	else
+		*out = CM_BoxTraceCtx (ctx, t->start, t->end, t->mins, t->maxs, 0, MASK_ALL);
+}
+
+static qboolean CM_TracesMatch (trace_t *a, trace_t *b)
+{
+	return a->allsolid == b->allsolid && a->startsolid == b->startsolid
+		&& a->fraction == b->fraction && VectorCompare (a->endpos, b->endpos)
+		&& VectorCompare (a->plane.normal, b->plane.normal) && a->plane.dist == b->plane.dist
+		&& a->surface == b->surface && a->contents == b->contents;
+}
+
+static void CM_TraceStress_f (void)
+{
+	int				numthreads, numtraces;
+	int				i, j, mismatches;
+	unsigned int	seed;
+	cmstresstrace_t	*traces;
+	trace_t			*expected, *results;
+	cmtrace_ctx_t	*ctx;
+	vec3_t			size;
+	int				start, singletime, threadtime;
+
+	if (!numnodes)
+	{
+		Com_Printf ("No map loaded\n");
+		return;
+	}
+
+	numthreads = Cmd_Argc() > 1 ? atoi (Cmd_Argv (1)) : (int)std::thread::hardware_concurrency ();
+	numtraces = Cmd_Argc() > 2 ? atoi (Cmd_Argv (2)) : 1000000;
+	if (numthreads < 1)
+		numthreads = 1;
+	if (numtraces < 1)
+		numtraces = 1;
+
+	traces = static_cast<cmstresstrace_t *>( Z_Malloc (numtraces * sizeof(*traces)) );
+	expected = static_cast<trace_t *>( Z_Malloc (numtraces * sizeof(*expected)) );
+	results = static_cast<trace_t *>( Z_Malloc (numtraces * sizeof(*results)) );
+
+	// random segments within the world's bounds, with a mix of points, boxes,
+	// position tests and box hulls
+	seed = 0x5eed;
+	VectorSubtract (map_cmodels[0].maxs, map_cmodels[0].mins, size);
+	for (i=0 ; i<numtraces ; i++)
+	{
+		cmstresstrace_t *t = &traces[i];
+		for (j=0 ; j<3 ; j++)
+		{
+			seed = seed * 1103515245 + 12345;
+			t->start[j] = map_cmodels[0].mins[j] + size[j] * ((seed >> 8) & 0xffff) / 65535.0f;
+			seed = seed * 1103515245 + 12345;
+			t->end[j] = map_cmodels[0].mins[j] + size[j] * ((seed >> 8) & 0xffff) / 65535.0f;
+		}
+
+		seed = seed * 1103515245 + 12345;
+		switch ((seed >> 16) & 7)
+		{
+		case 0:
+			VectorCopy (t->start, t->end);
+			// fall through
+		case 1:
+		case 2:
+			VectorSet (t->mins, -16, -16, -24);
+			VectorSet (t->maxs, 16, 16, 32);
+			break;
+		case 3:
+			t->boxhull = true;
+			VectorCopy (t->start, t->origin);
+			t->origin[2] += 8;
+			break;
+		}
+	}
+
+	ctx = CM_CreateTraceContext ();
+	start = Sys_Milliseconds ();
+	for (i=0 ; i<numtraces ; i++)
+		CM_StressTrace (ctx, &traces[i], &expected[i]);
+	singletime = Sys_Milliseconds () - start;
+	CM_FreeTraceContext (ctx);
+
+	// each thread takes a contiguous run, so they don't share cache lines of results
+	std::vector<std::thread> threads;
+	start = Sys_Milliseconds ();
+	for (i=0 ; i<numthreads ; i++)
+	{
+		int first = (int)((long long)numtraces * i / numthreads);
+		int last = (int)((long long)numtraces * (i + 1) / numthreads);
+
+		threads.emplace_back ([=]() {
+			cmtrace_ctx_t *threadctx = CM_CreateTraceContext ();
+			for (int k=first ; k<last ; k++)
+				CM_StressTrace (threadctx, &traces[k], &results[k]);
+			CM_FreeTraceContext (threadctx);
+		});
+	}
+	for (std::thread &thread : threads)
+		thread.join ();
+	threadtime = Sys_Milliseconds () - start;
+
+	mismatches = 0;
+	for (i=0 ; i<numtraces ; i++)
+	{
+		if (CM_TracesMatch (&expected[i], &results[i]))
+			continue;
+		if (mismatches++ < 8)
+			Com_Printf ("trace %i: fraction %f on one thread, %f on several\n", i, expected[i].fraction, results[i].fraction);
+	}
+
+	Com_Printf ("%i traces: %i ms on 1 thread, %i ms on %i threads, %i mismatches\n",
+		numtraces, singletime, threadtime, numthreads, mismatches);
+
+	Z_Free (results);
+	Z_Free (expected);
+	Z_Free (traces);
+}
+
+/*
+==================
+CM_TraceRecord_f
+
+Writes every trace through CM_BoxTrace out to a file, for cm_tracebench
+to replay
+==================
+*/
+static void CM_RecordTrace (vec3_t start, vec3_t end, vec3_t mins, vec3_t maxs, int headnode, int brushmask)
+{
+	// box hulls are rebuilt for every entity, so they can't be replayed
+	if (headnode == box_headnode)
+		return;
+
+	fprintf (cm_tracerecord, "t %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %i %i\n",
+		start[0], start[1], start[2], end[0], end[1], end[2],
+		mins[0], mins[1], mins[2], maxs[0], maxs[1], maxs[2], headnode, brushmask);
+}
+
+static void CM_TraceRecord_f (void)
+{
+	char	name[MAX_OSPATH];
+
+	if (Cmd_Argc() != 2)
+	{
+		if (cm_tracerecord)
+		{
+			fclose (cm_tracerecord);
+			cm_tracerecord = NULL;
+			Com_Printf ("Stopped recording traces\n");
+			return;
+		}
+
+		Com_Printf ("usage: cm_tracerecord <filename>, again with no arguments to stop\n");
+		return;
+	}
+
+	if (!numnodes)
+	{
+		Com_Printf ("No map loaded\n");
+		return;
+	}
+
+	if (cm_tracerecord)
+		fclose (cm_tracerecord);
+
+	Com_sprintf (name, sizeof(name), "%s/%s", FS_Gamedir(), Cmd_Argv(1));
+	FS_CreatePath (name);
+	cm_tracerecord = fopen (name, "w");
+	if (!cm_tracerecord)
+	{
+		Com_Printf ("Failed to open %s\n", name);
+		return;
+	}
+
+	fprintf (cm_tracerecord, "m %s\n", map_name);
+	Com_Printf ("Recording traces to %s\n", name);
+}
+
+/*
+==================
+CM_TraceBench_f
+
+Replays traces from cm_tracerecord one at a time and then through
+CM_BoxTraceBatch, and checks the results match
+==================
+*/
+static void CM_TraceBench_f (void)
+{
+	char			name[MAX_OSPATH], line[512], recordedmap[MAX_QPATH];
+	FILE			*f;
+	trace_req_t		*reqs, *r;
+	trace_t			*expected, *results;
+	cmtrace_ctx_t	*ctx;
+	int				numreqs, maxreqs, repeats;
+	int				i, j, start, singletime, batchtime, mismatches;
+
+	if (Cmd_Argc() < 2)
+	{
+		Com_Printf ("usage: cm_tracebench <filename> [repeats]\n");
+		return;
+	}
+
+	if (cm_tracerecord)
+	{
+		Com_Printf ("Can't benchmark while recording\n");
+		return;
+	}
+
+	Com_sprintf (name, sizeof(name), "%s/%s", FS_Gamedir(), Cmd_Argv(1));
+	f = fopen (name, "r");
+	if (!f)
+	{
+		Com_Printf ("Failed to open %s\n", name);
+		return;
+	}
+
+	repeats = Cmd_Argc() > 2 ? atoi (Cmd_Argv(2)) : 10;
+	if (repeats < 1)
+		repeats = 1;
+
+	reqs = NULL;
+	numreqs = maxreqs = 0;
+	recordedmap[0] = 0;
+	while (fgets (line, sizeof(line), f))
+	{
+		if (line[0] == 'm')
+		{
+			sscanf (line + 2, "%63s", recordedmap);
+			continue;
+		}
+
+		if (numreqs == maxreqs)
+		{
+			maxreqs = maxreqs ? maxreqs * 2 : 1024;
+			reqs = static_cast<trace_req_t *>( realloc (reqs, maxreqs * sizeof(*reqs)) );
+		}
+
+		r = &reqs[numreqs];
+		memset (r, 0, sizeof(*r));
+		if (sscanf (line, "t %f %f %f %f %f %f %f %f %f %f %f %f %i %i",
+			&r->start[0], &r->start[1], &r->start[2], &r->end[0], &r->end[1], &r->end[2],
+			&r->mins[0], &r->mins[1], &r->mins[2], &r->maxs[0], &r->maxs[1], &r->maxs[2],
+			&r->headnode, &r->contentmask) != 14)
+			continue;
+		if (r->headnode < 0 || r->headnode >= numnodes)
+			continue;
+		numreqs++;
+	}
+	fclose (f);
+
+	if (strcmp (recordedmap, map_name))
+	{
+		Com_Printf ("%s was recorded on %s, not %s\n", name, recordedmap, map_name);
+		free (reqs);
+		return;
+	}
+	if (!numreqs)
+	{
+		Com_Printf ("No traces in %s\n", name);
+		free (reqs);
+		return;
+	}
+
+	expected = static_cast<trace_t *>( Z_Malloc (numreqs * sizeof(*expected)) );
+	results = static_cast<trace_t *>( Z_Malloc (numreqs * sizeof(*results)) );
+
+	ctx = CM_CreateTraceContext ();
+	start = Sys_Milliseconds ();
+	for (j=0 ; j<repeats ; j++)
+	{
+		for (i=0 ; i<numreqs ; i++)
+		{
+			r = &reqs[i];
+			expected[i] = CM_BoxTraceCtx (ctx, r->start, r->end, r->mins, r->maxs, r->headnode, r->contentmask);
+		}
+	}
+	singletime = Sys_Milliseconds () - start;
+	CM_FreeTraceContext (ctx);
+
+	start = Sys_Milliseconds ();
+	for (j=0 ; j<repeats ; j++)
+		CM_BoxTraceBatch (reqs, results, numreqs);
+	batchtime = Sys_Milliseconds () - start;
+
+	mismatches = 0;
+	for (i=0 ; i<numreqs ; i++)
+	{
+		if (CM_TracesMatch (&expected[i], &results[i]))
+			continue;
+		if (mismatches++ < 8)
+			Com_Printf ("trace %i: fraction %f one at a time, %f batched\n", i, expected[i].fraction, results[i].fraction);
+	}
+
+	Com_Printf ("%i traces x %i: %i ms one at a time, %i ms batched, %i mismatches\n",
+		numreqs, repeats, singletime, batchtime, mismatches);
+
+	Z_Free (results);
+	Z_Free (expected);
+	free (reqs);
+}
+
+/*
+==================
+CM_Init
+==================
+*/
+void CM_Init (void)
+{
+	// takes effect on the next map load
+	cm_vismatrix = Cvar_Get ("cm_vismatrix", "32", CVAR_ARCHIVE);
+
+	CMod_LoadEmpty ();
+
+	Cmd_AddCommand ("cm_tracestress", CM_TraceStress_f);
+	Cmd_AddCommand ("cm_tracerecord", CM_TraceRecord_f);
+	Cmd_AddCommand ("cm_tracebench", CM_TraceBench_f);
+}
+
+
+/*
+===============================================================================
+
+PVS / PHS
+
+===============================================================================
+*/
+
+/*
+===================
+CM_DecompressVis
+===================
+*/
+void CM_DecompressVis (byte *in, byte *out)
+{
+	int		c;
+	byte	*out_p;
+	int		row;
+
+	row = (numclusters+7)>>3;	
+	out_p = out;
+
+	if (!in || !numvisibility)
+	{	// no vis info, so make all visible
+		while (row)
+		{
 			*out_p++ = 0xff;
 			row--;
 		}
@@ -1567,25 +2675,169 @@ void CM_DecompressVis (byte *in, byte *out)
 	} while (out_p - out < row);
 }
 
-byte	pvsrow[MAX_MAP_LEAFS/8];
-byte	phsrow[MAX_MAP_LEAFS/8];
+/*
+The decompressed rows live for the whole map.  When both sets fit in
+cm_vismatrix megabytes every row is decompressed at load into one 64 byte
+aligned block, otherwise the most recently used rows of each set are kept.
+Rows are padded to a multiple of 64 bytes with zeros, so CM_OrVis can work
+a vector at a time without looking at numclusters.
+*/
+#define	VIS_CACHEROWS	64		// per set, when the matrix doesn't fit
+
+static byte		*vis_block;			// as returned by Z_Malloc
+static byte		*vis_rows;			// vis_block rounded up to 64 bytes
+static byte		*vis_zerorow;		// for cluster -1
+static int		vis_rowbytes;
+static qboolean	vis_matrix;			// every row of both sets is in vis_rows
+
+static short	*vis_slotfor[2];	// cluster -> cache slot, -1 if not cached
+static int		vis_slotcluster[2][VIS_CACHEROWS];
+static unsigned	vis_slotused[2][VIS_CACHEROWS];
+static unsigned	vis_usecount;
 
-byte	*CM_ClusterPVS (int cluster)
+/*
+===================
+CM_CompressedVis
+
+NULL when the map has no vis data for the cluster, which decompresses
+to everything visible
+===================
+*/
+static byte *CM_CompressedVis (int set, int cluster)
 {
-	if (cluster == -1)
-		memset (pvsrow, 0, (numclusters+7)>>3);
-	else
-		CM_DecompressVis (map_visibility + map_vis->bitofs[cluster][DVIS_PVS], pvsrow);
-	return pvsrow;
+	if (!numvisibility || cluster >= map_vis->numclusters)
+		return NULL;
+	return map_visibility + map_vis->bitofs[cluster][set];
 }
 
-byte	*CM_ClusterPHS (int cluster)
+/*
+===================
+CM_InitVisCache
+
+Called whenever numclusters or the vis lump change
+===================
+*/
+static void CM_InitVisCache (void)
 {
+	int		set, i, rows;
+	double	bytes;
+
+	if (vis_block)
+		Z_Free (vis_block);
+	for (set=0 ; set<2 ; set++)
+	{
+		if (vis_slotfor[set])
+			Z_Free (vis_slotfor[set]);
+		vis_slotfor[set] = NULL;
+	}
+
+	vis_rowbytes = ((numclusters + 511) >> 9) << 6;
+	bytes = 2.0 * numclusters * vis_rowbytes;
+	vis_matrix = (bytes <= cm_vismatrix->value * 1024 * 1024);
+	rows = vis_matrix ? numclusters * 2 : VIS_CACHEROWS * 2;
+
+	vis_block = static_cast<byte *>( Z_Malloc ((rows + 1) * vis_rowbytes + 63) );
+	vis_rows = (byte *)(((uintptr_t)vis_block + 63) & ~(uintptr_t)63);
+	memset (vis_rows, 0, (rows + 1) * vis_rowbytes);
+	vis_zerorow = vis_rows + rows * vis_rowbytes;
+
+	if (vis_matrix)
+	{
+		for (set=0 ; set<2 ; set++)
+			for (i=0 ; i<numclusters ; i++)
+				CM_DecompressVis (CM_CompressedVis (set, i), vis_rows + (set * numclusters + i) * vis_rowbytes);
+		Com_DPrintf ("%i clusters, %i KB of decompressed vis\n", numclusters, (int)(bytes / 1024));
+		return;
+	}
+
+	for (set=0 ; set<2 ; set++)
+	{
+		vis_slotfor[set] = static_cast<short *>( Z_Malloc (numclusters * sizeof(short)) );
+		for (i=0 ; i<numclusters ; i++)
+			vis_slotfor[set][i] = -1;
+		for (i=0 ; i<VIS_CACHEROWS ; i++)
+		{
+			vis_slotcluster[set][i] = -1;
+			vis_slotused[set][i] = 0;
+		}
+	}
+	vis_usecount = 0;
+	Com_DPrintf ("%i clusters, caching %i decompressed vis rows\n", numclusters, VIS_CACHEROWS);
+}
+
+/*
+===================
+CM_VisRow
+===================
+*/
+static const byte *CM_VisRow (int set, int cluster)
+{
+	int		i, slot;
+
 	if (cluster == -1)
-		memset (phsrow, 0, (numclusters+7)>>3);
-	else
-		CM_DecompressVis (map_visibility + map_vis->bitofs[cluster][DVIS_PHS], phsrow);
-	return phsrow;
+		return vis_zerorow;
+	if (vis_matrix)
+		return vis_rows + (set * numclusters + cluster) * vis_rowbytes;
+
+	slot = vis_slotfor[set][cluster];
+	if (slot == -1)
+	{	// take over the least recently used slot
+		slot = 0;
+		for (i=1 ; i<VIS_CACHEROWS ; i++)
+			if (vis_slotused[set][i] < vis_slotused[set][slot])
+				slot = i;
+		if (vis_slotcluster[set][slot] != -1)
+			vis_slotfor[set][vis_slotcluster[set][slot]] = -1;
+		vis_slotcluster[set][slot] = cluster;
+		vis_slotfor[set][cluster] = slot;
+		CM_DecompressVis (CM_CompressedVis (set, cluster), vis_rows + (set * VIS_CACHEROWS + slot) * vis_rowbytes);
+	}
+	vis_slotused[set][slot] = ++vis_usecount;
+
+	return vis_rows + (set * VIS_CACHEROWS + slot) * vis_rowbytes;
+}
+
+const byte *CM_ClusterPVS (int cluster)
+{
+	return CM_VisRow (DVIS_PVS, cluster);
+}
+
+const byte *CM_ClusterPHS (int cluster)
+{
+	return CM_VisRow (DVIS_PHS, cluster);
+}
+
+/*
+===================
+CM_VisRowBytes
+
+Length of the rows returned by CM_ClusterPVS and CM_ClusterPHS
+===================
+*/
+int CM_VisRowBytes (void)
+{
+	return vis_rowbytes;
+}
+
+/*
+===================
+CM_OrVis
+
+dst |= src for a whole row; dst must hold CM_VisRowBytes
+===================
+*/
+void CM_OrVis (byte *dst, const byte *src)
+{
+	int		i;
+
+#ifdef CM_TRACE_SSE
+	for (i=0 ; i<vis_rowbytes ; i+=16)
+		_mm_storeu_ps ((float *)(dst + i), _mm_or_ps (_mm_loadu_ps ((const float *)(dst + i)),
+			_mm_loadu_ps ((const float *)(src + i))));
+#else
+	for (i=0 ; i<vis_rowbytes ; i+=4)
+		*(unsigned *)(dst + i) |= *(const unsigned *)(src + i);
+#endif
 }
 
 
@@ -1743,7 +2995,7 @@ Returns true if any leaf under headnode has a cluster that
 is potentially visible
 =============
 */
-qboolean CM_HeadnodeVisible (int nodenum, byte *visbits)
+qboolean CM_HeadnodeVisible (int nodenum, const byte *visbits)
 {
 	int		leafnum;
 	int		cluster;
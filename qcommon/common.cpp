@@ -21,6 +21,13 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include <setjmp.h>
 #include "qcommon.h"
 
+#include <algorithm>
+#include <atomic>
+
+#if !defined( _WIN32 )
+#	include <dlfcn.h>
+#endif
+
 #define MAXPRINTMSG 4096
 
 #define MAX_NUM_ARGVS 50
@@ -555,13 +562,309 @@ void MSG_WriteDeltaEntity( entity_state_t *from, entity_state_t *to,
 	if( bits & U_SOLID ) MSG_WriteShort( msg, to->solid );
 }
 
+/*
+==============================================================================
+
+BIT PACKED ENTITIES
+
+svc_bitentities carries the same updates as svc_packetentities, packed
+least significant bit first.  Every field decodes to exactly what the
+byte protocol would have given the client, so the two can be mixed
+freely from one frame to the next:
+
+  origins and old_origin are 1/8 unit deltas, from the previous
+  origin and the new one respectively
+  frames going up by one cost a single bit
+  angles, modelindexes, solid and sound use small static tables of
+  their common values, with an escape to the raw byte or short
+  everything else picks the narrowest of the byte protocol's widths
+
+Each entity is a continue bit, the gap from the last entity number,
+a remove bit, then the common field bits and, behind one more bit,
+the rare ones.
+==============================================================================
+*/
+
+// the listed values are sent as an index, anything else goes out raw
+// after an escape bit
+typedef struct {
+	int numvalues;
+	int indexbits;
+	int rawbits;
+	int values[ 4 ];
+} msgtable_t;
+
+static const msgtable_t msg_flatangles = { 1, 0, 8, { 0 } };  // pitch and roll
+static const msgtable_t msg_yawangles = { 4, 2, 8, { 0, 64, 128, 192 } };
+static const msgtable_t msg_modelindexes = { 2, 1, 8, { 0, 255 } };  // 255 is the player's skin model
+static const msgtable_t msg_solids = { 2, 1, 16, { 0, 31 } };  // 31 is a bmodel
+static const msgtable_t msg_sounds = { 1, 0, 8, { 0 } };
+
+static const msgtable_t *const msg_angletables[ 3 ] = {
+	&msg_flatangles, &msg_yawangles, &msg_flatangles
+};
+
+// widths picked by a two bit selector
+static const int msg_numberwidths[ 4 ] = { 0, 3, 6, 10 };  // gap between entity numbers
+static const int msg_coordwidths[ 4 ] = { 4, 8, 11, 16 };   // zigzagged 1/8 unit deltas
+
+// field bits, in the order they're sent
+#define UB_ORIGIN1 ( 1 << 0 )
+#define UB_ORIGIN2 ( 1 << 1 )
+#define UB_ORIGIN3 ( 1 << 2 )
+#define UB_ANGLE1 ( 1 << 3 )
+#define UB_ANGLE2 ( 1 << 4 )
+#define UB_ANGLE3 ( 1 << 5 )
+#define UB_FRAME ( 1 << 6 )
+#define UB_EVENT ( 1 << 7 )
+#define UB_MORE ( 1 << 8 )  // any of the below
+#define UB_MODEL ( 1 << 9 )
+#define UB_MODEL2 ( 1 << 10 )
+#define UB_MODEL3 ( 1 << 11 )
+#define UB_MODEL4 ( 1 << 12 )
+#define UB_SKIN ( 1 << 13 )
+#define UB_EFFECTS ( 1 << 14 )
+#define UB_RENDERFX ( 1 << 15 )
+#define UB_SOLID ( 1 << 16 )
+#define UB_SOUND ( 1 << 17 )
+#define UB_OLDORIGIN ( 1 << 18 )
+
+#define UB_COMMONBITS 9
+#define UB_RAREBITS 10
+
+// the U_ bit each UB_ bit reads back as
+static const unsigned msg_ubits[ UB_COMMONBITS + UB_RAREBITS ] = {
+	U_ORIGIN1, U_ORIGIN2, U_ORIGIN3, U_ANGLE1, U_ANGLE2, U_ANGLE3,
+	U_FRAME8, U_EVENT, 0,
+	U_MODEL, U_MODEL2, U_MODEL3, U_MODEL4, U_SKIN8, U_EFFECTS8,
+	U_RENDERFX8, U_SOLID, U_SOUND, U_OLDORIGIN
+};
+
+void MSG_WriteBits( sizebuf_t *sb, unsigned value, int bits ) {
+	int take;
+
+	if( bits < 32 ) value &= ( 1u << bits ) - 1;
+
+	while( bits > 0 ) {
+		if( !sb->bitpos ) *static_cast<byte *>( SZ_GetSpace( sb, 1 ) ) = 0;
+
+		take = 8 - sb->bitpos;
+		if( take > bits ) take = bits;
+
+		sb->data[ sb->cursize - 1 ] |= ( value << sb->bitpos ) & 255;
+		value >>= take;
+		bits -= take;
+		sb->bitpos = ( sb->bitpos + take ) & 7;
+	}
+}
+
+static void MSG_WriteTableBits( sizebuf_t *sb, int value, const msgtable_t *table ) {
+	int i;
+
+	for( i = 0; i < table->numvalues; i++ ) {
+		if( table->values[ i ] == value ) {
+			MSG_WriteBits( sb, 0, 1 );
+			MSG_WriteBits( sb, i, table->indexbits );
+			return;
+		}
+	}
+
+	MSG_WriteBits( sb, 1, 1 );
+	MSG_WriteBits( sb, value, table->rawbits );
+}
+
+static void MSG_WriteVarBits( sizebuf_t *sb, unsigned value, const int widths[ 4 ] ) {
+	int i;
+
+	for( i = 0; i < 3 && value >= ( 1u << widths[ i ] ); i++ )
+		;
+	MSG_WriteBits( sb, i, 2 );
+	MSG_WriteBits( sb, value, widths[ i ] );
+}
+
+// wraps like the short it replaces
+static void MSG_WriteCoordDelta( sizebuf_t *sb, int from, int to ) {
+	int delta = (short)( to - from );
+
+	MSG_WriteVarBits( sb, ( (unsigned)delta << 1 ) ^ (unsigned)( delta >> 31 ), msg_coordwidths );
+}
+
+// one of the byte protocol's byte / short / long widths
+static void MSG_WriteWidthBits( sizebuf_t *sb, int value, int width ) {
+	MSG_WriteBits( sb, width, 2 );
+	MSG_WriteBits( sb, value, 8 << width );
+}
+
+// what MSG_WriteCoord sends
+static int MSG_CoordBits( float f ) {
+	return (short)(int)( f * 8 );
+}
+
+// what MSG_WriteAngle sends
+static int MSG_AngleBits( float f ) {
+	return (int)( f * 256 / 360 ) & 255;
+}
+
+// the continue bit and the gap from the last entity number
+static void MSG_WriteEntityNumberBits( sizebuf_t *msg, int number, int *lastnum ) {
+	if( number <= *lastnum ) Com_Error( ERR_FATAL, "Entity %i out of order", number );
+
+	MSG_WriteBits( msg, 1, 1 );
+	MSG_WriteVarBits( msg, number - *lastnum - 1, msg_numberwidths );
+	*lastnum = number;
+}
+
+/*
+==================
+MSG_WriteRemoveEntityBits
+
+The svc_bitentities equivalent of a U_REMOVE update.  lastnum is the
+previous entity number in the message, 0 to start with.
+==================
+*/
+void MSG_WriteRemoveEntityBits( sizebuf_t *msg, int number, int *lastnum ) {
+	MSG_WriteEntityNumberBits( msg, number, lastnum );
+	MSG_WriteBits( msg, 1, 1 );
+}
+
+/*
+==================
+MSG_WriteDeltaEntityBits
+
+MSG_WriteDeltaEntity for svc_bitentities.
+==================
+*/
+void MSG_WriteDeltaEntityBits( entity_state_t *from, entity_state_t *to,
+	sizebuf_t *msg, qboolean force, qboolean newentity, int *lastnum ) {
+	int bits, i;
+	int origin[ 3 ], oldorigin[ 3 ], angles[ 3 ];
+
+	if( !to->number ) Com_Error( ERR_FATAL, "Unset entity number" );
+	if( to->number >= MAX_EDICTS )
+		Com_Error( ERR_FATAL, "Entity number >= MAX_EDICTS" );
+
+	// compare what the client would see, not the server's full precision
+	bits = 0;
+	for( i = 0; i < 3; i++ ) {
+		origin[ i ] = MSG_CoordBits( to->origin[ i ] );
+		if( origin[ i ] != MSG_CoordBits( from->origin[ i ] ) ) bits |= UB_ORIGIN1 << i;
+
+		angles[ i ] = MSG_AngleBits( to->angles[ i ] );
+		if( angles[ i ] != MSG_AngleBits( from->angles[ i ] ) ) bits |= UB_ANGLE1 << i;
+	}
+
+	if( to->frame != from->frame ) bits |= UB_FRAME;
+
+	// event is not delta compressed, just 0 compressed
+	if( to->event ) bits |= UB_EVENT;
+
+	if( to->modelindex != from->modelindex ) bits |= UB_MODEL;
+	if( to->modelindex2 != from->modelindex2 ) bits |= UB_MODEL2;
+	if( to->modelindex3 != from->modelindex3 ) bits |= UB_MODEL3;
+	if( to->modelindex4 != from->modelindex4 ) bits |= UB_MODEL4;
+	if( to->skinnum != from->skinnum ) bits |= UB_SKIN;
+	if( to->effects != from->effects ) bits |= UB_EFFECTS;
+	if( to->renderfx != from->renderfx ) bits |= UB_RENDERFX;
+	if( to->solid != from->solid ) bits |= UB_SOLID;
+	if( to->sound != from->sound ) bits |= UB_SOUND;
+
+	if( newentity || ( to->renderfx & RF_BEAM ) ) bits |= UB_OLDORIGIN;
+
+	if( !bits && !force ) return;  // nothing to send!
+
+	if( bits & ~( UB_MORE - 1 ) ) bits |= UB_MORE;
+
+	MSG_WriteEntityNumberBits( msg, to->number, lastnum );
+	MSG_WriteBits( msg, 0, 1 );  // not removed
+	MSG_WriteBits( msg, bits, UB_COMMONBITS );
+	if( bits & UB_MORE ) MSG_WriteBits( msg, bits >> UB_COMMONBITS, UB_RAREBITS );
+
+	for( i = 0; i < 3; i++ )
+		if( bits & ( UB_ORIGIN1 << i ) ) MSG_WriteCoordDelta( msg, MSG_CoordBits( from->origin[ i ] ), origin[ i ] );
+
+	for( i = 0; i < 3; i++ )
+		if( bits & ( UB_ANGLE1 << i ) ) MSG_WriteTableBits( msg, angles[ i ], msg_angletables[ i ] );
+
+	if( bits & UB_FRAME ) {
+		// the client only sees frames as a byte or a short
+		if( from->frame >= 0 && to->frame == from->frame + 1 && to->frame < 0x8000 )
+			MSG_WriteBits( msg, 0, 1 );
+		else {
+			MSG_WriteBits( msg, 1, 1 );
+			MSG_WriteBits( msg, to->frame < 256 ? 0 : 1, 1 );
+			MSG_WriteBits( msg, to->frame, to->frame < 256 ? 8 : 16 );
+		}
+	}
+
+	if( bits & UB_EVENT ) MSG_WriteBits( msg, to->event, 8 );
+
+	if( !( bits & UB_MORE ) ) return;
+
+	if( bits & UB_MODEL ) MSG_WriteTableBits( msg, to->modelindex & 255, &msg_modelindexes );
+	if( bits & UB_MODEL2 ) MSG_WriteTableBits( msg, to->modelindex2 & 255, &msg_modelindexes );
+	if( bits & UB_MODEL3 ) MSG_WriteTableBits( msg, to->modelindex3 & 255, &msg_modelindexes );
+	if( bits & UB_MODEL4 ) MSG_WriteTableBits( msg, to->modelindex4 & 255, &msg_modelindexes );
+
+	if( bits & UB_SKIN ) {
+		if( (unsigned)to->skinnum < 256 )
+			MSG_WriteWidthBits( msg, to->skinnum, 0 );
+		else if( (unsigned)to->skinnum < 0x10000 )
+			MSG_WriteWidthBits( msg, to->skinnum, 1 );
+		else
+			MSG_WriteWidthBits( msg, to->skinnum, 2 );
+	}
+
+	if( bits & UB_EFFECTS ) {
+		if( to->effects < 256 )
+			MSG_WriteWidthBits( msg, to->effects, 0 );
+		else if( to->effects < 0x8000 )
+			MSG_WriteWidthBits( msg, to->effects, 1 );
+		else
+			MSG_WriteWidthBits( msg, to->effects, 2 );
+	}
+
+	if( bits & UB_RENDERFX ) {
+		if( to->renderfx < 256 )
+			MSG_WriteWidthBits( msg, to->renderfx, 0 );
+		else if( to->renderfx < 0x8000 )
+			MSG_WriteWidthBits( msg, to->renderfx, 1 );
+		else
+			MSG_WriteWidthBits( msg, to->renderfx, 2 );
+	}
+
+	if( bits & UB_SOLID ) MSG_WriteTableBits( msg, (short)to->solid, &msg_solids );
+	if( bits & UB_SOUND ) MSG_WriteTableBits( msg, to->sound & 255, &msg_sounds );
+
+	if( bits & UB_OLDORIGIN ) {
+		for( i = 0; i < 3; i++ ) {
+			oldorigin[ i ] = MSG_CoordBits( to->old_origin[ i ] );
+			MSG_WriteCoordDelta( msg, origin[ i ], oldorigin[ i ] );
+		}
+	}
+}
+
+/*
+==================
+MSG_WriteEntityBitsEnd
+
+Ends the svc_bitentities list and goes back to whole bytes.
+==================
+*/
+void MSG_WriteEntityBitsEnd( sizebuf_t *msg ) {
+	MSG_WriteBits( msg, 0, 1 );
+	MSG_EndBits( msg );
+}
+
 //============================================================
 
 //
 // reading functions
 //
 
-void MSG_BeginReading( sizebuf_t *msg ) { msg->readcount = 0; }
+void MSG_BeginReading( sizebuf_t *msg ) {
+	msg->readcount = 0;
+	msg->bitpos = 0;
+}
 
 // returns -1 if no more characters are available
 int MSG_ReadChar( sizebuf_t *msg_read ) {
@@ -730,6 +1033,151 @@ void MSG_ReadData( sizebuf_t *msg_read, void *data, int len ) {
 	for( i = 0; i < len; i++ ) ( (byte *)data )[ i ] = MSG_ReadByte( msg_read );
 }
 
+// past the end of the message this returns zeros and leaves readcount
+// beyond cursize, as MSG_ReadByte does
+unsigned MSG_ReadBits( sizebuf_t *msg_read, int bits ) {
+	unsigned value;
+	int got, take;
+
+	value = 0;
+	for( got = 0; got < bits; got += take ) {
+		if( !msg_read->bitpos ) {
+			if( msg_read->readcount >= msg_read->cursize ) {
+				msg_read->readcount = msg_read->cursize + 1;
+				break;
+			}
+			msg_read->readcount++;
+		}
+
+		take = 8 - msg_read->bitpos;
+		if( take > bits - got ) take = bits - got;
+
+		value |= ( ( msg_read->data[ msg_read->readcount - 1 ] >> msg_read->bitpos ) & ( ( 1u << take ) - 1 ) ) << got;
+		msg_read->bitpos = ( msg_read->bitpos + take ) & 7;
+	}
+
+	return value;
+}
+
+static int MSG_ReadTableBits( sizebuf_t *msg_read, const msgtable_t *table ) {
+	int i;
+
+	if( MSG_ReadBits( msg_read, 1 ) ) return MSG_ReadBits( msg_read, table->rawbits );
+
+	i = MSG_ReadBits( msg_read, table->indexbits );
+	if( i >= table->numvalues ) return 0;  // only a corrupt message gets here
+	return table->values[ i ];
+}
+
+static unsigned MSG_ReadVarBits( sizebuf_t *msg_read, const int widths[ 4 ] ) {
+	return MSG_ReadBits( msg_read, widths[ MSG_ReadBits( msg_read, 2 ) ] );
+}
+
+static int MSG_ReadCoordDelta( sizebuf_t *msg_read, float from ) {
+	unsigned zigzag = MSG_ReadVarBits( msg_read, msg_coordwidths );
+
+	return (short)( MSG_CoordBits( from ) + (int)( ( zigzag >> 1 ) ^ ( 0u - ( zigzag & 1 ) ) ) );
+}
+
+// reads back a byte, a short or a long just as the byte protocol would
+static int MSG_ReadWidthBits( sizebuf_t *msg_read ) {
+	switch( MSG_ReadBits( msg_read, 2 ) ) {
+	case 0:
+		return MSG_ReadBits( msg_read, 8 );
+	case 1:
+		return (short)MSG_ReadBits( msg_read, 16 );
+	default:
+		return (int)MSG_ReadBits( msg_read, 32 );
+	}
+}
+
+/*
+==================
+MSG_ReadEntityBits
+
+Reads the header of an svc_bitentities update, translating the field
+bits into their U_ equivalents.  Returns 0 at the end of the list.
+==================
+*/
+int MSG_ReadEntityBits( sizebuf_t *msg_read, int *lastnum, unsigned *bits ) {
+	unsigned ubits;
+	int i;
+
+	*bits = 0;
+	if( !MSG_ReadBits( msg_read, 1 ) ) {
+		MSG_EndBits( msg_read );
+		return 0;
+	}
+
+	*lastnum += MSG_ReadVarBits( msg_read, msg_numberwidths ) + 1;
+
+	if( MSG_ReadBits( msg_read, 1 ) ) {
+		*bits = U_REMOVE;
+		return *lastnum;
+	}
+
+	ubits = MSG_ReadBits( msg_read, UB_COMMONBITS );
+	if( ubits & UB_MORE ) ubits |= MSG_ReadBits( msg_read, UB_RAREBITS ) << UB_COMMONBITS;
+
+	for( i = 0; i < UB_COMMONBITS + UB_RAREBITS; i++ )
+		if( ubits & ( 1 << i ) ) *bits |= msg_ubits[ i ];
+
+	return *lastnum;
+}
+
+/*
+==================
+MSG_ReadDeltaEntityBits
+
+Reads the fields of an svc_bitentities update into to, which should
+already hold the state being delta'd from.
+==================
+*/
+void MSG_ReadDeltaEntityBits( sizebuf_t *msg_read, entity_state_t *to, unsigned bits ) {
+	int i;
+
+	if( bits & U_ORIGIN1 ) to->origin[ 0 ] = MSG_ReadCoordDelta( msg_read, to->origin[ 0 ] ) * ( 1.0 / 8 );
+	if( bits & U_ORIGIN2 ) to->origin[ 1 ] = MSG_ReadCoordDelta( msg_read, to->origin[ 1 ] ) * ( 1.0 / 8 );
+	if( bits & U_ORIGIN3 ) to->origin[ 2 ] = MSG_ReadCoordDelta( msg_read, to->origin[ 2 ] ) * ( 1.0 / 8 );
+
+	if( bits & U_ANGLE1 ) to->angles[ 0 ] = (signed char)MSG_ReadTableBits( msg_read, msg_angletables[ 0 ] ) * ( 360.0 / 256 );
+	if( bits & U_ANGLE2 ) to->angles[ 1 ] = (signed char)MSG_ReadTableBits( msg_read, msg_angletables[ 1 ] ) * ( 360.0 / 256 );
+	if( bits & U_ANGLE3 ) to->angles[ 2 ] = (signed char)MSG_ReadTableBits( msg_read, msg_angletables[ 2 ] ) * ( 360.0 / 256 );
+
+	if( bits & U_FRAME8 ) {
+		if( !MSG_ReadBits( msg_read, 1 ) )
+			to->frame++;
+		else if( !MSG_ReadBits( msg_read, 1 ) )
+			to->frame = MSG_ReadBits( msg_read, 8 );
+		else
+			to->frame = (short)MSG_ReadBits( msg_read, 16 );
+	}
+
+	if( bits & U_EVENT )
+		to->event = MSG_ReadBits( msg_read, 8 );
+	else
+		to->event = 0;
+
+	if( bits & U_MODEL ) to->modelindex = MSG_ReadTableBits( msg_read, &msg_modelindexes );
+	if( bits & U_MODEL2 ) to->modelindex2 = MSG_ReadTableBits( msg_read, &msg_modelindexes );
+	if( bits & U_MODEL3 ) to->modelindex3 = MSG_ReadTableBits( msg_read, &msg_modelindexes );
+	if( bits & U_MODEL4 ) to->modelindex4 = MSG_ReadTableBits( msg_read, &msg_modelindexes );
+
+	if( bits & U_SKIN8 ) to->skinnum = MSG_ReadWidthBits( msg_read );
+	if( bits & U_EFFECTS8 ) to->effects = MSG_ReadWidthBits( msg_read );
+	if( bits & U_RENDERFX8 ) to->renderfx = MSG_ReadWidthBits( msg_read );
+
+	if( bits & U_SOLID ) to->solid = (short)MSG_ReadTableBits( msg_read, &msg_solids );
+	if( bits & U_SOUND ) to->sound = MSG_ReadTableBits( msg_read, &msg_sounds );
+
+	if( bits & U_OLDORIGIN ) {
+		for( i = 0; i < 3; i++ )
+			to->old_origin[ i ] = MSG_ReadCoordDelta( msg_read, to->origin[ i ] ) * ( 1.0 / 8 );
+	}
+}
+
+void MSG_EndBits( sizebuf_t *sb ) { sb->bitpos = 0; }
+
 //===========================================================================
 
 void SZ_Init( sizebuf_t *buf, byte *data, size_t length ) {
@@ -741,6 +1189,7 @@ void SZ_Init( sizebuf_t *buf, byte *data, size_t length ) {
 void SZ_Clear( sizebuf_t *buf ) {
 	buf->cursize = 0;
 	buf->overflowed = false;
+	buf->bitpos = 0;
 }
 
 void *SZ_GetSpace( sizebuf_t *buf, size_t length ) {
@@ -900,23 +1349,112 @@ void Info_Print( char *s ) {
 
 												ZONE MEMORY ALLOCATION
 
-just cleared malloc with counters now...
+Every tag owns its own set of arenas. Small blocks are carved out of the
+current arena by size class and recycled through per-class free lists,
+while anything larger goes straight to the system allocator and is chained
+onto its tag. Freeing a tag releases its arenas wholesale, so Z_FreeTags
+only has to walk the large blocks.
 
 ==============================================================================
 */
 
-#define Z_MAGIC 0x1d1d
+#define Z_MAGIC			0x1d1d
+#define Z_MAGIC_SMALL	0x1d1e
+#define Z_MAGIC_FREE	0x1dfe
+
+#define Z_MAX_TAGS		64
+#define Z_ARENA_SIZE	( 64 * 1024 )
 
 typedef struct zhead_s {
-	struct zhead_s *prev, *next;
+	struct zhead_s *prev, *next;	// tag chain for large blocks, free list for small ones
 	short magic;
 	short tag;  // for group free
-	int size;
+	int size;	// including the header, always the class size for small blocks
 } zhead_t;
 
-zhead_t z_chain;
+/* block sizes including the header, each a multiple of 16 so blocks stay aligned */
+static const int z_classSizes[] = { 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024 };
+#define Z_NUM_CLASSES	( sizeof( z_classSizes ) / sizeof( z_classSizes[ 0 ] ) )
+#define Z_MAX_SMALL		1024
+
+typedef struct zarena_s {
+	struct zarena_s *next;
+	int used;
+} zarena_t;
+
+#define Z_ARENA_HEADER	( ( sizeof( zarena_t ) + 15 ) & ~15 )
+
+typedef struct ztag_s {
+	int tag;
+	zhead_t chain;					// large blocks
+	zarena_t *arenas;				// the first is the one being carved
+	zhead_t *free[ Z_NUM_CLASSES ];
+
+	int count, bytes;
+	int numLarge, numArenas;
+	int classCount[ Z_NUM_CLASSES ];
+	int classFree[ Z_NUM_CLASSES ];
+} ztag_t;
+
+static ztag_t z_tags[ Z_MAX_TAGS ];
+static int z_numTags;
+static ztag_t *z_lastTag;
+static unsigned char z_sizeToClass[ Z_MAX_SMALL / 16 + 1 ];
+
 int z_count, z_bytes;
 
+static FILE *z_record;
+
+/*
+========================
+Z_GetTag
+
+Tags are few and allocations tend to come in runs of one tag, so a
+linear search behind a one entry cache is plenty.
+========================
+*/
+static ztag_t *Z_GetTag( int tag ) {
+	if( z_lastTag != NULL && z_lastTag->tag == tag ) {
+		return z_lastTag;
+	}
+
+	for( int i = 0; i < z_numTags; ++i ) {
+		if( z_tags[ i ].tag == tag ) {
+			return ( z_lastTag = &z_tags[ i ] );
+		}
+	}
+
+	if( z_numTags == Z_MAX_TAGS ) {
+		Com_Error( ERR_FATAL, "Z_GetTag: too many tags" );
+	}
+
+	/* first use of the zone, build the size class lookup */
+	if( z_numTags == 0 ) {
+		unsigned int c = 0;
+		for( int i = 0; i <= Z_MAX_SMALL / 16; ++i ) {
+			while( z_classSizes[ c ] < i * 16 ) {
+				c++;
+			}
+			z_sizeToClass[ i ] = c;
+		}
+	}
+
+	ztag_t *t = &z_tags[ z_numTags++ ];
+	memset( t, 0, sizeof( *t ) );
+	t->tag = tag;
+	t->chain.next = t->chain.prev = &t->chain;
+	return ( z_lastTag = t );
+}
+
+/*
+========================
+Z_FindClass
+========================
+*/
+static inline int Z_FindClass( int size ) {
+	return z_sizeToClass[ ( size + 15 ) >> 4 ];
+}
+
 /*
 ========================
 Z_Free
@@ -927,72 +1465,699 @@ void Z_Free( void *ptr ) {
 
 	z = ( (zhead_t *)ptr ) - 1;
 
-	if( z->magic != Z_MAGIC ) Com_Error( ERR_FATAL, "Z_Free: bad magic" );
+	if( z->magic != Z_MAGIC && z->magic != Z_MAGIC_SMALL ) Com_Error( ERR_FATAL, "Z_Free: bad magic" );
 
-	z->prev->next = z->next;
-	z->next->prev = z->prev;
+	if( z_record ) fprintf( z_record, "f %p\n", ptr );
+	if( mem_tracing ) Mem_Trace( MEM_TRACE_Z_FREE, MEM_TRACE_SITE, z->size - sizeof( zhead_t ), z->tag );
 
+	ztag_t *t = Z_GetTag( z->tag );
+	t->count--;
+	t->bytes -= z->size;
 	z_count--;
 	z_bytes -= z->size;
+
+	if( z->magic == Z_MAGIC_SMALL ) {
+		int c = Z_FindClass( z->size );
+		z->magic = Z_MAGIC_FREE;
+		z->next = t->free[ c ];
+		t->free[ c ] = z;
+		t->classCount[ c ]--;
+		t->classFree[ c ]++;
+		return;
+	}
+
+	z->prev->next = z->next;
+	z->next->prev = z->prev;
+	t->numLarge--;
+
 	free( z );
 }
 
 /*
 ========================
-Z_Stats_f
+Z_FreeTags
 ========================
 */
-void Z_Stats_f( void ) {
-	Com_Printf( "%i bytes in %i blocks\n", z_bytes, z_count );
+void Z_FreeTags( int tag ) {
+	if( z_record ) fprintf( z_record, "t %i\n", tag );
+
+	ztag_t *t = Z_GetTag( tag );
+
+	zhead_t *z, *next;
+	for( z = t->chain.next; z != &t->chain; z = next ) {
+		next = z->next;
+		free( z );
+	}
+
+	zarena_t *arena, *nextArena;
+	for( arena = t->arenas; arena != NULL; arena = nextArena ) {
+		nextArena = arena->next;
+		free( arena );
+	}
+
+	z_count -= t->count;
+	z_bytes -= t->bytes;
+
+	memset( t->free, 0, sizeof( t->free ) );
+	memset( t->classCount, 0, sizeof( t->classCount ) );
+	memset( t->classFree, 0, sizeof( t->classFree ) );
+	t->chain.next = t->chain.prev = &t->chain;
+	t->arenas = NULL;
+	t->count = t->bytes = 0;
+	t->numLarge = t->numArenas = 0;
 }
 
 /*
 ========================
-Z_FreeTags
+Z_AllocSmall
 ========================
 */
-void Z_FreeTags( int tag ) {
-	zhead_t *z, *next;
+static zhead_t *Z_AllocSmall( ztag_t *t, int c ) {
+	zhead_t *z = t->free[ c ];
+	if( z != NULL ) {
+		t->free[ c ] = z->next;
+		t->classFree[ c ]--;
+		memset( z, 0, z_classSizes[ c ] );
+		return z;
+	}
 
-	for( z = z_chain.next; z != &z_chain; z = next ) {
-		next = z->next;
-		if( z->tag == tag ) Z_Free( (void *)( z + 1 ) );
+	zarena_t *arena = t->arenas;
+	if( arena == NULL || arena->used + z_classSizes[ c ] > Z_ARENA_SIZE ) {
+		/* hand the tail of the old arena out to the smaller classes, rather than waste it */
+		if( arena != NULL ) {
+			for( int i = c - 1; i >= 0; --i ) {
+				while( arena->used + z_classSizes[ i ] <= Z_ARENA_SIZE ) {
+					zhead_t *tail = (zhead_t *)( (byte *)arena + arena->used );
+					arena->used += z_classSizes[ i ];
+					tail->magic = Z_MAGIC_FREE;
+					tail->next = t->free[ i ];
+					t->free[ i ] = tail;
+					t->classFree[ i ]++;
+				}
+			}
+		}
+
+		arena = static_cast<zarena_t *>( malloc( Z_ARENA_SIZE ) );
+		if( !arena )
+			Com_Error( ERR_FATAL, "Z_Malloc: failed on allocation of a %i byte arena", Z_ARENA_SIZE );
+		arena->next = t->arenas;
+		arena->used = Z_ARENA_HEADER;
+		t->arenas = arena;
+		t->numArenas++;
 	}
+
+	z = (zhead_t *)( (byte *)arena + arena->used );
+	arena->used += z_classSizes[ c ];
+	memset( z, 0, z_classSizes[ c ] );
+	return z;
 }
 
 /*
 ========================
-Z_TagMalloc
+Z_TagMallocSite
 ========================
 */
-void *Z_TagMalloc( int size, int tag ) {
+static void *Z_TagMallocSite( int size, int tag, const void *site ) {
 	zhead_t *z;
+	ztag_t *t = Z_GetTag( tag );
 
+	int requested = size;
 	size = size + sizeof( zhead_t );
-	z = static_cast<zhead_t *>( malloc( size ) );
-	if( !z )
-		Com_Error( ERR_FATAL, "Z_Malloc: failed on allocation of %i bytes", size );
-	memset( z, 0, size );
+	if( size <= Z_MAX_SMALL ) {
+		int c = Z_FindClass( size );
+		z = Z_AllocSmall( t, c );
+		z->magic = Z_MAGIC_SMALL;
+		size = z_classSizes[ c ];
+		t->classCount[ c ]++;
+	} else {
+		z = static_cast<zhead_t *>( calloc( 1, size ) );
+		if( !z )
+			Com_Error( ERR_FATAL, "Z_Malloc: failed on allocation of %i bytes", size );
+		z->magic = Z_MAGIC;
+
+		z->next = t->chain.next;
+		z->prev = &t->chain;
+		t->chain.next->prev = z;
+		t->chain.next = z;
+		t->numLarge++;
+	}
+
 	z_count++;
 	z_bytes += size;
-	z->magic = Z_MAGIC;
+	t->count++;
+	t->bytes += size;
 	z->tag = tag;
 	z->size = size;
 
-	z->next = z_chain.next;
-	z->prev = &z_chain;
-	z_chain.next->prev = z;
-	z_chain.next = z;
+	if( z_record ) fprintf( z_record, "a %p %i %i\n", (void *)( z + 1 ), requested, tag );
+	if( mem_tracing ) Mem_Trace( MEM_TRACE_Z_ALLOC, site, requested, tag );
 
 	return (void *)( z + 1 );
 }
 
+/*
+========================
+Z_TagMalloc
+========================
+*/
+void *Z_TagMalloc( int size, int tag ) { return Z_TagMallocSite( size, tag, MEM_TRACE_SITE ); }
+
 /*
 ========================
 Z_Malloc
 ========================
 */
-void *Z_Malloc( int size ) { return Z_TagMalloc( size, 0 ); }
+void *Z_Malloc( int size ) { return Z_TagMallocSite( size, 0, MEM_TRACE_SITE ); }
+
+/*
+========================
+Z_Stats_f
+========================
+*/
+void Z_Stats_f( void ) {
+	Com_Printf( "%i bytes in %i blocks\n", z_bytes, z_count );
+
+	int classCount[ Z_NUM_CLASSES ] = {}, classFree[ Z_NUM_CLASSES ] = {};
+	for( int i = 0; i < z_numTags; ++i ) {
+		const ztag_t *t = &z_tags[ i ];
+		if( t->count == 0 && t->numArenas == 0 ) {
+			continue;
+		}
+
+		Com_Printf( " tag %5i: %9i bytes in %6i blocks, %4i large, %4i arenas (%i KB)\n",
+		            t->tag, t->bytes, t->count, t->numLarge, t->numArenas, t->numArenas * Z_ARENA_SIZE / 1024 );
+
+		for( unsigned int c = 0; c < Z_NUM_CLASSES; ++c ) {
+			classCount[ c ] += t->classCount[ c ];
+			classFree[ c ] += t->classFree[ c ];
+		}
+	}
+
+	for( unsigned int c = 0; c < Z_NUM_CLASSES; ++c ) {
+		if( classCount[ c ] == 0 && classFree[ c ] == 0 ) {
+			continue;
+		}
+
+		Com_Printf( " class %4i: %6i used, %6i free\n", z_classSizes[ c ], classCount[ c ], classFree[ c ] );
+	}
+}
+
+/*
+========================
+Z_Record_f
+
+Writes every zone allocation and free out to a file, for z_bench to replay.
+========================
+*/
+static void Z_Record_f( void ) {
+	if( Cmd_Argc() != 2 ) {
+		if( z_record ) {
+			fclose( z_record );
+			z_record = NULL;
+			Com_Printf( "Stopped recording zone allocations\n" );
+			return;
+		}
+
+		Com_Printf( "usage: z_record <filename>, again with no arguments to stop\n" );
+		return;
+	}
+
+	if( z_record ) fclose( z_record );
+
+	char name[ MAX_OSPATH ];
+	Com_sprintf( name, sizeof( name ), "%s/%s", FS_Gamedir(), Cmd_Argv( 1 ) );
+	FS_CreatePath( name );
+	z_record = fopen( name, "w" );
+	if( !z_record ) {
+		Com_Printf( "Failed to open %s\n", name );
+		return;
+	}
+
+	Com_Printf( "Recording zone allocations to %s\n", name );
+}
+
+/*
+========================
+Z_Bench_f
+
+Replays a trace from z_record through the zone, and then again through
+malloc and free alone, to compare the two.
+========================
+*/
+typedef struct {
+	char op;
+	int size, tag;
+	int id;			// index into the live pointer table
+} zbenchop_t;
+
+#define Z_BENCH_TAG_BASE	0x4000
+
+static void Z_Bench_f( void ) {
+	if( Cmd_Argc() != 2 ) {
+		Com_Printf( "usage: z_bench <filename>\n" );
+		return;
+	}
+
+	if( z_record ) {
+		Com_Printf( "Can't benchmark while recording\n" );
+		return;
+	}
+
+	char name[ MAX_OSPATH ];
+	Com_sprintf( name, sizeof( name ), "%s/%s", FS_Gamedir(), Cmd_Argv( 1 ) );
+	FILE *f = fopen( name, "r" );
+	if( !f ) {
+		Com_Printf( "Failed to open %s\n", name );
+		return;
+	}
+
+	/* resolve the recorded pointers into slots, so the replay itself is just array lookups */
+	zbenchop_t *ops = NULL;
+	int numOps = 0, maxOps = 0;
+	void **keys = NULL;
+	int numKeys = 0, maxKeys = 0;
+	int numLive = 0, numSlots = 0;
+	char line[ 128 ];
+	while( fgets( line, sizeof( line ), f ) ) {
+		zbenchop_t op = { line[ 0 ], 0, 0, -1 };
+		void *key = NULL;
+		if( ( op.op == 'a' && sscanf( line + 2, "%p %i %i", &key, &op.size, &op.tag ) != 3 ) ||
+		    ( op.op == 'f' && sscanf( line + 2, "%p", &key ) != 1 ) ||
+		    ( op.op == 't' && sscanf( line + 2, "%i", &op.tag ) != 1 ) ||
+		    ( op.op != 'a' && op.op != 'f' && op.op != 't' ) ) {
+			continue;
+		}
+
+		if( op.op == 'a' ) {
+			if( numKeys == maxKeys ) {
+				maxKeys = maxKeys ? maxKeys * 2 : 1024;
+				keys = static_cast<void **>( realloc( keys, sizeof( void * ) * maxKeys ) );
+			}
+			op.id = numKeys;
+			keys[ numKeys++ ] = key;
+			numLive++;
+		} else if( op.op == 'f' ) {
+			/* most frees are of recent allocations */
+			for( int i = numKeys - 1; i >= 0; --i ) {
+				if( keys[ i ] == key ) {
+					op.id = i;
+					keys[ i ] = NULL;
+					break;
+				}
+			}
+			if( op.id < 0 ) {
+				continue;	// allocated before the recording started
+			}
+			numLive--;
+		}
+
+		if( numOps == maxOps ) {
+			maxOps = maxOps ? maxOps * 2 : 1024;
+			ops = static_cast<zbenchop_t *>( realloc( ops, sizeof( zbenchop_t ) * maxOps ) );
+		}
+		ops[ numOps++ ] = op;
+	}
+	fclose( f );
+	free( keys );
+	numSlots = numKeys;
+
+	if( numOps == 0 ) {
+		Com_Printf( "No allocations in %s\n", name );
+		free( ops );
+		return;
+	}
+
+	void **live = static_cast<void **>( calloc( numSlots, sizeof( void * ) ) );
+
+	/* replay into tags of our own, so we don't free anything real */
+	int startTime = Sys_Milliseconds();
+	for( int i = 0; i < numOps; ++i ) {
+		const zbenchop_t *op = &ops[ i ];
+		if( op->op == 'a' ) {
+			live[ op->id ] = Z_TagMalloc( op->size, Z_BENCH_TAG_BASE + ( op->tag & 0xfff ) );
+		} else if( op->op == 'f' ) {
+			Z_Free( live[ op->id ] );
+		} else {
+			Z_FreeTags( Z_BENCH_TAG_BASE + ( op->tag & 0xfff ) );
+		}
+	}
+	for( int i = 0; i < z_numTags; ++i ) {
+		if( z_tags[ i ].tag >= Z_BENCH_TAG_BASE ) Z_FreeTags( z_tags[ i ].tag );
+	}
+	int zoneTime = Sys_Milliseconds() - startTime;
+
+	/* and the same again the way the zone used to work, malloc with every block on one chain */
+	zhead_t chain;
+	chain.next = chain.prev = &chain;
+
+	startTime = Sys_Milliseconds();
+	for( int i = 0; i < numOps; ++i ) {
+		const zbenchop_t *op = &ops[ i ];
+		if( op->op == 'a' ) {
+			zhead_t *z = static_cast<zhead_t *>( malloc( op->size + sizeof( zhead_t ) ) );
+			memset( z, 0, op->size + sizeof( zhead_t ) );
+			z->tag = op->tag;
+			z->next = chain.next;
+			z->prev = &chain;
+			chain.next->prev = z;
+			chain.next = z;
+			live[ op->id ] = z;
+		} else if( op->op == 'f' ) {
+			zhead_t *z = static_cast<zhead_t *>( live[ op->id ] );
+			z->prev->next = z->next;
+			z->next->prev = z->prev;
+			free( z );
+		} else {
+			zhead_t *z, *next;
+			for( z = chain.next; z != &chain; z = next ) {
+				next = z->next;
+				if( z->tag == op->tag ) {
+					z->prev->next = z->next;
+					z->next->prev = z->prev;
+					free( z );
+				}
+			}
+		}
+	}
+	while( chain.next != &chain ) {
+		zhead_t *z = chain.next;
+		chain.next = z->next;
+		free( z );
+	}
+	int mallocTime = Sys_Milliseconds() - startTime;
+
+	Com_Printf( "%i operations (%i allocations left live)\n", numOps, numLive );
+	Com_Printf( "zone: %i ms, malloc: %i ms\n", zoneTime, mallocTime );
+
+	free( live );
+	free( ops );
+}
+
+/*
+==============================================================================
+
+MEMORY TRACING
+
+With mem_trace set, every zone, hunk and M_Alloc call is recorded along
+with its call site and the frame it happened on. Each thread writes to a
+ring of its own, so recording never takes a lock; readers just accept
+that a ring still being written to may hand back a torn event or two.
+
+==============================================================================
+*/
+
+#define MEM_TRACE_RING_SIZE		( 64 * 1024 )	// events per thread, a power of two
+#define MEM_TRACE_MAX_SITES		4096
+
+typedef struct memTraceEvent_s {
+	const void *site;
+	uint32_t size;
+	uint32_t frame;
+	int32_t tag;
+	uint8_t op;
+} memTraceEvent_t;
+
+typedef struct memTraceRing_s {
+	std::atomic<uint32_t> head;		// total events ever written
+	uint32_t threadIndex;
+	struct memTraceRing_s *next;
+	memTraceEvent_t events[ MEM_TRACE_RING_SIZE ];
+} memTraceRing_t;
+
+bool mem_tracing;
+
+static cvar_t *mem_trace;
+static std::atomic<uint32_t> com_frameNumber;
+static std::atomic<memTraceRing_t *> mem_traceRings;
+static std::atomic<uint32_t> mem_numTraceRings;
+static thread_local memTraceRing_t *mem_traceRing;
+
+static const char *mem_traceOpNames[ MEM_TRACE_MAX_OPS ] = {
+	"Z_TagMalloc", "Z_Free", "Hunk_Begin", "Hunk_Alloc", "M_Alloc"
+};
+
+/*
+========================
+Mem_Trace
+========================
+*/
+void Mem_Trace( memTraceOp_t op, const void *site, size_t size, int tag ) {
+	memTraceRing_t *ring = mem_traceRing;
+	if( ring == NULL ) {
+		/* rings are never freed, as a thread could still be writing to one while it's read */
+		ring = static_cast<memTraceRing_t *>( calloc( 1, sizeof( memTraceRing_t ) ) );
+		if( ring == NULL ) {
+			return;
+		}
+
+		ring->threadIndex = mem_numTraceRings++;
+		ring->next = mem_traceRings.load();
+		while( !mem_traceRings.compare_exchange_weak( ring->next, ring ) ) {
+		}
+
+		mem_traceRing = ring;
+	}
+
+	uint32_t head = ring->head.load( std::memory_order_relaxed );
+	memTraceEvent_t *event = &ring->events[ head & ( MEM_TRACE_RING_SIZE - 1 ) ];
+	event->site = site;
+	event->size = (uint32_t)size;
+	event->frame = com_frameNumber.load( std::memory_order_relaxed );
+	event->tag = tag;
+	event->op = op;
+	ring->head.store( head + 1, std::memory_order_release );
+}
+
+/*
+========================
+Mem_GetSiteName
+
+Best effort, as only exported symbols can be resolved.
+========================
+*/
+static const char *Mem_GetSiteName( const void *site ) {
+#if !defined( _WIN32 )
+	Dl_info info;
+	if( dladdr( site, &info ) && info.dli_sname != NULL ) {
+		return va( "%s+0x%x", info.dli_sname, (unsigned int)( (const byte *)site - (const byte *)info.dli_saddr ) );
+	}
+#endif
+
+	return va( "%p", site );
+}
+
+/*
+========================
+Mem_ForEachEvent
+
+Visits the events still held in every ring, oldest first per thread.
+========================
+*/
+template< typename Visitor >
+static void Mem_ForEachEvent( Visitor visitor ) {
+	for( memTraceRing_t *ring = mem_traceRings.load(); ring != NULL; ring = ring->next ) {
+		uint32_t head = ring->head.load( std::memory_order_acquire );
+		uint32_t start = ( head > MEM_TRACE_RING_SIZE ) ? head - MEM_TRACE_RING_SIZE : 0;
+		for( uint32_t i = start; i < head; ++i ) {
+			visitor( ring, ring->events[ i & ( MEM_TRACE_RING_SIZE - 1 ) ] );
+		}
+	}
+}
+
+/*
+========================
+Mem_Top_f
+
+Prints the sites allocating the most per frame, over the last few frames.
+========================
+*/
+typedef struct memTraceSite_s {
+	const void *site;
+	uint8_t op;
+	uint32_t count;
+	uint64_t bytes;
+} memTraceSite_t;
+
+static void Mem_Top_f( void ) {
+	if( mem_traceRings.load() == NULL ) {
+		Com_Printf( "Nothing traced, set mem_trace 1 first\n" );
+		return;
+	}
+
+	int numFrames = ( Cmd_Argc() > 1 ) ? atoi( Cmd_Argv( 1 ) ) : 60;
+	int numShown = ( Cmd_Argc() > 2 ) ? atoi( Cmd_Argv( 2 ) ) : 20;
+	if( numFrames < 1 ) numFrames = 1;
+	if( numShown < 1 ) numShown = 1;
+
+	/* the current frame is still in progress, so leave it out */
+	uint32_t lastFrame = com_frameNumber.load() - 1;
+	uint32_t firstFrame = ( lastFrame >= (uint32_t)numFrames ) ? lastFrame - numFrames + 1 : 0;
+
+	/* oldest frame still covered by every ring, as anything earlier may have been overwritten */
+	uint32_t oldestFrame = firstFrame;
+	for( memTraceRing_t *ring = mem_traceRings.load(); ring != NULL; ring = ring->next ) {
+		uint32_t head = ring->head.load( std::memory_order_acquire );
+		if( head > MEM_TRACE_RING_SIZE ) {
+			uint32_t frame = ring->events[ head & ( MEM_TRACE_RING_SIZE - 1 ) ].frame + 1;
+			if( frame > oldestFrame ) oldestFrame = frame;
+		}
+	}
+	if( oldestFrame > lastFrame ) {
+		Com_Printf( "WARNING: The last frame overflowed the trace, so it's incomplete\n" );
+		oldestFrame = lastFrame;
+	}
+	if( oldestFrame != firstFrame ) {
+		Com_Printf( "Only the last %u frames are still traced\n", lastFrame - oldestFrame + 1 );
+		firstFrame = oldestFrame;
+	}
+	numFrames = lastFrame - firstFrame + 1;
+
+	memTraceSite_t *sites = static_cast<memTraceSite_t *>( calloc( MEM_TRACE_MAX_SITES, sizeof( memTraceSite_t ) ) );
+	uint8_t *frameUsed = static_cast<uint8_t *>( calloc( numFrames, 1 ) );
+	int numSites = 0, numDropped = 0;
+	uint32_t numAllocs = 0;
+	uint64_t numBytes = 0;
+
+	Mem_ForEachEvent( [ & ]( const memTraceRing_t *, const memTraceEvent_t &event ) {
+		if( event.frame < firstFrame || event.frame > lastFrame || event.op == MEM_TRACE_Z_FREE ) {
+			return;
+		}
+
+		frameUsed[ event.frame - firstFrame ] = 1;
+		numAllocs++;
+		numBytes += event.size;
+
+		int i;
+		for( i = 0; i < numSites; ++i ) {
+			if( sites[ i ].site == event.site && sites[ i ].op == event.op ) {
+				break;
+			}
+		}
+
+		if( i == numSites ) {
+			if( numSites == MEM_TRACE_MAX_SITES ) {
+				numDropped++;
+				return;
+			}
+
+			sites[ numSites ].site = event.site;
+			sites[ numSites ].op = event.op;
+			numSites++;
+		}
+
+		sites[ i ].count++;
+		sites[ i ].bytes += event.size;
+	} );
+
+	std::sort( sites, sites + numSites, []( const memTraceSite_t &a, const memTraceSite_t &b ) {
+		return a.count != b.count ? a.count > b.count : a.bytes > b.bytes;
+	} );
+
+	int numQuietFrames = 0;
+	for( int i = 0; i < numFrames; ++i ) {
+		numQuietFrames += !frameUsed[ i ];
+	}
+
+	Com_Printf( "%i frames, %i without allocations, %.1f allocations and %.1f KB per frame\n",
+	            numFrames, numQuietFrames, numAllocs / (float)numFrames, numBytes / 1024.0f / numFrames );
+	for( int i = 0; i < numSites && i < numShown; ++i ) {
+		Com_Printf( "%8.1f/frame %10.1f KB/frame  %-12s %s\n", sites[ i ].count / (float)numFrames,
+		            sites[ i ].bytes / 1024.0f / numFrames, mem_traceOpNames[ sites[ i ].op ], Mem_GetSiteName( sites[ i ].site ) );
+	}
+	if( numDropped > 0 ) {
+		Com_Printf( "%i allocations from untracked sites\n", numDropped );
+	}
+
+	free( frameUsed );
+	free( sites );
+}
+
+/*
+========================
+Mem_Dump_f
+
+Writes every traced event out as:
+	"MTRC", version, number of events
+	{ uint64 site, uint32 size, uint32 frame, int32 tag, uint8 op, uint8 thread } per event
+	number of sites, { uint64 site, char name[ 64 ] } per site
+========================
+*/
+#define MEM_TRACE_FILE_VERSION	1
+
+static void Mem_WriteDumpEvent( FILE *f, const memTraceRing_t *ring, const memTraceEvent_t &event ) {
+	uint64_t site = (uintptr_t)event.site;
+	uint8_t thread = (uint8_t)ring->threadIndex;
+	fwrite( &site, sizeof( site ), 1, f );
+	fwrite( &event.size, sizeof( event.size ), 1, f );
+	fwrite( &event.frame, sizeof( event.frame ), 1, f );
+	fwrite( &event.tag, sizeof( event.tag ), 1, f );
+	fwrite( &event.op, sizeof( event.op ), 1, f );
+	fwrite( &thread, sizeof( thread ), 1, f );
+}
+
+static void Mem_Dump_f( void ) {
+	if( Cmd_Argc() != 2 ) {
+		Com_Printf( "usage: mem_dump <filename>\n" );
+		return;
+	}
+
+	char name[ MAX_OSPATH ];
+	Com_sprintf( name, sizeof( name ), "%s/%s", FS_Gamedir(), Cmd_Argv( 1 ) );
+	FS_CreatePath( name );
+	FILE *f = fopen( name, "wb" );
+	if( !f ) {
+		Com_Printf( "Failed to open %s\n", name );
+		return;
+	}
+
+	/* stop tracing while we look at the rings, so our own allocations don't show up */
+	bool tracing = mem_tracing;
+	mem_tracing = false;
+
+	uint32_t numEvents = 0;
+	Mem_ForEachEvent( [ & ]( const memTraceRing_t *, const memTraceEvent_t & ) { numEvents++; } );
+
+	uint32_t version = MEM_TRACE_FILE_VERSION;
+	fwrite( "MTRC", 4, 1, f );
+	fwrite( &version, sizeof( version ), 1, f );
+	fwrite( &numEvents, sizeof( numEvents ), 1, f );
+
+	/* the event count is fixed now, so anything that arrives on another thread is left out */
+	uint32_t numWritten = 0;
+	const void **sites = static_cast<const void **>( calloc( MEM_TRACE_MAX_SITES, sizeof( void * ) ) );
+	uint32_t numSites = 0;
+	Mem_ForEachEvent( [ & ]( const memTraceRing_t *ring, const memTraceEvent_t &event ) {
+		if( numWritten == numEvents ) {
+			return;
+		}
+
+		Mem_WriteDumpEvent( f, ring, event );
+		numWritten++;
+
+		uint32_t i;
+		for( i = 0; i < numSites && sites[ i ] != event.site; ++i ) {
+		}
+		if( i == numSites && numSites < MEM_TRACE_MAX_SITES ) {
+			sites[ numSites++ ] = event.site;
+		}
+	} );
+
+	fwrite( &numSites, sizeof( numSites ), 1, f );
+	for( uint32_t i = 0; i < numSites; ++i ) {
+		uint64_t site = (uintptr_t)sites[ i ];
+		char siteName[ 64 ] = {};
+		Com_sprintf( siteName, sizeof( siteName ), "%s", Mem_GetSiteName( sites[ i ] ) );
+		fwrite( &site, sizeof( site ), 1, f );
+		fwrite( siteName, sizeof( siteName ), 1, f );
+	}
+
+	fclose( f );
+	free( sites );
+
+	mem_tracing = tracing;
+
+	Com_Printf( "Wrote %u events from %u sites to %s\n", numEvents, numSites, name );
+}
 
 /**
  * Allocates; aborts on fail.
@@ -1003,6 +2168,8 @@ void *M_Alloc( size_t size ) {
 		Com_Error( ERR_FATAL, "Failed to allocate %u bytes!\n", size );
 	}
 
+	if( mem_tracing ) Mem_Trace( MEM_TRACE_M_ALLOC, MEM_TRACE_SITE, size, 0 );
+
 	memset( data, 0, size );
 
 	return data;
@@ -1162,8 +2329,6 @@ void Qcommon_Init( int argc, char **argv ) {
 
 	if( setjmp( abortframe ) ) Sys_Error( "Error during initialization" );
 
-	z_chain.next = z_chain.prev = &z_chain;
-
 	// prepare enough of the subsystems to handle
 	// cvar and command buffer management
 	COM_InitArgv( argc, argv );
@@ -1195,6 +2360,10 @@ void Qcommon_Init( int argc, char **argv ) {
 	// init commands and vars
 	//
 	Cmd_AddCommand( "z_stats", Z_Stats_f );
+	Cmd_AddCommand( "z_record", Z_Record_f );
+	Cmd_AddCommand( "z_bench", Z_Bench_f );
+	Cmd_AddCommand( "mem_top", Mem_Top_f );
+	Cmd_AddCommand( "mem_dump", Mem_Dump_f );
 	Cmd_AddCommand( "error", Com_Error_f );
 
 	host_speeds = Cvar_Get( "host_speeds", "0", 0 );
@@ -1204,6 +2373,7 @@ void Qcommon_Init( int argc, char **argv ) {
 	fixedtime = Cvar_Get( "fixedtime", "0", 0 );
 	logfile_active = Cvar_Get( "logfile", "0", 0 );
 	showtrace = Cvar_Get( "showtrace", "0", 0 );
+	mem_trace = Cvar_Get( "mem_trace", "0", 0 );
 #ifdef DEDICATED_ONLY
 	dedicated = Cvar_Get( "dedicated", "1", CVAR_NOSET );
 #else
@@ -1220,6 +2390,8 @@ void Qcommon_Init( int argc, char **argv ) {
 	NET_Init();
 	Netchan_Init();
 
+	CM_Init();
+
 	SV_Init();
 	CL_Init();
 
@@ -1250,6 +2422,9 @@ void Qcommon_Frame( int msec ) {
 
 	if( setjmp( abortframe ) ) return;  // an ERR_DROP was thrown
 
+	com_frameNumber++;
+	mem_tracing = mem_trace->value != 0;
+
 	if( log_stats->modified ) {
 		log_stats->modified = false;
 		if( log_stats->value ) {
@@ -24,6 +24,23 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include <sys/stat.h>
 #include <miniz/miniz.h>
 
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#if defined( _WIN32 )
+#	include <windows.h>
+#else
+#	include <fcntl.h>
+#	include <sys/mman.h>
+#	include <unistd.h>
+#endif
+
+/* msvc's sys/stat.h only has the mode bits */
+#if !defined( S_ISDIR )
+#	define S_ISDIR( m ) ( ( ( m ) & S_IFMT ) == S_IFDIR )
+#endif
+
 /*
 =============================================================================
 
@@ -32,27 +49,18 @@ QUAKE FILESYSTEM
 =============================================================================
 */
 
-typedef struct PackageHeader {
-	char		identifier[ 4 ];	/* ADAT */
-	uint32_t	tocOffset;			/* table of contents */
-	uint32_t	tocLength;			/* table of contents length */
-	uint32_t	version;			/* always appears to be 9 */
-} PackageHeader;
-
-typedef struct PackageIndex {
-	char		name[ 128 ];		/* the name of the file, excludes 'model/' etc. */
-	uint32_t	offset;				/* offset into the dat that the file resides */
-	uint32_t	length;				/* decompressed length of the file */
-	uint32_t	compressedLength;	/* length of the file in the dat */
-	uint32_t	u0;
-} PackageIndex;
-
 typedef struct Package {
 	char			mappedDir[ 32 ];			/* e.g., 'models' */
 	char			path[ MAX_QPATH ];
 	PackageHeader	header;						/* header data */
 	PackageIndex *indices;					/* index data */
 	unsigned int	numFiles;					/* number of files within */
+	uint8_t *mapping;					/* the whole package, mapped for its lifetime */
+	size_t			mappingLength;
+#if defined( _WIN32 )
+	HANDLE			fileHandle;
+	HANDLE			mappingHandle;
+#endif
 	LinkedListNode *nodeIndex;
 } Package;
 
@@ -69,20 +77,6 @@ static void FS_CanonicalisePath( char *path ) {
 	}
 }
 
-/**
- * Search for the given file within a package and return it's index.
- */
-static const PackageIndex *FS_GetPackageFileIndex( const Package *package, const char *fileName ) {
-	for( unsigned int i = 0; i < package->numFiles; ++i ) {
-		const PackageIndex *index = &package->indices[ i ];
-		if( Q_strncasecmp( index->name, fileName, sizeof( index->name ) ) == 0 ) {
-			return index;
-		}
-	}
-
-	return nullptr;
-}
-
 /**
  * Decompress the given file and carry out validation.
  */
@@ -101,355 +95,1800 @@ static bool FS_DecompressFile( const uint8_t *srcBuffer, size_t srcLength, uint8
 	return true;
 }
 
+/*
+=============================================================================
+
+DECOMPRESSED FILE CACHE
+
+Inflated package entries are kept around after FS_FreeFile, up to the
+budget given by fs_cachesize (in megabytes), so that restarts and map
+changes don't need to decompress the same data again. Cached buffers are
+shared, so they're only handed out as const through FS_LoadSharedFile;
+FS_LoadFile gives its callers a copy of their own.
+
+=============================================================================
+*/
+
+typedef struct FileCacheEntry {
+	const Package *package;			/* null if the package has since been unmounted */
+	const PackageIndex *index;
+	uint8_t *data;
+	uint32_t		length;
+	int				refCount;
+	struct FileCacheEntry *lruPrev, *lruNext;
+	struct FileCacheEntry *keyNext;		/* chain keyed on the package index */
+	struct FileCacheEntry *dataNext;	/* chain keyed on the data pointer */
+} FileCacheEntry;
+
+#define FILE_CACHE_HASH_SIZE 1024
+
+static FileCacheEntry *fs_cacheKeyHash[ FILE_CACHE_HASH_SIZE ];
+static FileCacheEntry *fs_cacheDataHash[ FILE_CACHE_HASH_SIZE ];
+static FileCacheEntry fs_cacheLru;		/* sentinel; next is most recently used */
+static size_t fs_cacheBytes;
+static unsigned int fs_cacheNumEntries;
+
+static unsigned int fs_cacheHits;
+static unsigned int fs_cacheMisses;
+static unsigned int fs_cacheEvictions;
+
+static cvar_t *fs_cachesize;
+
+static unsigned int FS_HashCachePointer( const void *ptr ) {
+	uintptr_t v = (uintptr_t)ptr;
+	v ^= v >> 17;
+	v *= 0x9e3779b1u;
+	return (unsigned int)( v >> 7 ) & ( FILE_CACHE_HASH_SIZE - 1 );
+}
+
+static void FS_LinkCacheLru( FileCacheEntry *entry ) {
+	if( fs_cacheLru.lruNext == NULL ) {
+		fs_cacheLru.lruNext = fs_cacheLru.lruPrev = &fs_cacheLru;
+	}
+
+	entry->lruPrev = &fs_cacheLru;
+	entry->lruNext = fs_cacheLru.lruNext;
+	fs_cacheLru.lruNext->lruPrev = entry;
+	fs_cacheLru.lruNext = entry;
+}
+
+static void FS_UnlinkCacheLru( FileCacheEntry *entry ) {
+	entry->lruPrev->lruNext = entry->lruNext;
+	entry->lruNext->lruPrev = entry->lruPrev;
+	entry->lruPrev = entry->lruNext = NULL;
+}
+
+static void FS_UnlinkCacheKey( FileCacheEntry *entry ) {
+	FileCacheEntry **link = &fs_cacheKeyHash[ FS_HashCachePointer( entry->index ) ];
+	while( *link != NULL ) {
+		if( *link == entry ) {
+			*link = entry->keyNext;
+			break;
+		}
+
+		link = &( *link )->keyNext;
+	}
+
+	entry->keyNext = NULL;
+}
+
+static FileCacheEntry *FS_FindCacheEntryByData( const void *data ) {
+	for( FileCacheEntry *entry = fs_cacheDataHash[ FS_HashCachePointer( data ) ]; entry != NULL; entry = entry->dataNext ) {
+		if( entry->data == data ) {
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
 /**
- * Load a file from the given package, and decompress the data.
+ * Completely release the given entry, which must not be referenced.
  */
-static uint8_t *FS_LoadPackageFile( const Package *package, const char *fileName, uint32_t *fileLength ) {
-	/* first, ensure that it's actually in the package file table */
-	const PackageIndex *fileIndex = FS_GetPackageFileIndex( package, fileName );
-	if( fileIndex == NULL ) {
-		return NULL;
+static void FS_DestroyCacheEntry( FileCacheEntry *entry ) {
+	if( entry->lruNext != NULL ) {
+		FS_UnlinkCacheLru( entry );
 	}
 
-	/* now proceed to load that file */
+	if( entry->package != NULL ) {
+		FS_UnlinkCacheKey( entry );
+	}
 
-	FILE *filePtr = fopen( package->path, "rb" );
-	if( filePtr == NULL ) {
-		Com_Printf( "WARNING: Failed to open package \"%s\"!\n", package->path );
-		return NULL;
+	FileCacheEntry **link = &fs_cacheDataHash[ FS_HashCachePointer( entry->data ) ];
+	while( *link != NULL ) {
+		if( *link == entry ) {
+			*link = entry->dataNext;
+			break;
+		}
+
+		link = &( *link )->dataNext;
 	}
 
-	fseek( filePtr, fileIndex->offset, SEEK_SET );
+	fs_cacheBytes -= entry->length;
+	fs_cacheNumEntries--;
 
-	/* now load the compressed block in */
-	uint8_t *srcBuffer = static_cast<uint8_t *>( Z_Malloc( fileIndex->compressedLength ) );
-	fread( srcBuffer, sizeof( uint8_t ), fileIndex->compressedLength, filePtr );
+	Z_Free( entry->data );
+	Z_Free( entry );
+}
 
-	/* decompress it */
+static size_t FS_GetCacheBudget( void ) {
+	if( fs_cachesize == NULL || fs_cachesize->value <= 0.0f ) {
+		return 0;
+	}
 
-	uint8_t *dstBuffer = static_cast<uint8_t *>( Z_Malloc( fileIndex->length ) );
-	size_t dstLength = fileIndex->length;
+	return (size_t)( fs_cachesize->value * 1024.0f * 1024.0f );
+}
 
-	bool status = FS_DecompressFile( srcBuffer, fileIndex->compressedLength, dstBuffer, &dstLength, fileIndex->length );
+/**
+ * Evict the least recently used, unreferenced, entries until we're
+ * under the given budget.
+ */
+static void FS_TrimFileCache( size_t budget ) {
+	if( fs_cacheLru.lruNext == NULL ) {
+		return;
+	}
 
-	Z_Free( srcBuffer );
+	FileCacheEntry *entry = fs_cacheLru.lruPrev;
+	while( fs_cacheBytes > budget && entry != &fs_cacheLru ) {
+		FileCacheEntry *prev = entry->lruPrev;
+		if( entry->refCount == 0 ) {
+			FS_DestroyCacheEntry( entry );
+			fs_cacheEvictions++;
+		}
 
-	fclose( filePtr );
+		entry = prev;
+	}
+}
 
-	if( status ) {
-#if 0 /* write it out so we can make sure it's all good! */
-		//char outFileName[ MAX_QPATH ];
-		//snprintf( outFileName, sizeof( outFileName ), "debug/%s.file", rand() % 256 );
-		FILE *outFile = fopen( fileName, "wb" );
-		if ( outFile != NULL ) {
-			fwrite( dstBuffer, sizeof( uint8_t ), dstLength, outFile );
-			fclose( outFile );
+/**
+ * Fetch the decompressed data for the given entry from the cache, if present.
+ */
+static uint8_t *FS_AcquireCachedFile( const Package *package, const PackageIndex *index, uint32_t *length ) {
+	for( FileCacheEntry *entry = fs_cacheKeyHash[ FS_HashCachePointer( index ) ]; entry != NULL; entry = entry->keyNext ) {
+		if( entry->index != index || entry->package != package ) {
+			continue;
 		}
-#endif
 
-		*fileLength = dstLength;
-		return dstBuffer;
+		entry->refCount++;
+
+		FS_UnlinkCacheLru( entry );
+		FS_LinkCacheLru( entry );
+
+		fs_cacheHits++;
+
+		*length = entry->length;
+		return entry->data;
 	}
 
-	Z_Free( dstBuffer );
+	fs_cacheMisses++;
 
 	return NULL;
 }
 
-static Package *FS_MountPackage( FILE *filePtr, const char *identity ) {
-	if( filePtr == NULL ) {
-		Com_Printf( "WARNING: Invalid file handle!\n" );
-		return NULL;
+/**
+ * Hand ownership of freshly decompressed data over to the cache, with a
+ * single reference held by the caller. Returns false if the cache is
+ * disabled or the data doesn't fit, in which case the caller keeps it.
+ */
+static bool FS_InsertCachedFile( const Package *package, const PackageIndex *index, uint8_t *data, uint32_t length ) {
+	size_t budget = FS_GetCacheBudget();
+	if( length > budget ) {
+		return false;
 	}
 
-	if( identity == NULL || identity[ 0 ] == '\0' ) {
-		Com_Printf( "WARNING: Invalid package identity!\n" );
-		return NULL;
+	FS_TrimFileCache( budget - length );
+
+	FileCacheEntry *entry = static_cast<FileCacheEntry *>( Z_Malloc( sizeof( FileCacheEntry ) ) );
+	entry->package = package;
+	entry->index = index;
+	entry->data = data;
+	entry->length = length;
+	entry->refCount = 1;
+
+	unsigned int keySlot = FS_HashCachePointer( index );
+	entry->keyNext = fs_cacheKeyHash[ keySlot ];
+	fs_cacheKeyHash[ keySlot ] = entry;
+
+	unsigned int dataSlot = FS_HashCachePointer( data );
+	entry->dataNext = fs_cacheDataHash[ dataSlot ];
+	fs_cacheDataHash[ dataSlot ] = entry;
+
+	FS_LinkCacheLru( entry );
+
+	fs_cacheBytes += length;
+	fs_cacheNumEntries++;
+
+	return true;
+}
+
+/**
+ * Drop a reference to a cached buffer. Returns false if the buffer
+ * didn't come from the cache.
+ */
+static bool FS_ReleaseCachedFile( const void *data ) {
+	FileCacheEntry *entry = FS_FindCacheEntryByData( data );
+	if( entry == NULL ) {
+		return false;
 	}
 
-	/* read in the header */
-	PackageHeader header;
-	fread( &header, sizeof( PackageHeader ), 1, filePtr );
+	if( --entry->refCount > 0 ) {
+		return true;
+	}
 
-	/* and now ensure it's as desired! */
-	if( strncmp( header.identifier, "ADAT", sizeof( header.identifier ) ) != 0 ) {
-		Com_Printf( "WARNING: Invalid identifier, package returned \"%s\" rather than \"ADAT\"!\n", header.identifier );
+	/* orphaned by an unmount, or the budget was lowered since */
+	if( entry->package == NULL ) {
+		FS_DestroyCacheEntry( entry );
+	} else {
+		FS_TrimFileCache( FS_GetCacheBudget() );
+	}
+
+	return true;
+}
+
+/**
+ * Forget everything cached from the given package. Entries that are still
+ * referenced are orphaned and destroyed once their last reference goes.
+ */
+static void FS_FlushFileCache( const Package *package ) {
+	if( fs_cacheLru.lruNext == NULL ) {
+		return;
+	}
+
+	FileCacheEntry *entry = fs_cacheLru.lruNext;
+	while( entry != &fs_cacheLru ) {
+		FileCacheEntry *next = entry->lruNext;
+		if( entry->package == package ) {
+			if( entry->refCount == 0 ) {
+				FS_DestroyCacheEntry( entry );
+			} else {
+				FS_UnlinkCacheKey( entry );
+				FS_UnlinkCacheLru( entry );
+				entry->package = NULL;
+				entry->index = NULL;
+			}
+		}
+
+		entry = next;
+	}
+}
+
+/*
+=============================================================================
+
+PREFETCH WORKERS
+
+FS_Prefetch hands package entries over to a pool of worker threads which
+inflate them ahead of time, so that by the time FS_LoadFile asks for them
+the data is already sitting in the ready list. Workers only ever run the
+decompression itself; everything touching the zone or the cache stays on
+the main thread.
+
+=============================================================================
+*/
+
+enum {
+	PREFETCH_QUEUED,
+	PREFETCH_RUNNING,
+	PREFETCH_DONE,
+	PREFETCH_FAILED,
+};
+
+typedef struct PrefetchJob {
+	const Package *package;
+	const PackageIndex *index;
+	uint8_t *data;						/* allocated by the main thread */
+	int				state;
+	struct PrefetchJob *queueNext;		/* pending work, guarded by fs_prefetchSync */
+	struct PrefetchJob *hashNext;		/* main thread only */
+} PrefetchJob;
+
+/* cap on how much inflated data can be waiting to be picked up */
+#define PREFETCH_MAX_BYTES ( 64 * 1024 * 1024 )
+
+/* created alongside the workers and never destroyed, as they're still
+ * waiting on it when the process exits */
+typedef struct PrefetchSync {
+	std::mutex				mutex;
+	std::condition_variable	work;
+	std::condition_variable	done;
+} PrefetchSync;
+
+static PrefetchSync *fs_prefetchSync;
+static PrefetchJob *fs_prefetchQueueHead, *fs_prefetchQueueTail;
+
+static PrefetchJob *fs_prefetchHash[ FILE_CACHE_HASH_SIZE ];
+static size_t fs_prefetchBytes;
+static unsigned int fs_numPrefetchThreads;
+
+static unsigned int fs_prefetchQueued;
+static unsigned int fs_prefetchHits;
+static unsigned int fs_prefetchWaits;
+
+static cvar_t *fs_prefetch;
+
+static void FS_PrefetchWorker( void ) {
+	for( ;; ) {
+		PrefetchJob *job;
+		{
+			std::unique_lock< std::mutex > lock( fs_prefetchSync->mutex );
+			fs_prefetchSync->work.wait( lock, [] { return fs_prefetchQueueHead != NULL; } );
+
+			job = fs_prefetchQueueHead;
+			fs_prefetchQueueHead = job->queueNext;
+			if( fs_prefetchQueueHead == NULL ) {
+				fs_prefetchQueueTail = NULL;
+			}
+
+			job->queueNext = NULL;
+			job->state = PREFETCH_RUNNING;
+		}
+
+		/* no printing from here, FS_DecompressFile isn't safe to use */
+		mz_ulong dstLength = job->index->length;
+		int returnCode = mz_uncompress( job->data, &dstLength, job->package->mapping + job->index->offset, job->index->compressedLength );
+
+		{
+			std::lock_guard< std::mutex > lock( fs_prefetchSync->mutex );
+			job->state = ( returnCode == MZ_OK && dstLength == job->index->length ) ? PREFETCH_DONE : PREFETCH_FAILED;
+		}
+
+		fs_prefetchSync->done.notify_all();
+	}
+}
+
+static void FS_StartPrefetchWorkers( void ) {
+	if( fs_numPrefetchThreads > 0 ) {
+		return;
+	}
+
+	unsigned int numThreads = std::thread::hardware_concurrency();
+	if( numThreads == 0 ) {
+		numThreads = 1;
+	} else if( numThreads > 16 ) {
+		numThreads = 16;
+	}
+
+	fs_prefetchSync = new PrefetchSync;
+
+	/* workers live for the lifetime of the process */
+	for( unsigned int i = 0; i < numThreads; ++i ) {
+		std::thread( FS_PrefetchWorker ).detach();
+	}
+
+	fs_numPrefetchThreads = numThreads;
+}
+
+/**
+ * Unlink the job from the main thread's table and free it, along with its
+ * data unless the caller has taken that over. Job must not be running.
+ */
+static void FS_DestroyPrefetchJob( PrefetchJob *job, bool freeData ) {
+	PrefetchJob **link = &fs_prefetchHash[ FS_HashCachePointer( job->index ) ];
+	while( *link != NULL ) {
+		if( *link == job ) {
+			*link = job->hashNext;
+			break;
+		}
+
+		link = &( *link )->hashNext;
+	}
+
+	fs_prefetchBytes -= job->index->length;
+
+	if( freeData ) {
+		Z_Free( job->data );
+	}
+
+	Z_Free( job );
+}
+
+/**
+ * Get the job out of the hands of the workers; if it's still queued it's
+ * pulled from the queue, if it's running we wait for it. Returns the
+ * state it was left in. Caller must hold the prefetch lock.
+ */
+static int FS_SettlePrefetchJob( std::unique_lock< std::mutex > &lock, PrefetchJob *job ) {
+	if( job->state == PREFETCH_QUEUED ) {
+		PrefetchJob *prev = NULL;
+		for( PrefetchJob *cur = fs_prefetchQueueHead; cur != NULL; prev = cur, cur = cur->queueNext ) {
+			if( cur != job ) {
+				continue;
+			}
+
+			if( prev != NULL ) {
+				prev->queueNext = job->queueNext;
+			} else {
+				fs_prefetchQueueHead = job->queueNext;
+			}
+
+			if( fs_prefetchQueueTail == job ) {
+				fs_prefetchQueueTail = prev;
+			}
+
+			break;
+		}
+
+		job->queueNext = NULL;
+		return PREFETCH_QUEUED;
+	}
+
+	if( job->state == PREFETCH_RUNNING ) {
+		fs_prefetchWaits++;
+		fs_prefetchSync->done.wait( lock, [ job ] { return job->state != PREFETCH_RUNNING; } );
+	}
+
+	return job->state;
+}
+
+static PrefetchJob *FS_FindPrefetchJob( const Package *package, const PackageIndex *index ) {
+	for( PrefetchJob *job = fs_prefetchHash[ FS_HashCachePointer( index ) ]; job != NULL; job = job->hashNext ) {
+		if( job->index == index && job->package == package ) {
+			return job;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Take ownership of prefetched data for the given entry, if there is any.
+ */
+static uint8_t *FS_TakePrefetchedFile( const Package *package, const PackageIndex *index, uint32_t *length ) {
+	PrefetchJob *job = FS_FindPrefetchJob( package, index );
+	if( job == NULL ) {
 		return NULL;
 	}
 
-	if( header.version != 9 ) {
-		Com_Printf( "WARNING: Unexpected package version, \"%d\" (expected \"9\")!\n", header.version );
+	int state;
+	{
+		std::unique_lock< std::mutex > lock( fs_prefetchSync->mutex );
+		state = FS_SettlePrefetchJob( lock, job );
+	}
+
+	if( state != PREFETCH_DONE ) {
+		/* either it never got picked up, or it failed; let the caller deal with it */
+		FS_DestroyPrefetchJob( job, true );
 		return NULL;
 	}
 
-	unsigned int numFiles = header.tocLength / sizeof( PackageIndex );
-	if( numFiles == 0 ) {
-		Com_Printf( "WARNING: Empty package!\n" );
+	uint8_t *data = job->data;
+	*length = index->length;
+
+	FS_DestroyPrefetchJob( job, false );
+
+	fs_prefetchHits++;
+
+	return data;
+}
+
+/**
+ * Cancel, or wait for, all of the outstanding work for the given package,
+ * or for every package if it's null.
+ */
+static void FS_FlushPrefetch( const Package *package ) {
+	for( unsigned int i = 0; i < FILE_CACHE_HASH_SIZE; ++i ) {
+		PrefetchJob *job = fs_prefetchHash[ i ];
+		while( job != NULL ) {
+			PrefetchJob *next = job->hashNext;
+			if( package == NULL || job->package == package ) {
+				{
+					std::unique_lock< std::mutex > lock( fs_prefetchSync->mutex );
+					FS_SettlePrefetchJob( lock, job );
+				}
+
+				FS_DestroyPrefetchJob( job, true );
+			}
+
+			job = next;
+		}
+	}
+}
+
+/**
+ * Map the given package into memory. The view is copy-on-write, so legacy
+ * loaders that poke at their buffer in place never touch the file on disk.
+ */
+static bool FS_MapPackage( Package *package, const char *path ) {
+#if defined( _WIN32 )
+	package->fileHandle = CreateFileA( path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+	if( package->fileHandle == INVALID_HANDLE_VALUE ) {
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	if( !GetFileSizeEx( package->fileHandle, &fileSize ) || fileSize.QuadPart == 0 ) {
+		CloseHandle( package->fileHandle );
+		return false;
+	}
+
+	package->mappingHandle = CreateFileMappingA( package->fileHandle, NULL, PAGE_WRITECOPY, 0, 0, NULL );
+	if( package->mappingHandle == NULL ) {
+		CloseHandle( package->fileHandle );
+		return false;
+	}
+
+	package->mapping = static_cast<uint8_t *>( MapViewOfFile( package->mappingHandle, FILE_MAP_COPY, 0, 0, 0 ) );
+	if( package->mapping == NULL ) {
+		CloseHandle( package->mappingHandle );
+		CloseHandle( package->fileHandle );
+		return false;
+	}
+
+	package->mappingLength = (size_t)fileSize.QuadPart;
+#else
+	int fd = open( path, O_RDONLY );
+	if( fd == -1 ) {
+		return false;
+	}
+
+	struct stat stats;
+	if( fstat( fd, &stats ) != 0 || stats.st_size == 0 ) {
+		close( fd );
+		return false;
+	}
+
+	void *mapping = mmap( NULL, stats.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
+
+	/* the mapping keeps its own reference to the file */
+	close( fd );
+
+	if( mapping == MAP_FAILED ) {
+		return false;
+	}
+
+	package->mapping = static_cast<uint8_t *>( mapping );
+	package->mappingLength = stats.st_size;
+#endif
+
+	return true;
+}
+
+static void FS_UnmapPackage( Package *package ) {
+	if( package->mapping == NULL ) {
+		return;
+	}
+
+#if defined( _WIN32 )
+	UnmapViewOfFile( package->mapping );
+	CloseHandle( package->mappingHandle );
+	CloseHandle( package->fileHandle );
+#else
+	munmap( package->mapping, package->mappingLength );
+#endif
+
+	package->mapping = NULL;
+	package->mappingLength = 0;
+}
+
+/**
+ * Returns true if the given index describes an entry that's stored without
+ * any compression, in which case it can be served straight from the mapping.
+ */
+static bool FS_IsPackageFileStored( const PackageIndex *fileIndex ) {
+	return fileIndex->compressedLength == fileIndex->length;
+}
+
+/**
+ * Load a file from the given package, and decompress the data.
+ */
+static const uint8_t *FS_LoadPackageFile( const Package *package, const PackageIndex *fileIndex, uint32_t *fileLength ) {
+	if( (size_t)fileIndex->offset + fileIndex->compressedLength > package->mappingLength ) {
+		Com_Printf( "WARNING: \"%s\" lies outside of package \"%s\"!\n", fileIndex->name, package->path );
 		return NULL;
 	}
 
-	Package *package = static_cast<Package *>( Z_Malloc( sizeof( Package ) ) );
-	strcpy( package->mappedDir, identity );
+	const uint8_t *srcBuffer = package->mapping + fileIndex->offset;
+
+	/* stored entries don't need any work, just hand out the mapped data */
+	if( FS_IsPackageFileStored( fileIndex ) ) {
+		*fileLength = fileIndex->length;
+		return srcBuffer;
+	}
+
+	uint8_t *cachedBuffer = FS_AcquireCachedFile( package, fileIndex, fileLength );
+	if( cachedBuffer != NULL ) {
+		return cachedBuffer;
+	}
+
+	/* it might have already been inflated ahead of time by a worker */
+	uint8_t *prefetchedBuffer = FS_TakePrefetchedFile( package, fileIndex, fileLength );
+	if( prefetchedBuffer != NULL ) {
+		FS_InsertCachedFile( package, fileIndex, prefetchedBuffer, *fileLength );
+		return prefetchedBuffer;
+	}
+
+	/* otherwise decompress it directly from the mapping */
+
+	uint8_t *dstBuffer = static_cast<uint8_t *>( Z_Malloc( fileIndex->length ) );
+	size_t dstLength = fileIndex->length;
+
+	if( FS_DecompressFile( srcBuffer, fileIndex->compressedLength, dstBuffer, &dstLength, fileIndex->length ) ) {
+		FS_InsertCachedFile( package, fileIndex, dstBuffer, dstLength );
+
+		*fileLength = dstLength;
+		return dstBuffer;
+	}
+
+	Z_Free( dstBuffer );
+
+	return NULL;
+}
+
+/**
+ * Read in the table of contents from an Anachronox .dat package.
+ */
+static bool FS_ReadDatIndices( Package *package ) {
+	PackageHeader header;
+	memcpy( &header, package->mapping, sizeof( PackageHeader ) );
+
+	/* and now ensure it's as desired! */
+	if( strncmp( header.identifier, "ADAT", sizeof( header.identifier ) ) != 0 ) {
+		Com_Printf( "WARNING: Invalid identifier, package returned \"%.4s\" rather than \"ADAT\"!\n", header.identifier );
+		return false;
+	}
+
+	if( header.version != 9 ) {
+		Com_Printf( "WARNING: Unexpected package version, \"%d\" (expected \"9\")!\n", header.version );
+		return false;
+	}
+
+	unsigned int numFiles = header.tocLength / sizeof( PackageIndex );
+	if( numFiles == 0 ) {
+		Com_Printf( "WARNING: Empty package!\n" );
+		return false;
+	}
+
+	if( (size_t)header.tocOffset + sizeof( PackageIndex ) * numFiles > package->mappingLength ) {
+		Com_Printf( "WARNING: Failed to read entire table of contents!\n" );
+		return false;
+	}
+
+	package->header = header;
+	package->numFiles = numFiles;
+
+	/* and now copy out the table of contents, as we canonicalise the names */
+	package->indices = static_cast<PackageIndex *>( Z_Malloc( sizeof( PackageIndex ) * package->numFiles ) );
+	memcpy( package->indices, package->mapping + package->header.tocOffset, sizeof( PackageIndex ) * package->numFiles );
+
+	return true;
+}
+
+/**
+ * Read in the table of contents from an .opk package, converting it
+ * into the same form as a .dat so the rest of the filesystem doesn't
+ * need to care which it came from.
+ */
+static bool FS_ReadOpkIndices( Package *package ) {
+	if( package->mappingLength < sizeof( OpkHeader ) ) {
+		Com_Printf( "WARNING: Package \"%s\" is too small to be valid!\n", package->path );
+		return false;
+	}
+
+	OpkHeader header;
+	memcpy( &header, package->mapping, sizeof( OpkHeader ) );
+
+	if( header.version != OPK_VERSION ) {
+		Com_Printf( "WARNING: Unexpected package version, \"%d\" (expected \"%d\")!\n", header.version, OPK_VERSION );
+		return false;
+	}
+
+	if( header.numEntries == 0 ) {
+		Com_Printf( "WARNING: Empty package!\n" );
+		return false;
+	}
+
+	if( (size_t)header.tocOffset + sizeof( OpkIndex ) * header.numEntries > package->mappingLength ||
+	    (size_t)header.namesOffset + header.namesLength > package->mappingLength ||
+	    header.namesLength == 0 || package->mapping[ header.namesOffset + header.namesLength - 1 ] != '\0' ) {
+		Com_Printf( "WARNING: Failed to read entire table of contents!\n" );
+		return false;
+	}
+
+	memcpy( package->header.identifier, header.identifier, sizeof( header.identifier ) );
+	package->header.tocOffset = header.tocOffset;
+	package->header.tocLength = sizeof( OpkIndex ) * header.numEntries;
+	package->header.version = header.version;
+	package->numFiles = header.numEntries;
+
+	package->indices = static_cast<PackageIndex *>( Z_Malloc( sizeof( PackageIndex ) * package->numFiles ) );
+
+	const char *names = (const char *)package->mapping + header.namesOffset;
+	for( unsigned int i = 0; i < package->numFiles; ++i ) {
+		OpkIndex opkIndex;
+		memcpy( &opkIndex, package->mapping + header.tocOffset + sizeof( OpkIndex ) * i, sizeof( OpkIndex ) );
+
+		/* stored entries are the only ones where the lengths match, which is what we key on */
+		if( opkIndex.nameOffset >= header.namesLength ||
+		    ( opkIndex.codec == OPK_CODEC_STORE && opkIndex.storedLength != opkIndex.length ) ||
+		    ( opkIndex.codec == OPK_CODEC_DEFLATE && opkIndex.storedLength >= opkIndex.length ) ||
+		    opkIndex.codec >= OPK_CODEC_LZ ) {
+			Com_Printf( "WARNING: Unsupported or invalid entry %u in \"%s\"!\n", i, package->path );
+			Z_Free( package->indices );
+			return false;
+		}
+
+		PackageIndex *index = &package->indices[ i ];
+		Com_sprintf( index->name, sizeof( index->name ), "%s", names + opkIndex.nameOffset );
+		index->offset = opkIndex.offset;
+		index->length = opkIndex.length;
+		index->compressedLength = opkIndex.storedLength;
+		index->u0 = opkIndex.crc;
+	}
+
+	return true;
+}
+
+static Package *FS_MountPackage( const char *path, const char *identity ) {
+	if( identity == NULL || identity[ 0 ] == '\0' ) {
+		Com_Printf( "WARNING: Invalid package identity!\n" );
+		return NULL;
+	}
+
+	Package *package = static_cast<Package *>( Z_Malloc( sizeof( Package ) ) );
+	if( !FS_MapPackage( package, path ) ) {
+		Z_Free( package );
+		return NULL;
+	}
+
+	/* read in the header */
+	if( package->mappingLength < sizeof( PackageHeader ) ) {
+		Com_Printf( "WARNING: Package \"%s\" is too small to be valid!\n", path );
+		FS_UnmapPackage( package );
+		Z_Free( package );
+		return NULL;
+	}
+
+	Com_sprintf( package->path, sizeof( package->path ), "%s", path );
+	strcpy( package->mappedDir, identity );
+
+	bool status;
+	if( strncmp( (const char *)package->mapping, OPK_IDENTIFIER, 4 ) == 0 ) {
+		status = FS_ReadOpkIndices( package );
+	} else {
+		status = FS_ReadDatIndices( package );
+	}
+
+	if( !status ) {
+		FS_UnmapPackage( package );
+		Z_Free( package );
+		return NULL;
+	}
+
+	/* flip back slash to forward */
+	for( unsigned int i = 0; i < package->numFiles; ++i ) {
+		FS_CanonicalisePath( package->indices[ i ].name );
+	}
+
+	return package;
+}
+
+/**
+ * Free the given package and everything it owns.
+ */
+static void FS_FreePackage( Package *package ) {
+	FS_FlushPrefetch( package );
+	FS_FlushFileCache( package );
+	FS_UnmapPackage( package );
+
+	Z_Free( package->indices );
+	Z_Free( package );
+}
+
+//
+// in memory
+//
+
+static char fs_gamedir[ MAX_OSPATH ];
+static cvar_t *fs_basedir;
+static cvar_t *fs_cddir;
+
+cvar_t *fs_gamedirvar;
+
+typedef struct searchpath_s {
+	char				filename[ MAX_OSPATH ];
+	LinkedList *packDirectories;
+	struct searchpath_s *next;
+} searchpath_t;
+
+static searchpath_t *fs_searchpaths;
+static searchpath_t *fs_base_searchpaths;	// without gamedirs
+
+/*
+=============================================================================
+
+VIRTUAL FILE TABLE
+
+Every file reachable through the search path, whether loose on disk or
+inside a package, is merged into a single table when the search path
+changes. Lookups are case-insensitive and only ever cost a hash probe;
+nothing touches the disk until the winning source is actually read.
+
+=============================================================================
+*/
+
+typedef struct FileTableEntry {
+	uint32_t			nameOffset;		/* into the table's name pool */
+	const searchpath_t *search;			/* where a loose file lives */
+	const Package *package;		/* null for loose files */
+	const PackageIndex *index;
+} FileTableEntry;
+
+typedef struct FileTable {
+	FileTableEntry *entries;
+	unsigned int		numEntries;
+	unsigned int		maxEntries;
+	char *names;
+	size_t				namesLength;
+	size_t				maxNamesLength;
+	uint32_t *slots;			/* open-addressed, stores entry + 1, 0 is empty */
+	uint32_t			slotMask;
+} FileTable;
+
+static FileTable fs_fileTable;
+
+/* counters reported by fs_stats */
+static unsigned int fs_numLookups;
+static unsigned int fs_numLookupMisses;
+static unsigned int fs_numProbes;
+static unsigned int fs_maxProbes;
+
+/**
+ * Case-insensitive FNV-1a hash of a file name.
+ */
+static uint32_t FS_HashFileName( const char *name ) {
+	uint32_t hash = 2166136261u;
+	for( ; *name != '\0'; ++name ) {
+		char c = *name;
+		if( c >= 'A' && c <= 'Z' ) {
+			c += 'a' - 'A';
+		}
+
+		hash ^= (uint8_t)c;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static void FS_ClearFileTable( FileTable *table ) {
+	if( table->entries != NULL ) {
+		Z_Free( table->entries );
+	}
+
+	if( table->names != NULL ) {
+		Z_Free( table->names );
+	}
+
+	if( table->slots != NULL ) {
+		Z_Free( table->slots );
+	}
+
+	memset( table, 0, sizeof( FileTable ) );
+}
+
+/**
+ * Returns the slot the given name lives in, or the empty slot it would
+ * go into. Table must have at least one empty slot.
+ */
+static uint32_t FS_ProbeFileTable( const FileTable *table, const char *name, uint32_t hash, unsigned int *numProbes ) {
+	uint32_t slot = hash & table->slotMask;
+	while( table->slots[ slot ] != 0 ) {
+		( *numProbes )++;
+
+		const FileTableEntry *entry = &table->entries[ table->slots[ slot ] - 1 ];
+		if( Q_strcasecmp( table->names + entry->nameOffset, name ) == 0 ) {
+			break;
+		}
+
+		slot = ( slot + 1 ) & table->slotMask;
+	}
+
+	return slot;
+}
+
+static void FS_ResizeFileTableSlots( FileTable *table, uint32_t numSlots ) {
+	if( table->slots != NULL ) {
+		Z_Free( table->slots );
+	}
+
+	table->slots = static_cast<uint32_t *>( Z_Malloc( sizeof( uint32_t ) * numSlots ) );
+	table->slotMask = numSlots - 1;
+
+	for( unsigned int i = 0; i < table->numEntries; ++i ) {
+		const char *name = table->names + table->entries[ i ].nameOffset;
+
+		unsigned int numProbes = 0;
+		table->slots[ FS_ProbeFileTable( table, name, FS_HashFileName( name ), &numProbes ) ] = i + 1;
+	}
+}
+
+/**
+ * Add the given file to the table, unless something earlier in the search
+ * order already claimed the name.
+ */
+static void FS_InsertFileTableEntry( FileTable *table, const char *name, const searchpath_t *search, const Package *package, const PackageIndex *index ) {
+	/* keep the load factor at or below a half */
+	if( table->slots == NULL || ( table->numEntries + 1 ) * 2 > table->slotMask + 1 ) {
+		FS_ResizeFileTableSlots( table, table->slots == NULL ? 1024 : ( table->slotMask + 1 ) * 2 );
+	}
+
+	unsigned int numProbes = 0;
+	uint32_t slot = FS_ProbeFileTable( table, name, FS_HashFileName( name ), &numProbes );
+	if( table->slots[ slot ] != 0 ) {
+		return;
+	}
+
+	if( table->numEntries == table->maxEntries ) {
+		table->maxEntries = table->maxEntries == 0 ? 1024 : table->maxEntries * 2;
+
+		FileTableEntry *entries = static_cast<FileTableEntry *>( Z_Malloc( sizeof( FileTableEntry ) * table->maxEntries ) );
+		if( table->entries != NULL ) {
+			memcpy( entries, table->entries, sizeof( FileTableEntry ) * table->numEntries );
+			Z_Free( table->entries );
+		}
+
+		table->entries = entries;
+	}
+
+	size_t nameLength = strlen( name ) + 1;
+	if( table->namesLength + nameLength > table->maxNamesLength ) {
+		size_t maxNamesLength = table->maxNamesLength == 0 ? 65536 : table->maxNamesLength;
+		while( table->namesLength + nameLength > maxNamesLength ) {
+			maxNamesLength *= 2;
+		}
+
+		char *names = static_cast<char *>( Z_Malloc( maxNamesLength ) );
+		if( table->names != NULL ) {
+			memcpy( names, table->names, table->namesLength );
+			Z_Free( table->names );
+		}
+
+		table->names = names;
+		table->maxNamesLength = maxNamesLength;
+	}
+
+	FileTableEntry *entry = &table->entries[ table->numEntries ];
+	entry->nameOffset = (uint32_t)table->namesLength;
+	entry->search = search;
+	entry->package = package;
+	entry->index = index;
+
+	memcpy( table->names + table->namesLength, name, nameLength );
+	table->namesLength += nameLength;
+
+	table->slots[ slot ] = ++table->numEntries;
+}
+
+static const FileTableEntry *FS_LookupFileTable( const FileTable *table, const char *name ) {
+	fs_numLookups++;
+
+	if( table->slots == NULL ) {
+		fs_numLookupMisses++;
+		return NULL;
+	}
+
+	unsigned int numProbes = 0;
+	uint32_t slot = FS_ProbeFileTable( table, name, FS_HashFileName( name ), &numProbes );
+
+	fs_numProbes += numProbes;
+	if( numProbes > fs_maxProbes ) {
+		fs_maxProbes = numProbes;
+	}
+
+	if( table->slots[ slot ] == 0 ) {
+		fs_numLookupMisses++;
+		return NULL;
+	}
+
+	return &table->entries[ table->slots[ slot ] - 1 ];
+}
+
+char **FS_ListFiles( char *findname, int *numfiles, unsigned musthave, unsigned canthave );
+
+/**
+ * Recursively add all the loose files under the given search path.
+ */
+static void FS_AddLooseFilesToTable( FileTable *table, const searchpath_t *search, const char *directory, int depth ) {
+	/* guard against symlink loops */
+	if( depth > 16 ) {
+		return;
+	}
+
+	char findname[ MAX_OSPATH ];
+	Com_sprintf( findname, sizeof( findname ), "%s/*", directory );
+
+	size_t rootLength = strlen( search->filename ) + 1;
+
+	/* not every platform honours the subdirectory flags, so check each one ourselves */
+	int numFiles;
+	char **files = FS_ListFiles( findname, &numFiles, 0, SFF_HIDDEN | SFF_SYSTEM );
+	if( files == NULL ) {
+		return;
+	}
+
+	for( int i = 0; i < numFiles - 1; ++i ) {
+		FS_CanonicalisePath( files[ i ] );
+
+		struct stat stats;
+		if( stat( files[ i ], &stats ) == 0 ) {
+			if( S_ISDIR( stats.st_mode ) ) {
+				FS_AddLooseFilesToTable( table, search, files[ i ], depth + 1 );
+			} else if( strlen( files[ i ] ) > rootLength ) {
+				FS_InsertFileTableEntry( table, files[ i ] + rootLength, search, NULL, NULL );
+			}
+		}
+
+		free( files[ i ] );
+	}
+
+	free( files );
+}
+
+/**
+ * Throw away the table and build it again from the current search path.
+ * Within each search path loose files take priority over packages, and
+ * earlier search paths take priority over later ones.
+ */
+static void FS_RebuildFileTable( void ) {
+	FS_ClearFileTable( &fs_fileTable );
+
+	for( searchpath_t *search = fs_searchpaths; search; search = search->next ) {
+		FS_AddLooseFilesToTable( &fs_fileTable, search, search->filename, 0 );
+
+		LinkedListNode *node = LL_GetRootNode( search->packDirectories );
+		while( node != NULL ) {
+			Package *package = (Package *)LL_GetLinkedListNodeUserData( node );
+			for( unsigned int i = 0; i < package->numFiles; ++i ) {
+				char name[ MAX_OSPATH ];
+				Com_sprintf( name, sizeof( name ), "%s/%s", package->mappedDir, package->indices[ i ].name );
+				FS_InsertFileTableEntry( &fs_fileTable, name, search, package, &package->indices[ i ] );
+			}
+
+			node = LL_GetNextLinkedListNode( node );
+		}
+	}
+
+	Com_DPrintf( "FS_RebuildFileTable: %u files\n", fs_fileTable.numEntries );
+}
+
+/*
+============
+FS_AddLocalFile
+
+Makes a file the engine has just written somewhere in the search
+path, such as a demo, visible without rescanning everything
+============
+*/
+void FS_AddLocalFile( const char *path ) {
+	char name[ MAX_OSPATH ];
+	Com_sprintf( name, sizeof( name ), "%s", path );
+	FS_CanonicalisePath( name );
+
+	for( searchpath_t *search = fs_searchpaths; search; search = search->next ) {
+		char root[ MAX_OSPATH ];
+		Com_sprintf( root, sizeof( root ), "%s", search->filename );
+		FS_CanonicalisePath( root );
+
+		size_t rootLength = strlen( root );
+		if( strncmp( name, root, rootLength ) != 0 || name[ rootLength ] != '/' || name[ rootLength + 1 ] == '\0' ) {
+			continue;
+		}
+
+		const char *relative = name + rootLength + 1;
+		const FileTableEntry *entry = FS_LookupFileTable( &fs_fileTable, relative );
+		if( entry == NULL ) {
+			FS_InsertFileTableEntry( &fs_fileTable, relative, search, NULL, NULL );
+		} else if( entry->package != NULL || entry->search != search ) {
+			/* something else already had the name, so let a rebuild decide which one wins */
+			FS_RebuildFileTable();
+		}
+
+		return;
+	}
+}
+
+/*
+============
+FS_Rescan
+
+Picks up any files that have been added to, or removed from,
+the search path since it was last scanned
+============
+*/
+void FS_Rescan( void ) {
+	FS_RebuildFileTable();
+}
+
+
+/*
+
+All of Quake's data access is through a hierchal file system, but the contents of the file system can be transparently merged from several sources.
+
+The "base directory" is the path to the directory holding the quake.exe and all game directories.  The sys_* files pass this to host_init in quakeparms_t->basedir.  This can be overridden with the "-basedir" command line parm to allow code debugging in a different directory.  The base directory is
+only used during filesystem initialization.
+
+The "game directory" is the first tree on the search path and directory that all generated files (savegames, screenshots, demos, config files) will be saved to.  This can be overridden with the "-game" command line parameter.  The game directory can never be changed while quake is executing.  This is a precacution against having a malicious server instruct clients to write files over areas they shouldn't.
+
+*/
+
+/**
+ * Stat a file to fetch it's size. Only works for local files.
+ */
+int FS_GetLocalFileLength( const char *path ) {
+	struct stat buf;
+	if( stat( path, &buf ) != 0 ) {
+		return -1;
+	}
+
+	return (int)buf.st_size;
+}
+
+/*
+============
+FS_CreatePath
+
+Creates any directories needed to store the given filename
+============
+*/
+void FS_CreatePath( char *path ) {
+	for( char *ofs = path + 1; *ofs; ofs++ ) {
+		if( *ofs == '/' ) {	// create the directory
+			*ofs = 0;
+			Sys_Mkdir( path );
+			*ofs = '/';
+		}
+	}
+}
+
+/**
+ * Check if the given file exists locally. Only works for local files.
+ */
+bool FS_LocalFileExists( const char *path ) {
+	struct stat stats;
+	if( stat( path, &stats ) == 0 ) {
+		return true;
+	}
+
+	return false;
+}
+
+/**
+ * Locate the given file within the search path. If it exists as a loose
+ * file, the returned package is null and netpath holds the local path.
+ */
+static bool FS_FindFile( const char *filename, char *netpath, size_t netpathLength, const Package **outPackage, const PackageIndex **outIndex ) {
+	*outPackage = NULL;
+	*outIndex = NULL;
+
+	char name[ MAX_OSPATH ];
+	Com_sprintf( name, sizeof( name ), "%s", filename );
+	FS_CanonicalisePath( name );
+
+	const FileTableEntry *entry = FS_LookupFileTable( &fs_fileTable, name );
+	if( entry == NULL ) {
+		return false;
+	}
+
+	if( entry->package != NULL ) {
+		*outPackage = entry->package;
+		*outIndex = entry->index;
+		return true;
+	}
+
+	/* use the name as it was found on disk, which may differ in case */
+	Com_sprintf( netpath, netpathLength, "%s/%s", entry->search->filename, fs_fileTable.names + entry->nameOffset );
+
+	Com_DPrintf( "FindFile: %s\n", netpath );
+
+	return true;
+}
+
+/**
+ * Check if the given file exists anywhere in the search path, without
+ * reading any of it.
+ */
+bool FS_FileExists( const char *path ) {
+	char netpath[ MAX_OSPATH ];
+	const Package *package;
+	const PackageIndex *fileIndex;
+	return FS_FindFile( path, netpath, sizeof( netpath ), &package, &fileIndex );
+}
+
+/*
+===========
+FS_FOpenFile
+
+Finds the file in the search path and loads it into memory,
+returning the buffer and its length. Package entries may be
+shared, loose files are always read into a buffer of their own
+===========
+*/
+static const uint8_t *FS_FOpenFile( const char *filename, uint32_t *length ) {
+	char netpath[ MAX_OSPATH ];
+	const Package *package;
+	const PackageIndex *fileIndex;
+	if( FS_FindFile( filename, netpath, sizeof( netpath ), &package, &fileIndex ) ) {
+		if( package != NULL ) {
+			const uint8_t *buffer = FS_LoadPackageFile( package, fileIndex, length );
+			if( buffer != NULL ) {
+				return buffer;
+			}
+		} else {
+			FILE *filePtr = fopen( netpath, "rb" );
+			if( filePtr != NULL ) {
+				/* allocate a buffer and read the whole thing into memory */
+				fseek( filePtr, 0, SEEK_END );
+				uint32_t fileLength = ftell( filePtr );
+				fseek( filePtr, 0, SEEK_SET );
+
+				uint8_t *buffer = static_cast<uint8_t *>( Z_Malloc( fileLength ) );
+				fread( buffer, sizeof( uint8_t ), fileLength, filePtr );
+
+				fclose( filePtr );
+				*length = fileLength;
+
+				return buffer;
+			}
+		}
+	}
+
+	Com_DPrintf( "FindFile: can't find %s\n", filename );
+
+	return NULL;
+}
+
+/*
+=================
+FS_ReadFile
+
+Properly handles partial reads
+=================
+*/
+void CDAudio_Stop( void );
+#define	MAX_READ	0x10000		// read in blocks of 64k
+void FS_Read( void *buffer, int len, FILE *f ) {
+	int		block, remaining;
+	int		read;
+	byte *buf;
+	int		tries;
+
+	buf = (byte *)buffer;
+
+	// read in chunks for progress bar
+	remaining = len;
+	tries = 0;
+	while( remaining ) {
+		block = remaining;
+		if( block > MAX_READ )
+			block = MAX_READ;
+		read = fread( buf, 1, block, f );
+		if( read == 0 ) {
+			// we might have been trying to read from a CD
+			if( !tries ) {
+				tries = 1;
+				CDAudio_Stop();
+			} else
+				Com_Error( ERR_FATAL, "FS_Read: 0 bytes read" );
+		}
+
+		if( read == -1 )
+			Com_Error( ERR_FATAL, "FS_Read: -1 bytes read" );
+
+		// do some progress bar thing here...
+
+		remaining -= read;
+		buf += read;
+	}
+}
+
+/*
+============
+FS_Prefetch
+
+Queue up the given files to be inflated in the background,
+ahead of them being requested through FS_LoadFile
+============
+*/
+void FS_Prefetch( const char **names, int count ) {
+	if( fs_prefetch == NULL || fs_prefetch->value == 0.0f ) {
+		return;
+	}
+
+	int numQueued = 0;
+	for( int i = 0; i < count; ++i ) {
+		if( names[ i ] == NULL || names[ i ][ 0 ] == '\0' ) {
+			continue;
+		}
+
+		char netpath[ MAX_OSPATH ];
+		const Package *package;
+		const PackageIndex *fileIndex;
+		if( !FS_FindFile( names[ i ], netpath, sizeof( netpath ), &package, &fileIndex ) || package == NULL ) {
+			continue;
+		}
+
+		/* stored entries are served from the mapping, so there's no work to do */
+		if( FS_IsPackageFileStored( fileIndex ) ) {
+			continue;
+		}
+
+		if( (size_t)fileIndex->offset + fileIndex->compressedLength > package->mappingLength ) {
+			continue;
+		}
+
+		if( FS_FindPrefetchJob( package, fileIndex ) != NULL ) {
+			continue;
+		}
+
+		/* skip anything that's already sitting in the cache */
+		bool isCached = false;
+		for( FileCacheEntry *entry = fs_cacheKeyHash[ FS_HashCachePointer( fileIndex ) ]; entry != NULL; entry = entry->keyNext ) {
+			if( entry->index == fileIndex && entry->package == package ) {
+				isCached = true;
+				break;
+			}
+		}
+
+		if( isCached ) {
+			continue;
+		}
+
+		/* something smaller further down the list may still fit */
+		if( fs_prefetchBytes + fileIndex->length > PREFETCH_MAX_BYTES ) {
+			continue;
+		}
+
+		FS_StartPrefetchWorkers();
+
+		PrefetchJob *job = static_cast<PrefetchJob *>( Z_Malloc( sizeof( PrefetchJob ) ) );
+		job->package = package;
+		job->index = fileIndex;
+		job->data = static_cast<uint8_t *>( Z_Malloc( fileIndex->length ) );
+		job->state = PREFETCH_QUEUED;
+
+		unsigned int slot = FS_HashCachePointer( fileIndex );
+		job->hashNext = fs_prefetchHash[ slot ];
+		fs_prefetchHash[ slot ] = job;
+
+		fs_prefetchBytes += fileIndex->length;
+
+		{
+			std::lock_guard< std::mutex > lock( fs_prefetchSync->mutex );
+			if( fs_prefetchQueueTail != NULL ) {
+				fs_prefetchQueueTail->queueNext = job;
+			} else {
+				fs_prefetchQueueHead = job;
+			}
+
+			fs_prefetchQueueTail = job;
+		}
+
+		numQueued++;
+	}
+
+	fs_prefetchQueued += numQueued;
+
+	if( numQueued > 1 ) {
+		fs_prefetchSync->work.notify_all();
+	} else if( numQueued == 1 ) {
+		fs_prefetchSync->work.notify_one();
+	}
+}
+
+/*
+============
+FS_CancelPrefetch
+
+Drops everything that was prefetched but never claimed, waiting
+for any of it that's still being inflated
+============
+*/
+void FS_CancelPrefetch( void ) {
+	FS_FlushPrefetch( NULL );
+}
+
+/**
+ * Returns true if the given pointer lies within one of the mounted packages.
+ */
+static bool FS_IsMappedPointer( const void *buffer ) {
+	const uint8_t *p = static_cast<const uint8_t *>( buffer );
+	for( searchpath_t *s = fs_searchpaths; s; s = s->next ) {
+		LinkedListNode *node = LL_GetRootNode( s->packDirectories );
+		while( node != NULL ) {
+			Package *package = (Package *)LL_GetLinkedListNodeUserData( node );
+			if( p >= package->mapping && p < package->mapping + package->mappingLength ) {
+				return true;
+			}
+
+			node = LL_GetNextLinkedListNode( node );
+		}
+	}
+
+	return false;
+}
+
+/*
+============
+FS_LoadSharedFile
+
+As FS_LoadFile, but the buffer may be mapped straight from a package
+or shared with other callers through the cache, so it's read-only
+============
+*/
+int FS_LoadSharedFile( const char *path, const void **buffer ) {
+	// look for it in the filesystem or pack files
+	uint32_t length;
+	const uint8_t *buf = FS_FOpenFile( path, &length );
+	if( buf == NULL ) {
+		if( buffer != NULL ) {
+			*buffer = NULL;
+		}
+
+		return -1;
+	}
+
+	/* retain compat for fetching the length, for now */
+	if( buffer == NULL ) {
+		FS_FreeSharedFile( buf );
+
+		return length;
+	}
+
+	*buffer = buf;
+
+	return length;
+}
+
+/*
+============
+FS_LoadFile
+
+Filename are reletive to the quake search path
+a null buffer will just return the file length without loading
+============
+*/
+int FS_LoadFile( const char *path, void **buffer ) {
+	const void *shared;
+	int length = FS_LoadSharedFile( path, buffer != NULL ? &shared : NULL );
+	if( buffer == NULL || length == -1 ) {
+		if( buffer != NULL ) {
+			*buffer = NULL;
+		}
+
+		return length;
+	}
 
-	package->header = header;
-	package->numFiles = numFiles;
+	/* callers are free to write to what they get back, so anything
+	   that someone else could also be holding has to be copied */
+	if( !FS_IsMappedPointer( shared ) && FS_FindCacheEntryByData( shared ) == NULL ) {
+		*buffer = const_cast<void *>( shared );
+		return length;
+	}
 
-	/* seek to the table of contents */
-	fseek( filePtr, package->header.tocOffset, SEEK_SET );
+	*buffer = Z_Malloc( length );
+	memcpy( *buffer, shared, length );
+	FS_FreeSharedFile( shared );
 
-	/* and now read in the table of contents */
-	package->indices = static_cast<PackageIndex *>( Z_Malloc( sizeof( PackageIndex ) * package->numFiles ) );
-	if( fread( package->indices, sizeof( PackageIndex ), package->numFiles, filePtr ) != package->numFiles ) {
-		Z_Free( package->indices );
-		Z_Free( package );
+	return length;
+}
 
-		Com_Printf( "WARNING: Failed to read entire table of contents!\n" );
-		return NULL;
+/*
+=============
+FS_FreeSharedFile
+=============
+*/
+void FS_FreeSharedFile( const void *buffer ) {
+	/* stored package entries are handed out straight from the mapping */
+	if( FS_IsMappedPointer( buffer ) ) {
+		return;
 	}
 
-	/* flip back slash to forward */
-	for( unsigned int i = 0; i < package->numFiles; ++i ) {
-		FS_CanonicalisePath( package->indices[ i ].name );
+	if( FS_ReleaseCachedFile( buffer ) ) {
+		return;
 	}
 
-	return package;
+	Z_Free( const_cast<void *>( buffer ) );
 }
 
-//
-// in memory
-//
+/*
+=============
+FS_FreeFile
+=============
+*/
+void FS_FreeFile( void *buffer ) {
+	FS_FreeSharedFile( buffer );
+}
 
-static char fs_gamedir[ MAX_OSPATH ];
-static cvar_t *fs_basedir;
-static cvar_t *fs_cddir;
+/*
+=============================================================================
 
-cvar_t *fs_gamedirvar;
+STREAMING
 
-typedef struct searchpath_s {
-	char				filename[ MAX_OSPATH ];
-	LinkedList *packDirectories;
-	struct searchpath_s *next;
-} searchpath_t;
+Streams let large files, such as cinematics, be read a piece at a time
+rather than being loaded in whole. Compressed package entries are inflated
+incrementally into a ring the size of the deflate window, so only that
+much of the file is ever resident.
 
-static searchpath_t *fs_searchpaths;
-static searchpath_t *fs_base_searchpaths;	// without gamedirs
+=============================================================================
+*/
 
+enum {
+	STREAM_LOOSE,
+	STREAM_STORED,
+	STREAM_COMPRESSED,
+};
+
+typedef struct FileStream {
+	int					type;
+	uint32_t			length;		/* decompressed length */
+	uint32_t			position;
+
+	FILE *filePtr;	/* STREAM_LOOSE */
+
+	const uint8_t *src;		/* STREAM_STORED and STREAM_COMPRESSED */
+	uint32_t			srcLength;
+	uint32_t			srcPosition;
+
+	/* STREAM_COMPRESSED */
+	tinfl_decompressor	inflator;
+	int					inflateStatus;
+	uint32_t			ringPosition;	/* where the next inflated block goes */
+	uint32_t			blockPosition;	/* start of the last inflated block */
+	uint32_t			readPosition;	/* start of the unread bytes */
+	uint32_t			numAvailable;	/* unread bytes following readPosition */
+	uint8_t				ring[ TINFL_LZ_DICT_SIZE ];
+} FileStream;
+
+static void FS_RewindStream( FileStream *stream ) {
+	stream->position = 0;
+	stream->srcPosition = 0;
+
+	if( stream->type == STREAM_COMPRESSED ) {
+		tinfl_init( &stream->inflator );
+		stream->inflateStatus = TINFL_STATUS_NEEDS_MORE_INPUT;
+		stream->ringPosition = 0;
+		stream->blockPosition = 0;
+		stream->readPosition = 0;
+		stream->numAvailable = 0;
+	}
+}
 
 /*
+============
+FS_OpenStream
 
-All of Quake's data access is through a hierchal file system, but the contents of the file system can be transparently merged from several sources.
+Opens the given file for reading a piece at a time,
+returns null if it can't be found
+============
+*/
+FileStream *FS_OpenStream( const char *path ) {
+	char netpath[ MAX_OSPATH ];
+	const Package *package;
+	const PackageIndex *fileIndex;
+	if( !FS_FindFile( path, netpath, sizeof( netpath ), &package, &fileIndex ) ) {
+		Com_DPrintf( "FS_OpenStream: can't find %s\n", path );
+		return NULL;
+	}
 
-The "base directory" is the path to the directory holding the quake.exe and all game directories.  The sys_* files pass this to host_init in quakeparms_t->basedir.  This can be overridden with the "-basedir" command line parm to allow code debugging in a different directory.  The base directory is
-only used during filesystem initialization.
+	FileStream *stream;
+	if( package == NULL ) {
+		FILE *filePtr = fopen( netpath, "rb" );
+		if( filePtr == NULL ) {
+			return NULL;
+		}
 
-The "game directory" is the first tree on the search path and directory that all generated files (savegames, screenshots, demos, config files) will be saved to.  This can be overridden with the "-game" command line parameter.  The game directory can never be changed while quake is executing.  This is a precacution against having a malicious server instruct clients to write files over areas they shouldn't.
+		/* loose files don't need the ring */
+		stream = static_cast<FileStream *>( Z_Malloc( offsetof( FileStream, inflator ) ) );
+		stream->type = STREAM_LOOSE;
+		stream->filePtr = filePtr;
 
-*/
+		fseek( filePtr, 0, SEEK_END );
+		stream->length = ftell( filePtr );
+		fseek( filePtr, 0, SEEK_SET );
+	} else {
+		if( (size_t)fileIndex->offset + fileIndex->compressedLength > package->mappingLength ) {
+			Com_Printf( "WARNING: \"%s\" lies outside of package \"%s\"!\n", fileIndex->name, package->path );
+			return NULL;
+		}
 
-/**
- * Stat a file to fetch it's size. Only works for local files.
- */
-int FS_GetLocalFileLength( const char *path ) {
-	struct stat buf;
-	if( stat( path, &buf ) != 0 ) {
-		return -1;
+		if( FS_IsPackageFileStored( fileIndex ) ) {
+			stream = static_cast<FileStream *>( Z_Malloc( offsetof( FileStream, inflator ) ) );
+			stream->type = STREAM_STORED;
+		} else {
+			stream = static_cast<FileStream *>( Z_Malloc( sizeof( FileStream ) ) );
+			stream->type = STREAM_COMPRESSED;
+		}
+
+		stream->src = package->mapping + fileIndex->offset;
+		stream->srcLength = fileIndex->compressedLength;
+		stream->length = fileIndex->length;
 	}
 
-	return (int)buf.st_size;
+	FS_RewindStream( stream );
+
+	return stream;
 }
 
 /*
 ============
-FS_CreatePath
-
-Creates any directories needed to store the given filename
+FS_CloseStream
 ============
 */
-void FS_CreatePath( char *path ) {
-	for( char *ofs = path + 1; *ofs; ofs++ ) {
-		if( *ofs == '/' ) {	// create the directory
-			*ofs = 0;
-			Sys_Mkdir( path );
-			*ofs = '/';
-		}
+void FS_CloseStream( FileStream *stream ) {
+	if( stream->type == STREAM_LOOSE ) {
+		fclose( stream->filePtr );
 	}
+
+	Z_Free( stream );
 }
 
 /**
- * Check if the given file exists locally. Only works for local files.
+ * Inflate the next block into the ring. Returns false once there's
+ * nothing more to be had.
  */
-bool FS_LocalFileExists( const char *path ) {
-	struct stat stats;
-	if( stat( path, &stats ) == 0 ) {
-		return true;
+static bool FS_InflateStream( FileStream *stream ) {
+	if( stream->inflateStatus <= TINFL_STATUS_DONE ) {
+		return false;
 	}
 
-	return false;
-}
+	size_t inBytes = stream->srcLength - stream->srcPosition;
+	size_t outBytes = TINFL_LZ_DICT_SIZE - stream->ringPosition;
+	stream->inflateStatus = tinfl_decompress( &stream->inflator,
+	                                          stream->src + stream->srcPosition, &inBytes,
+	                                          stream->ring, stream->ring + stream->ringPosition, &outBytes,
+	                                          TINFL_FLAG_PARSE_ZLIB_HEADER );
+	stream->srcPosition += inBytes;
 
-/*
-===========
-FS_FOpenFile
+	if( stream->inflateStatus < TINFL_STATUS_DONE ) {
+		Com_Printf( "Failed to decompress stream, return code \"%d\"!\n", stream->inflateStatus );
+		return false;
+	}
 
-Finds the file in the search path.
-returns filesize and an open FILE *
-Used for streaming data out of either a pak file or
-a seperate file.
-===========
-*/
-uint8_t *FS_FOpenFile( const char *filename, uint32_t *length ) {
-	/* search through the path, one element at a time */
-	for( searchpath_t *search = fs_searchpaths; search; search = search->next ) {
-		// check a file in the directory tree
-		char netpath[ MAX_OSPATH ];
-		Com_sprintf( netpath, sizeof( netpath ), "%s/%s", search->filename, filename );
+	stream->blockPosition = stream->ringPosition;
+	stream->readPosition = stream->ringPosition;
+	stream->numAvailable = outBytes;
+	stream->ringPosition = ( stream->ringPosition + outBytes ) & ( TINFL_LZ_DICT_SIZE - 1 );
 
-		FS_CanonicalisePath( netpath );
+	return outBytes > 0;
+}
 
-		Com_DPrintf( "FindFile: %s\n", netpath );
+/*
+============
+FS_ReadStream
 
-		/* first, attempt to open it locally */
-		uint32_t fileLength = FS_GetLocalFileLength( netpath );
-		if( fileLength >= 0 ) {
-			FILE *filePtr = fopen( netpath, "rb" );
-			if( filePtr != NULL ) {
-				/* allocate a buffer and read the whole thing into memory */
-				uint8_t *buffer = static_cast<uint8_t *>( Z_Malloc( fileLength ) );
-				fread( buffer, sizeof( uint8_t ), fileLength, filePtr );
+Reads up to length bytes into the buffer, which may be null to skip
+them, and returns how many were actually read
+============
+*/
+int FS_ReadStream( FileStream *stream, void *buffer, int length ) {
+	if( length <= 0 ) {
+		return 0;
+	}
 
-				fclose( filePtr );
-				*length = fileLength;
+	uint32_t numRemaining = stream->length - stream->position;
+	if( (uint32_t)length > numRemaining ) {
+		length = numRemaining;
+	}
 
-				return buffer;
+	uint8_t *dst = static_cast<uint8_t *>( buffer );
+	int numRead = 0;
+	switch( stream->type ) {
+		case STREAM_LOOSE:
+			if( dst == NULL ) {
+				fseek( stream->filePtr, length, SEEK_CUR );
+				numRead = length;
+			} else {
+				numRead = fread( dst, 1, length, stream->filePtr );
 			}
-		}
-
-		/* otherwise, load it from one of the anox packages */
-
-		/* Anachronox does some horrible path munging in order to determine which package
-		 * it should be loading from, so we need to grab the first dir here to do the same. */
-		char rootFolder[ 32 ];
-		memset( rootFolder, 0, sizeof( rootFolder ) );
-		const char *p = filename;
-		for( unsigned int i = 0; i < sizeof( rootFolder ) - 4; ++i ) {
-			if( *p == '\0' || *p == '/' ) {
-				break;
+			break;
+		case STREAM_STORED:
+			if( dst != NULL ) {
+				memcpy( dst, stream->src + stream->position, length );
 			}
+			numRead = length;
+			break;
+		case STREAM_COMPRESSED:
+			while( numRead < length ) {
+				if( stream->numAvailable == 0 && !FS_InflateStream( stream ) ) {
+					break;
+				}
 
-			rootFolder[ i ] = *p++;
-		}
-		p++;
-
-		/* see if we have a match! */
-		LinkedListNode *node = LL_GetRootNode( search->packDirectories );
-		while( node != NULL ) {
-			Package *package = (Package *)LL_GetLinkedListNodeUserData( node );
-			if( package == NULL ) {
-				break;
-			}
+				uint32_t numBytes = stream->numAvailable;
+				if( numBytes > (uint32_t)( length - numRead ) ) {
+					numBytes = length - numRead;
+				}
 
-			if( strcmp( rootFolder, package->mappedDir ) == 0 ) {
-				/* we've got a match! */
-				uint8_t *buffer = FS_LoadPackageFile( package, p, length );
-				if( buffer != NULL ) {
-					return buffer;
+				if( dst != NULL ) {
+					memcpy( dst + numRead, stream->ring + stream->readPosition, numBytes );
 				}
 
-				break;
+				stream->readPosition += numBytes;
+				stream->numAvailable -= numBytes;
+				numRead += numBytes;
 			}
-
-			node = LL_GetNextLinkedListNode( node );
-		}
+			break;
 	}
 
-	Com_DPrintf( "FindFile: can't find %s\n", filename );
+	stream->position += numRead;
 
-	return NULL;
+	return numRead;
 }
 
 /*
-=================
-FS_ReadFile
+============
+FS_SeekStream
 
-Properly handles partial reads
-=================
+Works like fseek. Seeking backwards within a compressed
+entry means inflating it again from the start
+============
 */
-void CDAudio_Stop( void );
-#define	MAX_READ	0x10000		// read in blocks of 64k
-void FS_Read( void *buffer, int len, FILE *f ) {
-	int		block, remaining;
-	int		read;
-	byte *buf;
-	int		tries;
-
-	buf = (byte *)buffer;
+bool FS_SeekStream( FileStream *stream, int offset, int whence ) {
+	int64_t target;
+	switch( whence ) {
+		case SEEK_SET:
+			target = offset;
+			break;
+		case SEEK_CUR:
+			target = (int64_t)stream->position + offset;
+			break;
+		case SEEK_END:
+			target = (int64_t)stream->length + offset;
+			break;
+		default:
+			return false;
+	}
 
-	// read in chunks for progress bar
-	remaining = len;
-	tries = 0;
-	while( remaining ) {
-		block = remaining;
-		if( block > MAX_READ )
-			block = MAX_READ;
-		read = fread( buf, 1, block, f );
-		if( read == 0 ) {
-			// we might have been trying to read from a CD
-			if( !tries ) {
-				tries = 1;
-				CDAudio_Stop();
-			} else
-				Com_Error( ERR_FATAL, "FS_Read: 0 bytes read" );
-		}
+	if( target < 0 || target > stream->length ) {
+		return false;
+	}
 
-		if( read == -1 )
-			Com_Error( ERR_FATAL, "FS_Read: -1 bytes read" );
+	switch( stream->type ) {
+		case STREAM_LOOSE:
+			if( fseek( stream->filePtr, (long)target, SEEK_SET ) != 0 ) {
+				return false;
+			}
+			stream->position = (uint32_t)target;
+			return true;
+		case STREAM_STORED:
+			stream->position = (uint32_t)target;
+			return true;
+		default:
+			break;
+	}
 
-		// do some progress bar thing here...
+	/* see if it's still within the last block we inflated */
+	if( target <= stream->position ) {
+		uint32_t distance = stream->position - (uint32_t)target;
+		if( distance <= stream->readPosition - stream->blockPosition ) {
+			stream->readPosition -= distance;
+			stream->numAvailable += distance;
+			stream->position -= distance;
+			return true;
+		}
 
-		remaining -= read;
-		buf += read;
+		FS_RewindStream( stream );
 	}
+
+	uint32_t numToSkip = (uint32_t)target - stream->position;
+	return FS_ReadStream( stream, NULL, numToSkip ) == (int)numToSkip;
 }
 
 /*
 ============
-FS_LoadFile
-
-Filename are reletive to the quake search path
-a null buffer will just return the file length without loading
+FS_TellStream
 ============
 */
-int FS_LoadFile( const char *path, void **buffer ) {
-	// look for it in the filesystem or pack files
-	uint32_t length;
-	uint8_t *buf = FS_FOpenFile( path, &length );
-	if( buf == NULL ) {
-		if( buffer != NULL ) {
-			*buffer = NULL;
-		}
-
-		return -1;
-	}
-
-	/* retain compat for fetching the length, for now */
-	if( buffer == NULL ) {
-		Z_Free( buf );
-
-		return length;
-	}
-
-	*buffer = buf;
-
-	return length;
+int FS_TellStream( const FileStream *stream ) {
+	return stream->position;
 }
 
 /*
-=============
-FS_FreeFile
-=============
+============
+FS_GetStreamLength
+============
 */
-void FS_FreeFile( void *buffer ) {
-	Z_Free( buffer );
+int FS_GetStreamLength( const FileStream *stream ) {
+	return stream->length;
 }
 
 /*
@@ -487,29 +1926,36 @@ static void FS_AddGameDirectory( const char *dir ) {
 		"textures",
 	};
 
+	/* a rebuilt .opk takes priority over the original .dat */
+	static const char *packExtensions[] = {
+		".opk",
+		".dat",
+	};
+
 	search->packDirectories = LL_CreateLinkedList();
 	for( uint8_t i = 0; i < ARRAY_LENGTH( defaultPacks ); ++i ) {
-		/* check a file in the directory tree, e.g. 'anoxdata/battle.dat' */
-		char packPath[ MAX_OSPATH ];
-		snprintf( packPath, sizeof( packPath ), "%s/%s.dat", search->filename, defaultPacks[ i ] );
+		/* check a file in the directory tree, e.g. 'anoxdata/battle.opk', falling back to 'anoxdata/battle.dat' */
+		Package *package = NULL;
+		for( uint8_t j = 0; j < ARRAY_LENGTH( packExtensions ) && package == NULL; ++j ) {
+			char packPath[ MAX_OSPATH ];
+			int packPathLength = snprintf( packPath, sizeof( packPath ), "%s/%s%s", search->filename, defaultPacks[ i ], packExtensions[ j ] );
+			if( packPathLength < 0 || packPathLength >= (int)sizeof( packPath ) ) {
+				Com_Printf( "WARNING: Path to package \"%s%s\" is too long, skipping!\n", defaultPacks[ i ], packExtensions[ j ] );
+				continue;
+			}
 
-		FILE *filePtr = fopen( packPath, "rb" );
-		if( filePtr == NULL ) {
-			continue;
+			package = FS_MountPackage( packPath, defaultPacks[ i ] );
 		}
 
-		Package *package = FS_MountPackage( filePtr, defaultPacks[ i ] );
-
-		fclose( filePtr );
-
 		if( package == NULL ) {
 			continue;
 		}
 
 		/* if it loaded successfully, add it onto the list */
 		package->nodeIndex = LL_InsertLinkedListNode( search->packDirectories, package );
-		strcpy( package->path, packPath );
 	}
+
+	FS_RebuildFileTable();
 }
 
 /*
@@ -570,8 +2016,7 @@ void FS_SetGamedir( const char *dir ) {
 			while( node != NULL ) {
 				Package *package = (Package *)LL_GetLinkedListNodeUserData( node );
 
-				Z_Free( package->indices );
-				Z_Free( package );
+				FS_FreePackage( package );
 
 				node = LL_GetNextLinkedListNode( node );
 			}
@@ -584,6 +2029,9 @@ void FS_SetGamedir( const char *dir ) {
 		fs_searchpaths = next;
 	}
 
+	/* the table still points at everything we just freed */
+	FS_RebuildFileTable();
+
 	//
 	// flush all data, so it will be forced to reload
 	//
@@ -718,6 +2166,100 @@ void FS_Path_f( void ) {
 			node = LL_GetNextLinkedListNode( node );
 		}
 	}
+
+	Com_Printf( "File cache: %u entries, %u/%u KB\n", fs_cacheNumEntries, (unsigned int)( fs_cacheBytes / 1024 ), (unsigned int)( FS_GetCacheBudget() / 1024 ) );
+	Com_Printf( " %u hits, %u misses, %u evictions\n", fs_cacheHits, fs_cacheMisses, fs_cacheEvictions );
+	Com_Printf( "Prefetch: %u threads, %u queued, %u used, %u waited, %u KB pending\n", fs_numPrefetchThreads, fs_prefetchQueued, fs_prefetchHits, fs_prefetchWaits, (unsigned int)( fs_prefetchBytes / 1024 ) );
+}
+
+/*
+============
+FS_Stats_f
+
+Reports how the file table is performing
+============
+*/
+static void FS_Stats_f( void ) {
+	unsigned int numLoose = 0;
+	for( unsigned int i = 0; i < fs_fileTable.numEntries; ++i ) {
+		if( fs_fileTable.entries[ i ].package == NULL ) {
+			numLoose++;
+		}
+	}
+
+	Com_Printf( "%u files (%u loose, %u packaged), %u slots, %u KB of names\n",
+	            fs_fileTable.numEntries, numLoose, fs_fileTable.numEntries - numLoose,
+	            fs_fileTable.slots != NULL ? fs_fileTable.slotMask + 1 : 0, (unsigned int)( fs_fileTable.namesLength / 1024 ) );
+	Com_Printf( "%u lookups, %u misses\n", fs_numLookups, fs_numLookupMisses );
+	if( fs_numLookups > 0 ) {
+		Com_Printf( "%.2f average probes, %u max probes\n", (float)fs_numProbes / fs_numLookups, fs_maxProbes );
+	}
+}
+
+/*
+============
+FS_Bench_f
+
+Times lookups against a table built from a synthetic package,
+so changes to the file table can be compared without needing
+the game data
+============
+*/
+static void FS_Bench_f( void ) {
+	static const unsigned int numBenchFiles = 4096;
+	static const unsigned int numBenchLookups = 100000;
+
+	Package *package = static_cast<Package *>( Z_Malloc( sizeof( Package ) ) );
+	strcpy( package->mappedDir, "bench" );
+	package->numFiles = numBenchFiles;
+	package->indices = static_cast<PackageIndex *>( Z_Malloc( sizeof( PackageIndex ) * numBenchFiles ) );
+	for( unsigned int i = 0; i < numBenchFiles; ++i ) {
+		Com_sprintf( package->indices[ i ].name, sizeof( package->indices[ i ].name ), "Subdir%u/texture_%u.png", i % 37, i );
+	}
+
+	FileTable table;
+	memset( &table, 0, sizeof( FileTable ) );
+	for( unsigned int i = 0; i < numBenchFiles; ++i ) {
+		char name[ MAX_OSPATH ];
+		Com_sprintf( name, sizeof( name ), "%s/%s", package->mappedDir, package->indices[ i ].name );
+		FS_InsertFileTableEntry( &table, name, NULL, package, &package->indices[ i ] );
+	}
+
+	/* don't pollute the real counters */
+	unsigned int oldLookups = fs_numLookups, oldMisses = fs_numLookupMisses;
+	unsigned int oldProbes = fs_numProbes, oldMaxProbes = fs_maxProbes;
+	fs_numLookups = fs_numLookupMisses = fs_numProbes = fs_maxProbes = 0;
+
+	char names[ 64 ][ MAX_QPATH ];
+	for( unsigned int i = 0; i < 64; ++i ) {
+		/* every fourth name is a miss, the rest differ in case from the entry */
+		unsigned int entry = ( i * 97 ) % numBenchFiles;
+		if( ( i & 3 ) == 3 ) {
+			Com_sprintf( names[ i ], sizeof( names[ i ] ), "bench/subdir%u/missing_%u.png", entry % 37, entry );
+		} else {
+			Com_sprintf( names[ i ], sizeof( names[ i ] ), "BENCH/SUBDIR%u/TEXTURE_%u.PNG", entry % 37, entry );
+		}
+	}
+
+	unsigned int numFound = 0;
+	int startTime = Sys_Milliseconds();
+	for( unsigned int i = 0; i < numBenchLookups; ++i ) {
+		if( FS_LookupFileTable( &table, names[ i & 63 ] ) != nullptr ) {
+			numFound++;
+		}
+	}
+	int endTime = Sys_Milliseconds();
+
+	Com_Printf( "%u lookups (%u found) against %u entries in %i ms\n", numBenchLookups, numFound, numBenchFiles, endTime - startTime );
+	Com_Printf( "%.2f average probes, %u max probes\n", (float)fs_numProbes / fs_numLookups, fs_maxProbes );
+
+	fs_numLookups = oldLookups;
+	fs_numLookupMisses = oldMisses;
+	fs_numProbes = oldProbes;
+	fs_maxProbes = oldMaxProbes;
+
+	FS_ClearFileTable( &table );
+	FS_FreePackage( package );
 }
 
 /*
@@ -752,6 +2294,9 @@ FS_InitFilesystem
 void FS_InitFilesystem( void ) {
 	Cmd_AddCommand( "path", FS_Path_f );
 	Cmd_AddCommand( "dir", FS_Dir_f );
+	Cmd_AddCommand( "fs_stats", FS_Stats_f );
+	Cmd_AddCommand( "fs_bench", FS_Bench_f );
+	Cmd_AddCommand( "fs_rescan", FS_Rescan );
 
 	//
 	// basedir <path>
@@ -765,6 +2310,19 @@ void FS_InitFilesystem( void ) {
 	// allows the game to run from outside the data tree
 	//
 	fs_cddir = Cvar_Get( "cddir", "", CVAR_NOSET );
+
+	//
+	// fs_cachesize <megabytes>
+	// budget for keeping decompressed package entries around, 0 disables
+	//
+	fs_cachesize = Cvar_Get( "fs_cachesize", "32", CVAR_ARCHIVE );
+
+	//
+	// fs_prefetch <0/1>
+	// inflates precached files on worker threads during level load
+	//
+	fs_prefetch = Cvar_Get( "fs_prefetch", "1", CVAR_ARCHIVE );
+
 	if( fs_cddir->string[ 0 ] )
 		FS_AddGameDirectory( va( "%s/" BASEDIRNAME, fs_cddir->string ) );
 
@@ -80,6 +80,7 @@ typedef struct sizebuf_s {
 	size_t maxsize;
 	size_t cursize;
 	size_t readcount;
+	int bitpos;  // bits used of the last byte in a run of MSG_WriteBits / MSG_ReadBits
 } sizebuf_t;
 
 void SZ_Init( sizebuf_t *buf, byte *data, size_t length );
@@ -110,6 +111,13 @@ void MSG_WriteDeltaEntity( struct entity_state_s *from,
 	qboolean force, qboolean newentity );
 void MSG_WriteDir( sizebuf_t *sb, vec3_t vector );
 
+void MSG_WriteBits( sizebuf_t *sb, unsigned value, int bits );
+void MSG_WriteRemoveEntityBits( sizebuf_t *msg, int number, int *lastnum );
+void MSG_WriteDeltaEntityBits( struct entity_state_s *from,
+	struct entity_state_s *to, sizebuf_t *msg,
+	qboolean force, qboolean newentity, int *lastnum );
+void MSG_WriteEntityBitsEnd( sizebuf_t *msg );
+
 void MSG_BeginReading( sizebuf_t *sb );
 
 int MSG_ReadChar( sizebuf_t *sb );
@@ -131,6 +139,13 @@ void MSG_ReadDir( sizebuf_t *sb, vec3_t vector );
 
 void MSG_ReadData( sizebuf_t *sb, void *buffer, int size );
 
+unsigned MSG_ReadBits( sizebuf_t *sb, int bits );
+int MSG_ReadEntityBits( sizebuf_t *msg, int *lastnum, unsigned *bits );
+void MSG_ReadDeltaEntityBits( sizebuf_t *msg, struct entity_state_s *to,
+	unsigned bits );
+
+void MSG_EndBits( sizebuf_t *sb );
+
 //============================================================================
 
 extern qboolean bigendien;
@@ -178,6 +193,9 @@ PROTOCOL
 
 #define PROTOCOL_VERSION 34
 
+// optional extensions, offered after the userinfo in the connect packet
+#define PROTOCOL_EXT_BITENTITIES 1  // svc_bitentities in place of svc_packetentities
+
 //=========================================
 
 #define PORT_MASTER 27900
@@ -224,7 +242,8 @@ enum svc_ops_e {
 					svc_playerinfo,           // variable
 					svc_packetentities,       // [...]
 					svc_deltapacketentities,  // [...]
-					svc_frame
+					svc_frame,
+					svc_bitentities  // svc_packetentities, bit packed
 };
 
 //==============================================
@@ -642,8 +661,38 @@ trace_t CM_TransformedBoxTrace( vec3_t start, vec3_t end, vec3_t mins,
 	vec3_t maxs, int headnode, int brushmask,
 	vec3_t origin, vec3_t angles );
 
-byte *CM_ClusterPVS( int cluster );
-byte *CM_ClusterPHS( int cluster );
+// the same results as CM_BoxTrace on each request, but swept through the
+// tree several at a time
+void CM_BoxTraceBatch( const trace_req_t *reqs, trace_t *out, int n );
+
+// per-thread trace state, so traces on separate contexts can run concurrently
+typedef struct cmtrace_ctx_s cmtrace_ctx_t;
+
+void CM_Init( void );
+
+cmtrace_ctx_t *CM_CreateTraceContext( void );
+void CM_FreeTraceContext( cmtrace_ctx_t *ctx );
+// once a context has a box of its own, CM_HeadnodeForBox no longer affects it
+int CM_HeadnodeForBoxCtx( cmtrace_ctx_t *ctx, vec3_t mins, vec3_t maxs );
+trace_t CM_BoxTraceCtx( cmtrace_ctx_t *ctx, vec3_t start, vec3_t end,
+	vec3_t mins, vec3_t maxs, int headnode, int brushmask );
+trace_t CM_TransformedBoxTraceCtx( cmtrace_ctx_t *ctx, vec3_t start,
+	vec3_t end, vec3_t mins, vec3_t maxs, int headnode, int brushmask,
+	vec3_t origin, vec3_t angles );
+void CM_BoxTraceBatchCtx( cmtrace_ctx_t *ctx, const trace_req_t *reqs,
+	trace_t *out, int n );
+
+// rows are CM_VisRowBytes long, a multiple of 64, and stay valid until
+// the next map load when the whole matrix fits in cm_vismatrix megabytes;
+// otherwise until 64 other clusters of the same set have been asked for
+const byte *CM_ClusterPVS( int cluster );
+const byte *CM_ClusterPHS( int cluster );
+int CM_VisRowBytes( void );
+void CM_OrVis( byte *dst, const byte *src );
+
+static inline qboolean CM_VisTest( const byte *vis, int cluster ) {
+	return cluster >= 0 && ( vis[ cluster >> 3 ] & ( 1 << ( cluster & 7 ) ) ) != 0;
+}
 
 int CM_PointLeafnum( vec3_t p );
 
@@ -660,7 +709,7 @@ void CM_SetAreaPortalState( int portalnum, qboolean open );
 qboolean CM_AreasConnected( int area1, int area2 );
 
 int CM_WriteAreaBits( byte *buffer, int area );
-qboolean CM_HeadnodeVisible( int headnode, byte *visbits );
+qboolean CM_HeadnodeVisible( int headnode, const byte *visbits );
 
 void CM_WritePortalState( FILE *f );
 void CM_ReadPortalState( FILE *f );
@@ -696,10 +745,41 @@ void FS_ExecAutoexec( void );
 int FS_LoadFile( const char *path, void **buffer );
 // a null buffer will just return the file length without loading
 // a -1 length is not present
+// the buffer is the caller's own, and may be written to
+
+int FS_LoadSharedFile( const char *path, const void **buffer );
+// as FS_LoadFile, but saves a copy by handing out package data as it's
+// mapped or cached, so it must not be written to
+void FS_FreeSharedFile( const void *buffer );
+
+bool FS_FileExists( const char *path );
+// looks the file up in the search path without loading it
+
+void FS_Rescan( void );
+// picks up files added to or removed from the search path on disk
+void FS_AddLocalFile( const char *path );
+// makes a single file just written under the search path visible
+
+void FS_Prefetch( const char **names, int count );
+// starts inflating the given files in the background, so
+// that later FS_LoadFile calls for them don't need to wait
+void FS_CancelPrefetch( void );
+// frees whatever was prefetched and never loaded
 
 void FS_Read( void *buffer, int len, FILE *f );
 // properly handles partial reads
 
+typedef struct FileStream FileStream;
+
+FileStream *FS_OpenStream( const char *path );
+// reads a file a piece at a time, rather than loading it in whole
+void FS_CloseStream( FileStream *stream );
+int FS_ReadStream( FileStream *stream, void *buffer, int length );
+// returns the number of bytes read, a null buffer skips over them
+bool FS_SeekStream( FileStream *stream, int offset, int whence );
+int FS_TellStream( const FileStream *stream );
+int FS_GetStreamLength( const FileStream *stream );
+
 void FS_FreeFile( void *buffer );
 
 void FS_CreatePath( char *path );
@@ -733,7 +813,7 @@ void Com_Quit( void );
 int Com_ServerState( void );  // this should have just been a cvar...
 void Com_SetServerState( int state );
 
-unsigned Com_BlockChecksum( void *buffer, int length );
+unsigned Com_BlockChecksum( const void *buffer, int length );
 byte COM_BlockSequenceCRCByte( byte *base, int length, int sequence );
 
 float frand( void );  // 0 ti 1
@@ -757,6 +837,29 @@ void *Z_Malloc( int size );  // returns 0 filled memory
 void *Z_TagMalloc( int size, int tag );
 void Z_FreeTags( int tag );
 
+/* mem_trace, records who allocates what during each frame */
+typedef enum memTraceOp_e {
+	MEM_TRACE_Z_ALLOC,
+	MEM_TRACE_Z_FREE,
+	MEM_TRACE_HUNK_BEGIN,
+	MEM_TRACE_HUNK_ALLOC,
+	MEM_TRACE_M_ALLOC,
+
+	MEM_TRACE_MAX_OPS
+} memTraceOp_t;
+
+#if defined( _MSC_VER )
+#	include <intrin.h>
+#	pragma intrinsic( _ReturnAddress )
+#	define MEM_TRACE_SITE _ReturnAddress()
+#else
+#	define MEM_TRACE_SITE __builtin_return_address( 0 )
+#endif
+
+extern bool mem_tracing;
+
+void Mem_Trace( memTraceOp_t op, const void *site, size_t size, int tag );
+
 void Qcommon_Init( int argc, char **argv );
 void Qcommon_Frame( int msec );
 void Qcommon_Shutdown( void );
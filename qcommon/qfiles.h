@@ -50,6 +50,78 @@ typedef struct {
 /*
 ========================================================================
 
+The Anachronox .dat packages, one per root folder (e.g. textures.dat)
+
+========================================================================
+*/
+
+typedef struct PackageHeader {
+	char		identifier[ 4 ];	/* ADAT */
+	uint32_t	tocOffset;			/* table of contents */
+	uint32_t	tocLength;			/* table of contents length */
+	uint32_t	version;			/* always appears to be 9 */
+} PackageHeader;
+
+typedef struct PackageIndex {
+	char		name[ 128 ];		/* the name of the file, excludes 'model/' etc. */
+	uint32_t	offset;				/* offset into the dat that the file resides */
+	uint32_t	length;				/* decompressed length of the file */
+	uint32_t	compressedLength;	/* length of the file in the dat */
+	uint32_t	u0;
+} PackageIndex;
+
+/*
+========================================================================
+
+.OPK packages, written by mkpak as a drop-in replacement for a .dat
+
+Entry data is aligned to OPK_ALIGNMENT and laid out by group, so that
+everything a map needs sits together on disk. The table of contents
+follows the data and is sorted by name, case-insensitively, with an
+open-addressed hash table over it keyed on the case-insensitive FNV-1a
+hash of the name.
+
+========================================================================
+*/
+
+#define OPK_IDENTIFIER	"OPAK"
+#define OPK_VERSION		1
+#define OPK_ALIGNMENT	4096
+
+typedef enum OpkCodec {
+	OPK_CODEC_STORE,	/* raw, storedLength matches length */
+	OPK_CODEC_DEFLATE,	/* zlib stream, always smaller than length */
+	OPK_CODEC_LZ,		/* reserved for a fast lz codec */
+
+	OPK_MAX_CODECS
+} OpkCodec;
+
+typedef struct OpkHeader {
+	char		identifier[ 4 ];	/* OPAK */
+	uint32_t	version;
+	uint32_t	numEntries;
+	uint32_t	tocOffset;			/* OpkIndex[ numEntries ] */
+	uint32_t	hashOffset;			/* uint32_t[ numHashSlots ], entry + 1, 0 is empty */
+	uint32_t	numHashSlots;		/* always a power of two */
+	uint32_t	namesOffset;		/* nul terminated names */
+	uint32_t	namesLength;
+} OpkHeader;
+
+typedef struct OpkIndex {
+	uint32_t	nameOffset;			/* relative to namesOffset */
+	uint32_t	nameHash;
+	uint32_t	offset;
+	uint32_t	length;				/* decompressed length */
+	uint32_t	storedLength;		/* length in the package */
+	uint16_t	crc;				/* CRC_Block of the decompressed data */
+	uint8_t		codec;
+	uint8_t		pad;
+	uint32_t	group;
+} OpkIndex;
+
+/*
+========================================================================
+
 PCX files are used for as many images as possible
 
 ========================================================================
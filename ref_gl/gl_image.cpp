@@ -24,12 +24,17 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
 image_t		gltextures[ MAX_GLTEXTURES ];
 int			numgltextures;
 int			base_textureid;		// gltextures[i] = base_textureid+i
 
 static byte			 intensitytable[ 256 ];
 static unsigned char gammatable[ 256 ];
+static byte			 lightscaletable[ 256 ];	// gammatable[ intensitytable[ i ] ]
 
 cvar_t *intensity;
 
@@ -360,114 +365,124 @@ PCX LOADING
 
 /*
 ==============
-LoadPCX
+GL_ReadPCXHeader
+
+Checks the header is one we can decode and pulls the size out of it
 ==============
 */
-void LoadPCX( const char *filename, byte **pic, byte **palette, int *width, int *height ) {
-	byte *raw;
-	pcx_t *pcx;
-	int		x, y;
-	int		len;
-	int		dataByte, runLength;
-	byte *out, *pix;
+static qboolean GL_ReadPCXHeader( const byte *buffer, int length, int *width, int *height ) {
+	const pcx_t *pcx;
+	int		xmax, ymax;
 
-	*pic = NULL;
-	*palette = NULL;
-
-	//
-	// load the file
-	//
-	len = FS_LoadFile( filename, (void **)&raw );
-	if( !raw ) {
-		VID_Printf( PRINT_DEVELOPER, "Bad pcx file %s\n", filename );
-		return;
-	}
-
-	//
-	// parse the PCX file
-	//
-	pcx = (pcx_t *)raw;
-
-	pcx->xmin = LittleShort( pcx->xmin );
-	pcx->ymin = LittleShort( pcx->ymin );
-	pcx->xmax = LittleShort( pcx->xmax );
-	pcx->ymax = LittleShort( pcx->ymax );
-	pcx->hres = LittleShort( pcx->hres );
-	pcx->vres = LittleShort( pcx->vres );
-	pcx->bytes_per_line = LittleShort( pcx->bytes_per_line );
-	pcx->palette_type = LittleShort( pcx->palette_type );
-
-	raw = &pcx->data;
+	if( length < (int)sizeof( pcx_t ) + 768 )
+		return false;
 
+	pcx = (const pcx_t *)buffer;
+	xmax = (unsigned short)LittleShort( pcx->xmax );
+	ymax = (unsigned short)LittleShort( pcx->ymax );
 	if( pcx->manufacturer != 0x0a
 		|| pcx->version != 5
 		|| pcx->encoding != 1
 		|| pcx->bits_per_pixel != 8
-		|| pcx->xmax >= 640
-		|| pcx->ymax >= 480 ) {
-		VID_Printf( PRINT_ALL, "Bad pcx file %s\n", filename );
-		return;
-	}
+		|| xmax >= 640
+		|| ymax >= 480 )
+		return false;
 
-	out = new byte[ ( pcx->ymax + 1 ) * ( pcx->xmax + 1 ) ];
+	*width = xmax + 1;
+	*height = ymax + 1;
+	return true;
+}
 
-	*pic = out;
-	pix = out;
+/*
+==============
+GL_DecodePCX
 
-	if( palette ) {
-		*palette = new byte[ 768 ];
-		memcpy( *palette, (byte *)pcx + len - 768, 768 );
-	}
+Leaves the file untouched and never prints, so the image workers can
+use it too.  The palette is the last 768 bytes of the file.
+==============
+*/
+static byte *GL_DecodePCX( const byte *buffer, int length, int *width, int *height ) {
+	const byte *raw, *end;
+	int		x, y;
+	int		dataByte, runLength;
+	byte *out, *pix;
 
-	if( width )
-		*width = pcx->xmax + 1;
-	if( height )
-		*height = pcx->ymax + 1;
+	if( !GL_ReadPCXHeader( buffer, length, width, height ) )
+		return NULL;
+
+	raw = &( (const pcx_t *)buffer )->data;
+	end = buffer + length;
+
+	out = new byte[ *width * *height ];
+	pix = out;
 
-	for( y = 0; y <= pcx->ymax; y++, pix += pcx->xmax + 1 ) {
-		for( x = 0; x <= pcx->xmax; ) {
+	for( y = 0; y < *height; y++, pix += *width ) {
+		for( x = 0; x < *width; ) {
+			if( raw >= end )
+				goto malformed;
 			dataByte = *raw++;
 
 			if( ( dataByte & 0xC0 ) == 0xC0 ) {
 				runLength = dataByte & 0x3F;
+				if( raw >= end )
+					goto malformed;
 				dataByte = *raw++;
 			} else
 				runLength = 1;
 
-			while( runLength-- > 0 )
+			while( runLength-- > 0 && x < *width )
 				pix[ x++ ] = dataByte;
 		}
-
 	}
 
-	if( raw - (byte *)pcx > len ) {
-		VID_Printf( PRINT_DEVELOPER, "PCX file %s was malformed", filename );
-		delete[] *pic;
-		*pic = NULL;
-	}
+	return out;
 
-	FS_FreeFile( pcx );
+malformed:
+	delete[] out;
+	return NULL;
 }
 
-static void LoadImage32( const char *name, byte **pic, int *width, int *height ) {
+/*
+==============
+LoadPCX
+==============
+*/
+void LoadPCX( const char *filename, byte **pic, byte **palette, int *width, int *height ) {
+	const byte *raw;
+	int		len;
+	int		w, h;
+
 	*pic = NULL;
+	if( palette )
+		*palette = NULL;
 
-	byte *buffer;
-	int length = FS_LoadFile( name, (void **)&buffer );
-	if( buffer == NULL ) {
-		VID_Printf( PRINT_DEVELOPER, "Bad image file %s\n", name );
+	//
+	// load the file
+	//
+	len = FS_LoadSharedFile( filename, (const void **)&raw );
+	if( !raw ) {
+		VID_Printf( PRINT_DEVELOPER, "Bad pcx file %s\n", filename );
+		return;
+	}
+
+	*pic = GL_DecodePCX( raw, len, &w, &h );
+	if( !*pic ) {
+		VID_Printf( PRINT_ALL, "Bad pcx file %s\n", filename );
+		FS_FreeSharedFile( raw );
 		return;
 	}
 
-	int comp; /* this gets ignored for now */
-	byte *rgbData = stbi_load_from_memory( buffer, length, width, height, &comp, 4 );
-	if( rgbData == NULL ) {
-		VID_Error( ERR_DROP, "Failed to read %s!\n%s\n", name, stbi_failure_reason() );
+	if( palette ) {
+		*palette = new byte[ 768 ];
+		memcpy( *palette, raw + len - 768, 768 );
 	}
 
-	*pic = rgbData;
+	if( width )
+		*width = w;
+	if( height )
+		*height = h;
 
-	FS_FreeFile( buffer );
+	FS_FreeSharedFile( raw );
 }
 
 /*
@@ -551,48 +566,6 @@ void R_FloodFillSkin( byte *skin, int skinwidth, int skinheight ) {
 //=======================================================
 
 
-/*
-================
-GL_ResampleTexture
-================
-*/
-void GL_ResampleTexture( unsigned *in, int inwidth, int inheight, unsigned *out, int outwidth, int outheight ) {
-	int		i, j;
-	unsigned *inrow, *inrow2;
-	unsigned	frac, fracstep;
-	unsigned	p1[ 1024 ], p2[ 1024 ];
-	byte *pix1, *pix2, *pix3, *pix4;
-
-	fracstep = inwidth * 0x10000 / outwidth;
-
-	frac = fracstep >> 2;
-	for( i = 0; i < outwidth; i++ ) {
-		p1[ i ] = 4 * ( frac >> 16 );
-		frac += fracstep;
-	}
-	frac = 3 * ( fracstep >> 2 );
-	for( i = 0; i < outwidth; i++ ) {
-		p2[ i ] = 4 * ( frac >> 16 );
-		frac += fracstep;
-	}
-
-	for( i = 0; i < outheight; i++, out += outwidth ) {
-		inrow = in + inwidth * (int)( ( i + 0.25 ) * inheight / outheight );
-		inrow2 = in + inwidth * (int)( ( i + 0.75 ) * inheight / outheight );
-		frac = fracstep >> 1;
-		for( j = 0; j < outwidth; j++ ) {
-			pix1 = (byte *)inrow + p1[ j ];
-			pix2 = (byte *)inrow + p2[ j ];
-			pix3 = (byte *)inrow2 + p1[ j ];
-			pix4 = (byte *)inrow2 + p2[ j ];
-			( (byte *)( out + j ) )[ 0 ] = ( pix1[ 0 ] + pix2[ 0 ] + pix3[ 0 ] + pix4[ 0 ] ) >> 2;
-			( (byte *)( out + j ) )[ 1 ] = ( pix1[ 1 ] + pix2[ 1 ] + pix3[ 1 ] + pix4[ 1 ] ) >> 2;
-			( (byte *)( out + j ) )[ 2 ] = ( pix1[ 2 ] + pix2[ 2 ] + pix3[ 2 ] + pix4[ 2 ] ) >> 2;
-			( (byte *)( out + j ) )[ 3 ] = ( pix1[ 3 ] + pix2[ 3 ] + pix3[ 3 ] + pix4[ 3 ] ) >> 2;
-		}
-	}
-}
-
 /*
 ================
 GL_LightScaleTexture
@@ -602,55 +575,28 @@ lighting range
 ================
 */
 void GL_LightScaleTexture( unsigned *in, int inwidth, int inheight, qboolean only_gamma ) {
-	if( only_gamma ) {
-		int		i, c;
-		byte *p;
-
-		p = (byte *)in;
-
-		c = inwidth * inheight;
-		for( i = 0; i < c; i++, p += 4 ) {
-			p[ 0 ] = gammatable[ p[ 0 ] ];
-			p[ 1 ] = gammatable[ p[ 1 ] ];
-			p[ 2 ] = gammatable[ p[ 2 ] ];
-		}
-	} else {
-		int		i, c;
-		byte *p;
-
-		p = (byte *)in;
-
-		c = inwidth * inheight;
-		for( i = 0; i < c; i++, p += 4 ) {
-			p[ 0 ] = gammatable[ intensitytable[ p[ 0 ] ] ];
-			p[ 1 ] = gammatable[ intensitytable[ p[ 1 ] ] ];
-			p[ 2 ] = gammatable[ intensitytable[ p[ 2 ] ] ];
-		}
-	}
+	GL_LookupTexture( in, inwidth * inheight, only_gamma ? gammatable : lightscaletable );
 }
 
 /*
 ================
-GL_MipMap
+GL_UploadBuffer
 
-Operates in place, quartering the size of the texture
+Upload scratch space only ever grows, so big textures don't need
+big stack frames and small ones don't hit the allocator
 ================
 */
-void GL_MipMap( byte *in, int width, int height ) {
-	int		i, j;
-	byte *out;
-
-	width <<= 2;
-	height >>= 1;
-	out = in;
-	for( i = 0; i < height; i++, in += width ) {
-		for( j = 0; j < width; j += 8, out += 4, in += 8 ) {
-			out[ 0 ] = ( in[ 0 ] + in[ 4 ] + in[ width + 0 ] + in[ width + 4 ] ) >> 2;
-			out[ 1 ] = ( in[ 1 ] + in[ 5 ] + in[ width + 1 ] + in[ width + 5 ] ) >> 2;
-			out[ 2 ] = ( in[ 2 ] + in[ 6 ] + in[ width + 2 ] + in[ width + 6 ] ) >> 2;
-			out[ 3 ] = ( in[ 3 ] + in[ 7 ] + in[ width + 3 ] + in[ width + 7 ] ) >> 2;
-		}
+static unsigned *upload_buffers[ 2 ];
+static int		upload_buffersize[ 2 ];
+
+static unsigned *GL_UploadBuffer( int slot, int pixels ) {
+	if( upload_buffersize[ slot ] < pixels ) {
+		if( upload_buffers[ slot ] )
+			Z_Free( upload_buffers[ slot ] );
+		upload_buffers[ slot ] = (unsigned *)Z_Malloc( pixels * 4 );
+		upload_buffersize[ slot ] = pixels;
 	}
+	return upload_buffers[ slot ];
 }
 
 int		upload_width, upload_height;
@@ -658,8 +604,9 @@ qboolean uploaded_paletted;
 
 qboolean GL_Upload32( unsigned *data, int width, int height, qboolean mipmap ) {
 	int			samples;
-	unsigned	scaled[ 256 * 256 ];
+	unsigned *scaled;
 	int			scaled_width, scaled_height;
+	int			maxsize;
 	int			i, c;
 	byte *scan;
 	int comp;
@@ -681,11 +628,16 @@ qboolean GL_Upload32( unsigned *data, int width, int height, qboolean mipmap ) {
 		scaled_height >>= (int)gl_picmip->value;
 	}
 
-	// don't ever bother with >256 textures
-	if( scaled_width > 256 )
-		scaled_width = 256;
-	if( scaled_height > 256 )
-		scaled_height = 256;
+	// don't go past what the card takes, or what gl_maxtexsize asks for
+	maxsize = gl_config.maxtexsize;
+	if( gl_maxtexsize->value > 0 && gl_maxtexsize->value < maxsize ) {
+		for( maxsize = 1; maxsize * 2 <= gl_maxtexsize->value; maxsize <<= 1 )
+			;
+	}
+	if( scaled_width > maxsize )
+		scaled_width = maxsize;
+	if( scaled_height > maxsize )
+		scaled_height = maxsize;
 
 	if( scaled_width < 1 )
 		scaled_width = 1;
@@ -695,9 +647,6 @@ qboolean GL_Upload32( unsigned *data, int width, int height, qboolean mipmap ) {
 	upload_width = scaled_width;
 	upload_height = scaled_height;
 
-	if( scaled_width * scaled_height > sizeof( scaled ) / 4 )
-		VID_Error( ERR_DROP, "GL_Upload32: too big" );
-
 	// scan the texture for any non-255 alpha
 	c = width * height;
 	scan = ( (byte *)data ) + 3;
@@ -737,9 +686,12 @@ qboolean GL_Upload32( unsigned *data, int width, int height, qboolean mipmap ) {
 			glTexImage2D( GL_TEXTURE_2D, 0, comp, scaled_width, scaled_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data );
 			goto done;
 		}
+		scaled = GL_UploadBuffer( 0, width * height );
 		memcpy( scaled, data, width * height * 4 );
-	} else
+	} else {
+		scaled = GL_UploadBuffer( 0, scaled_width * scaled_height );
 		GL_ResampleTexture( data, width, height, scaled, scaled_width, scaled_height );
+	}
 
 	//GL_LightScaleTexture( scaled, scaled_width, scaled_height, !mipmap );
 
@@ -801,38 +753,11 @@ static qboolean IsPowerOf2( int value )
 */
 
 qboolean GL_Upload8( byte *data, int width, int height, qboolean mipmap, qboolean is_sky ) {
-	unsigned	trans[ 640 * 256 ];
-	int			i, s;
-	int			p;
-
-	s = width * height;
-
-	if( s > sizeof( trans ) / 4 )
-		VID_Error( ERR_DROP, "GL_Upload8: too large" );
-
-	for( i = 0; i < s; i++ ) {
-		p = data[ i ];
-		trans[ i ] = d_8to24table[ p ];
-
-		if( p == 255 ) {	// transparent, so scan around for another color
-			// to avoid alpha fringes
-			// FIXME: do a full flood fill so mips work...
-			if( i > width && data[ i - width ] != 255 )
-				p = data[ i - width ];
-			else if( i < s - width && data[ i + width ] != 255 )
-				p = data[ i + width ];
-			else if( i > 0 && data[ i - 1 ] != 255 )
-				p = data[ i - 1 ];
-			else if( i < s - 1 && data[ i + 1 ] != 255 )
-				p = data[ i + 1 ];
-			else
-				p = 0;
-			// copy rgb components
-			( (byte *)&trans[ i ] )[ 0 ] = ( (byte *)&d_8to24table[ p ] )[ 0 ];
-			( (byte *)&trans[ i ] )[ 1 ] = ( (byte *)&d_8to24table[ p ] )[ 1 ];
-			( (byte *)&trans[ i ] )[ 2 ] = ( (byte *)&d_8to24table[ p ] )[ 2 ];
-		}
-	}
+	unsigned *trans;
+
+	// the second slot, as GL_Upload32 scales into the first
+	trans = GL_UploadBuffer( 1, width * height );
+	GL_ExpandPalettedTexture( data, width, height, d_8to24table, trans );
 
 	return GL_Upload32( trans, width, height, mipmap );
 }
@@ -840,12 +765,10 @@ qboolean GL_Upload8( byte *data, int width, int height, qboolean mipmap, qboolea
 
 /*
 ================
-GL_LoadPic
-
-This is also used as an entry point for the generated r_notexture
+GL_AllocImage
 ================
 */
-image_t *GL_LoadPic( const char *name, byte *pic, int width, int height, imagetype_t type, int bits ) {
+static image_t *GL_AllocImage( const char *name, int width, int height, imagetype_t type ) {
 	image_t *image;
 	int			i;
 
@@ -870,6 +793,22 @@ image_t *GL_LoadPic( const char *name, byte *pic, int width, int height, imagety
 	image->height = height;
 	image->type = type;
 
+	return image;
+}
+
+/*
+================
+GL_LoadPic
+
+This is also used as an entry point for the generated r_notexture
+================
+*/
+image_t *GL_LoadPic( const char *name, byte *pic, int width, int height, imagetype_t type, int bits ) {
+	image_t *image;
+	int			i;
+
+	image = GL_AllocImage( name, width, height, type );
+
 	if( type == it_skin && bits == 8 )
 		R_FloodFillSkin( pic, width, height );
 
@@ -918,6 +857,340 @@ image_t *GL_LoadPic( const char *name, byte *pic, int width, int height, imagety
 	return image;
 }
 
+/*
+=================================================================
+
+BACKGROUND DECODING
+
+Everything but pics is decoded on worker threads.  Files are still
+read on the main thread, as the filesystem can't be used from the
+workers, but the image_t is handed out straight away, sized from the
+header and with a placeholder uploaded.  Finished decodes are uploaded
+from R_BeginFrame, and registration waits for the rest, so a level
+load costs about as much as reading it does.
+
+=================================================================
+*/
+
+#define IMAGEJOB_QUEUED		0
+#define IMAGEJOB_RUNNING	1
+#define IMAGEJOB_DONE		2
+
+typedef struct imagejob_s {
+	image_t *image;
+	const byte *file;		// from FS_LoadSharedFile, only the main thread frees it
+	int			filelength;
+	int			bits;		// 8 for pcx, 32 for anything stb_image reads
+	int			width, height;
+	qboolean	floodfill;
+	byte *pic;				// rgba from the worker, malloc'd
+	int			state;
+	struct imagejob_s *queuenext;	// pending work, guarded by image_sync
+	struct imagejob_s *next;		// main thread only
+} imagejob_t;
+
+// created alongside the workers and never destroyed, as they're still
+// waiting on it when the process exits
+typedef struct {
+	std::mutex				mutex;
+	std::condition_variable	work;
+	std::condition_variable	done;
+} imagesync_t;
+
+static imagesync_t *image_sync;
+static imagejob_t *image_queuehead, *image_queuetail;
+static imagejob_t *image_jobs;
+static int	image_numthreads;
+
+static int	image_numdecoded;
+static int	image_waitmsec;
+
+/*
+================
+GL_DecodeImage
+
+Returns the image as rgba, allocated with malloc, or NULL if it doesn't
+decode to the size the header promised.  Safe to call from any thread.
+================
+*/
+static byte *GL_DecodeImage( const byte *file, int length, int bits, int width, int height, qboolean floodfill ) {
+	byte *pic, *pic8;
+	int		w, h, comp;
+
+	if( bits == 32 ) {
+		pic = stbi_load_from_memory( file, length, &w, &h, &comp, 4 );
+		if( pic && ( w != width || h != height ) ) {
+			stbi_image_free( pic );
+			pic = NULL;
+		}
+		return pic;
+	}
+
+	pic8 = GL_DecodePCX( file, length, &w, &h );
+	if( !pic8 )
+		return NULL;
+
+	if( floodfill )
+		R_FloodFillSkin( pic8, w, h );
+
+	pic = (byte *)malloc( w * h * 4 );
+	GL_ExpandPalettedTexture( pic8, w, h, d_8to24table, (unsigned *)pic );
+	delete[] pic8;
+
+	return pic;
+}
+
+static void GL_ImageWorker( void ) {
+	for( ;; ) {
+		imagejob_t *job;
+		byte *pic;
+
+		{
+			std::unique_lock< std::mutex > lock( image_sync->mutex );
+			image_sync->work.wait( lock, [] { return image_queuehead != NULL; } );
+
+			job = image_queuehead;
+			image_queuehead = job->queuenext;
+			if( !image_queuehead )
+				image_queuetail = NULL;
+
+			job->queuenext = NULL;
+			job->state = IMAGEJOB_RUNNING;
+		}
+
+		pic = GL_DecodeImage( job->file, job->filelength, job->bits, job->width, job->height, job->floodfill );
+
+		{
+			std::lock_guard< std::mutex > lock( image_sync->mutex );
+			job->pic = pic;
+			job->state = IMAGEJOB_DONE;
+		}
+
+		image_sync->done.notify_all();
+	}
+}
+
+static void GL_StartImageWorkers( void ) {
+	int		numthreads;
+
+	if( image_numthreads > 0 )
+		return;
+
+	numthreads = std::thread::hardware_concurrency();
+	if( numthreads < 1 )
+		numthreads = 1;
+	else if( numthreads > 8 )
+		numthreads = 8;
+
+	image_sync = new imagesync_t;
+
+	// workers live for the lifetime of the process
+	for( int i = 0; i < numthreads; i++ )
+		std::thread( GL_ImageWorker ).detach();
+
+	image_numthreads = numthreads;
+}
+
+/*
+================
+GL_QueueImage
+
+Hands the file over to the workers, which will decode it into image
+================
+*/
+static void GL_QueueImage( image_t *image, const byte *file, int length, int bits ) {
+	imagejob_t *job;
+
+	GL_StartImageWorkers();
+
+	job = (imagejob_t *)Z_Malloc( sizeof( *job ) );
+	job->image = image;
+	job->file = file;
+	job->filelength = length;
+	job->bits = bits;
+	job->width = image->width;
+	job->height = image->height;
+	job->floodfill = ( image->type == it_skin && bits == 8 );
+	job->state = IMAGEJOB_QUEUED;
+
+	job->next = image_jobs;
+	image_jobs = job;
+
+	{
+		std::lock_guard< std::mutex > lock( image_sync->mutex );
+		if( image_queuetail )
+			image_queuetail->queuenext = job;
+		else
+			image_queuehead = job;
+		image_queuetail = job;
+	}
+
+	image_sync->work.notify_one();
+}
+
+/*
+================
+GL_FinishImage
+
+Gets the job back from the workers, decoding it here if none of them
+have picked it up yet, and uploads the result over the placeholder
+================
+*/
+static void GL_FinishImage( imagejob_t *job ) {
+	image_t *image = job->image;
+	qboolean	mipmap;
+
+	{
+		std::unique_lock< std::mutex > lock( image_sync->mutex );
+
+		if( job->state == IMAGEJOB_QUEUED ) {
+			imagejob_t *prev = NULL;
+
+			for( imagejob_t *cur = image_queuehead; cur; prev = cur, cur = cur->queuenext ) {
+				if( cur != job )
+					continue;
+				if( prev )
+					prev->queuenext = job->queuenext;
+				else
+					image_queuehead = job->queuenext;
+				if( image_queuetail == job )
+					image_queuetail = prev;
+				break;
+			}
+		} else if( job->state == IMAGEJOB_RUNNING ) {
+			const int start = Sys_Milliseconds();
+			image_sync->done.wait( lock, [ job ] { return job->state == IMAGEJOB_DONE; } );
+			image_waitmsec += Sys_Milliseconds() - start;
+		}
+	}
+
+	if( job->state == IMAGEJOB_QUEUED )
+		job->pic = GL_DecodeImage( job->file, job->filelength, job->bits, job->width, job->height, job->floodfill );
+
+	if( job->pic ) {
+		mipmap = ( image->type != it_pic && image->type != it_sky );
+		GL_Bind( image->texnum );
+		image->has_alpha = GL_Upload32( (unsigned *)job->pic, job->width, job->height, mipmap );
+		image->upload_width = upload_width;
+		image->upload_height = upload_height;
+		image->paletted = uploaded_paletted;
+		free( job->pic );
+	} else
+		VID_Printf( PRINT_ALL, "WARNING: Failed to decode \"%s\"!\n", image->name );
+
+	image_numdecoded++;
+
+	FS_FreeSharedFile( job->file );
+	Z_Free( job );
+}
+
+/*
+================
+GL_UploadImages
+
+Uploads every image that has finished decoding, or with wait set,
+every image that's still outstanding
+================
+*/
+void GL_UploadImages( qboolean wait ) {
+	imagejob_t **link;
+	imagejob_t *job;
+
+	link = &image_jobs;
+	while( ( job = *link ) != NULL ) {
+		if( !wait ) {
+			std::lock_guard< std::mutex > lock( image_sync->mutex );
+			if( job->state != IMAGEJOB_DONE ) {
+				link = &job->next;
+				continue;
+			}
+		}
+
+		*link = job->next;
+		GL_FinishImage( job );
+	}
+
+	if( wait && image_numdecoded ) {
+		VID_Printf( PRINT_DEVELOPER, "%i images decoded on %i threads, waited %i ms\n",
+			image_numdecoded, image_numthreads, image_waitmsec );
+		image_numdecoded = 0;
+		image_waitmsec = 0;
+	}
+}
+
+/*
+================
+GL_LoadImage
+
+Loads the given file into a new image, decoding it in the background
+unless it's a pic, as those go into the scrap and get measured straight
+away by the 2D code
+================
+*/
+static image_t *GL_LoadImage( const char *name, imagetype_t type, int bits ) {
+	static const unsigned placeholder = LittleLong( 0xff7f7f7f );
+	image_t *image;
+	const byte *file;
+	byte *pic;
+	int		length;
+	int		width, height, comp;
+	qboolean	valid;
+
+	length = FS_LoadSharedFile( name, (const void **)&file );
+	if( !file ) {
+		VID_Printf( PRINT_DEVELOPER, "Bad image file %s\n", name );
+		return NULL;
+	}
+
+	if( bits == 8 )
+		valid = GL_ReadPCXHeader( file, length, &width, &height );
+	else
+		valid = stbi_info_from_memory( file, length, &width, &height, &comp ) ? true : false;
+	if( !valid ) {
+		VID_Printf( PRINT_ALL, "Bad image file %s\n", name );
+		FS_FreeSharedFile( file );
+		return NULL;
+	}
+
+	if( type != it_pic && gl_asyncimages->value ) {
+		image = GL_AllocImage( name, width, height, type );
+		image->scrap = false;
+		image->texnum = TEXNUM_IMAGES + ( image - gltextures );
+		image->sl = 0;
+		image->sh = 1;
+		image->tl = 0;
+		image->th = 1;
+
+		GL_Bind( image->texnum );
+		GL_Upload32( (unsigned *)&placeholder, 1, 1, ( type != it_sky ) );
+		image->upload_width = upload_width;
+		image->upload_height = upload_height;
+
+		GL_QueueImage( image, file, length, bits );
+		return image;
+	}
+
+	if( bits == 8 )
+		pic = GL_DecodePCX( file, length, &width, &height );
+	else
+		pic = stbi_load_from_memory( file, length, &width, &height, &comp, 4 );
+	FS_FreeSharedFile( file );
+
+	if( !pic ) {
+		VID_Printf( PRINT_ALL, "WARNING: Failed to decode \"%s\"!\n", name );
+		return NULL;
+	}
+
+	image = GL_LoadPic( name, pic, width, height, type, bits );
+
+	if( bits == 8 )
+		delete[] pic;
+	else
+		stbi_image_free( pic );
+
+	return image;
+}
+
 /*
 ===============
 GL_FindImage
@@ -928,13 +1201,11 @@ Finds or loads the given image
 image_t *GL_FindImage( const char *name, imagetype_t type ) {
 	image_t *image;
 	int		i, len;
-	byte *pic, *palette;
-	int		width, height;
 
 	if( !name )
 		return NULL;	//	ri.Sys_Error (ERR_DROP, "GL_FindImage: NULL name");
 	len = strlen( name );
-	if( len < 5 )
+	if( len < 5 || len >= MAX_QPATH )
 		return NULL;	//	ri.Sys_Error (ERR_DROP, "GL_FindImage: bad name: %s", name);
 
 	// look for it
@@ -945,62 +1216,45 @@ image_t *GL_FindImage( const char *name, imagetype_t type ) {
 		}
 	}
 
-	image = NULL;
-
 	//
 	// load the pic from disk
 	//
 
-  // Right, this is kinda gross but Anachronox seems to strip the extension
-  // from the filename and then load whatever standard formats it supports
+	// Right, this is kinda gross but Anachronox seems to strip the extension
+	// from the filename and then load whatever standard formats it supports.
+	// Only the first one that exists gets loaded.
 
-	typedef struct ImageLoader {
+	static const struct {
 		const char *extension;
-		unsigned int depth;
-		void( *Load8bpp )( const char *filename, byte **pic, byte **palette, int *width, int *height );
-		void( *Load32bpp )( const char *filename, byte **pic, int *width, int *height );
-	} ImageLoader;
-
-	static ImageLoader loaders[] = {
-		{ "tga", 32, NULL, LoadImage32 },
-		{ "png", 32, NULL, LoadImage32 },
-		{ "bmp", 32, NULL, LoadImage32 },
-		{ "pcx", 8, LoadPCX, NULL },
+		int depth;
+	} formats[] = {
+		{ "tga", 32 },
+		{ "png", 32 },
+		{ "bmp", 32 },
+		{ "pcx", 8 },
 	};
 
 	char uname[ MAX_QPATH ];
 	strcpy( uname, name );
 
-	for( auto &loader : loaders ) {
+	for( const auto &format : formats ) {
 		uname[ len - 3 ] = '\0';
-		strcat( uname, loader.extension );
-
-		pic = nullptr;
-		palette = nullptr;
-		if( loader.depth == 8 ) {
-			loader.Load8bpp( uname, &pic, &palette, &width, &height );
-		} else {
-			loader.Load32bpp( uname, &pic, &width, &height );
-		}
+		strcat( uname, format.extension );
 
-		if( pic == nullptr ) {
+		if( !FS_FileExists( uname ) )
 			continue;
-		}
 
-		image = GL_LoadPic( uname, pic, width, height, type, loader.depth );
+		image = GL_LoadImage( uname, type, format.depth );
+		if( image == nullptr )
+			return nullptr;
+
 		// HACK: store the original name for comparing later!
 		strcpy( image->name, name );
+		return image;
 	}
 
-	if( image == nullptr ) {
-		Com_Printf( "WARNING: Failed to find \"%s\"!\n", uname );
-		return nullptr;
-	}
-
-	delete[] pic;
-	delete[] palette;
-
-	return image;
+	Com_Printf( "WARNING: Failed to find \"%s\"!\n", name );
+	return nullptr;
 }
 
 
@@ -1027,6 +1281,9 @@ void GL_FreeUnusedImages( void ) {
 	int		i;
 	image_t *image;
 
+	// nothing can be freed out from under the workers
+	GL_UploadImages( true );
+
 	// never free r_notexture or particle texture
 	r_notexture->registration_sequence = registration_sequence;
 	r_particletexture->registration_sequence = registration_sequence;
@@ -1127,6 +1384,9 @@ void	GL_InitImages( void ) {
 			j = 255;
 		intensitytable[ i ] = j;
 	}
+
+	for( i = 0; i < 256; i++ )
+		lightscaletable[ i ] = gammatable[ intensitytable[ i ] ];
 }
 
 /*
@@ -1138,6 +1398,8 @@ void	GL_ShutdownImages( void ) {
 	int		i;
 	image_t *image;
 
+	GL_UploadImages( true );
+
 	for( i = 0, image = gltextures; i < numgltextures; i++, image++ ) {
 		if( !image->registration_sequence )
 			continue;		// free image_t slot
@@ -1145,4 +1407,12 @@ void	GL_ShutdownImages( void ) {
 		glDeleteTextures( 1, (GLuint *)&image->texnum );
 		memset( image, 0, sizeof( *image ) );
 	}
+
+	for( i = 0; i < 2; i++ ) {
+		if( upload_buffers[ i ] )
+			Z_Free( upload_buffers[ i ] );
+		upload_buffers[ i ] = NULL;
+		upload_buffersize[ i ] = 0;
+	}
+	GL_ShutdownImageProcessing();
 }
@@ -0,0 +1,408 @@
+/*
+Copyright (C) 1997-2001 Id Software, Inc.
+Copyright (C) 2020 Mark Sowden <markelswo@gmail.com>
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+// gl_imageproc.cpp -- cpu side texel work done before a texture is uploaded
+
+#include "gl_local.h"
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#define GL_IMAGE_SSE
+#include <emmintrin.h>
+#define GL_IMAGE_BEST 1
+#else
+#define GL_IMAGE_BEST 0
+#endif
+
+/*
+================
+GL_ExpandPalettedTexture
+
+Converts 8 bit texels to 32 bit through the palette.  Transparent texels
+borrow the color of a neighbour to avoid alpha fringes.
+================
+*/
+void GL_ExpandPalettedTexture( const byte *data, int width, int height, const unsigned *palette, unsigned *out ) {
+	int		i, s;
+	int		p;
+
+	s = width * height;
+
+	for( i = 0; i < s; i++ ) {
+		p = data[ i ];
+		out[ i ] = palette[ p ];
+
+		if( p == 255 ) {	// transparent, so scan around for another color
+			// to avoid alpha fringes
+			// FIXME: do a full flood fill so mips work...
+			if( i > width && data[ i - width ] != 255 )
+				p = data[ i - width ];
+			else if( i < s - width && data[ i + width ] != 255 )
+				p = data[ i + width ];
+			else if( i > 0 && data[ i - 1 ] != 255 )
+				p = data[ i - 1 ];
+			else if( i < s - 1 && data[ i + 1 ] != 255 )
+				p = data[ i + 1 ];
+			else
+				p = 0;
+			// copy rgb components
+			( (byte *)&out[ i ] )[ 0 ] = ( (const byte *)&palette[ p ] )[ 0 ];
+			( (byte *)&out[ i ] )[ 1 ] = ( (const byte *)&palette[ p ] )[ 1 ];
+			( (byte *)&out[ i ] )[ 2 ] = ( (const byte *)&palette[ p ] )[ 2 ];
+		}
+	}
+}
+
+/*
+=============================================================================
+
+FOUR TAP AVERAGING
+
+Both the resampler and the mipmapper boil down to averaging four texels
+per channel with truncation.  The SSE versions widen to 16 bits, so they
+produce exactly the same bytes as the C versions.
+
+=============================================================================
+*/
+
+static inline unsigned GL_Average4( unsigned a, unsigned b, unsigned c, unsigned d ) {
+	unsigned	out;
+	int			i;
+
+	out = 0;
+	for( i = 0; i < 32; i += 8 )
+		out |= ( ( ( ( a >> i ) & 255 ) + ( ( b >> i ) & 255 ) + ( ( c >> i ) & 255 ) + ( ( d >> i ) & 255 ) ) >> 2 ) << i;
+	return out;
+}
+
+static inline unsigned GL_Average2( unsigned a, unsigned b ) {
+	unsigned	out;
+	int			i;
+
+	out = 0;
+	for( i = 0; i < 32; i += 8 )
+		out |= ( ( ( ( a >> i ) & 255 ) + ( ( b >> i ) & 255 ) ) >> 1 ) << i;
+	return out;
+}
+
+#ifdef GL_IMAGE_SSE
+static inline __m128i GL_Average4SSE( __m128i a, __m128i b, __m128i c, __m128i d ) {
+	const __m128i zero = _mm_setzero_si128();
+	__m128i lo, hi;
+
+	lo = _mm_add_epi16( _mm_add_epi16( _mm_unpacklo_epi8( a, zero ), _mm_unpacklo_epi8( b, zero ) ),
+		_mm_add_epi16( _mm_unpacklo_epi8( c, zero ), _mm_unpacklo_epi8( d, zero ) ) );
+	hi = _mm_add_epi16( _mm_add_epi16( _mm_unpackhi_epi8( a, zero ), _mm_unpackhi_epi8( b, zero ) ),
+		_mm_add_epi16( _mm_unpackhi_epi8( c, zero ), _mm_unpackhi_epi8( d, zero ) ) );
+	return _mm_packus_epi16( _mm_srli_epi16( lo, 2 ), _mm_srli_epi16( hi, 2 ) );
+}
+#endif
+
+/*
+=============================================================================
+
+RESAMPLING
+
+Every output texel averages two columns of two rows, picked a quarter of
+a step either side of its center: a box filter when shrinking by two,
+a cheap bilinear tap otherwise.
+
+=============================================================================
+*/
+
+typedef void ( *resamplerow_t )( const unsigned *inrow, const unsigned *inrow2, const int *p1, const int *p2, unsigned *out, int outwidth );
+
+static int *resample_columns;
+static int	resample_columnsize;
+
+static void GL_ResampleRowC( const unsigned *inrow, const unsigned *inrow2, const int *p1, const int *p2, unsigned *out, int outwidth ) {
+	int		j;
+
+	for( j = 0; j < outwidth; j++ )
+		out[ j ] = GL_Average4( inrow[ p1[ j ] ], inrow[ p2[ j ] ], inrow2[ p1[ j ] ], inrow2[ p2[ j ] ] );
+}
+
+#ifdef GL_IMAGE_SSE
+static void GL_ResampleRowSSE( const unsigned *inrow, const unsigned *inrow2, const int *p1, const int *p2, unsigned *out, int outwidth ) {
+	int		j;
+
+	for( j = 0; j + 4 <= outwidth; j += 4 ) {
+		const __m128i a = _mm_setr_epi32( inrow[ p1[ j ] ], inrow[ p1[ j + 1 ] ], inrow[ p1[ j + 2 ] ], inrow[ p1[ j + 3 ] ] );
+		const __m128i b = _mm_setr_epi32( inrow[ p2[ j ] ], inrow[ p2[ j + 1 ] ], inrow[ p2[ j + 2 ] ], inrow[ p2[ j + 3 ] ] );
+		const __m128i c = _mm_setr_epi32( inrow2[ p1[ j ] ], inrow2[ p1[ j + 1 ] ], inrow2[ p1[ j + 2 ] ], inrow2[ p1[ j + 3 ] ] );
+		const __m128i d = _mm_setr_epi32( inrow2[ p2[ j ] ], inrow2[ p2[ j + 1 ] ], inrow2[ p2[ j + 2 ] ], inrow2[ p2[ j + 3 ] ] );
+
+		_mm_storeu_si128( (__m128i *)( out + j ), GL_Average4SSE( a, b, c, d ) );
+	}
+
+	GL_ResampleRowC( inrow, inrow2, p1 + j, p2 + j, out + j, outwidth - j );
+}
+#endif
+
+static void GL_Resample( const unsigned *in, int inwidth, int inheight, unsigned *out, int outwidth, int outheight, resamplerow_t row ) {
+	int			i;
+	unsigned	frac, fracstep;
+	int *p1, *p2;
+
+	if( resample_columnsize < outwidth ) {
+		if( resample_columns )
+			Z_Free( resample_columns );
+		resample_columns = (int *)Z_Malloc( 2 * outwidth * sizeof( int ) );
+		resample_columnsize = outwidth;
+	}
+	p1 = resample_columns;
+	p2 = resample_columns + outwidth;
+
+	fracstep = inwidth * 0x10000 / outwidth;
+
+	frac = fracstep >> 2;
+	for( i = 0; i < outwidth; i++ ) {
+		p1[ i ] = frac >> 16;
+		frac += fracstep;
+	}
+	frac = 3 * ( fracstep >> 2 );
+	for( i = 0; i < outwidth; i++ ) {
+		p2[ i ] = frac >> 16;
+		frac += fracstep;
+	}
+
+	for( i = 0; i < outheight; i++, out += outwidth ) {
+		row( in + inwidth * (int)( ( i + 0.25 ) * inheight / outheight ),
+			in + inwidth * (int)( ( i + 0.75 ) * inheight / outheight ),
+			p1, p2, out, outwidth );
+	}
+}
+
+#ifdef GL_IMAGE_SSE
+static const resamplerow_t gl_resamplerows[ 2 ] = { GL_ResampleRowC, GL_ResampleRowSSE };
+#else
+static const resamplerow_t gl_resamplerows[ 2 ] = { GL_ResampleRowC, GL_ResampleRowC };
+#endif
+
+/*
+================
+GL_ResampleTexture
+================
+*/
+void GL_ResampleTexture( unsigned *in, int inwidth, int inheight, unsigned *out, int outwidth, int outheight ) {
+	GL_Resample( in, inwidth, inheight, out, outwidth, outheight, gl_resamplerows[ GL_IMAGE_BEST ] );
+}
+
+/*
+=============================================================================
+
+MIPMAPPING
+
+=============================================================================
+*/
+
+typedef void ( *miprow_t )( const unsigned *in, const unsigned *in2, unsigned *out, int outwidth );
+
+static void GL_MipRowC( const unsigned *in, const unsigned *in2, unsigned *out, int outwidth ) {
+	int		j;
+
+	for( j = 0; j < outwidth; j++, in += 2, in2 += 2 )
+		out[ j ] = GL_Average4( in[ 0 ], in[ 1 ], in2[ 0 ], in2[ 1 ] );
+}
+
+#ifdef GL_IMAGE_SSE
+static void GL_MipRowSSE( const unsigned *in, const unsigned *in2, unsigned *out, int outwidth ) {
+	int		j;
+
+	// all four loads happen before the store, and the output trails the
+	// input, so working in place is safe
+	for( j = 0; j + 4 <= outwidth; j += 4, in += 8, in2 += 8 ) {
+		const __m128i a0 = _mm_loadu_si128( (const __m128i *)in );
+		const __m128i a1 = _mm_loadu_si128( (const __m128i *)( in + 4 ) );
+		const __m128i b0 = _mm_loadu_si128( (const __m128i *)in2 );
+		const __m128i b1 = _mm_loadu_si128( (const __m128i *)( in2 + 4 ) );
+
+		// split each row into its even and odd texels
+		const __m128i aeven = _mm_unpacklo_epi64( _mm_shuffle_epi32( a0, _MM_SHUFFLE( 3, 1, 2, 0 ) ), _mm_shuffle_epi32( a1, _MM_SHUFFLE( 3, 1, 2, 0 ) ) );
+		const __m128i aodd = _mm_unpackhi_epi64( _mm_shuffle_epi32( a0, _MM_SHUFFLE( 3, 1, 2, 0 ) ), _mm_shuffle_epi32( a1, _MM_SHUFFLE( 3, 1, 2, 0 ) ) );
+		const __m128i beven = _mm_unpacklo_epi64( _mm_shuffle_epi32( b0, _MM_SHUFFLE( 3, 1, 2, 0 ) ), _mm_shuffle_epi32( b1, _MM_SHUFFLE( 3, 1, 2, 0 ) ) );
+		const __m128i bodd = _mm_unpackhi_epi64( _mm_shuffle_epi32( b0, _MM_SHUFFLE( 3, 1, 2, 0 ) ), _mm_shuffle_epi32( b1, _MM_SHUFFLE( 3, 1, 2, 0 ) ) );
+
+		_mm_storeu_si128( (__m128i *)( out + j ), GL_Average4SSE( aeven, aodd, beven, bodd ) );
+	}
+
+	GL_MipRowC( in, in2, out + j, outwidth - j );
+}
+#endif
+
+static void GL_Mip( unsigned *in, int width, int height, miprow_t row ) {
+	int		i;
+	unsigned *out;
+
+	out = in;
+
+	// the last levels of a non square texture are a single row or
+	// column, which only have pairs to average
+	if( width == 1 || height == 1 ) {
+		const int c = ( width * height ) >> 1;
+
+		for( i = 0; i < c; i++ )
+			out[ i ] = GL_Average2( in[ 2 * i ], in[ 2 * i + 1 ] );
+		return;
+	}
+
+	width >>= 1;
+	height >>= 1;
+	for( i = 0; i < height; i++, out += width, in += 4 * width )
+		row( in, in + 2 * width, out, width );
+}
+
+#ifdef GL_IMAGE_SSE
+static const miprow_t gl_miprows[ 2 ] = { GL_MipRowC, GL_MipRowSSE };
+#else
+static const miprow_t gl_miprows[ 2 ] = { GL_MipRowC, GL_MipRowC };
+#endif
+
+/*
+================
+GL_MipMap
+
+Operates in place, quartering the size of the texture
+================
+*/
+void GL_MipMap( byte *in, int width, int height ) {
+	GL_Mip( (unsigned *)in, width, height, gl_miprows[ GL_IMAGE_BEST ] );
+}
+
+/*
+================
+GL_LookupTexture
+
+Runs the rgb channels through table, leaving alpha alone.  SSE2 has no
+byte gather, so this just works a texel at a time from registers.
+================
+*/
+void GL_LookupTexture( unsigned *data, int count, const byte table[ 256 ] ) {
+	int			i;
+	unsigned	p;
+
+	for( i = 0; i < count; i++ ) {
+		p = LittleLong( data[ i ] );
+		p = ( p & 0xff000000 ) | table[ p & 255 ] | ( table[ ( p >> 8 ) & 255 ] << 8 ) | ( table[ ( p >> 16 ) & 255 ] << 16 );
+		data[ i ] = LittleLong( p );
+	}
+}
+
+/*
+================
+GL_ShutdownImageProcessing
+================
+*/
+void GL_ShutdownImageProcessing( void ) {
+	if( resample_columns )
+		Z_Free( resample_columns );
+	resample_columns = NULL;
+	resample_columnsize = 0;
+}
+
+/*
+================
+GL_ImageBench
+
+Pushes random 8 bit textures through the whole upload path, expand,
+resample, gamma and the mip chain, once with the C rows and once with
+the SSE rows, without touching GL.  Both must build the same mips.
+Returns false if they didn't, or if the arguments were out of range.
+================
+*/
+qboolean GL_ImageBench( int width, int height, int count ) {
+	int			scaled_width, scaled_height;
+	int			msec[ 2 ];
+	unsigned	checksum[ 2 ];
+	byte		table[ 256 ];
+	byte *pic;
+	unsigned *trans, *scaled;
+	int			i;
+
+	if( width < 1 || height < 1 || width > 4096 || height > 4096 || count < 1 ) {
+		VID_Printf( PRINT_ALL, "GL_ImageBench: %dx%d x %d is out of range, sizes are 1 to 4096\n", width, height, count );
+		return false;
+	}
+
+	// round down to a power of two, as gl_round_down does
+	for( scaled_width = 1; scaled_width * 2 <= width; scaled_width <<= 1 )
+		;
+	for( scaled_height = 1; scaled_height * 2 <= height; scaled_height <<= 1 )
+		;
+
+	pic = (byte *)Z_Malloc( width * height );
+	trans = (unsigned *)Z_Malloc( width * height * 4 );
+	scaled = (unsigned *)Z_Malloc( scaled_width * scaled_height * 4 );
+
+	for( i = 0; i < width * height; i++ )
+		pic[ i ] = rand() & 255;
+	for( i = 0; i < 256; i++ )
+		table[ i ] = (byte)( 255 * pow( i / 255.0, 0.7 ) );
+
+	for( int sse = 0; sse < 2; sse++ ) {
+		const int start = Sys_Milliseconds();
+
+		checksum[ sse ] = 0;
+		for( int n = 0; n < count; n++ ) {
+			int		w, h;
+
+			GL_ExpandPalettedTexture( pic, width, height, d_8to24table, trans );
+			GL_Resample( trans, width, height, scaled, scaled_width, scaled_height, gl_resamplerows[ sse ] );
+			GL_LookupTexture( scaled, scaled_width * scaled_height, table );
+
+			w = scaled_width;
+			h = scaled_height;
+			while( w > 1 || h > 1 ) {
+				GL_Mip( scaled, w, h, gl_miprows[ sse ] );
+				w = w > 1 ? w >> 1 : 1;
+				h = h > 1 ? h >> 1 : 1;
+
+				// only the last pass is checked, so the sum stays out of the timing
+				if( n == count - 1 ) {
+					for( i = 0; i < w * h; i++ )
+						checksum[ sse ] = checksum[ sse ] * 31 + scaled[ i ];
+				}
+			}
+		}
+		msec[ sse ] = Sys_Milliseconds() - start;
+	}
+
+	VID_Printf( PRINT_ALL, "%dx%d -> %dx%d: C %.3f ms, SSE %.3f ms per texture, mips %s\n",
+		width, height, scaled_width, scaled_height,
+		(double)msec[ 0 ] / count, (double)msec[ 1 ] / count,
+		checksum[ 0 ] == checksum[ 1 ] ? "match" : "DIFFER" );
+
+	Z_Free( scaled );
+	Z_Free( trans );
+	Z_Free( pic );
+
+	return checksum[ 0 ] == checksum[ 1 ] ? true : false;
+}
+
+/*
+================
+GL_ImageBench_f
+================
+*/
+void GL_ImageBench_f( void ) {
+	GL_ImageBench( Cmd_Argc() > 1 ? atoi( Cmd_Argv( 1 ) ) : 320,
+		Cmd_Argc() > 2 ? atoi( Cmd_Argv( 2 ) ) : 240,
+		Cmd_Argc() > 3 ? atoi( Cmd_Argv( 3 ) ) : 200 );
+}
@@ -185,6 +185,8 @@ extern cvar_t *gl_monolightmap;
 extern cvar_t *gl_nobind;
 extern cvar_t *gl_round_down;
 extern cvar_t *gl_picmip;
+extern cvar_t *gl_maxtexsize;
+extern cvar_t *gl_asyncimages;
 extern cvar_t *gl_skymip;
 extern cvar_t *gl_showtris;
 extern cvar_t *gl_finish;
@@ -252,6 +254,7 @@ void R_Shutdown( void );
 void     R_RenderView( refdef_t *fd );
 void     GL_ScreenShot_f( void );
 void     R_DrawAliasModel( entity_t *e );
+void     GL_LerpBench_f( void );
 void     R_DrawBrushModel( entity_t *e );
 void     R_DrawSpriteModel( entity_t *e );
 void     R_DrawBeam( entity_t *e );
@@ -297,6 +300,13 @@ int Draw_GetPalette( void );
 
 void GL_ResampleTexture( unsigned *in, int inwidth, int inheight, unsigned *out,
                          int outwidth, int outheight );
+void GL_MipMap( byte *in, int width, int height );
+void GL_ExpandPalettedTexture( const byte *data, int width, int height,
+                               const unsigned *palette, unsigned *out );
+void GL_LookupTexture( unsigned *data, int count, const byte table[ 256 ] );
+void GL_ShutdownImageProcessing( void );
+qboolean GL_ImageBench( int width, int height, int count );
+void GL_ImageBench_f( void );
 
 struct image_s *R_RegisterSkin( const char *name );
 
@@ -305,6 +315,7 @@ void     LoadPCX( const char *filename, byte **pic, byte **palette, int *width,
 image_t *GL_LoadPic( const char *name, byte *pic, int width, int height,
                      imagetype_t type, int bits );
 image_t *GL_FindImage( const char *name, imagetype_t type );
+void     GL_UploadImages( qboolean wait );
 void     GL_TextureMode( char *string );
 void     GL_ImageList_f( void );
 
@@ -342,6 +353,8 @@ typedef struct
 	const char *version_string;
 	const char *extensions_string;
 
+	int maxtexsize;
+
 	qboolean allow_cds;
 } glconfig_t;
 
@@ -21,6 +21,11 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "gl_local.h"
 
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#define GL_LERP_SSE
+#include <emmintrin.h>
+#endif
+
 /*
 =============================================================
 
@@ -29,15 +34,14 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 =============================================================
 */
 
-#define NUMVERTEXNORMALS 162
-
 float r_avertexnormals[ NUMVERTEXNORMALS ][ 3 ] = {
 #include "anorms.h"
 };
 
 typedef float vec4_t[ 4 ];
 
-static vec4_t s_lerped[ MAX_VERTS ];
+alignas( 16 ) static vec4_t s_lerped[ MAX_ALIAS_VERTS ];
+static uint16_t s_lerpnormals[ MAX_ALIAS_VERTS ];
 // static	vec3_t	lerped[MAX_VERTS];
 
 vec3_t shadevector;
@@ -51,23 +55,235 @@ float r_avertexnormal_dots[ SHADEDOT_QUANT ][ 256 ] = {
 
 float *shadedots = r_avertexnormal_dots[ 0 ];
 
-void GL_LerpVerts( unsigned int nverts, Md2VertexGroup *v, Md2VertexGroup *ov, Md2VertexGroup *verts, float *lerp, float *move, float *frontv, float *backv ) {
+/*
+** Alias frames come in three vertex resolutions:
+**
+** 0 - Md2VertexGroup, one byte per axis
+** 1 - Md2VertexGroup4, one 32 bit word holding 11 bits of x, 10 of y and
+**     11 of z, from the top bit down
+** 2 - Md2VertexGroup6, one 16 bit word per axis
+**
+** The lerp kernels are instanced per resolution so the decode is inlined,
+** and again for power shells, which push every vertex out along its normal.
+*/
+
+static const float r_aliasvertexrange[ 3 ][ 3 ] = {
+	{ 255, 255, 255 },
+	{ 2047, 1023, 2047 },
+	{ 65535, 65535, 65535 },
+};
+
+static inline void GL_DecodeVertex( const Md2VertexGroup *v, int *xyz ) {
+	xyz[ 0 ] = v->vertexIndices[ 0 ];
+	xyz[ 1 ] = v->vertexIndices[ 1 ];
+	xyz[ 2 ] = v->vertexIndices[ 2 ];
+}
+
+static inline void GL_DecodeVertex( const Md2VertexGroup4 *v, int *xyz ) {
+	xyz[ 0 ] = v->vertexIndices >> 21;
+	xyz[ 1 ] = ( v->vertexIndices >> 11 ) & 0x3ff;
+	xyz[ 2 ] = v->vertexIndices & 0x7ff;
+}
+
+static inline void GL_DecodeVertex( const Md2VertexGroup6 *v, int *xyz ) {
+	xyz[ 0 ] = v->vertexIndices[ 0 ];
+	xyz[ 1 ] = v->vertexIndices[ 1 ];
+	xyz[ 2 ] = v->vertexIndices[ 2 ];
+}
+
+typedef void ( *lerpverts_t )( unsigned int nverts, const void *v, const void *ov, float *lerp, uint16_t *normals,
+	const float *move, const float *frontv, const float *backv );
+
+template< typename VertexGroup, bool shell >
+static void GL_LerpVertsC( unsigned int nverts, const void *frontverts, const void *backverts, float *lerp, uint16_t *normals,
+	const float *move, const float *frontv, const float *backv ) {
+	const VertexGroup *v = (const VertexGroup *)frontverts;
+	const VertexGroup *ov = (const VertexGroup *)backverts;
+	int a[ 3 ], b[ 3 ];
+
+	for( unsigned int i = 0; i < nverts; i++, v++, ov++, lerp += 4 ) {
+		GL_DecodeVertex( v, a );
+		GL_DecodeVertex( ov, b );
+		normals[ i ] = v->normalIndex;
+
+		lerp[ 0 ] = move[ 0 ] + b[ 0 ] * backv[ 0 ] + a[ 0 ] * frontv[ 0 ];
+		lerp[ 1 ] = move[ 1 ] + b[ 1 ] * backv[ 1 ] + a[ 1 ] * frontv[ 1 ];
+		lerp[ 2 ] = move[ 2 ] + b[ 2 ] * backv[ 2 ] + a[ 2 ] * frontv[ 2 ];
+
+		if( shell ) {
+			const float *normal = r_avertexnormals[ v->normalIndex ];
+			lerp[ 0 ] += normal[ 0 ] * POWERSUIT_SCALE;
+			lerp[ 1 ] += normal[ 1 ] * POWERSUIT_SCALE;
+			lerp[ 2 ] += normal[ 2 ] * POWERSUIT_SCALE;
+		}
+	}
+}
+
+#ifdef GL_LERP_SSE
+/*
+** The SSE kernels decode a whole vertex into one register.  The fourth
+** lane picks up whatever follows the position bytes, but it is always
+** multiplied by zero, so the pad float written to s_lerped stays 0.
+*/
+static inline __m128i GL_LoadVertex( const Md2VertexGroup *v ) {
+	int32_t word;
+
+	memcpy( &word, v, sizeof( word ) );
+	__m128i bytes = _mm_cvtsi32_si128( word );
+	return _mm_unpacklo_epi16( _mm_unpacklo_epi8( bytes, _mm_setzero_si128() ), _mm_setzero_si128() );
+}
+
+static inline __m128i GL_LoadVertex( const Md2VertexGroup4 *v ) {
+	const __m128i word = _mm_set1_epi32( (int)v->vertexIndices );
+	const __m128i x = _mm_and_si128( _mm_srli_epi32( word, 21 ), _mm_setr_epi32( 0x7ff, 0, 0, 0 ) );
+	const __m128i y = _mm_and_si128( _mm_srli_epi32( word, 11 ), _mm_setr_epi32( 0, 0x3ff, 0, 0 ) );
+	const __m128i z = _mm_and_si128( word, _mm_setr_epi32( 0, 0, 0x7ff, 0 ) );
+	return _mm_or_si128( _mm_or_si128( x, y ), z );
+}
+
+static inline __m128i GL_LoadVertex( const Md2VertexGroup6 *v ) {
+	__m128i words = _mm_loadl_epi64( (const __m128i *)v );
+	return _mm_unpacklo_epi16( words, _mm_setzero_si128() );
+}
+
+template< typename VertexGroup, bool shell >
+static void GL_LerpVertsSSE( unsigned int nverts, const void *frontverts, const void *backverts, float *lerp, uint16_t *normals,
+	const float *move, const float *frontv, const float *backv ) {
+	const VertexGroup *v = (const VertexGroup *)frontverts;
+	const VertexGroup *ov = (const VertexGroup *)backverts;
+	const __m128 vmove = _mm_setr_ps( move[ 0 ], move[ 1 ], move[ 2 ], 0 );
+	const __m128 vfront = _mm_setr_ps( frontv[ 0 ], frontv[ 1 ], frontv[ 2 ], 0 );
+	const __m128 vback = _mm_setr_ps( backv[ 0 ], backv[ 1 ], backv[ 2 ], 0 );
+	const __m128 vscale = _mm_set1_ps( POWERSUIT_SCALE );
+
+	for( unsigned int i = 0; i < nverts; i++, v++, ov++, lerp += 4 ) {
+		const __m128 a = _mm_cvtepi32_ps( GL_LoadVertex( v ) );
+		const __m128 b = _mm_cvtepi32_ps( GL_LoadVertex( ov ) );
+		normals[ i ] = v->normalIndex;
+
+		__m128 out = _mm_add_ps( _mm_add_ps( vmove, _mm_mul_ps( b, vback ) ), _mm_mul_ps( a, vfront ) );
+		if( shell ) {
+			const float *normal = r_avertexnormals[ v->normalIndex ];
+			out = _mm_add_ps( out, _mm_mul_ps( _mm_setr_ps( normal[ 0 ], normal[ 1 ], normal[ 2 ], 0 ), vscale ) );
+		}
+		_mm_store_ps( lerp, out );
+	}
+}
+#endif
+
+// [ sse ][ resolution ][ shell ]
+static const lerpverts_t gl_lerpverts[ 2 ][ 3 ][ 2 ] = {
+	{
+		{ GL_LerpVertsC< Md2VertexGroup, false >, GL_LerpVertsC< Md2VertexGroup, true > },
+		{ GL_LerpVertsC< Md2VertexGroup4, false >, GL_LerpVertsC< Md2VertexGroup4, true > },
+		{ GL_LerpVertsC< Md2VertexGroup6, false >, GL_LerpVertsC< Md2VertexGroup6, true > },
+	},
+#ifdef GL_LERP_SSE
+	{
+		{ GL_LerpVertsSSE< Md2VertexGroup, false >, GL_LerpVertsSSE< Md2VertexGroup, true > },
+		{ GL_LerpVertsSSE< Md2VertexGroup4, false >, GL_LerpVertsSSE< Md2VertexGroup4, true > },
+		{ GL_LerpVertsSSE< Md2VertexGroup6, false >, GL_LerpVertsSSE< Md2VertexGroup6, true > },
+	},
+#else
+	{
+		{ GL_LerpVertsC< Md2VertexGroup, false >, GL_LerpVertsC< Md2VertexGroup, true > },
+		{ GL_LerpVertsC< Md2VertexGroup4, false >, GL_LerpVertsC< Md2VertexGroup4, true > },
+		{ GL_LerpVertsC< Md2VertexGroup6, false >, GL_LerpVertsC< Md2VertexGroup6, true > },
+	},
+#endif
+};
+
+#ifdef GL_LERP_SSE
+#define GL_LERP_BEST 1
+#else
+#define GL_LERP_BEST 0
+#endif
+
+/*
+** GL_LerpVerts
+**
+** Blends frame and oldframe into s_lerped and gathers frame's normal
+** indices into s_lerpnormals for the lighting pass.
+*/
+static void GL_LerpVerts( dmdl_t *paliashdr, Md2FrameHeader *frame, Md2FrameHeader *oldframe, float *move, float *frontv, float *backv ) {
 	// PMM -- added RF_SHELL_DOUBLE, RF_SHELL_HALF_DAM
-	if( currententity->flags & ( RF_SHELL_RED | RF_SHELL_GREEN | RF_SHELL_BLUE |
-		RF_SHELL_DOUBLE | RF_SHELL_HALF_DAM ) ) {
-		for( unsigned int i = 0; i < nverts; i++, v++, ov++, lerp += 4 ) {
-			float *normal = r_avertexnormals[ verts[ i ].normalIndex ];
-			lerp[ 0 ] = move[ 0 ] + ov->vertexIndices[ 0 ] * backv[ 0 ] + v->vertexIndices[ 0 ] * frontv[ 0 ] + normal[ 0 ] * POWERSUIT_SCALE;
-			lerp[ 1 ] = move[ 1 ] + ov->vertexIndices[ 1 ] * backv[ 1 ] + v->vertexIndices[ 1 ] * frontv[ 1 ] + normal[ 1 ] * POWERSUIT_SCALE;
-			lerp[ 2 ] = move[ 2 ] + ov->vertexIndices[ 2 ] * backv[ 2 ] + v->vertexIndices[ 2 ] * frontv[ 2 ] + normal[ 2 ] * POWERSUIT_SCALE;
+	const bool shell = ( currententity->flags & ( RF_SHELL_RED | RF_SHELL_GREEN | RF_SHELL_BLUE |
+		RF_SHELL_DOUBLE | RF_SHELL_HALF_DAM ) ) != 0;
+
+	gl_lerpverts[ GL_LERP_BEST ][ paliashdr->resolution ][ shell ]( paliashdr->num_xyz, frame->verts, oldframe->verts,
+		s_lerped[ 0 ], s_lerpnormals, move, frontv, backv );
+}
+
+/*
+** GL_LerpBench_f
+**
+** gl_lerpbench [verts] [frames]
+**
+** Lerps random frames of every resolution with the C and SSE kernels,
+** reports vertices per second for each and checks that both produce the
+** same positions.
+*/
+void GL_LerpBench_f( void ) {
+	const unsigned int nverts = Cmd_Argc() > 1 ? atoi( Cmd_Argv( 1 ) ) : MAX_ALIAS_VERTS;
+	const int frames = Cmd_Argc() > 2 ? atoi( Cmd_Argv( 2 ) ) : 2000;
+
+	if( nverts < 1 || nverts > MAX_ALIAS_VERTS || frames < 1 ) {
+		VID_Printf( PRINT_ALL, "usage: gl_lerpbench [1-%d verts] [frames]\n", MAX_ALIAS_VERTS );
+		return;
+	}
+
+	// room for two frames of the widest vertex group, plus slack so the
+	// byte decode's 4 byte load never runs off the end
+	byte *data = (byte *)Z_Malloc( 2 * nverts * sizeof( Md2VertexGroup6 ) + 16 );
+	float *reference = (float *)Z_Malloc( nverts * 4 * sizeof( float ) );
+	float move[ 3 ], frontv[ 3 ], backv[ 3 ];
+
+	for( int i = 0; i < 3; i++ ) {
+		move[ i ] = crand() * 64;
+		frontv[ i ] = 0.25f + frand();
+		backv[ i ] = 0.25f + frand();
+	}
+
+	for( int res = 0; res < 3; res++ ) {
+		static const int size[ 3 ] = { sizeof( Md2VertexGroup ), sizeof( Md2VertexGroup4 ), sizeof( Md2VertexGroup6 ) };
+		byte *v = data;
+		byte *ov = data + nverts * size[ res ];
+
+		for( unsigned int i = 0; i < 2 * nverts * size[ res ]; i++ )
+			data[ i ] = rand() & 255;
+		// keep the normals inside the table
+		for( unsigned int i = 0; i < 2 * nverts; i++ ) {
+			uint16_t normal = rand() % NUMVERTEXNORMALS;
+			memcpy( data + i * size[ res ] + size[ res ] - sizeof( normal ), &normal, sizeof( normal ) );
 		}
-	} else {
-		for( unsigned int i = 0; i < nverts; i++, v++, ov++, lerp += 4 ) {
-			lerp[ 0 ] = move[ 0 ] + ov->vertexIndices[ 0 ] * backv[ 0 ] + v->vertexIndices[ 0 ] * frontv[ 0 ];
-			lerp[ 1 ] = move[ 1 ] + ov->vertexIndices[ 1 ] * backv[ 1 ] + v->vertexIndices[ 1 ] * frontv[ 1 ];
-			lerp[ 2 ] = move[ 2 ] + ov->vertexIndices[ 2 ] * backv[ 2 ] + v->vertexIndices[ 2 ] * frontv[ 2 ];
+
+		for( int shell = 0; shell < 2; shell++ ) {
+			int msec[ 2 ];
+
+			for( int sse = 0; sse < 2; sse++ ) {
+				const int start = Sys_Milliseconds();
+				for( int f = 0; f < frames; f++ )
+					gl_lerpverts[ sse ][ res ][ shell ]( nverts, v, ov, s_lerped[ 0 ], s_lerpnormals, move, frontv, backv );
+				msec[ sse ] = Sys_Milliseconds() - start;
+
+				if( !sse )
+					memcpy( reference, s_lerped, nverts * 4 * sizeof( float ) );
+			}
+
+			int mismatches = 0;
+			for( unsigned int i = 0; i < nverts; i++ ) {
+				if( memcmp( reference + i * 4, s_lerped[ i ], 3 * sizeof( float ) ) )
+					mismatches++;
+			}
+
+			VID_Printf( PRINT_ALL, "res %d%s: C %.1f Mverts/s, SSE %.1f Mverts/s, %d mismatches\n", res, shell ? " shell" : "",
+				(double)nverts * frames / ( 1000.0 * ( msec[ 0 ] ? msec[ 0 ] : 1 ) ),
+				(double)nverts * frames / ( 1000.0 * ( msec[ 1 ] ? msec[ 1 ] : 1 ) ), mismatches );
 		}
 	}
+
+	Z_Free( reference );
+	Z_Free( data );
 }
 
 /*
@@ -75,32 +291,22 @@ void GL_LerpVerts( unsigned int nverts, Md2VertexGroup *v, Md2VertexGroup *ov, M
 GL_DrawAliasFrameLerp
 
 interpolates between two frames and origins
-FIXME: batch lerp all vertexes
 =============
 */
 void GL_DrawAliasFrameLerp( dmdl_t *paliashdr, float backlerp ) {
 	float l;
 	Md2FrameHeader *frame, *oldframe;
-	Md2VertexGroup *v, *ov, *verts;
-	int *order;
-	int count;
 	float frontlerp;
 	float alpha;
 	vec3_t move, delta, vectors[ 3 ];
 	vec3_t frontv, backv;
 	int i;
-	int index_xyz;
-	float *lerp;
 
 	frame = (Md2FrameHeader *)( (byte *)paliashdr + paliashdr->ofs_frames +
 		currententity->frame * paliashdr->framesize );
-	verts = v = frame->verts;
 
 	oldframe = (Md2FrameHeader *)( (byte *)paliashdr + paliashdr->ofs_frames +
 		currententity->oldframe * paliashdr->framesize );
-	ov = oldframe->verts;
-
-	order = (int *)( (byte *)paliashdr + paliashdr->ofs_glcmds );
 
 	//	glTranslatef (frame->translate[0], frame->translate[1],
 	//frame->translate[2]); 	glScalef (frame->scale[0], frame->scale[1],
@@ -137,9 +343,7 @@ void GL_DrawAliasFrameLerp( dmdl_t *paliashdr, float backlerp ) {
 		backv[ i ] = backlerp * oldframe->scale[ i ];
 	}
 
-	lerp = s_lerped[ 0 ];
-
-	GL_LerpVerts( paliashdr->num_xyz, v, ov, verts, lerp, move, frontv, backv );
+	GL_LerpVerts( paliashdr, frame, oldframe, move, frontv, backv );
 
 	if( gl_vertex_arrays->value ) {
 		glEnableClientState( GL_VERTEX_ARRAY );
@@ -152,111 +356,59 @@ void GL_DrawAliasFrameLerp( dmdl_t *paliashdr, float backlerp ) {
 			RF_SHELL_DOUBLE | RF_SHELL_HALF_DAM ) ) {
 			glColor4f( shadelight[ 0 ], shadelight[ 1 ], shadelight[ 2 ], alpha );
 		} else {
-			float *colorArray = static_cast< float* >( Hunk_Alloc( paliashdr->num_xyz * 4 ) );
+			// the hunk is only there while loading, so light into a static array
+			static float colorArray[ MAX_ALIAS_VERTS * 3 ];
 
 			glEnableClientState( GL_COLOR_ARRAY );
 			glColorPointer( 3, GL_FLOAT, 0, colorArray );
+			glEnableClientState( GL_TEXTURE_COORD_ARRAY );
+			glTexCoordPointer( 2, GL_FLOAT, 0, currentmodel->aliasst );
 
 			//
 			// pre light everything
 			//
 			for( i = 0; i < paliashdr->num_xyz; i++ ) {
-				float l = shadedots[ verts[ i ].normalIndex ];
+				float l = shadedots[ s_lerpnormals[ i ] ];
 
 				colorArray[ i * 3 + 0 ] = l * shadelight[ 0 ];
 				colorArray[ i * 3 + 1 ] = l * shadelight[ 1 ];
 				colorArray[ i * 3 + 2 ] = l * shadelight[ 2 ];
 			}
-
-			Hunk_Free( colorArray );
 		}
 
 		if( glLockArraysEXT != 0 ) glLockArraysEXT( 0, paliashdr->num_xyz );
 
-		while( 1 ) {
-			// get the vertex count and primitive type
-			count = *order++;
-			if( !count ) break;  // done
-			if( count < 0 ) {
-				count = -count;
-				glBegin( GL_TRIANGLE_FAN );
-			} else {
-				glBegin( GL_TRIANGLE_STRIP );
-			}
+		glDrawElements( GL_TRIANGLES, currentmodel->numaliasindices, GL_UNSIGNED_SHORT, currentmodel->aliasindices );
 
-			// PMM - added double damage shell
-			if( currententity->flags &
-				( RF_SHELL_RED | RF_SHELL_GREEN | RF_SHELL_BLUE | RF_SHELL_DOUBLE |
-					RF_SHELL_HALF_DAM ) ) {
-				do {
-					index_xyz = order[ 2 ];
-					order += 3;
-
-					glVertex3fv( s_lerped[ index_xyz ] );
-
-				} while( --count );
-			} else {
-				do {
-					// texture coordinates come from the draw list
-					glTexCoord2f( ( (float *)order )[ 0 ], ( (float *)order )[ 1 ] );
-					index_xyz = order[ 2 ];
-
-					order += 3;
-
-					// normals and vertexes come from the frame list
-					//					l =
-					//shadedots[verts[index_xyz].lightnormalindex];
+		if( glUnlockArraysEXT != 0 ) glUnlockArraysEXT();
 
-					//					qglColor4f (l* shadelight[0], l*shadelight[1],
-					//l*shadelight[2], alpha);
-					glArrayElement( index_xyz );
+		glDisableClientState( GL_COLOR_ARRAY );
+		glDisableClientState( GL_TEXTURE_COORD_ARRAY );
+	} else {
+		const uint16_t *indices = currentmodel->aliasindices;
+		const float *st = currentmodel->aliasst;
 
-				} while( --count );
-			}
-			glEnd();
-		}
+		glBegin( GL_TRIANGLES );
 
-		if( glUnlockArraysEXT != 0 ) glUnlockArraysEXT();
-	} else {
-		while( 1 ) {
-			// get the vertex count and primitive type
-			count = *order++;
-			if( !count ) break;  // done
-			if( count < 0 ) {
-				count = -count;
-				glBegin( GL_TRIANGLE_FAN );
-			} else {
-				glBegin( GL_TRIANGLE_STRIP );
+		if( currententity->flags & ( RF_SHELL_RED | RF_SHELL_GREEN | RF_SHELL_BLUE ) ) {
+			glColor4f( shadelight[ 0 ], shadelight[ 1 ], shadelight[ 2 ], alpha );
+			for( i = 0; i < currentmodel->numaliasindices; i++ ) {
+				glVertex3fv( s_lerped[ indices[ i ] ] );
 			}
+		} else {
+			for( i = 0; i < currentmodel->numaliasindices; i++ ) {
+				const int v = indices[ i ];
 
-			if( currententity->flags &
-				( RF_SHELL_RED | RF_SHELL_GREEN | RF_SHELL_BLUE ) ) {
-				do {
-					index_xyz = order[ 2 ];
-					order += 3;
-
-					glColor4f( shadelight[ 0 ], shadelight[ 1 ], shadelight[ 2 ], alpha );
-					glVertex3fv( s_lerped[ index_xyz ] );
+				// normals and vertexes come from the frame list
+				l = shadedots[ s_lerpnormals[ v ] ];
 
-				} while( --count );
-			} else {
-				do {
-					// texture coordinates come from the draw list
-					glTexCoord2f( ( (float *)order )[ 0 ], ( (float *)order )[ 1 ] );
-					index_xyz = order[ 2 ];
-					order += 3;
-
-					// normals and vertexes come from the frame list
-					l = shadedots[ verts[ index_xyz ].normalIndex ];
-
-					glColor4f( l * shadelight[ 0 ], l * shadelight[ 1 ], l * shadelight[ 2 ],
-						alpha );
-					glVertex3fv( s_lerped[ index_xyz ] );
-				} while( --count );
+				glTexCoord2f( st[ v * 2 ], st[ v * 2 + 1 ] );
+				glColor4f( l * shadelight[ 0 ], l * shadelight[ 1 ], l * shadelight[ 2 ], alpha );
+				glVertex3fv( s_lerped[ v ] );
 			}
-
-			glEnd();
 		}
+
+		glEnd();
 	}
 
 	//	if ( currententity->flags & ( RF_SHELL_RED | RF_SHELL_GREEN |
@@ -276,38 +428,26 @@ GL_DrawAliasShadow
 extern vec3_t lightspot;
 
 void GL_DrawAliasShadow( dmdl_t *paliashdr, int posenum ) {
-	int count;
-	int *order = (int *)( (byte *)paliashdr + paliashdr->ofs_glcmds );
+	const uint16_t *indices = currentmodel->aliasindices;
 
 	float lheight = currententity->origin[ 2 ] - lightspot[ 2 ];
 	float height = -lheight + 1.0;
 
-	while( 1 ) {
-		// get the vertex count and primitive type
-		count = *order++;
-		if( !count ) break;  // done
-		if( count < 0 ) {
-			count = -count;
-			glBegin( GL_TRIANGLE_FAN );
-		} else
-			glBegin( GL_TRIANGLE_STRIP );
-
-		do {
-			// normals and vertexes come from the frame list
-			vec3_t point;
-			memcpy( point, s_lerped[ order[ 2 ] ], sizeof( point ) );
-
-			point[ 0 ] -= shadevector[ 0 ] * ( point[ 2 ] + lheight );
-			point[ 1 ] -= shadevector[ 1 ] * ( point[ 2 ] + lheight );
-			point[ 2 ] = height;
-			//			height -= 0.001;
-			glVertex3fv( point );
-
-			order += 3;
-		} while( --count );
+	glBegin( GL_TRIANGLES );
 
-		glEnd();
+	for( int i = 0; i < currentmodel->numaliasindices; i++ ) {
+		// normals and vertexes come from the frame list
+		vec3_t point;
+		memcpy( point, s_lerped[ indices[ i ] ], sizeof( point ) );
+
+		point[ 0 ] -= shadevector[ 0 ] * ( point[ 2 ] + lheight );
+		point[ 1 ] -= shadevector[ 1 ] * ( point[ 2 ] + lheight );
+		point[ 2 ] = height;
+		//			height -= 0.001;
+		glVertex3fv( point );
 	}
+
+	glEnd();
 }
 
 #endif
@@ -339,6 +479,7 @@ static qboolean R_CullAliasModel( vec3_t bbox[ 8 ], entity_t *e ) {
 
 	Md2FrameHeader *pframe = (Md2FrameHeader *)( (byte *)paliashdr + paliashdr->ofs_frames + e->frame * paliashdr->framesize );
 	Md2FrameHeader *poldframe = (Md2FrameHeader *)( (byte *)paliashdr + paliashdr->ofs_frames + e->oldframe * paliashdr->framesize );
+	const float *range = r_aliasvertexrange[ paliashdr->resolution ];
 
 	/*
 	** compute axially aligned mins and maxs
@@ -346,15 +487,15 @@ static qboolean R_CullAliasModel( vec3_t bbox[ 8 ], entity_t *e ) {
 	if( pframe == poldframe ) {
 		for( i = 0; i < 3; i++ ) {
 			mins[ i ] = pframe->translate[ i ];
-			maxs[ i ] = mins[ i ] + pframe->scale[ i ] * 255;
+			maxs[ i ] = mins[ i ] + pframe->scale[ i ] * range[ i ];
 		}
 	} else {
 		for( i = 0; i < 3; i++ ) {
 			thismins[ i ] = pframe->translate[ i ];
-			thismaxs[ i ] = thismins[ i ] + pframe->scale[ i ] * 255;
+			thismaxs[ i ] = thismins[ i ] + pframe->scale[ i ] * range[ i ];
 
 			oldmins[ i ] = poldframe->translate[ i ];
-			oldmaxs[ i ] = oldmins[ i ] + poldframe->scale[ i ] * 255;
+			oldmaxs[ i ] = oldmins[ i ] + poldframe->scale[ i ] * range[ i ];
 
 			if( thismins[ i ] < oldmins[ i ] )
 				mins[ i ] = thismins[ i ];
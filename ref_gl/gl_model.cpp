@@ -21,12 +21,14 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "gl_local.h"
 
+#include <cstddef>
+
 model_t *loadmodel;
 int modfilelen;
 
-void Mod_LoadSpriteModel( model_t *mod, void *buffer );
-void Mod_LoadBrushModel( model_t *mod, void *buffer );
-void Mod_LoadAliasModel( model_t *mod, void *buffer );
+void Mod_LoadSpriteModel( model_t *mod, const void *buffer );
+void Mod_LoadBrushModel( model_t *mod, const void *buffer );
+void Mod_LoadAliasModel( model_t *mod, const void *buffer );
 model_t *Mod_LoadModel( model_t *mod, qboolean crash );
 
 byte mod_novis[ MAX_MAP_LEAFS / 8 ];
@@ -125,18 +127,28 @@ Mod_Modellist_f
 ================
 */
 void Mod_Modellist_f( void ) {
+	static const char *typeNames[] = { "bad", "brush", "sprite", "alias" };
+
 	int i;
 	model_t *mod;
-	int total;
+	int total, totalReserved;
+	int typeTotals[ 4 ] = {}, typeCounts[ 4 ] = {};
 
-	total = 0;
+	total = totalReserved = 0;
 	VID_Printf( PRINT_ALL, "Loaded models:\n" );
+	VID_Printf( PRINT_ALL, "    used reserved   type : name\n" );
 	for( i = 0, mod = mod_known; i < mod_numknown; i++, mod++ ) {
 		if( !mod->name[ 0 ] ) continue;
-		VID_Printf( PRINT_ALL, "%8i : %s\n", mod->extradatasize, mod->name );
+		VID_Printf( PRINT_ALL, "%8i %8i %6s : %s\n", mod->extradatasize, mod->extradatareserved, typeNames[ mod->type ], mod->name );
 		total += mod->extradatasize;
+		totalReserved += mod->extradatareserved;
+		typeTotals[ mod->type ] += mod->extradatasize;
+		typeCounts[ mod->type ]++;
 	}
-	VID_Printf( PRINT_ALL, "Total resident: %i\n", total );
+	for( i = mod_brush; i <= mod_alias; i++ ) {
+		VID_Printf( PRINT_ALL, "%i %s models: %i\n", typeCounts[ i ], typeNames[ i ], typeTotals[ i ] );
+	}
+	VID_Printf( PRINT_ALL, "Total resident: %i (%i reserved)\n", total, totalReserved );
 }
 
 /*
@@ -146,6 +158,126 @@ Mod_Init
 */
 void Mod_Init( void ) { memset( mod_novis, 0xff, sizeof( mod_novis ) ); }
 
+/*
+==================
+Mod_HunkSize
+
+Hunk_Alloc rounds every allocation up to a cacheline
+==================
+*/
+static size_t Mod_HunkSize( size_t size ) { return ( size + 31 ) & ~31; }
+
+/*
+==================
+Mod_AliasModelSize
+
+Estimates the hunk Mod_LoadAliasModel needs from the file header. Frames
+get a vertex per distinct (xyz, st) pair, which is usually about num_st.
+The counts are checked the way the loader checks them first, and against
+the file length; anything that fails just gets a hunk the size of the
+file, and is then rejected by the loader.
+==================
+*/
+static size_t Mod_AliasModelSize( const dmdl_t *header, int filelen ) {
+	if( filelen < (int)sizeof( dmdl_t ) )
+		return Mod_HunkSize( sizeof( dmdl_t ) );
+
+	const int num_xyz = LittleLong( header->num_xyz );
+	const int num_st = LittleLong( header->num_st );
+	const int num_tris = LittleLong( header->num_tris );
+	const int num_frames = LittleLong( header->num_frames );
+	const int num_glcmds = LittleLong( header->num_glcmds );
+	const int ofs_end = LittleLong( header->ofs_end );
+	if( num_xyz <= 0 || num_xyz > MAX_VERTS || num_st <= 0 || num_tris <= 0 || num_frames <= 0 || num_glcmds <= 0
+		|| ofs_end < (int)sizeof( dmdl_t ) || ofs_end > filelen
+		|| num_st > filelen / (int)sizeof( dstvert_t ) || num_tris > filelen / (int)sizeof( dtriangle_t )
+		|| num_glcmds > filelen / (int)sizeof( int )
+		|| num_frames > filelen / (int)( offsetof( Md2FrameHeader, verts ) + num_xyz * sizeof( Md2VertexGroup ) ) )
+		return Mod_HunkSize( filelen );
+
+	// the loader gives up past MAX_ALIAS_VERTS, and there's a glcmd word for every corner
+	const size_t numxyz = num_xyz;
+	size_t numverts = num_st > num_xyz ? num_st : num_xyz;
+	if( numverts > MAX_ALIAS_VERTS )
+		numverts = MAX_ALIAS_VERTS;
+	if( numverts > (size_t)num_glcmds )
+		numverts = num_glcmds;
+	if( numverts < numxyz )
+		numverts = numxyz;
+	const size_t numframes = num_frames;
+
+	size_t size = Mod_HunkSize( ofs_end + numframes * ( numverts - numxyz ) * sizeof( Md2VertexGroup6 ) );
+	size += Mod_HunkSize( num_tris * 3 * sizeof( uint16_t ) );
+	size += Mod_HunkSize( numverts * 2 * sizeof( float ) );
+	size += Mod_HunkSize( numverts * sizeof( uint16_t ) );
+	return size;
+}
+
+/*
+==================
+Mod_BrushLumpsInFile
+
+Checks the file is long enough for the header, and that every lump the
+header points at lies within it, before anything has been swapped
+==================
+*/
+static qboolean Mod_BrushLumpsInFile( const dheader_t *header, int filelen ) {
+	if( filelen < (int)sizeof( dheader_t ) )
+		return false;
+
+	for( int i = 0; i < HEADER_LUMPS; i++ ) {
+		const int ofs = LittleLong( header->lumps[ i ].fileofs );
+		const int len = LittleLong( header->lumps[ i ].filelen );
+		if( ofs < 0 || len < 0 || ofs > filelen - len )
+			return false;
+	}
+
+	return true;
+}
+
+/*
+==================
+Mod_BrushModelSize
+
+Works out how much hunk Mod_LoadBrushModel needs from the lump headers,
+before they've been swapped. Everything is exact except the surface
+polygons, which are built later and so are only estimated from the
+number of edges; warped surfaces can need more once subdivided. A
+header that doesn't fit the file just gets a token hunk, and is then
+rejected by the loader.
+==================
+*/
+static size_t Mod_BrushModelSize( const dheader_t *header, int filelen ) {
+	if( !Mod_BrushLumpsInFile( header, filelen ) )
+		return Mod_HunkSize( sizeof( dheader_t ) );
+
+#define LUMP_LENGTH( lump ) ( (size_t)LittleLong( header->lumps[ lump ].filelen ) )
+#define LUMP_COUNT( lump, type ) ( LUMP_LENGTH( lump ) / sizeof( type ) )
+
+	size_t size = 0;
+	size += Mod_HunkSize( LUMP_COUNT( LUMP_VERTEXES, dvertex_t ) * sizeof( mvertex_t ) );
+	size += Mod_HunkSize( ( LUMP_COUNT( LUMP_EDGES, dedge_t ) + 1 ) * sizeof( medge_t ) );
+	size += Mod_HunkSize( LUMP_COUNT( LUMP_SURFEDGES, int ) * sizeof( int ) );
+	size += Mod_HunkSize( LUMP_LENGTH( LUMP_LIGHTING ) );
+	size += Mod_HunkSize( LUMP_COUNT( LUMP_PLANES, dplane_t ) * 2 * sizeof( cplane_t ) );
+	size += Mod_HunkSize( LUMP_COUNT( LUMP_TEXINFO, texinfo_t ) * sizeof( mtexinfo_t ) );
+	size += Mod_HunkSize( LUMP_COUNT( LUMP_FACES, dface_t ) * sizeof( msurface_t ) );
+	size += Mod_HunkSize( LUMP_COUNT( LUMP_LEAFFACES, short ) * sizeof( msurface_t * ) );
+	size += Mod_HunkSize( LUMP_LENGTH( LUMP_VISIBILITY ) );
+	size += Mod_HunkSize( LUMP_COUNT( LUMP_LEAFS, dleaf_t ) * sizeof( mleaf_t ) );
+	size += Mod_HunkSize( LUMP_COUNT( LUMP_NODES, dnode_t ) * sizeof( mnode_t ) );
+	size += Mod_HunkSize( LUMP_COUNT( LUMP_MODELS, dmodel_t ) * sizeof( mmodel_t ) );
+
+	// a polygon per face, each vertex of which is an edge
+	size += LUMP_COUNT( LUMP_FACES, dface_t ) * Mod_HunkSize( sizeof( glpoly_t ) );
+	size += LUMP_COUNT( LUMP_SURFEDGES, int ) * VERTEXSIZE * sizeof( float );
+
+#undef LUMP_COUNT
+#undef LUMP_LENGTH
+
+	return size;
+}
+
 /*
 ==================
 Mod_ForName
@@ -155,7 +287,7 @@ Loads in a model for the given name
 */
 model_t *Mod_ForName( const char *name, qboolean crash ) {
 	model_t *mod;
-	unsigned *buf;
+	const unsigned *buf;
 	int i;
 
 	if( !name[ 0 ] ) VID_Error( ERR_DROP, "Mod_ForName: NULL name" );
@@ -194,7 +326,7 @@ model_t *Mod_ForName( const char *name, qboolean crash ) {
 	//
 	// load the file
 	//
-	modfilelen = FS_LoadFile( mod->name, (void **)&buf );
+	modfilelen = FS_LoadSharedFile( mod->name, (const void **)&buf );
 	if( !buf ) {
 		if( crash )
 			VID_Error( ERR_DROP, "Mod_NumForName: %s not found", mod->name );
@@ -210,19 +342,20 @@ model_t *Mod_ForName( const char *name, qboolean crash ) {
 
 	// call the apropriate loader
 
-	switch( LittleLong( *(unsigned *)buf ) ) {
+	// the hunk is sized from the headers, and grows if that wasn't enough
+	switch( LittleLong( *buf ) ) {
 	case IDALIASHEADER:
-		loadmodel->extradata = Hunk_Begin( 0x500000 );
+		loadmodel->extradata = Hunk_Begin( Mod_AliasModelSize( (const dmdl_t *)buf, modfilelen ) );
 		Mod_LoadAliasModel( mod, buf );
 		break;
 
 	case IDSPRITEHEADER:
-		loadmodel->extradata = Hunk_Begin( 0x10000 );
+		loadmodel->extradata = Hunk_Begin( Mod_HunkSize( modfilelen ) );
 		Mod_LoadSpriteModel( mod, buf );
 		break;
 
 	case IDBSPHEADER:
-		loadmodel->extradata = Hunk_Begin( 0x1000000 );
+		loadmodel->extradata = Hunk_Begin( Mod_BrushModelSize( (const dheader_t *)buf, modfilelen ) );
 		Mod_LoadBrushModel( mod, buf );
 		break;
 
@@ -235,9 +368,12 @@ model_t *Mod_ForName( const char *name, qboolean crash ) {
 		break;
 	}
 
-	loadmodel->extradatasize = Hunk_End();
+	if( loadmodel->extradata ) {
+		loadmodel->extradatasize = Hunk_End();
+		loadmodel->extradatareserved = (int)Hunk_Reserved( loadmodel->extradata );
+	}
 
-	FS_FreeFile( buf );
+	FS_FreeSharedFile( buf );
 
 	return mod;
 }
@@ -250,7 +386,7 @@ model_t *Mod_ForName( const char *name, qboolean crash ) {
 ===============================================================================
 */
 
-byte *mod_base;
+const byte *mod_base;
 
 /*
 =================
@@ -294,11 +430,11 @@ Mod_LoadVertexes
 =================
 */
 void Mod_LoadVertexes( lump_t *l ) {
-	dvertex_t *in;
+	const dvertex_t *in;
 	mvertex_t *out;
 	int i, count;
 
-	in = (dvertex_t *)( mod_base + l->fileofs );
+	in = (const dvertex_t *)( mod_base + l->fileofs );
 	if( l->filelen % sizeof( *in ) )
 		VID_Error( ERR_DROP, "MOD_LoadBmodel: funny lump size in %s",
 			loadmodel->name );
@@ -337,11 +473,11 @@ Mod_LoadSubmodels
 =================
 */
 void Mod_LoadSubmodels( lump_t *l ) {
-	dmodel_t *in;
+	const dmodel_t *in;
 	mmodel_t *out;
 	int i, j, count;
 
-	in = (dmodel_t *)( mod_base + l->fileofs );
+	in = (const dmodel_t *)( mod_base + l->fileofs );
 	if( l->filelen % sizeof( *in ) )
 		VID_Error( ERR_DROP, "MOD_LoadBmodel: funny lump size in %s",
 			loadmodel->name );
@@ -370,11 +506,11 @@ Mod_LoadEdges
 =================
 */
 void Mod_LoadEdges( lump_t *l ) {
-	dedge_t *in;
+	const dedge_t *in;
 	medge_t *out;
 	int i, count;
 
-	in = (dedge_t *)( mod_base + l->fileofs );
+	in = (const dedge_t *)( mod_base + l->fileofs );
 	if( l->filelen % sizeof( *in ) )
 		VID_Error( ERR_DROP, "MOD_LoadBmodel: funny lump size in %s",
 			loadmodel->name );
@@ -396,13 +532,13 @@ Mod_LoadTexinfo
 =================
 */
 void Mod_LoadTexinfo( lump_t *l ) {
-	texinfo_t *in;
+	const texinfo_t *in;
 	mtexinfo_t *out, *step;
 	int i, j, count;
 	char name[ MAX_QPATH ];
 	int next;
 
-	in = (texinfo_t *)( mod_base + l->fileofs );
+	in = (const texinfo_t *)( mod_base + l->fileofs );
 	if( l->filelen % sizeof( *in ) )
 		VID_Error( ERR_DROP, "MOD_LoadBmodel: funny lump size in %s",
 			loadmodel->name );
@@ -497,13 +633,13 @@ Mod_LoadFaces
 =================
 */
 void Mod_LoadFaces( lump_t *l ) {
-	dface_t *in;
+	const dface_t *in;
 	msurface_t *out;
 	int i, count, surfnum;
 	int planenum, side;
 	int ti;
 
-	in = (dface_t *)( mod_base + l->fileofs );
+	in = (const dface_t *)( mod_base + l->fileofs );
 	if( l->filelen % sizeof( *in ) )
 		VID_Error( ERR_DROP, "MOD_LoadBmodel: funny lump size in %s",
 			loadmodel->name );
@@ -586,10 +722,10 @@ Mod_LoadNodes
 */
 void Mod_LoadNodes( lump_t *l ) {
 	int i, j, count, p;
-	dnode_t *in;
+	const dnode_t *in;
 	mnode_t *out;
 
-	in = (dnode_t *)( mod_base + l->fileofs );
+	in = (const dnode_t *)( mod_base + l->fileofs );
 	if( l->filelen % sizeof( *in ) )
 		VID_Error( ERR_DROP, "MOD_LoadBmodel: funny lump size in %s",
 			loadmodel->name );
@@ -630,12 +766,12 @@ Mod_LoadLeafs
 =================
 */
 void Mod_LoadLeafs( lump_t *l ) {
-	dleaf_t *in;
+	const dleaf_t *in;
 	mleaf_t *out;
 	int i, j, count, p;
 	//	glpoly_t	*poly;
 
-	in = (dleaf_t *)( mod_base + l->fileofs );
+	in = (const dleaf_t *)( mod_base + l->fileofs );
 	if( l->filelen % sizeof( *in ) )
 		VID_Error( ERR_DROP, "MOD_LoadBmodel: funny lump size in %s",
 			loadmodel->name );
@@ -681,10 +817,10 @@ Mod_LoadMarksurfaces
 */
 void Mod_LoadMarksurfaces( lump_t *l ) {
 	int i, j, count;
-	short *in;
+	const short *in;
 	msurface_t **out;
 
-	in = (short *)( mod_base + l->fileofs );
+	in = (const short *)( mod_base + l->fileofs );
 	if( l->filelen % sizeof( *in ) )
 		VID_Error( ERR_DROP, "MOD_LoadBmodel: funny lump size in %s",
 			loadmodel->name );
@@ -709,9 +845,10 @@ Mod_LoadSurfedges
 */
 void Mod_LoadSurfedges( lump_t *l ) {
 	int i, count;
-	int *in, *out;
+	const int *in;
+	int *out;
 
-	in = (int *)( mod_base + l->fileofs );
+	in = (const int *)( mod_base + l->fileofs );
 	if( l->filelen % sizeof( *in ) )
 		VID_Error( ERR_DROP, "MOD_LoadBmodel: funny lump size in %s",
 			loadmodel->name );
@@ -736,11 +873,11 @@ Mod_LoadPlanes
 void Mod_LoadPlanes( lump_t *l ) {
 	int i, j;
 	cplane_t *out;
-	dplane_t *in;
+	const dplane_t *in;
 	int count;
 	int bits;
 
-	in = (dplane_t *)( mod_base + l->fileofs );
+	in = (const dplane_t *)( mod_base + l->fileofs );
 	if( l->filelen % sizeof( *in ) )
 		VID_Error( ERR_DROP, "MOD_LoadBmodel: funny lump size in %s",
 			loadmodel->name );
@@ -768,17 +905,22 @@ void Mod_LoadPlanes( lump_t *l ) {
 Mod_LoadBrushModel
 =================
 */
-void Mod_LoadBrushModel( model_t *mod, void *buffer ) {
-	dheader_t *header;
+void Mod_LoadBrushModel( model_t *mod, const void *buffer ) {
+	dheader_t header;
 	mmodel_t *bm;
 
 	loadmodel->type = mod_brush;
 	if( loadmodel != mod_known )
 		VID_Error( ERR_DROP, "Loaded a brush model after the world" );
 
-	header = (dheader_t *)buffer;
+	if( !Mod_BrushLumpsInFile( (const dheader_t *)buffer, modfilelen ) )
+		VID_Error( ERR_DROP, "Mod_LoadBrushModel: %s is truncated or has a bad header", mod->name );
+
+	// byte swap a copy of the header, the file itself is read-only
+	for( unsigned int i = 0; i < sizeof( dheader_t ) / 4; i++ )
+		( (int *)&header )[ i ] = LittleLong( ( (const int *)buffer )[ i ] );
 
-	unsigned int version = LittleLong( header->version );
+	unsigned int version = header.version;
 	if( version != BSPVERSION )
 		VID_Error(
 			ERR_DROP,
@@ -787,26 +929,22 @@ void Mod_LoadBrushModel( model_t *mod, void *buffer ) {
 
 		        , BSPVERSION );
 
-	// swap all the lumps
-	mod_base = (byte *)header;
-
-	for( unsigned int i = 0; i < sizeof( dheader_t ) / 4; i++ )
-		( (int *)header )[ i ] = LittleLong( ( (int *)header )[ i ] );
+	mod_base = (const byte *)buffer;
 
 	// load into heap
 
-	Mod_LoadVertexes( &header->lumps[ LUMP_VERTEXES ] );
-	Mod_LoadEdges( &header->lumps[ LUMP_EDGES ] );
-	Mod_LoadSurfedges( &header->lumps[ LUMP_SURFEDGES ] );
-	Mod_LoadLighting( &header->lumps[ LUMP_LIGHTING ] );
-	Mod_LoadPlanes( &header->lumps[ LUMP_PLANES ] );
-	Mod_LoadTexinfo( &header->lumps[ LUMP_TEXINFO ] );
-	Mod_LoadFaces( &header->lumps[ LUMP_FACES ] );
-	Mod_LoadMarksurfaces( &header->lumps[ LUMP_LEAFFACES ] );
-	Mod_LoadVisibility( &header->lumps[ LUMP_VISIBILITY ] );
-	Mod_LoadLeafs( &header->lumps[ LUMP_LEAFS ] );
-	Mod_LoadNodes( &header->lumps[ LUMP_NODES ] );
-	Mod_LoadSubmodels( &header->lumps[ LUMP_MODELS ] );
+	Mod_LoadVertexes( &header.lumps[ LUMP_VERTEXES ] );
+	Mod_LoadEdges( &header.lumps[ LUMP_EDGES ] );
+	Mod_LoadSurfedges( &header.lumps[ LUMP_SURFEDGES ] );
+	Mod_LoadLighting( &header.lumps[ LUMP_LIGHTING ] );
+	Mod_LoadPlanes( &header.lumps[ LUMP_PLANES ] );
+	Mod_LoadTexinfo( &header.lumps[ LUMP_TEXINFO ] );
+	Mod_LoadFaces( &header.lumps[ LUMP_FACES ] );
+	Mod_LoadMarksurfaces( &header.lumps[ LUMP_LEAFFACES ] );
+	Mod_LoadVisibility( &header.lumps[ LUMP_VISIBILITY ] );
+	Mod_LoadLeafs( &header.lumps[ LUMP_LEAFS ] );
+	Mod_LoadNodes( &header.lumps[ LUMP_NODES ] );
+	Mod_LoadSubmodels( &header.lumps[ LUMP_MODELS ] );
 	mod->numframes = 2;  // regular and alternate animation
 
 	//
@@ -844,18 +982,185 @@ ALIAS MODELS
 ==============================================================================
 */
 
+/*
+=================
+Mod_AliasNormalIndex
+
+Normals index r_avertexnormals and the shadedots tables, so don't let a
+broken or third party model send the lighting off the end of them
+=================
+*/
+static uint16_t Mod_AliasNormalIndex( uint16_t in, int *numclamped ) {
+	const uint16_t normal = (uint16_t)LittleShort( in );
+	if( normal >= NUMVERTEXNORMALS ) {
+		( *numclamped )++;
+		return NUMVERTEXNORMALS - 1;
+	}
+	return normal;
+}
+
+/*
+=================
+Mod_AliasVertexSize
+=================
+*/
+static int Mod_AliasVertexSize( int resolution ) {
+	switch( resolution ) {
+	case 1: return sizeof( Md2VertexGroup4 );
+	case 2: return sizeof( Md2VertexGroup6 );
+	default: return sizeof( Md2VertexGroup );
+	}
+}
+
+static uint16_t mesh_xyz[ MAX_ALIAS_VERTS ];
+static float    mesh_st[ MAX_ALIAS_VERTS ][ 2 ];
+static int      mesh_chain[ MAX_ALIAS_VERTS ];  // next vertex sharing an xyz
+static int      mesh_first[ MAX_VERTS ];        // first vertex using each xyz
+
+/*
+=================
+Mod_AliasMeshVertex
+
+Finds or adds the mesh vertex for an (xyz, st) pair, returns -1 if
+there's no room for another
+=================
+*/
+static int Mod_AliasMeshVertex( int *numverts, int xyz, float s, float t ) {
+	for( int v = mesh_first[ xyz ]; v != -1; v = mesh_chain[ v ] ) {
+		if( mesh_st[ v ][ 0 ] == s && mesh_st[ v ][ 1 ] == t ) return v;
+	}
+
+	if( *numverts == MAX_ALIAS_VERTS ) return -1;
+
+	const int v = ( *numverts )++;
+	mesh_xyz[ v ] = xyz;
+	mesh_st[ v ][ 0 ] = s;
+	mesh_st[ v ][ 1 ] = t;
+	mesh_chain[ v ] = mesh_first[ xyz ];
+	mesh_first[ xyz ] = v;
+	return v;
+}
+
+/*
+=================
+Mod_AliasCommandTriangles
+
+Walks a glcmd list and calls emit with the three corners, as (xyz, s, t),
+of every triangle GL would draw from its strips and fans, winding
+included. Returns false if the list is malformed, or if emit returns
+false to stop the walk.
+=================
+*/
+template< typename Emit >
+static bool Mod_AliasCommandTriangles( const int *cmds, int numcmds, int numxyz, Emit emit ) {
+	int pos = 0;
+
+	while( 1 ) {
+		if( pos >= numcmds ) return false;
+		int count = LittleLong( cmds[ pos++ ] );
+		if( !count ) return true;
+
+		const bool fan = count < 0;
+		if( fan ) count = -count;
+		if( count > ( numcmds - pos ) / 3 ) return false;
+
+		int corner[ 3 ][ 3 ];  // first, previous and current (xyz, s, t)
+		for( int i = 0; i < count; i++, pos += 3 ) {
+			int *c = corner[ i < 2 ? i : 2 ];
+			c[ 0 ] = LittleLong( cmds[ pos + 2 ] );
+			c[ 1 ] = LittleLong( cmds[ pos ] );  // float bits
+			c[ 2 ] = LittleLong( cmds[ pos + 1 ] );
+			if( c[ 0 ] < 0 || c[ 0 ] >= numxyz ) return false;
+			if( i < 2 ) continue;
+
+			// strips flip every other triangle to keep the winding
+			bool more;
+			if( fan )
+				more = emit( corner[ 0 ], corner[ 1 ], corner[ 2 ] );
+			else if( i & 1 )
+				more = emit( corner[ 1 ], corner[ 0 ], corner[ 2 ] );
+			else
+				more = emit( corner[ 0 ], corner[ 1 ], corner[ 2 ] );
+			if( !more ) return false;
+
+			if( !fan ) memcpy( corner[ 0 ], corner[ 1 ], sizeof( corner[ 0 ] ) );
+			memcpy( corner[ 1 ], corner[ 2 ], sizeof( corner[ 1 ] ) );
+		}
+	}
+}
+
+static float Mod_BitsToFloat( int bits ) {
+	float f;
+	memcpy( &f, &bits, sizeof( f ) );
+	return f;
+}
+
+/*
+=================
+Mod_CheckAliasMeshes_f
+
+Rebuilds the triangles of every loaded alias model from its strips and
+fans and checks the indexed triangle list draws exactly the same ones,
+in the same order
+=================
+*/
+void Mod_CheckAliasMeshes_f( void ) {
+	model_t *mod;
+	int i, checked = 0, failed = 0;
+
+	for( i = 0, mod = mod_known; i < mod_numknown; i++, mod++ ) {
+		if( !mod->name[ 0 ] || mod->type != mod_alias ) continue;
+
+		const dmdl_t *pheader = (dmdl_t *)mod->extradata;
+		const int *cmds = (const int *)( (const byte *)pheader + pheader->ofs_glcmds );
+		int numtris = 0, bad = 0;
+
+		const bool ok = Mod_AliasCommandTriangles( cmds, pheader->num_glcmds, MAX_VERTS, [ & ]( const int *a, const int *b, const int *c ) {
+			const int *corners[ 3 ] = { a, b, c };
+			for( int k = 0; k < 3; k++ ) {
+				const int index = numtris * 3 + k;
+				if( index >= mod->numaliasindices ) {
+					bad++;
+					continue;
+				}
+				const int v = mod->aliasindices[ index ];
+				if( mod->aliasxyz[ v ] != corners[ k ][ 0 ] || mod->aliasst[ v * 2 ] != Mod_BitsToFloat( corners[ k ][ 1 ] ) ||
+					mod->aliasst[ v * 2 + 1 ] != Mod_BitsToFloat( corners[ k ][ 2 ] ) )
+					bad++;
+			}
+			numtris++;
+			return true;
+		} );
+
+		if( !ok || bad || numtris * 3 != mod->numaliasindices ) {
+			VID_Printf( PRINT_ALL, "%s: %d of %d triangles, %d bad corners\n", mod->name, mod->numaliasindices / 3, numtris, bad );
+			failed++;
+		}
+		checked++;
+	}
+
+	VID_Printf( PRINT_ALL, "%d alias models checked, %d mismatched\n", checked, failed );
+}
+
 /*
 =================
 Mod_LoadAliasModel
+
+The glcmd strips and fans are turned into one indexed triangle list, and
+the frames are re-laid out with a vertex per distinct (xyz, st) pair so
+a lerped frame can be drawn straight from the vertex array. The glcmds
+are kept for Mod_CheckAliasMeshes_f.
 =================
 */
-void Mod_LoadAliasModel( model_t *mod, void *buffer ) {
-	dstvert_t *pinst, *poutst;
+void Mod_LoadAliasModel( model_t *mod, const void *buffer ) {
+	const dstvert_t *pinst;
+	dstvert_t *poutst;
 
-	int *pincmd, *poutcmd;
+	const int *pincmd;
+	int *poutcmd;
 	int version;
 
-	dmdl_t *pinmodel = (dmdl_t *)buffer;
+	const dmdl_t *pinmodel = (const dmdl_t *)buffer;
 
 	version = LittleLong( pinmodel->version );
 	if( version != ALIAS_VERSION ) {
@@ -868,35 +1173,100 @@ void Mod_LoadAliasModel( model_t *mod, void *buffer ) {
 #endif
 	}
 
-	dmdl_t *pheader = static_cast<dmdl_t *>( Hunk_Alloc( LittleLong( pinmodel->ofs_end ) ) );
 	// byte swap the header fields and sanity check
+	dmdl_t header;
 	for( unsigned int i = 0; i < sizeof( dmdl_t ) / 4; i++ )
-		( (int *)pheader )[ i ] = LittleLong( ( (int *)buffer )[ i ] );
+		( (int *)&header )[ i ] = LittleLong( ( (const int *)buffer )[ i ] );
 
-	if( pheader->skinheight > MAX_LBM_HEIGHT )
+	if( header.skinheight > MAX_LBM_HEIGHT )
 		VID_Error( ERR_DROP, "model %s has a skin taller than %d", mod->name,
 			MAX_LBM_HEIGHT );
 
-	if( pheader->num_xyz <= 0 )
+	if( header.num_xyz <= 0 )
 		VID_Error( ERR_DROP, "model %s has no vertices", mod->name );
 
-	if( pheader->num_st <= 0 )
+	if( header.num_xyz > MAX_VERTS )
+		VID_Error( ERR_DROP, "model %s has too many vertices", mod->name );
+
+	if( header.num_st <= 0 )
 		VID_Error( ERR_DROP, "model %s has no st vertices", mod->name );
 
-	if( pheader->num_tris <= 0 )
+	if( header.num_tris <= 0 )
 		VID_Error( ERR_DROP, "model %s has no triangles", mod->name );
 
-	if( pheader->num_frames <= 0 )
+	if( header.num_frames <= 0 )
 		VID_Error( ERR_DROP, "model %s has no frames", mod->name );
 
-	if( pheader->resolution < 0 || pheader->resolution > 2 ) {
+	if( header.resolution < 0 || header.resolution > 2 ) {
 		VID_Error( ERR_DROP, "model %s has invalid resolution", mod->name );
 	}
 
+	if( header.num_glcmds <= 0 )
+		VID_Error( ERR_DROP, "model %s has no glcmds", mod->name );
+
+	//
+	// turn the strips and fans into a triangle list; there can't be more
+	// corners than glcmd words
+	//
+	pincmd = (const int *)( (const byte *)pinmodel + header.ofs_glcmds );
+	uint16_t *indices = static_cast<uint16_t *>( Z_Malloc( header.num_glcmds * sizeof( uint16_t ) ) );
+	int numindices = 0, numverts = 0;
+	bool toomanyverts = false;
+
+	memset( mesh_first, -1, header.num_xyz * sizeof( mesh_first[ 0 ] ) );
+	const bool cmdsok = Mod_AliasCommandTriangles( pincmd, header.num_glcmds, header.num_xyz, [ & ]( const int *a, const int *b, const int *c ) {
+		const int *corners[ 3 ] = { a, b, c };
+		for( int k = 0; k < 3; k++ ) {
+			const int v = Mod_AliasMeshVertex( &numverts, corners[ k ][ 0 ],
+				Mod_BitsToFloat( corners[ k ][ 1 ] ), Mod_BitsToFloat( corners[ k ][ 2 ] ) );
+			if( v < 0 ) {
+				toomanyverts = true;
+				return false;
+			}
+			indices[ numindices++ ] = v;
+		}
+		return true;
+	} );
+	if( !cmdsok ) {
+		Z_Free( indices );
+		if( toomanyverts )
+			VID_Error( ERR_DROP, "model %s has more than %d vertices once seams are split", mod->name, MAX_ALIAS_VERTS );
+		VID_Error( ERR_DROP, "model %s has bad glcmds", mod->name );
+	}
+
+	//
+	// lay the model out again, with the bigger frames last
+	//
+	const int vertsize = Mod_AliasVertexSize( header.resolution );
+	const int frameheadersize = (int)offsetof( Md2FrameHeader, verts );
+
+	dmdl_t outheader = header;
+	outheader.num_xyz = numverts;
+	outheader.framesize = frameheadersize + numverts * vertsize;
+	outheader.ofs_skins = sizeof( dmdl_t );
+	outheader.ofs_st = outheader.ofs_skins + header.num_skins * MAX_SKINNAME;
+	outheader.ofs_tris = outheader.ofs_st + header.num_st * sizeof( dstvert_t );
+	outheader.ofs_glcmds = outheader.ofs_tris + header.num_tris * sizeof( dtriangle_t );
+	outheader.ofs_frames = outheader.ofs_glcmds + header.num_glcmds * sizeof( int );
+	outheader.ofs_end = outheader.ofs_frames + header.num_frames * outheader.framesize;
+
+	dmdl_t *pheader = static_cast<dmdl_t *>( Hunk_Alloc( outheader.ofs_end ) );
+	*pheader = outheader;
+
+	mod->numaliasindices = numindices;
+	mod->aliasindices = static_cast<uint16_t *>( Hunk_Alloc( numindices * sizeof( uint16_t ) ) );
+	memcpy( mod->aliasindices, indices, numindices * sizeof( uint16_t ) );
+	Z_Free( indices );
+
+	mod->aliasst = static_cast<float *>( Hunk_Alloc( numverts * 2 * sizeof( float ) ) );
+	memcpy( mod->aliasst, mesh_st, numverts * 2 * sizeof( float ) );
+	mod->aliasxyz = static_cast<uint16_t *>( Hunk_Alloc( numverts * sizeof( uint16_t ) ) );
+	memcpy( mod->aliasxyz, mesh_xyz, numverts * sizeof( uint16_t ) );
+
 	//
 	// load base s and t vertices (not used in gl version)
 	//
-	pinst = (dstvert_t *)( (byte *)pinmodel + pheader->ofs_st );
+	pinst = (const dstvert_t *)( (const byte *)pinmodel + header.ofs_st );
 	poutst = (dstvert_t *)( (byte *)pheader + pheader->ofs_st );
 	for( int i = 0; i < pheader->num_st; i++ ) {
 		poutst[ i ].s = LittleShort( pinst[ i ].s );
@@ -906,7 +1276,7 @@ void Mod_LoadAliasModel( model_t *mod, void *buffer ) {
 	//
 	// load triangle lists
 	//
-	dtriangle_t *pintri = (dtriangle_t *)( (byte *)pinmodel + pheader->ofs_tris );
+	const dtriangle_t *pintri = (const dtriangle_t *)( (const byte *)pinmodel + header.ofs_tris );
 	dtriangle_t *pouttri = (dtriangle_t *)( (byte *)pheader + pheader->ofs_tris );
 	for( int i = 0; i < pheader->num_tris; i++ ) {
 		for( unsigned int j = 0; j < 3; j++ ) {
@@ -916,62 +1286,48 @@ void Mod_LoadAliasModel( model_t *mod, void *buffer ) {
 	}
 
 	//
-	// load the frames
+	// load the frames, a vertex per mesh vertex
 	//
+	int numclamped = 0;
 	for( int i = 0; i < pheader->num_frames; i++ ) {
-		switch( pheader->resolution ) {
-		case 0:
-		{
-			Md2FrameHeader *pinframe = (Md2FrameHeader *)( (byte *)pinmodel + pheader->ofs_frames + i * pheader->framesize );
-			Md2FrameHeader *poutframe = (Md2FrameHeader *)( (byte *)pheader + pheader->ofs_frames + i * pheader->framesize );
-			memcpy( poutframe->name, pinframe->name, sizeof( poutframe->name ) );
+		const Md2FrameHeader *pinframe = (const Md2FrameHeader *)( (const byte *)pinmodel + header.ofs_frames + i * header.framesize );
+		Md2FrameHeader *poutframe = (Md2FrameHeader *)( (byte *)pheader + pheader->ofs_frames + i * pheader->framesize );
+		memcpy( poutframe->name, pinframe->name, sizeof( poutframe->name ) );
 
-			for( unsigned int j = 0; j < 3; j++ ) {
-				poutframe->scale[ j ] = LittleFloat( pinframe->scale[ j ] );
-				poutframe->translate[ j ] = LittleFloat( pinframe->translate[ j ] );
-			}
+		for( unsigned int j = 0; j < 3; j++ ) {
+			poutframe->scale[ j ] = LittleFloat( pinframe->scale[ j ] );
+			poutframe->translate[ j ] = LittleFloat( pinframe->translate[ j ] );
+		}
 
-			for( int j = 0; j < pheader->num_xyz; ++j ) {
+		switch( pheader->resolution ) {
+		case 0:
+			for( int j = 0; j < numverts; ++j ) {
+				const Md2VertexGroup *in = &pinframe->verts[ mesh_xyz[ j ] ];
 				for( unsigned int k = 0; k < 3; ++k ) {
-					poutframe->verts[ j ].vertexIndices[ k ] = pinframe->verts[ j ].vertexIndices[ k ];
+					poutframe->verts[ j ].vertexIndices[ k ] = in->vertexIndices[ k ];
 				}
-				poutframe->verts[ j ].normalIndex = LittleShort( pinframe->verts->normalIndex );
+				poutframe->verts[ j ].normalIndex = Mod_AliasNormalIndex( in->normalIndex, &numclamped );
 			}
 			break;
-		}
 		case 1:
 		{
-			Md2FrameHeader4 *pinframe = (Md2FrameHeader4 *)( (byte *)pinmodel + pheader->ofs_frames + i * pheader->framesize );
-			Md2FrameHeader4 *poutframe = (Md2FrameHeader4 *)( (byte *)pheader + pheader->ofs_frames + i * pheader->framesize );
-			memcpy( poutframe->name, pinframe->name, sizeof( poutframe->name ) );
-
-			for( unsigned int j = 0; j < 3; j++ ) {
-				poutframe->scale[ j ] = LittleFloat( pinframe->scale[ j ] );
-				poutframe->translate[ j ] = LittleFloat( pinframe->translate[ j ] );
-			}
-
-			for( int j = 0; j < pheader->num_xyz; ++j ) {
-				poutframe->verts[ j ].vertexIndices = pinframe->verts[ j ].vertexIndices;
-				poutframe->verts[ j ].normalIndex = LittleShort( pinframe->verts->normalIndex );
+			const Md2VertexGroup4 *in = ( (const Md2FrameHeader4 *)pinframe )->verts;
+			Md2VertexGroup4 *out = ( (Md2FrameHeader4 *)poutframe )->verts;
+			for( int j = 0; j < numverts; ++j ) {
+				out[ j ].vertexIndices = LittleLong( in[ mesh_xyz[ j ] ].vertexIndices );
+				out[ j ].normalIndex = Mod_AliasNormalIndex( in[ mesh_xyz[ j ] ].normalIndex, &numclamped );
 			}
 			break;
 		}
 		case 2:
 		{
-			Md2FrameHeader6 *pinframe = (Md2FrameHeader6 *)( (byte *)pinmodel + pheader->ofs_frames + i * pheader->framesize );
-			Md2FrameHeader6 *poutframe = (Md2FrameHeader6 *)( (byte *)pheader + pheader->ofs_frames + i * pheader->framesize );
-			memcpy( poutframe->name, pinframe->name, sizeof( poutframe->name ) );
-
-			for( unsigned int j = 0; j < 3; j++ ) {
-				poutframe->scale[ j ] = LittleFloat( pinframe->scale[ j ] );
-				poutframe->translate[ j ] = LittleFloat( pinframe->translate[ j ] );
-			}
-
-			for( int j = 0; j < pheader->num_xyz; ++j ) {
+			const Md2VertexGroup6 *in = ( (const Md2FrameHeader6 *)pinframe )->verts;
+			Md2VertexGroup6 *out = ( (Md2FrameHeader6 *)poutframe )->verts;
+			for( int j = 0; j < numverts; ++j ) {
 				for( unsigned int k = 0; k < 3; ++k ) {
-					poutframe->verts[ j ].vertexIndices[ k ] = pinframe->verts[ j ].vertexIndices[ k ];
+					out[ j ].vertexIndices[ k ] = LittleShort( in[ mesh_xyz[ j ] ].vertexIndices[ k ] );
 				}
-				poutframe->verts[ j ].normalIndex = LittleShort( pinframe->verts->normalIndex );
+				out[ j ].normalIndex = Mod_AliasNormalIndex( in[ mesh_xyz[ j ] ].normalIndex, &numclamped );
 			}
 			break;
 		}
@@ -980,18 +1336,20 @@ void Mod_LoadAliasModel( model_t *mod, void *buffer ) {
 		}
 	}
 
+	if( numclamped )
+		VID_Printf( PRINT_DEVELOPER, "%s has %d out of range normals\n", mod->name, numclamped );
+
 	mod->type = mod_alias;
 
 	//
 	// load the glcmds
 	//
-	pincmd = (int *)( (byte *)pinmodel + pheader->ofs_glcmds );
 	poutcmd = (int *)( (byte *)pheader + pheader->ofs_glcmds );
 	for( int i = 0; i < pheader->num_glcmds; i++ ) poutcmd[ i ] = LittleLong( pincmd[ i ] );
 
 	// register all skins
 	memcpy( (char *)pheader + pheader->ofs_skins,
-		(char *)pinmodel + pheader->ofs_skins,
+		(const char *)pinmodel + header.ofs_skins,
 		pheader->num_skins * MAX_SKINNAME );
 	for( int i = 0; i < pheader->num_skins; i++ ) {
 		char skin_path[ MAX_QPATH ];
@@ -1029,11 +1387,12 @@ SPRITE MODELS
 Mod_LoadSpriteModel
 =================
 */
-void Mod_LoadSpriteModel( model_t *mod, void *buffer ) {
-	dsprite_t *sprin, *sprout;
+void Mod_LoadSpriteModel( model_t *mod, const void *buffer ) {
+	const dsprite_t *sprin;
+	dsprite_t *sprout;
 	int i;
 
-	sprin = (dsprite_t *)buffer;
+	sprin = (const dsprite_t *)buffer;
 	sprout = static_cast<dsprite_t *>( Hunk_Alloc( modfilelen ) );
 
 	sprout->ident = LittleLong( sprin->ident );
@@ -169,6 +169,9 @@ typedef struct mleaf_s
 // Whole model
 //
 
+// alias frames are expanded so seams get their own vertices
+#define MAX_ALIAS_VERTS 8192
+
 typedef enum
 {
 	mod_bad,
@@ -244,7 +247,17 @@ typedef struct model_s
 	// for alias models and skins
 	image_t *skins[ MAX_MD2SKINS ];
 
+	//
+	// alias model, as one indexed triangle list; the frames are stored
+	// with a vertex per distinct (xyz, st) pair, in the same order
+	//
+	int       numaliasindices;
+	uint16_t *aliasindices;
+	float *   aliasst;     // [ num_xyz ][ 2 ]
+	uint16_t *aliasxyz;    // which vertex of the file each one came from
+
 	int   extradatasize;
+	int   extradatareserved;// including whatever the hunk didn't use
 	void *extradata;
 } model_t;
 
@@ -257,11 +270,13 @@ mleaf_t *Mod_PointInLeaf( float *p, model_t *model );
 byte *   Mod_ClusterPVS( int cluster, model_t *model );
 
 void Mod_Modellist_f( void );
+void Mod_CheckAliasMeshes_f( void );
 
 void *Hunk_Begin( size_t maxsize );
 void *Hunk_Alloc( size_t size );
 int   Hunk_End( void );
 void  Hunk_Free( void *base );
+size_t Hunk_Reserved( void *base );
 
 void Mod_FreeAll( void );
 void Mod_Free( model_t *mod );
@@ -111,6 +111,8 @@ cvar_t *gl_modulate;
 cvar_t *gl_nobind;
 cvar_t *gl_round_down;
 cvar_t *gl_picmip;
+cvar_t *gl_maxtexsize;
+cvar_t *gl_asyncimages;
 cvar_t *gl_skymip;
 cvar_t *gl_showtris;
 cvar_t *gl_ztrick;
@@ -925,6 +927,8 @@ void R_Register( void ) {
 	gl_nobind = Cvar_Get( "gl_nobind", "0", 0 );
 	gl_round_down = Cvar_Get( "gl_round_down", "1", 0 );
 	gl_picmip = Cvar_Get( "gl_picmip", "0", 0 );
+	gl_maxtexsize = Cvar_Get( "gl_maxtexsize", "0", CVAR_ARCHIVE );
+	gl_asyncimages = Cvar_Get( "gl_asyncimages", "1", 0 );
 	gl_skymip = Cvar_Get( "gl_skymip", "0", 0 );
 	gl_showtris = Cvar_Get( "gl_showtris", "0", 0 );
 	gl_ztrick = Cvar_Get( "gl_ztrick", "0", 0 );
@@ -970,6 +974,9 @@ void R_Register( void ) {
 	Cmd_AddCommand( "screenshot", GL_ScreenShot_f );
 	Cmd_AddCommand( "modellist", Mod_Modellist_f );
 	Cmd_AddCommand( "gl_strings", GL_Strings_f );
+	Cmd_AddCommand( "gl_lerpbench", GL_LerpBench_f );
+	Cmd_AddCommand( "gl_checkmeshes", Mod_CheckAliasMeshes_f );
+	Cmd_AddCommand( "gl_imagebench", GL_ImageBench_f );
 }
 
 /*
@@ -1090,6 +1097,11 @@ int R_Init( void *hinstance, void *hWnd ) {
 	gl_config.extensions_string = ( const char * ) glGetString( GL_EXTENSIONS );
 	VID_Printf( PRINT_ALL, "GL_EXTENSIONS: %s\n", gl_config.extensions_string );
 
+	// gl_maxtexsize can only bring this down
+	glGetIntegerv( GL_MAX_TEXTURE_SIZE, &gl_config.maxtexsize );
+	if( gl_config.maxtexsize < 256 )
+		gl_config.maxtexsize = 256;
+
 	strcpy( renderer_buffer, gl_config.renderer_string );
 	Q_strtolower( renderer_buffer );
 
@@ -1154,6 +1166,9 @@ void R_Shutdown( void ) {
 	Cmd_RemoveCommand( "screenshot" );
 	Cmd_RemoveCommand( "imagelist" );
 	Cmd_RemoveCommand( "gl_strings" );
+	Cmd_RemoveCommand( "gl_lerpbench" );
+	Cmd_RemoveCommand( "gl_checkmeshes" );
+	Cmd_RemoveCommand( "gl_imagebench" );
 
 	Mod_FreeAll();
 
@@ -1269,6 +1284,11 @@ void R_BeginFrame( float camera_separation ) {
 		gl_texturesolidmode->modified = false;
 	}
 
+	/*
+	** upload whatever the image workers have finished
+	*/
+	GL_UploadImages( false );
+
 	/*
 	** swapinterval stuff
 	*/
@@ -62,7 +62,7 @@ typedef struct
 	byte		multicast_buf[MAX_MSGLEN];
 
 	// demo server information
-	FILE		*demofile;
+	FileStream	*demofile;
 	qboolean	timedemo;		// don't time sync
 } server_t;
 
@@ -92,6 +92,15 @@ typedef struct
 #define	LATENCY_COUNTS	16
 #define	RATE_MESSAGES	10
 
+#define	MAX_CLIENT_MULTICASTS	64
+
+// an unreliable multicast that a client shares with the others it went to
+typedef struct
+{
+	int			offset;			// into the frame's multicast buffer
+	int			length;
+} multicastref_t;
+
 typedef struct client_s
 {
 	client_state_t	state;
@@ -120,6 +129,19 @@ typedef struct client_s
 	sizebuf_t		datagram;
 	byte			datagram_buf[MAX_MSGLEN];
 
+	// unreliable multicasts that follow the datagram, they are only
+	// copied when the datagram is sent
+	int				numrefs;
+	int				refbytes;
+	multicastref_t	refs[MAX_CLIENT_MULTICASTS];
+
+	// where SV_Multicast last found the client
+	qboolean		mcplaced;		// in the cluster buckets
+	int				mcspawncount;
+	vec3_t			mcorigin;
+	int				mccluster;
+	int				mcarea;
+
 	client_frame_t	frames[UPDATE_BACKUP];	// updates can be delta'd from here
 
 	byte			*download;			// file being downloaded
@@ -131,6 +153,8 @@ typedef struct client_s
 
 	int				challenge;			// challenge of this user, randomly generated
 
+	qboolean		bitentities;		// takes svc_bitentities
+
 	netchan_t		netchan;
 } client_t;
 
@@ -196,6 +220,11 @@ extern	cvar_t		*sv_noreload;			// don't reload level state when reentering
 extern	cvar_t		*sv_airaccelerate;		// don't reload level state when reentering
 											// development tool
 extern	cvar_t		*sv_enforcetime;
+extern	cvar_t		*sv_broadphase;			// "grid" or "tree", takes effect on the next map
+extern	cvar_t		*sv_snapthreads;		// worker threads for client frames, 0 builds them serially
+extern	cvar_t		*sv_snapcheck;			// compare every parallel frame with a serial build
+extern	cvar_t		*sv_bitentities;		// offer svc_bitentities to clients that ask
+extern	cvar_t		*sv_demokeyframes;		// serverrecord frames from one keyframe to the next
 
 extern	client_t	*sv_client;
 extern	edict_t		*sv_player;
@@ -248,8 +277,10 @@ void SV_FlushRedirect (int sv_redirected, char *outputbuf);
 
 void SV_DemoCompleted (void);
 void SV_SendClientMessages (void);
+void SV_SnapStats_f (void);
 
 void SV_Multicast (vec3_t origin, multicast_t to);
+void SV_FlushMulticasts (client_t *client);
 void SV_StartSound (vec3_t origin, edict_t *entity, int channel,
 					int soundindex, float volume,
 					float attenuation, float timeofs);
@@ -272,10 +303,46 @@ void SV_Status_f (void);
 //
 // sv_ents.c
 //
+
+// the most a frame can take before the datagram is added: every entity
+// number once, either removed or with all of its fields, and the rest
+#define	SNAP_MSGLEN		(MAX_EDICTS*48 + 1024)
+
+// one client's frame while SV_SendClientMessages builds them all
+typedef struct
+{
+	client_t	*client;
+	qboolean	ingame;			// false if there's no frame to build
+	vec3_t		org;
+	int			clientarea;
+	byte		fatpvs[MAX_MAP_LEAFS/8];
+	byte		phs[MAX_MAP_LEAFS/8];
+	int			numvisible;
+	short		visible[MAX_EDICTS];
+	sizebuf_t	msg;
+	byte		msg_buf[SNAP_MSGLEN];
+	int			refsize;		// sv_snapcheck's copy of the serial build
+	byte		ref_buf[MAX_MSGLEN];
+} clientsnap_t;
+
 void SV_WriteFrameToClient (client_t *client, sizebuf_t *msg);
-void SV_RecordDemoMessage (void);
 void SV_BuildClientFrame (client_t *client);
+void SV_BuildSnapEntities (void);
+qboolean SV_SetupClientSnap (clientsnap_t *snap, client_t *client);
+void SV_CullClientSnap (clientsnap_t *snap);
+void SV_StoreClientSnap (clientsnap_t *snap);
+
+//
+// sv_demo.c
+//
+void SV_BeginServerDemo (sizebuf_t *signon);
+void SV_EndServerDemo (void);
+void SV_RecordDemoMessage (void);
 
+qboolean SV_OpenDemo (const char *name);
+void SV_CloseDemo (void);
+void SV_SeekDemo (float seconds);
+qboolean SV_ReadDemoMessage (byte *msgbuf, int *msglen);
 
 void SV_Error (char *error, ...);
 
@@ -318,6 +385,9 @@ int SV_AreaEdicts (vec3_t mins, vec3_t maxs, edict_t **list, int maxcount, int a
 // returns the number of pointers filled in
 // ??? does this always return the world?
 
+void SV_AreaStats_f (void);
+void SV_AreaBench_f (void);
+
 //===================================================================
 
 //
@@ -339,3 +409,7 @@ trace_t SV_Trace (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, edict_t *p
 
 // passedict is explicitly excluded from clipping checks (normally NULL)
 
+void SV_TraceBatch (const trace_req_t *reqs, trace_t *out, int n);
+// SV_Trace for each request, with passent as the passedict, and the world
+// clipping done together
+
@@ -427,11 +427,35 @@ void SV_ReadServerFile( void ) {
 ==================
 SV_DemoMap_f
 
-Puts the server in demo mode on a specific map/cinematic
+Puts the server in demo mode on a specific map/cinematic, a server
+demo can be started the given number of seconds in
 ==================
 */
 void SV_DemoMap_f( void ) {
 	SV_Map( true, Cmd_Argv( 1 ), false );
+	if( Cmd_Argc() > 2 )
+		SV_SeekDemo( atof( Cmd_Argv( 2 ) ) );
+}
+
+/*
+==================
+SV_DemoSeek_f
+
+Jumps to the given number of seconds into the demo being played
+==================
+*/
+void SV_DemoSeek_f( void ) {
+	if( Cmd_Argc() != 2 ) {
+		Com_Printf( "USAGE: demoseek <seconds>\n" );
+		return;
+	}
+
+	if( sv.state != ss_demo ) {
+		Com_Printf( "Not playing a demo.\n" );
+		return;
+	}
+
+	SV_SeekDemo( atof( Cmd_Argv( 1 ) ) );
 }
 
 /*
@@ -807,13 +831,13 @@ void SV_DumpUser_f( void ) {
 SV_ServerRecord_f
 
 Begins server demo recording.  Every entity and every message will be
-recorded, but no playerinfo will be stored.  Primarily for demo merging.
+recorded, but no playerinfo will be stored.  Primarily for demo merging,
+demomap can play it back from any point.
 ==============
 */
 void SV_ServerRecord_f( void ) {
 	char	name[ MAX_OSPATH ];
 	sizebuf_t	buf;
-	int		len;
 	int		i;
 
 	if( Cmd_Argc() != 2 ) {
@@ -844,6 +868,9 @@ void SV_ServerRecord_f( void ) {
 		return;
 	}
 
+	// so demomap can find it without a rescan
+	FS_AddLocalFile( name );
+
 	// setup a buffer to catch all multicasts
 	SZ_Init( &svs.demo_multicast, svs.demo_multicast_buf, sizeof( svs.demo_multicast_buf ) );
 
@@ -865,7 +892,7 @@ void SV_ServerRecord_f( void ) {
 	// 2 means server demo
 	MSG_WriteByte( &buf, 2 );	// demos are always attract loops
 	MSG_WriteString( &buf, Cvar_VariableString( "gamedir" ) );
-	MSG_WriteShort( &buf, -1 );
+	MSG_WriteShort( &buf, 0 );	// -1 would be a cinematic
 	// send full levelname
 	MSG_WriteString( &buf, sv.configstrings[ CS_NAME ] );
 
@@ -878,11 +905,9 @@ void SV_ServerRecord_f( void ) {
 
 	// write it to the demo file
 	Com_DPrintf( "signon message length: %i\n", buf.cursize );
-	len = LittleLong( buf.cursize );
-	fwrite( &len, 4, 1, svs.demofile );
-	fwrite( buf.data, buf.cursize, 1, svs.demofile );
+	SV_BeginServerDemo( &buf );
 
-	// the rest of the demo file will be individual frames
+	// the rest of the demo file will be chunks of frames
 	free( buf_data );
 }
 
@@ -899,8 +924,7 @@ void SV_ServerStop_f( void ) {
 		Com_Printf( "Not doing a serverrecord.\n" );
 		return;
 	}
-	fclose( svs.demofile );
-	svs.demofile = NULL;
+	SV_EndServerDemo();
 	Com_Printf( "Recording completed.\n" );
 }
 
@@ -952,6 +976,7 @@ void SV_InitOperatorCommands( void ) {
 
 	Cmd_AddCommand( "map", SV_Map_f );
 	Cmd_AddCommand( "demomap", SV_DemoMap_f );
+	Cmd_AddCommand( "demoseek", SV_DemoSeek_f );
 	Cmd_AddCommand( "gamemap", SV_GameMap_f );
 	Cmd_AddCommand( "setmaster", SV_SetMaster_f );
 
@@ -967,5 +992,9 @@ void SV_InitOperatorCommands( void ) {
 	Cmd_AddCommand( "killserver", SV_KillServer_f );
 
 	Cmd_AddCommand( "sv", SV_ServerCommand_f );
+
+	Cmd_AddCommand( "sv_areastats", SV_AreaStats_f );
+	Cmd_AddCommand( "sv_areabench", SV_AreaBench_f );
+	Cmd_AddCommand( "sv_snapstats", SV_SnapStats_f );
 }
 
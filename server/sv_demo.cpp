@@ -0,0 +1,1061 @@
+/*
+Copyright (C) 1997-2001 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+#include "server.h"
+
+#include <miniz/miniz.h>
+
+/*
+=============================================================================
+
+SERVER DEMOS
+
+A serverrecord demo is a header and the signon, then the frames grouped
+into chunks that are each compressed on their own.  Every chunk starts
+with a keyframe holding all of the entities, the rest of its frames are
+svc_bitentities style deltas from the frame before.  The file ends with
+an index of the chunks, so playback can jump to any frame by inflating
+one chunk and applying at most sv_demokeyframes-1 deltas.
+
+	"SVDM" version keyframes maxclients signonlen signon
+	chunk: firstframe numframes rawlen complen compressed frames
+	...
+	index: offset firstframe numframes, for every chunk
+	numchunks indexofs "SVDX"
+
+A frame is its number, flags, the configstrings that changed (all of
+the ones that differ from the signon for a keyframe), the entities and
+the multicasts sent during it.
+
+Playback turns the frames back into ordinary svc_frame messages, delta
+compressed against the newest one every viewer has acknowledged, so any
+client can watch, even over a network that drops packets.
+Demos recorded by a client, or by older servers, are still just played
+one message at a time.
+
+=============================================================================
+*/
+
+#define	DEMO_MAGIC		(('M'<<24)+('D'<<16)+('V'<<8)+'S')	// "SVDM"
+#define	DEMO_INDEXMAGIC	(('X'<<24)+('D'<<16)+('V'<<8)+'S')	// "SVDX"
+#define	DEMO_VERSION	1
+
+#define	DEMO_KEYFRAME	1		// frame flag, the entities aren't deltas
+
+#define	DEMO_MSGLEN		(MAX_MSGLEN - 16)	// leave room for the netchan header
+
+typedef struct
+{
+	int		offset;				// of the chunk header in the file
+	int		firstframe;
+	int		numframes;
+} demochunk_t;
+
+// serverrecord
+typedef struct
+{
+	int				keyframes;
+	int				maxclients;
+	entity_state_t	*ents;			// [MAX_EDICTS] as of the last frame
+	char			(*signoncs)[MAX_QPATH];
+	char			(*cs)[MAX_QPATH];
+	short			changed[MAX_CONFIGSTRINGS];
+
+	sizebuf_t		chunk;			// the frames of the chunk being built
+	int				firstframe;
+	int				numframes;
+
+	demochunk_t		*index;
+	int				numchunks;
+	int				maxchunks;
+} demorecord_t;
+
+// demomap
+typedef struct
+{
+	qboolean		indexed;		// false for a plain sequence of messages
+	int				keyframes;
+	int				maxclients;
+	float			seektime;		// -1 if not seeking
+
+	demochunk_t		*index;
+	int				numchunks;
+	int				maxchunks;
+
+	byte			*signon;
+	int				signonlen;		// the serverdata, without configstrings
+	qboolean		signonsent;
+
+	sizebuf_t		chunk;			// inflated frames of the current chunk
+	int				chunknum;
+
+	// the last frame read from the chunk
+	qboolean		framepending;	// read, but not sent yet
+	int				framenum;
+	entity_state_t	*ents;			// [MAX_EDICTS]
+	char			(*signoncs)[MAX_QPATH];
+	char			(*cs)[MAX_QPATH];
+	byte			*multicast;
+	int				multicastlen;
+
+	// what the clients may have
+	int				sentframes[UPDATE_BACKUP];	// -1 for a slot that can't be a delta base
+	int				lastsent;		// number of the frame sent last
+	entity_state_t	*sent;			// [UPDATE_BACKUP][MAX_EDICTS]
+	char			(*sentcs)[MAX_QPATH];
+	int				cscursor;		// MAX_CONFIGSTRINGS when sentcs is up to date
+} demoplayback_t;
+
+static demorecord_t		demorec;
+static demoplayback_t	demoplay = { false, 0, 0, -1 };
+
+static entity_state_t	demo_nostate;
+
+
+/*
+================
+SV_AddDemoChunk
+
+Grows an index by one entry
+================
+*/
+static demochunk_t *SV_AddDemoChunk (demochunk_t **index, int *numchunks, int *maxchunks)
+{
+	demochunk_t	*newindex;
+
+	if (*numchunks == *maxchunks)
+	{
+		*maxchunks = *maxchunks ? *maxchunks * 2 : 64;
+		newindex = (demochunk_t *)Z_Malloc (*maxchunks * sizeof(demochunk_t));
+		if (*index)
+		{
+			memcpy (newindex, *index, *numchunks * sizeof(demochunk_t));
+			Z_Free (*index);
+		}
+		*index = newindex;
+	}
+
+	return &(*index)[(*numchunks)++];
+}
+
+/*
+=============================================================================
+
+RECORDING
+
+=============================================================================
+*/
+
+static void SV_DemoWriteLong (int l)
+{
+	l = LittleLong (l);
+	fwrite (&l, 4, 1, svs.demofile);
+}
+
+/*
+================
+SV_DemoChunkSpace
+
+Makes sure another length bytes will fit in the chunk
+================
+*/
+static void SV_DemoChunkSpace (int length)
+{
+	sizebuf_t	*chunk;
+	byte		*data;
+	size_t		maxsize;
+
+	chunk = &demorec.chunk;
+	if (chunk->cursize + length <= chunk->maxsize)
+		return;
+
+	maxsize = chunk->maxsize * 2;
+	if (maxsize < chunk->cursize + length)
+		maxsize = chunk->cursize + length;
+
+	data = (byte *)Z_Malloc (maxsize);
+	memcpy (data, chunk->data, chunk->cursize);
+	Z_Free (chunk->data);
+	chunk->data = data;
+	chunk->maxsize = maxsize;
+}
+
+/*
+================
+SV_FlushDemoChunk
+
+Compresses the frames since the last keyframe into the file
+================
+*/
+static void SV_FlushDemoChunk (void)
+{
+	demochunk_t	*c;
+	mz_ulong	complen;
+	byte		*comp;
+
+	if (!demorec.numframes)
+		return;
+
+	complen = mz_compressBound (demorec.chunk.cursize);
+	comp = (byte *)Z_Malloc (complen);
+	if (mz_compress2 (comp, &complen, demorec.chunk.data, demorec.chunk.cursize, MZ_DEFAULT_LEVEL) != MZ_OK)
+		Com_Error (ERR_DROP, "SV_FlushDemoChunk: compression failed");
+
+	c = SV_AddDemoChunk (&demorec.index, &demorec.numchunks, &demorec.maxchunks);
+	c->offset = ftell (svs.demofile);
+	c->firstframe = demorec.firstframe;
+	c->numframes = demorec.numframes;
+
+	SV_DemoWriteLong (c->firstframe);
+	SV_DemoWriteLong (c->numframes);
+	SV_DemoWriteLong (demorec.chunk.cursize);
+	SV_DemoWriteLong (complen);
+	fwrite (comp, complen, 1, svs.demofile);
+
+	Z_Free (comp);
+	SZ_Clear (&demorec.chunk);
+	demorec.numframes = 0;
+}
+
+/*
+================
+SV_BeginServerDemo
+
+Writes the header and the signon to the freshly opened svs.demofile
+================
+*/
+void SV_BeginServerDemo (sizebuf_t *signon)
+{
+	demorec.keyframes = (int)sv_demokeyframes->value;
+	if (demorec.keyframes < 1)
+		demorec.keyframes = 1;
+	demorec.maxclients = (int)maxclients->value;
+
+	demorec.ents = (entity_state_t *)Z_Malloc (MAX_EDICTS * sizeof(entity_state_t));
+	memset (demorec.ents, 0, MAX_EDICTS * sizeof(entity_state_t));
+
+	// the configstrings the signon is about to carry
+	demorec.signoncs = (char (*)[MAX_QPATH])Z_Malloc (sizeof(sv.configstrings));
+	memcpy (demorec.signoncs, sv.configstrings, sizeof(sv.configstrings));
+	demorec.cs = (char (*)[MAX_QPATH])Z_Malloc (sizeof(sv.configstrings));
+	memcpy (demorec.cs, sv.configstrings, sizeof(sv.configstrings));
+
+	SZ_Init (&demorec.chunk, (byte *)Z_Malloc (0x10000), 0x10000);
+	demorec.numframes = 0;
+	demorec.index = NULL;
+	demorec.numchunks = demorec.maxchunks = 0;
+
+	SV_DemoWriteLong (DEMO_MAGIC);
+	SV_DemoWriteLong (DEMO_VERSION);
+	SV_DemoWriteLong (demorec.keyframes);
+	SV_DemoWriteLong (demorec.maxclients);
+	SV_DemoWriteLong (signon->cursize);
+	fwrite (signon->data, signon->cursize, 1, svs.demofile);
+}
+
+/*
+================
+SV_EndServerDemo
+
+Writes out the last chunk and the index, and closes the file
+================
+*/
+void SV_EndServerDemo (void)
+{
+	int		indexofs;
+	int		i;
+
+	SV_FlushDemoChunk ();
+
+	indexofs = ftell (svs.demofile);
+	for (i=0 ; i<demorec.numchunks ; i++)
+	{
+		SV_DemoWriteLong (demorec.index[i].offset);
+		SV_DemoWriteLong (demorec.index[i].firstframe);
+		SV_DemoWriteLong (demorec.index[i].numframes);
+	}
+	SV_DemoWriteLong (demorec.numchunks);
+	SV_DemoWriteLong (indexofs);
+	SV_DemoWriteLong (DEMO_INDEXMAGIC);
+
+	fclose (svs.demofile);
+	svs.demofile = NULL;
+
+	Z_Free (demorec.ents);
+	Z_Free (demorec.signoncs);
+	Z_Free (demorec.cs);
+	Z_Free (demorec.chunk.data);
+	if (demorec.index)
+		Z_Free (demorec.index);
+	memset (&demorec, 0, sizeof(demorec));
+}
+
+/*
+==================
+SV_RecordDemoMessage
+
+Save everything in the world out, as a keyframe at the start of every
+chunk and as deltas from the previous frame in between.
+Used for recording footage for merged or assembled demos
+==================
+*/
+void SV_RecordDemoMessage (void)
+{
+	int			e, i;
+	int			numchanged;
+	int			cslength;
+	int			lastnum;
+	qboolean	keyframe;
+	edict_t		*ent;
+	entity_state_t	*from, *to;
+	sizebuf_t	*chunk;
+
+	if (!svs.demofile)
+		return;
+
+	if (demorec.numframes == demorec.keyframes)
+		SV_FlushDemoChunk ();
+	keyframe = (qboolean)!demorec.numframes;
+	if (keyframe)
+		demorec.firstframe = sv.framenum;
+	demorec.numframes++;
+
+	chunk = &demorec.chunk;
+	SV_DemoChunkSpace (5);
+	MSG_WriteLong (chunk, sv.framenum);
+	MSG_WriteByte (chunk, keyframe ? DEMO_KEYFRAME : 0);
+
+	// configstrings changed since the last frame, or since the signon
+	// for a keyframe
+	numchanged = 0;
+	for (i=0 ; i<MAX_CONFIGSTRINGS ; i++)
+	{
+		if (strcmp (sv.configstrings[i], demorec.cs[i]))
+		{
+			strcpy (demorec.cs[i], sv.configstrings[i]);
+			if (!keyframe)
+				demorec.changed[numchanged++] = i;
+		}
+		if (keyframe && strcmp (demorec.cs[i], demorec.signoncs[i]))
+			demorec.changed[numchanged++] = i;
+	}
+
+	// strings can run on past MAX_QPATH, into the slots after them
+	cslength = 2;
+	for (i=0 ; i<numchanged ; i++)
+		cslength += 2 + strlen (demorec.cs[demorec.changed[i]]) + 1;
+	SV_DemoChunkSpace (cslength);
+	MSG_WriteShort (chunk, numchanged);
+	for (i=0 ; i<numchanged ; i++)
+	{
+		MSG_WriteShort (chunk, demorec.changed[i]);
+		MSG_WriteString (chunk, demorec.cs[demorec.changed[i]]);
+	}
+
+	// entities
+	SV_DemoChunkSpace (SNAP_MSGLEN);
+	lastnum = 0;
+	for (e=1 ; e<MAX_EDICTS ; e++)
+	{
+		from = &demorec.ents[e];
+		to = NULL;
+		if (e < ge->num_edicts)
+		{
+			// ignore ents without visible models unless they have an effect
+			ent = EDICT_NUM(e);
+			if (ent->inuse &&
+				ent->s.number == e &&
+				(ent->s.modelindex || ent->s.effects || ent->s.sound || ent->s.event) &&
+				!(ent->svflags & SVF_NOCLIENT))
+				to = &ent->s;
+		}
+
+		if (!to)
+		{
+			if (from->number && !keyframe)
+				MSG_WriteRemoveEntityBits (chunk, e, &lastnum);
+			from->number = 0;
+			continue;
+		}
+
+		if (keyframe || !from->number)
+			MSG_WriteDeltaEntityBits (&demo_nostate, to, chunk, true, true, &lastnum);
+		else
+			MSG_WriteDeltaEntityBits (from, to, chunk, false, e <= demorec.maxclients, &lastnum);
+		*from = *to;
+	}
+	MSG_WriteEntityBitsEnd (chunk);
+
+	// now add the accumulated multicast information
+	SV_DemoChunkSpace (2 + svs.demo_multicast.cursize);
+	MSG_WriteShort (chunk, svs.demo_multicast.cursize);
+	SZ_Write (chunk, svs.demo_multicast.data, svs.demo_multicast.cursize);
+	SZ_Clear (&svs.demo_multicast);
+}
+
+/*
+=============================================================================
+
+PLAYBACK
+
+=============================================================================
+*/
+
+static int SV_DemoReadLong (void)
+{
+	int		l;
+
+	if (FS_ReadStream (sv.demofile, &l, 4) != 4)
+		return -1;
+	return LittleLong (l);
+}
+
+/*
+================
+SV_SetDemoConfigstring
+
+Stores the string the way sv.configstrings does, running on into the
+following slots if it's longer than one, like CS_STATUSBAR
+================
+*/
+static void SV_SetDemoConfigstring (char (*cs)[MAX_QPATH], int index, const char *s)
+{
+	size_t	length, room;
+
+	room = (MAX_CONFIGSTRINGS - index) * MAX_QPATH;
+	length = strlen (s);
+	if (length >= room)
+		length = room - 1;
+
+	memcpy (cs[index], s, length);
+	cs[index][length] = 0;
+}
+
+/*
+================
+SV_ParseDemoSignon
+
+Splits the configstrings off the end of the signon, they are sent
+along with any others the client is missing
+================
+*/
+static void SV_ParseDemoSignon (void)
+{
+	sizebuf_t	msg;
+	int			i;
+
+	SZ_Init (&msg, demoplay.signon, demoplay.signonlen);
+	msg.cursize = demoplay.signonlen;
+
+	MSG_ReadByte (&msg);		// svc_serverdata
+	MSG_ReadLong (&msg);		// protocol
+	MSG_ReadLong (&msg);		// spawncount
+	MSG_ReadByte (&msg);		// attractloop
+	MSG_ReadString (&msg);		// gamedir
+	MSG_ReadShort (&msg);		// playernum
+	MSG_ReadString (&msg);		// levelname
+	if (msg.readcount > msg.cursize)
+		Com_Error (ERR_DROP, "SV_ParseDemoSignon: bad serverdata");
+	demoplay.signonlen = msg.readcount;
+
+	while (msg.readcount < msg.cursize)
+	{
+		if (MSG_ReadByte (&msg) != svc_configstring)
+			Com_Error (ERR_DROP, "SV_ParseDemoSignon: not configstring");
+		i = MSG_ReadShort (&msg);
+		if (i < 0 || i >= MAX_CONFIGSTRINGS)
+			Com_Error (ERR_DROP, "SV_ParseDemoSignon: bad configstring");
+		SV_SetDemoConfigstring (demoplay.signoncs, i, MSG_ReadString (&msg));
+	}
+}
+
+/*
+================
+SV_ScanDemoChunks
+
+Rebuilds the index of a recording that never got to write one, the
+chunk headers are enough
+================
+*/
+static void SV_ScanDemoChunks (int offset)
+{
+	demochunk_t	*c;
+	int			length;
+	int			firstframe, numframes, complen;
+
+	length = FS_GetStreamLength (sv.demofile);
+	while (offset + 16 <= length)
+	{
+		FS_SeekStream (sv.demofile, offset, SEEK_SET);
+		firstframe = SV_DemoReadLong ();
+		numframes = SV_DemoReadLong ();
+		SV_DemoReadLong ();		// rawlen
+		complen = SV_DemoReadLong ();
+		if (numframes <= 0 || complen <= 0 || complen > length - offset - 16)
+			break;
+
+		c = SV_AddDemoChunk (&demoplay.index, &demoplay.numchunks, &demoplay.maxchunks);
+		c->offset = offset;
+		c->firstframe = firstframe;
+		c->numframes = numframes;
+		offset += 16 + complen;
+	}
+}
+
+/*
+================
+SV_FreeDemo
+================
+*/
+static void SV_FreeDemo (void)
+{
+	float	seektime;
+
+	if (sv.demofile)
+		FS_CloseStream (sv.demofile);
+	sv.demofile = NULL;
+
+	if (demoplay.index)
+		Z_Free (demoplay.index);
+	if (demoplay.signon)
+		Z_Free (demoplay.signon);
+	if (demoplay.chunk.data)
+		Z_Free (demoplay.chunk.data);
+	if (demoplay.ents)
+	{
+		Z_Free (demoplay.ents);
+		Z_Free (demoplay.sent);
+		Z_Free (demoplay.signoncs);
+		Z_Free (demoplay.cs);
+		Z_Free (demoplay.sentcs);
+	}
+
+	seektime = demoplay.seektime;
+	memset (&demoplay, 0, sizeof(demoplay));
+	demoplay.seektime = seektime;
+}
+
+/*
+================
+SV_OpenDemo
+
+Opens a demo for playback, a pending SV_SeekDemo is kept
+================
+*/
+qboolean SV_OpenDemo (const char *name)
+{
+	int		length;
+	int		numchunks, indexofs;
+	int		framesofs;
+	int		i;
+	demochunk_t	*c;
+
+	SV_FreeDemo ();
+
+	sv.demofile = FS_OpenStream (name);
+	if (!sv.demofile)
+		return false;
+
+	if (SV_DemoReadLong () != DEMO_MAGIC)
+	{
+		// a plain sequence of messages
+		FS_SeekStream (sv.demofile, 0, SEEK_SET);
+		return true;
+	}
+
+	if (SV_DemoReadLong () != DEMO_VERSION)
+		Com_Error (ERR_DROP, "%s is an unknown server demo version", name);
+
+	demoplay.indexed = true;
+	demoplay.keyframes = SV_DemoReadLong ();
+	demoplay.maxclients = SV_DemoReadLong ();
+	demoplay.signonlen = SV_DemoReadLong ();
+	if (demoplay.keyframes < 1 || demoplay.signonlen <= 0 || demoplay.signonlen > 0x100000)
+		Com_Error (ERR_DROP, "%s has a bad header", name);
+
+	demoplay.signon = (byte *)Z_Malloc (demoplay.signonlen);
+	if (FS_ReadStream (sv.demofile, demoplay.signon, demoplay.signonlen) != demoplay.signonlen)
+		Com_Error (ERR_DROP, "%s has a bad header", name);
+	framesofs = FS_TellStream (sv.demofile);
+
+	demoplay.ents = (entity_state_t *)Z_Malloc (MAX_EDICTS * sizeof(entity_state_t));
+	demoplay.sent = (entity_state_t *)Z_Malloc (UPDATE_BACKUP * MAX_EDICTS * sizeof(entity_state_t));
+	memset (demoplay.ents, 0, MAX_EDICTS * sizeof(entity_state_t));
+	memset (demoplay.sent, 0, UPDATE_BACKUP * MAX_EDICTS * sizeof(entity_state_t));
+	demoplay.signoncs = (char (*)[MAX_QPATH])Z_Malloc (sizeof(sv.configstrings));
+	demoplay.cs = (char (*)[MAX_QPATH])Z_Malloc (sizeof(sv.configstrings));
+	demoplay.sentcs = (char (*)[MAX_QPATH])Z_Malloc (sizeof(sv.configstrings));
+	memset (demoplay.signoncs, 0, sizeof(sv.configstrings));
+	memset (demoplay.sentcs, 0, sizeof(sv.configstrings));
+
+	SV_ParseDemoSignon ();
+	memcpy (demoplay.cs, demoplay.signoncs, sizeof(sv.configstrings));
+
+	// the index is at the end, unless the recording was cut short
+	length = FS_GetStreamLength (sv.demofile);
+	FS_SeekStream (sv.demofile, length - 12, SEEK_SET);
+	numchunks = SV_DemoReadLong ();
+	indexofs = SV_DemoReadLong ();
+	if (SV_DemoReadLong () == DEMO_INDEXMAGIC && numchunks >= 0
+		&& indexofs >= 0 && indexofs + numchunks*12 == length - 12)
+	{
+		FS_SeekStream (sv.demofile, indexofs, SEEK_SET);
+		for (i=0 ; i<numchunks ; i++)
+		{
+			c = SV_AddDemoChunk (&demoplay.index, &demoplay.numchunks, &demoplay.maxchunks);
+			c->offset = SV_DemoReadLong ();
+			c->firstframe = SV_DemoReadLong ();
+			c->numframes = SV_DemoReadLong ();
+		}
+	}
+	else
+	{
+		Com_Printf ("%s has no index, scanning it\n", name);
+		SV_ScanDemoChunks (framesofs);
+	}
+
+	demoplay.chunknum = -1;
+	for (i=0 ; i<UPDATE_BACKUP ; i++)
+		demoplay.sentframes[i] = -1;
+	demoplay.lastsent = -1;
+	demoplay.cscursor = MAX_CONFIGSTRINGS;
+
+	return true;
+}
+
+/*
+================
+SV_CloseDemo
+================
+*/
+void SV_CloseDemo (void)
+{
+	SV_FreeDemo ();
+	demoplay.seektime = -1;
+}
+
+/*
+================
+SV_SeekDemo
+
+Playback continues from the given number of seconds into the demo,
+starting with the next message
+================
+*/
+void SV_SeekDemo (float seconds)
+{
+	demoplay.seektime = seconds < 0 ? 0 : seconds;
+}
+
+/*
+================
+SV_LoadDemoChunk
+================
+*/
+static void SV_LoadDemoChunk (int chunknum)
+{
+	int			rawlen, complen;
+	mz_ulong	length;
+	byte		*comp;
+
+	FS_SeekStream (sv.demofile, demoplay.index[chunknum].offset + 8, SEEK_SET);
+	rawlen = SV_DemoReadLong ();
+	complen = SV_DemoReadLong ();
+	if (rawlen <= 0 || complen <= 0 || complen > FS_GetStreamLength (sv.demofile))
+		Com_Error (ERR_DROP, "SV_LoadDemoChunk: bad chunk %i", chunknum);
+
+	comp = (byte *)Z_Malloc (complen);
+	if (FS_ReadStream (sv.demofile, comp, complen) != complen)
+		Com_Error (ERR_DROP, "SV_LoadDemoChunk: chunk %i is cut short", chunknum);
+
+	if ((size_t)rawlen > demoplay.chunk.maxsize)
+	{
+		if (demoplay.chunk.data)
+			Z_Free (demoplay.chunk.data);
+		SZ_Init (&demoplay.chunk, (byte *)Z_Malloc (rawlen), rawlen);
+	}
+
+	length = rawlen;
+	if (mz_uncompress (demoplay.chunk.data, &length, comp, complen) != MZ_OK || (int)length != rawlen)
+		Com_Error (ERR_DROP, "SV_LoadDemoChunk: chunk %i is corrupt", chunknum);
+	Z_Free (comp);
+
+	MSG_BeginReading (&demoplay.chunk);
+	demoplay.chunk.cursize = rawlen;
+	demoplay.chunknum = chunknum;
+}
+
+/*
+================
+SV_ReadDemoFrame
+
+Applies the next frame to demoplay, returns false at the end of the demo
+================
+*/
+static qboolean SV_ReadDemoFrame (void)
+{
+	sizebuf_t	*msg;
+	int			e, i;
+	int			count;
+	int			lastnum;
+	unsigned	bits;
+	entity_state_t	*to;
+
+	msg = &demoplay.chunk;
+	while (msg->readcount >= msg->cursize)
+	{
+		if (demoplay.chunknum + 1 >= demoplay.numchunks)
+			return false;
+		SV_LoadDemoChunk (demoplay.chunknum + 1);
+	}
+
+	demoplay.framenum = MSG_ReadLong (msg);
+	if (MSG_ReadByte (msg) & DEMO_KEYFRAME)
+	{
+		memset (demoplay.ents, 0, MAX_EDICTS * sizeof(entity_state_t));
+		memcpy (demoplay.cs, demoplay.signoncs, sizeof(sv.configstrings));
+		demoplay.cscursor = 0;
+	}
+
+	count = MSG_ReadShort (msg);
+	if (count)
+		demoplay.cscursor = 0;
+	for ( ; count > 0 ; count--)
+	{
+		i = MSG_ReadShort (msg);
+		if (i < 0 || i >= MAX_CONFIGSTRINGS)
+			Com_Error (ERR_DROP, "SV_ReadDemoFrame: bad configstring");
+		SV_SetDemoConfigstring (demoplay.cs, i, MSG_ReadString (msg));
+	}
+
+	// events only last for the frame they are sent in
+	for (e=1 ; e<MAX_EDICTS ; e++)
+		demoplay.ents[e].event = 0;
+
+	lastnum = 0;
+	while ((e = MSG_ReadEntityBits (msg, &lastnum, &bits)) != 0)
+	{
+		if (e >= MAX_EDICTS)
+			Com_Error (ERR_DROP, "SV_ReadDemoFrame: bad entity number");
+		to = &demoplay.ents[e];
+		if (bits & U_REMOVE)
+		{
+			to->number = 0;
+			continue;
+		}
+		if (!to->number)
+		{
+			*to = demo_nostate;
+			to->number = e;
+		}
+		MSG_ReadDeltaEntityBits (msg, to, bits);
+	}
+
+	demoplay.multicastlen = MSG_ReadShort (msg);
+	demoplay.multicast = msg->data + msg->readcount;
+	msg->readcount += demoplay.multicastlen;
+
+	if (demoplay.multicastlen < 0 || msg->readcount > msg->cursize)
+		Com_Error (ERR_DROP, "SV_ReadDemoFrame: bad frame %i", demoplay.framenum);
+
+	return true;
+}
+
+/*
+================
+SV_SeekDemoFrame
+
+Finds the chunk with the wanted frame and reads up to it, so that it
+is the next one read
+================
+*/
+static void SV_SeekDemoFrame (int framenum)
+{
+	int		c, lo, hi;
+	int		skipped;
+	int		next;
+	sizebuf_t	*msg;
+
+	if (!demoplay.numchunks)
+		return;
+
+	// chunks normally hold exactly sv_demokeyframes frames, but the
+	// frame numbers stand still while a single player game is paused
+	c = (framenum - demoplay.index[0].firstframe) / demoplay.keyframes;
+	if (c < 0)
+		c = 0;
+	if (c >= demoplay.numchunks)
+		c = demoplay.numchunks - 1;
+	if (demoplay.index[c].firstframe > framenum
+		|| (c+1 < demoplay.numchunks && demoplay.index[c+1].firstframe <= framenum))
+	{
+		lo = 0;
+		hi = demoplay.numchunks - 1;
+		while (lo < hi)
+		{
+			c = (lo + hi + 1) / 2;
+			if (demoplay.index[c].firstframe <= framenum)
+				lo = c;
+			else
+				hi = c - 1;
+		}
+		c = lo;
+	}
+
+	SV_LoadDemoChunk (c);
+
+	msg = &demoplay.chunk;
+	for (skipped=0 ; msg->readcount + 4 <= msg->cursize ; skipped++)
+	{
+		memcpy (&next, msg->data + msg->readcount, 4);
+		if (LittleLong (next) >= framenum)
+			break;
+		SV_ReadDemoFrame ();
+	}
+
+	Com_DPrintf ("demo seek to frame %i: chunk %i, %i frames read\n", framenum, c, skipped);
+
+	demoplay.framepending = false;
+	demoplay.cscursor = 0;
+}
+
+/*
+================
+SV_WriteDemoConfigstrings
+
+Sends the configstrings the client doesn't have yet, as many as fit
+================
+*/
+static void SV_WriteDemoConfigstrings (sizebuf_t *msg)
+{
+	int		i;
+	int		length;
+
+	for (i=demoplay.cscursor ; i<MAX_CONFIGSTRINGS ; i++)
+	{
+		if (!strcmp (demoplay.cs[i], demoplay.sentcs[i]))
+			continue;
+
+		length = strlen (demoplay.cs[i]);
+		if (msg->cursize + length + 4 > msg->maxsize)
+			break;
+
+		MSG_WriteByte (msg, svc_configstring);
+		MSG_WriteShort (msg, i);
+		MSG_WriteString (msg, demoplay.cs[i]);
+		strcpy (demoplay.sentcs[i], demoplay.cs[i]);
+	}
+
+	demoplay.cscursor = i;
+}
+
+/*
+================
+SV_DemoDeltaFrame
+
+Every viewer gets the same message, so frames can only be deltas from
+the newest one all of them have acknowledged, and only while that is
+still kept.  Returns -1 if a full frame has to be sent.
+================
+*/
+static int SV_DemoDeltaFrame (void)
+{
+	int			i;
+	int			base;
+	client_t	*cl;
+
+	base = -1;
+	for (i=0, cl=svs.clients ; i<maxclients->value ; i++, cl++)
+	{
+		if (cl->state < cs_connected)
+			continue;
+		if (cl->lastframe <= 0)
+			return -1;
+		if (base == -1 || cl->lastframe < base)
+			base = cl->lastframe;
+	}
+
+	if (base < 0 || base >= demoplay.framenum
+		|| demoplay.framenum - base >= UPDATE_BACKUP - 1
+		|| demoplay.sentframes[base & UPDATE_MASK] != base)
+		return -1;
+
+	return base;
+}
+
+/*
+================
+SV_WriteDemoFrame
+
+Writes the frame read last as a regular svc_frame, delta compressed from
+one the clients are known to have
+================
+*/
+static qboolean SV_WriteDemoFrame (sizebuf_t *msg)
+{
+	int			e, bits;
+	int			deltaframe, slot;
+	entity_state_t	*base, *from, *to;
+	byte		areabits[MAX_MAP_AREAS/8];
+
+	deltaframe = SV_DemoDeltaFrame ();
+	base = deltaframe >= 0 ? &demoplay.sent[(deltaframe & UPDATE_MASK) * MAX_EDICTS] : NULL;
+
+	MSG_WriteByte (msg, svc_frame);
+	MSG_WriteLong (msg, demoplay.framenum);
+	MSG_WriteLong (msg, deltaframe);
+	MSG_WriteByte (msg, 0);		// rate dropped packets
+
+	// nothing is hidden behind closed doors
+	memset (areabits, 255, sizeof(areabits));
+	MSG_WriteByte (msg, sizeof(areabits));
+	SZ_Write (msg, areabits, sizeof(areabits));
+
+	// no player state was recorded, just give the view a field of view
+	MSG_WriteByte (msg, svc_playerinfo);
+	MSG_WriteShort (msg, PS_FOV);
+	MSG_WriteByte (msg, 90);
+	MSG_WriteLong (msg, 0);
+
+	MSG_WriteByte (msg, svc_packetentities);
+	for (e=1 ; e<MAX_EDICTS ; e++)
+	{
+		from = (base && base[e].number) ? &base[e] : NULL;
+		to = demoplay.ents[e].number ? &demoplay.ents[e] : NULL;
+
+		if (to && from)
+			MSG_WriteDeltaEntity (from, to, msg, false, e <= demoplay.maxclients);
+		else if (to)
+			MSG_WriteDeltaEntity (&demo_nostate, to, msg, true, true);
+		else if (from)
+		{
+			bits = U_REMOVE;
+			if (e >= 256)
+				bits |= U_NUMBER16 | U_MOREBITS1;
+
+			MSG_WriteByte (msg,	bits&255 );
+			if (bits & 0x0000ff00)
+				MSG_WriteByte (msg,	(bits>>8)&255 );
+
+			if (bits & U_NUMBER16)
+				MSG_WriteShort (msg, e);
+			else
+				MSG_WriteByte (msg, e);
+		}
+	}
+	MSG_WriteShort (msg, 0);	// end of packetentities
+
+	SZ_Write (msg, demoplay.multicast, demoplay.multicastlen);
+
+	if (msg->overflowed)
+		return false;
+
+	// the frame numbers stand still while a single player game is paused,
+	// and a client could hold either of two frames sent with the same one
+	slot = demoplay.framenum & UPDATE_MASK;
+	if (demoplay.framenum == demoplay.lastsent)
+	{
+		demoplay.sentframes[slot] = -1;
+		return true;
+	}
+	demoplay.lastsent = demoplay.framenum;
+
+	memcpy (&demoplay.sent[slot * MAX_EDICTS], demoplay.ents, MAX_EDICTS * sizeof(entity_state_t));
+	demoplay.sentframes[slot] = demoplay.framenum;
+	return true;
+}
+
+/*
+================
+SV_ReadDemoMessage
+
+Gets the next message to send to demo clients, returns false at the
+end of the demo
+================
+*/
+qboolean SV_ReadDemoMessage (byte *msgbuf, int *msglen)
+{
+	sizebuf_t	msg;
+
+	if (!demoplay.indexed)
+	{
+		if (demoplay.seektime >= 0)
+		{
+			Com_Printf ("Can't seek in a demo without an index.\n");
+			demoplay.seektime = -1;
+		}
+
+		// get the next message
+		*msglen = SV_DemoReadLong ();
+		if (*msglen == -1)
+			return false;
+		if (*msglen < 0 || *msglen > MAX_MSGLEN)
+			Com_Error (ERR_DROP, "SV_ReadDemoMessage: msglen > MAX_MSGLEN");
+		if (FS_ReadStream (sv.demofile, msgbuf, *msglen) != *msglen)
+			return false;
+		return true;
+	}
+
+	SZ_Init (&msg, msgbuf, DEMO_MSGLEN);
+	msg.allowoverflow = true;
+
+	if (!demoplay.signonsent)
+	{
+		SZ_Write (&msg, demoplay.signon, demoplay.signonlen);
+		demoplay.signonsent = true;
+		*msglen = msg.cursize;
+		return true;
+	}
+
+	if (demoplay.seektime >= 0 && demoplay.numchunks)
+	{
+		SV_SeekDemoFrame (demoplay.index[0].firstframe + (int)(demoplay.seektime * 10));
+		demoplay.seektime = -1;
+	}
+
+	if (!demoplay.framepending)
+	{
+		if (!SV_ReadDemoFrame ())
+			return false;
+		demoplay.framepending = true;
+	}
+
+	// bring the configstrings up to date before the frame that uses them
+	if (demoplay.cscursor < MAX_CONFIGSTRINGS)
+	{
+		SV_WriteDemoConfigstrings (&msg);
+		if (msg.cursize)
+		{
+			*msglen = msg.cursize;
+			return true;
+		}
+	}
+
+	demoplay.framepending = false;
+	if (!SV_WriteDemoFrame (&msg))
+	{
+		// the client still deltas from the last frame it got
+		Com_Printf ("WARNING: demo frame %i overflowed\n", demoplay.framenum);
+		SZ_Clear (&msg);
+	}
+
+	*msglen = msg.cursize;
+	return true;
+}
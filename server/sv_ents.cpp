@@ -119,23 +119,29 @@ void SV_EmitProjectileUpdate (sizebuf_t *msg)
 =============
 SV_EmitPacketEntities
 
-Writes a delta update of an entity_state_t list to the message.
+Writes a delta update of an entity_state_t list to the message, bit
+packed for clients that negotiated svc_bitentities.
 =============
 */
-void SV_EmitPacketEntities (client_frame_t *from, client_frame_t *to, sizebuf_t *msg)
+void SV_EmitPacketEntities (client_frame_t *from, client_frame_t *to, sizebuf_t *msg, qboolean bitpacked)
 {
 	entity_state_t	*oldent, *newent;
 	int		oldindex, newindex;
 	int		oldnum, newnum;
 	int		from_num_entities;
 	int		bits;
+	int		lastnum;
 
 #if 0
 	if (numprojs)
 		MSG_WriteByte (msg, svc_packetentities2);
 	else
 #endif
+	if (bitpacked)
+		MSG_WriteByte (msg, svc_bitentities);
+	else
 		MSG_WriteByte (msg, svc_packetentities);
+	lastnum = 0;
 
 	if (!from)
 		from_num_entities = 0;
@@ -168,7 +174,10 @@ void SV_EmitPacketEntities (client_frame_t *from, client_frame_t *to, sizebuf_t
 			// in any bytes being emited if the entity has not changed at all
 			// note that players are always 'newentities', this updates their oldorigin always
 			// and prevents warping
-			MSG_WriteDeltaEntity (oldent, newent, msg, false, newent->number <= maxclients->value);
+			if (bitpacked)
+				MSG_WriteDeltaEntityBits (oldent, newent, msg, false, newent->number <= maxclients->value, &lastnum);
+			else
+				MSG_WriteDeltaEntity (oldent, newent, msg, false, newent->number <= maxclients->value);
 			oldindex++;
 			newindex++;
 			continue;
@@ -176,13 +185,23 @@ void SV_EmitPacketEntities (client_frame_t *from, client_frame_t *to, sizebuf_t
 
 		if (newnum < oldnum)
 		{	// this is a new entity, send it from the baseline
-			MSG_WriteDeltaEntity (&sv.baselines[newnum], newent, msg, true, true);
+			if (bitpacked)
+				MSG_WriteDeltaEntityBits (&sv.baselines[newnum], newent, msg, true, true, &lastnum);
+			else
+				MSG_WriteDeltaEntity (&sv.baselines[newnum], newent, msg, true, true);
 			newindex++;
 			continue;
 		}
 
 		if (newnum > oldnum)
 		{	// the old entity isn't present in the new message
+			if (bitpacked)
+			{
+				MSG_WriteRemoveEntityBits (msg, oldnum, &lastnum);
+				oldindex++;
+				continue;
+			}
+
 			bits = U_REMOVE;
 			if (oldnum >= 256)
 				bits |= U_NUMBER16 | U_MOREBITS1;
@@ -201,7 +220,10 @@ void SV_EmitPacketEntities (client_frame_t *from, client_frame_t *to, sizebuf_t
 		}
 	}
 
-	MSG_WriteShort (msg, 0);	// end of packetentities
+	if (bitpacked)
+		MSG_WriteEntityBitsEnd (msg);
+	else
+		MSG_WriteShort (msg, 0);	// end of packetentities
 
 #if 0
 	if (numprojs)
@@ -450,7 +472,7 @@ void SV_WriteFrameToClient (client_t *client, sizebuf_t *msg)
 	SV_WritePlayerstateToClient (oldframe, frame, msg);
 
 	// delta encode the entities
-	SV_EmitPacketEntities (oldframe, frame, msg);
+	SV_EmitPacketEntities (oldframe, frame, msg, client->bitentities);
 }
 
 
@@ -462,8 +484,6 @@ Build a client frame structure
 =============================================================================
 */
 
-byte		fatpvs[65536/8];	// 32767 is MAX_MAP_LEAFS
-
 /*
 ============
 SV_FatPVS
@@ -472,12 +492,10 @@ The client will interpolate the view position,
 so we can't use a single PVS point
 ===========
 */
-void SV_FatPVS (vec3_t org)
+void SV_FatPVS (vec3_t org, byte *fatpvs)
 {
 	int		leafs[64];
 	int		i, j, count;
-	int		longs;
-	byte	*src;
 	vec3_t	mins, maxs;
 
 	for (i=0 ; i<3 ; i++)
@@ -489,13 +507,12 @@ void SV_FatPVS (vec3_t org)
 	count = CM_BoxLeafnums (mins, maxs, leafs, 64, NULL);
 	if (count < 1)
 		Com_Error (ERR_FATAL, "SV_FatPVS: count < 1");
-	longs = (CM_NumClusters()+31)>>5;
 
 	// convert leafs to clusters
 	for (i=0 ; i<count ; i++)
 		leafs[i] = CM_LeafCluster(leafs[i]);
 
-	memcpy (fatpvs, CM_ClusterPVS(leafs[0]), longs<<2);
+	memcpy (fatpvs, CM_ClusterPVS(leafs[0]), CM_VisRowBytes());
 	// or in all the other leaf bits
 	for (i=1 ; i<count ; i++)
 	{
@@ -504,43 +521,36 @@ void SV_FatPVS (vec3_t org)
 				break;
 		if (j != i)
 			continue;		// already have the cluster we want
-		src = CM_ClusterPVS(leafs[i]);
-		for (j=0 ; j<longs ; j++)
-			((long *)fatpvs)[j] |= ((long *)src)[j];
+		CM_OrVis (fatpvs, CM_ClusterPVS(leafs[i]));
 	}
 }
 
 
 /*
 =============
-SV_BuildClientFrame
+SV_SetupClientSnap
 
-Decides which entities are going to be visible to the client, and
-copies off the playerstat and areabits.
+The part of building a client frame that goes through the collision
+model's shared state: finds the client's PVS and PHS, and copies off
+the playerstate and areabits.  Returns false if the client isn't in the
+game yet, in which case no frame is built.
 =============
 */
-void SV_BuildClientFrame (client_t *client)
+qboolean SV_SetupClientSnap (clientsnap_t *snap, client_t *client)
 {
-	int		e, i;
-	vec3_t	org;
-	edict_t	*ent;
+	int		i;
 	edict_t	*clent;
 	client_frame_t	*frame;
-	entity_state_t	*state;
-	int		l;
-	int		clientarea, clientcluster;
+	int		clientcluster;
 	int		leafnum;
-	int		c_fullsend;
-	byte	*clientphs;
-	byte	*bitvector;
+
+	snap->client = client;
+	snap->numvisible = 0;
+	snap->ingame = false;
 
 	clent = client->edict;
 	if (!clent->client)
-		return;		// not in game yet
-
-#if 0
-	numprojs = 0; // no projectiles yet
-#endif
+		return false;		// not in game yet
 
 	// this is the frame we are creating
 	frame = &client->frames[sv.framenum & UPDATE_MASK];
@@ -549,27 +559,107 @@ void SV_BuildClientFrame (client_t *client)
 
 	// find the client's PVS
 	for (i=0 ; i<3 ; i++)
-		org[i] = clent->client->ps.pmove.origin[i]*0.125 + clent->client->ps.viewoffset[i];
+		snap->org[i] = clent->client->ps.pmove.origin[i]*0.125 + clent->client->ps.viewoffset[i];
 
-	leafnum = CM_PointLeafnum (org);
-	clientarea = CM_LeafArea (leafnum);
+	leafnum = CM_PointLeafnum (snap->org);
+	snap->clientarea = CM_LeafArea (leafnum);
 	clientcluster = CM_LeafCluster (leafnum);
 
 	// calculate the visible areas
-	frame->areabytes = CM_WriteAreaBits (frame->areabits, clientarea);
+	frame->areabytes = CM_WriteAreaBits (frame->areabits, snap->clientarea);
 
 	// grab the current player_state_t
 	frame->ps = clent->client->ps;
 
+	SV_FatPVS (snap->org, snap->fatpvs);
+	memcpy (snap->phs, CM_ClusterPHS (clientcluster), CM_VisRowBytes());
+
+	snap->ingame = true;
+	return true;
+}
 
-	SV_FatPVS (org);
-	clientphs = CM_ClusterPHS (clientcluster);
+/*
+===============================================================================
 
-	// build up the list of visible entities
-	frame->num_entities = 0;
-	frame->first_entity = svs.next_client_entities;
+SNAP ENTITIES
+
+Whether an edict can be sent at all doesn't depend on the client, so
+SV_BuildSnapEntities sorts that out once a frame and packs the ones
+that can into parallel arrays, along with their clusters.  Each cluster
+also gets a bucket of the entities touching it, so a client can gather
+its entities from just the clusters set in its PVS.
+
+Beams and entities in too many clusters to list go on the wide list and
+are tested one by one.
+===============================================================================
+*/
+
+#define	SE_WIDE			1		// tested by itself, not through the buckets
+#define	SE_BEAM			2		// one point against the PHS
+#define	SE_SOUNDONLY	4		// no model, so dropped beyond hearing range
+
+typedef struct
+{
+	int		numents;
+	short	number[MAX_EDICTS];		// ascending
+	byte	flags[MAX_EDICTS];
+	int		areanum[MAX_EDICTS];
+	int		areanum2[MAX_EDICTS];
+	int		headnode[MAX_EDICTS];
+	vec3_t	origin[MAX_EDICTS];
+	int		firstcluster[MAX_EDICTS+1];
+	int		clusters[MAX_EDICTS*MAX_ENT_CLUSTERS];
+
+	int		numwide;
+	short	wide[MAX_EDICTS];
+
+	int		numrefs;				// cluster references in the buckets
+	int		rowbytes;
+	byte	occupied[MAX_MAP_LEAFS/8];	// clusters with a non-empty bucket
+	int		bucketstart[MAX_MAP_LEAFS+1];
+	short	bucket[MAX_EDICTS*MAX_ENT_CLUSTERS];
+} snapents_t;
+
+static snapents_t	sv_snapents;
+
+// index of the lowest set bit, x must be non-zero
+static inline int ctz32 (unsigned x)
+{
+#if defined( _MSC_VER )
+	unsigned long	i;
+
+	_BitScanForward (&i, x);
+	return (int)i;
+#else
+	return __builtin_ctz (x);
+#endif
+}
+
+/*
+=============
+SV_BuildSnapEntities
 
-	c_fullsend = 0;
+Called once a frame before any client frames are built, and again if
+anything in between could have changed the edicts.
+=============
+*/
+void SV_BuildSnapEntities (void)
+{
+	snapents_t	*se;
+	int		e, i, j, n, c;
+	int		numclusters;
+	edict_t	*ent;
+
+	se = &sv_snapents;
+	se->numents = 0;
+	se->numwide = 0;
+	se->numrefs = 0;
+	se->firstcluster[0] = 0;
+
+	se->rowbytes = CM_VisRowBytes ();
+	numclusters = se->rowbytes * 8;
+	memset (se->occupied, 0, se->rowbytes);
+	memset (se->bucketstart, 0, (numclusters + 1) * sizeof(se->bucketstart[0]));
 
 	for (e=1 ; e<ge->num_edicts ; e++)
 	{
@@ -584,71 +674,237 @@ void SV_BuildClientFrame (client_t *client)
 			&& !ent->s.event)
 			continue;
 
-		// ignore if not touching a PV leaf
-		if (ent != clent)
+		n = se->numents++;
+		se->number[n] = e;
+		se->flags[n] = 0;
+		se->areanum[n] = ent->areanum;
+		se->areanum2[n] = ent->areanum2;
+		se->headnode[n] = ent->headnode;
+		VectorCopy (ent->s.origin, se->origin[n]);
+		j = se->firstcluster[n];
+
+		if (ent->s.renderfx & RF_BEAM)
+		{	// beams just check one point for PHS
+			se->flags[n] = SE_WIDE|SE_BEAM;
+			se->clusters[j++] = ent->clusternums[0];
+		}
+		else
 		{
-			// check area
-			if (!CM_AreasConnected (clientarea, ent->areanum))
-			{	// doors can legally straddle two areas, so
-				// we may need to check another one
-				if (!ent->areanum2
-					|| !CM_AreasConnected (clientarea, ent->areanum2))
-					continue;		// blocked by a door
+			if (!ent->s.modelindex)
+				se->flags[n] = SE_SOUNDONLY;
+			if (ent->num_clusters == -1)
+				se->flags[n] |= SE_WIDE;	// go by headnode
+			else
+			{
+				for (i=0 ; i<ent->num_clusters ; i++)
+				{
+					c = ent->clusternums[i];
+					if (c < 0 || c >= numclusters)
+						continue;		// can't be visible
+					se->clusters[j++] = c;
+					se->bucketstart[c+1]++;
+				}
+				se->numrefs += j - se->firstcluster[n];
 			}
+		}
+		se->firstcluster[n+1] = j;
+
+		if (se->flags[n] & SE_WIDE)
+			se->wide[se->numwide++] = n;
+	}
+
+	// turn the counts into offsets, then fill the buckets in entity order
+	for (c=0 ; c<numclusters ; c++)
+	{
+		if (se->bucketstart[c+1])
+			se->occupied[c>>3] |= 1<<(c&7);
+		se->bucketstart[c+1] += se->bucketstart[c];
+	}
+
+	for (n=0 ; n<se->numents ; n++)
+	{
+		if (se->flags[n] & SE_WIDE)
+			continue;
+		for (j=se->firstcluster[n] ; j<se->firstcluster[n+1] ; j++)
+			se->bucket[se->bucketstart[se->clusters[j]]++] = n;
+	}
+
+	// filling moved each start up to the next one's
+	for (c=numclusters ; c>0 ; c--)
+		se->bucketstart[c] = se->bucketstart[c-1];
+	se->bucketstart[0] = 0;
+}
+
+/*
+=============
+SV_FindSnapEntity
+
+The candidate index of an entity number, or -1 if it can't be sent.
+=============
+*/
+static int SV_FindSnapEntity (int e)
+{
+	int		lo, hi, mid;
+
+	lo = 0;
+	hi = sv_snapents.numents - 1;
+	while (lo <= hi)
+	{
+		mid = (lo + hi) >> 1;
+		if (sv_snapents.number[mid] == e)
+			return mid;
+		if (sv_snapents.number[mid] < e)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+	return -1;
+}
+
+/*
+=============
+SV_CullClientSnap
 
-			// beams just check one point for PHS
-			if (ent->s.renderfx & RF_BEAM)
+Decides which entities are going to be visible to the client.  Only
+reads shared state, so it can run for several clients at once.
+=============
+*/
+void SV_CullClientSnap (clientsnap_t *snap)
+{
+	const snapents_t	*se;
+	unsigned	mask[MAX_EDICTS/32];
+	unsigned	word;
+	const unsigned	*pvswords, *occwords;
+	const byte	*wordbytes;
+	int		n, i, j, w, c, bits;
+	int		numwords;
+	int		self;
+	vec3_t	delta;
+
+	se = &sv_snapents;
+	snap->numvisible = 0;
+	memset (mask, 0, ((se->numents + 31) >> 5) * sizeof(mask[0]));
+
+	numwords = se->rowbytes >> 2;
+	if (se->numrefs < numwords)
+	{	// fewer cluster references than PVS words, so test each entity
+		for (n=0 ; n<se->numents ; n++)
+		{
+			if (se->flags[n] & SE_WIDE)
+				continue;
+			for (j=se->firstcluster[n] ; j<se->firstcluster[n+1] ; j++)
 			{
-				l = ent->clusternums[0];
-				if ( !(clientphs[l >> 3] & (1 << (l&7) )) )
-					continue;
+				if (CM_VisTest (snap->fatpvs, se->clusters[j]))
+				{
+					mask[n>>5] |= 1u<<(n&31);
+					break;
+				}
 			}
-			else
+		}
+	}
+	else
+	{	// gather from the buckets of the visible, occupied clusters
+		pvswords = (const unsigned *)snap->fatpvs;
+		occwords = (const unsigned *)se->occupied;
+		for (w=0 ; w<numwords ; w++)
+		{
+			word = pvswords[w] & occwords[w];
+			if (!word)
+				continue;
+			wordbytes = (const byte *)&word;
+			for (i=0 ; i<4 ; i++)
 			{
-				// FIXME: if an ent has a model and a sound, but isn't
-				// in the PVS, only the PHS, clear the model
-				if (ent->s.sound)
+				for (bits = wordbytes[i] ; bits ; bits &= bits - 1)
 				{
-					bitvector = fatpvs;	//clientphs;
+					c = (w<<5) + (i<<3) + ctz32 (bits);
+					for (j=se->bucketstart[c] ; j<se->bucketstart[c+1] ; j++)
+						mask[se->bucket[j]>>5] |= 1u<<(se->bucket[j]&31);
 				}
-				else
-					bitvector = fatpvs;
+			}
+		}
+	}
 
-				if (ent->num_clusters == -1)
-				{	// too many leafs for individual check, go by headnode
-					if (!CM_HeadnodeVisible (ent->headnode, bitvector))
-						continue;
-					c_fullsend++;
-				}
-				else
-				{	// check individual leafs
-					for (i=0 ; i < ent->num_clusters ; i++)
-					{
-						l = ent->clusternums[i];
-						if (bitvector[l >> 3] & (1 << (l&7) ))
-							break;
-					}
-					if (i == ent->num_clusters)
-						continue;		// not visible
+	for (i=0 ; i<se->numwide ; i++)
+	{
+		n = se->wide[i];
+		if (se->flags[n] & SE_BEAM)
+		{
+			if (!CM_VisTest (snap->phs, se->clusters[se->firstcluster[n]]))
+				continue;
+		}
+		else
+		{	// too many leafs for individual check, go by headnode
+			// FIXME: if an ent has a model and a sound, but isn't
+			// in the PVS, only the PHS, clear the model
+			if (!CM_HeadnodeVisible (se->headnode[n], snap->fatpvs))
+				continue;
+		}
+		mask[n>>5] |= 1u<<(n&31);
+	}
+
+	// the client always sees itself
+	self = SV_FindSnapEntity (NUM_FOR_EDICT(snap->client->edict));
+	if (self != -1)
+		mask[self>>5] |= 1u<<(self&31);
+
+	// walk the survivors in entity order
+	for (w=0 ; w<(se->numents + 31)>>5 ; w++)
+	{
+		for (word = mask[w] ; word ; word &= word - 1)
+		{
+			n = (w<<5) + ctz32 (word);
+
+			if (n != self)
+			{
+				// check area
+				if (!CM_AreasConnected (snap->clientarea, se->areanum[n]))
+				{	// doors can legally straddle two areas, so
+					// we may need to check another one
+					if (!se->areanum2[n]
+						|| !CM_AreasConnected (snap->clientarea, se->areanum2[n]))
+						continue;		// blocked by a door
 				}
 
-				if (!ent->s.modelindex)
+				if (se->flags[n] & SE_SOUNDONLY)
 				{	// don't send sounds if they will be attenuated away
-					vec3_t	delta;
-					float	len;
-
-					VectorSubtract (org, ent->s.origin, delta);
-					len = VectorLength (delta);
-					if (len > 400)
+					VectorSubtract (snap->org, se->origin[n], delta);
+					if (VectorLength (delta) > 400)
 						continue;
 				}
 			}
+
+			snap->visible[snap->numvisible++] = se->number[n];
 		}
+	}
+}
 
-#if 0
-		if (SV_AddProjectileUpdate(ent))
-			continue; // added as a special projectile
-#endif
+/*
+=============
+SV_StoreClientSnap
+
+Copies the visible entities into the circular client_entities array.
+Clients have to be stored in the same order every time for the frames
+to come out the same.
+=============
+*/
+void SV_StoreClientSnap (clientsnap_t *snap)
+{
+	int		i, e;
+	edict_t	*ent;
+	client_frame_t	*frame;
+	entity_state_t	*state;
+
+	// this is the frame we are creating
+	frame = &snap->client->frames[sv.framenum & UPDATE_MASK];
+
+	// build up the list of visible entities
+	frame->num_entities = 0;
+	frame->first_entity = svs.next_client_entities;
+
+	for (i=0 ; i<snap->numvisible ; i++)
+	{
+		e = snap->visible[i];
+		ent = EDICT_NUM(e);
 
 		// add it to the circular client_entities array
 		state = &svs.client_entities[svs.next_client_entities%svs.num_client_entities];
@@ -660,7 +916,7 @@ void SV_BuildClientFrame (client_t *client)
 		*state = ent->s;
 
 		// don't mark players missiles as solid
-		if (ent->owner == client->edict)
+		if (ent->owner == snap->client->edict)
 			state->solid = 0;
 
 		svs.next_client_entities++;
@@ -668,60 +924,22 @@ void SV_BuildClientFrame (client_t *client)
 	}
 }
 
-
 /*
-==================
-SV_RecordDemoMessage
+=============
+SV_BuildClientFrame
 
-Save everything in the world out without deltas.
-Used for recording footage for merged or assembled demos
-==================
+Decides which entities are going to be visible to the client, and
+copies off the playerstat and areabits.
+=============
 */
-void SV_RecordDemoMessage (void)
+void SV_BuildClientFrame (client_t *client)
 {
-	int			e;
-	edict_t		*ent;
-	entity_state_t	nostate;
-	sizebuf_t	buf;
-	byte		buf_data[32768];
-	int			len;
-
-	if (!svs.demofile)
-		return;
-
-	memset (&nostate, 0, sizeof(nostate));
-	SZ_Init (&buf, buf_data, sizeof(buf_data));
-
-	// write a frame message that doesn't contain a player_state_t
-	MSG_WriteByte (&buf, svc_frame);
-	MSG_WriteLong (&buf, sv.framenum);
+	static clientsnap_t	snap;
 
-	MSG_WriteByte (&buf, svc_packetentities);
-
-	e = 1;
-	ent = EDICT_NUM(e);
-	while (e < ge->num_edicts) 
-	{
-		// ignore ents without visible models unless they have an effect
-		if (ent->inuse &&
-			ent->s.number && 
-			(ent->s.modelindex || ent->s.effects || ent->s.sound || ent->s.event) && 
-			!(ent->svflags & SVF_NOCLIENT))
-			MSG_WriteDeltaEntity (&nostate, &ent->s, &buf, false, true);
-
-		e++;
-		ent = EDICT_NUM(e);
-	}
-
-	MSG_WriteShort (&buf, 0);		// end of packetentities
-
-	// now add the accumulated multicast information
-	SZ_Write (&buf, svs.demo_multicast.data, svs.demo_multicast.cursize);
-	SZ_Clear (&svs.demo_multicast);
-
-	// now write the entire message to the file, prefixed by the length
-	len = LittleLong (buf.cursize);
-	fwrite (&len, 4, 1, svs.demofile);
-	fwrite (buf.data, buf.cursize, 1, svs.demofile);
+	if (!SV_SetupClientSnap (&snap, client))
+		return;
+	SV_CullClientSnap (&snap);
+	SV_StoreClientSnap (&snap);
 }
 
+
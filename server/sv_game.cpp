@@ -48,7 +48,10 @@ void PF_Unicast (edict_t *ent, qboolean reliable)
 	if (reliable)
 		SZ_Write (&client->netchan.message, sv.multicast.data, sv.multicast.cursize);
 	else
+	{
+		SV_FlushMulticasts (client);	// keep it behind the multicasts before it
 		SZ_Write (&client->datagram, sv.multicast.data, sv.multicast.cursize);
+	}
 
 	SZ_Clear (&sv.multicast);
 }
@@ -237,7 +240,7 @@ qboolean PF_inPVS (vec3_t p1, vec3_t p2)
 	int		leafnum;
 	int		cluster;
 	int		area1, area2;
-	byte	*mask;
+	const byte	*mask;
 
 	leafnum = CM_PointLeafnum (p1);
 	cluster = CM_LeafCluster (leafnum);
@@ -247,7 +250,7 @@ qboolean PF_inPVS (vec3_t p1, vec3_t p2)
 	leafnum = CM_PointLeafnum (p2);
 	cluster = CM_LeafCluster (leafnum);
 	area2 = CM_LeafArea (leafnum);
-	if ( mask && (!(mask[cluster>>3] & (1<<(cluster&7)) ) ) )
+	if ( mask && !CM_VisTest (mask, cluster) )
 		return false;
 	if (!CM_AreasConnected (area1, area2))
 		return false;		// a door blocks sight
@@ -267,7 +270,7 @@ qboolean PF_inPHS (vec3_t p1, vec3_t p2)
 	int		leafnum;
 	int		cluster;
 	int		area1, area2;
-	byte	*mask;
+	const byte	*mask;
 
 	leafnum = CM_PointLeafnum (p1);
 	cluster = CM_LeafCluster (leafnum);
@@ -277,7 +280,7 @@ qboolean PF_inPHS (vec3_t p1, vec3_t p2)
 	leafnum = CM_PointLeafnum (p2);
 	cluster = CM_LeafCluster (leafnum);
 	area2 = CM_LeafArea (leafnum);
-	if ( mask && (!(mask[cluster>>3] & (1<<(cluster&7)) ) ) )
+	if ( mask && !CM_VisTest (mask, cluster) )
 		return false;		// more than one bounce away
 	if (!CM_AreasConnected (area1, area2))
 		return false;		// a door blocks hearing
@@ -343,6 +346,7 @@ void SV_InitGameProgs (void)
 	import.unlinkentity = SV_UnlinkEdict;
 	import.BoxEdicts = SV_AreaEdicts;
 	import.trace = SV_Trace;
+	import.tracebatch = SV_TraceBatch;
 	import.pointcontents = SV_PointContents;
 	import.setmodel = PF_setmodel;
 	import.inPVS = PF_inPVS;
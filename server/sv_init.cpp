@@ -157,6 +157,52 @@ void SV_CheckForSavegame (void)
 }
 
 
+/*
+================
+SV_PrefetchConfigstrings
+
+Hands the model and sound precache lists over to the filesystem,
+so they can be inflated in the background while the local client
+is busy registering them
+================
+*/
+static void SV_PrefetchConfigstrings (void)
+{
+	static char	names[MAX_MODELS+MAX_SOUNDS][MAX_QPATH];
+	const char	*list[MAX_MODELS+MAX_SOUNDS];
+	const char	*name;
+	int			i, count;
+
+	if (dedicated->value)
+		return;		// nobody local to load them
+
+	count = 0;
+	for (i=1 ; i<MAX_MODELS && sv.configstrings[CS_MODELS+i][0] ; i++)
+	{
+		name = sv.configstrings[CS_MODELS+i];
+		if (name[0] == '*' || name[0] == '#')
+			continue;	// inline or player weapon models
+		Com_sprintf (names[count], sizeof(names[count]), "%s", name);
+		list[count] = names[count];
+		count++;
+	}
+
+	for (i=1 ; i<MAX_SOUNDS && sv.configstrings[CS_SOUNDS+i][0] ; i++)
+	{
+		name = sv.configstrings[CS_SOUNDS+i];
+		if (name[0] == '*')
+			continue;	// sexed sounds are resolved by the client
+		if (name[0] == '#')
+			Com_sprintf (names[count], sizeof(names[count]), "%s", name + 1);
+		else
+			Com_sprintf (names[count], sizeof(names[count]), "sound/%s", name);
+		list[count] = names[count];
+		count++;
+	}
+
+	FS_Prefetch (list, count);
+}
+
 /*
 ================
 SV_SpawnServer
@@ -177,8 +223,10 @@ void SV_SpawnServer (char *server, char *spawnpoint, server_state_t serverstate,
 	Com_Printf ("------- Server Initialization -------\n");
 
 	Com_DPrintf ("SpawnServer: %s\n",server);
-	if (sv.demofile)
-		fclose (sv.demofile);
+	SV_CloseDemo ();
+
+	// nobody is going to load what the last map prefetched now
+	FS_CancelPrefetch ();
 
 	svs.spawncount++;		// any partially connected client will be
 							// restarted
@@ -266,6 +314,9 @@ void SV_SpawnServer (char *server, char *spawnpoint, server_state_t serverstate,
 	// all precaches are complete
 	sv.state = serverstate;
 	Com_SetServerState (sv.state);
+
+	// get the filesystem started on them while we finish up
+	SV_PrefetchConfigstrings ();
 	
 	// create a baseline for more efficient communications
 	SV_CreateBaseline ();
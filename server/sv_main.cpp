@@ -28,6 +28,11 @@ cvar_t	*sv_paused;
 cvar_t	*sv_timedemo;
 
 cvar_t	*sv_enforcetime;
+cvar_t	*sv_broadphase;
+cvar_t	*sv_snapthreads;
+cvar_t	*sv_snapcheck;
+cvar_t	*sv_bitentities;
+cvar_t	*sv_demokeyframes;
 
 cvar_t	*timeout;				// seconds without any message
 cvar_t	*zombietime;			// seconds to sink messages after disconnect
@@ -276,6 +281,7 @@ void SVC_DirectConnect (void)
 	int			version;
 	int			qport;
 	int			challenge;
+	int			extensions;
 
 	adr = net_from;
 
@@ -296,6 +302,9 @@ void SVC_DirectConnect (void)
 	strncpy (userinfo, Cmd_Argv(4), sizeof(userinfo)-1);
 	userinfo[sizeof(userinfo) - 1] = 0;
 
+	// older clients don't send these
+	extensions = atoi(Cmd_Argv(5));
+
 	// force the IP key/value pair so the game can filter based on ip
 	Info_SetValueForKey (userinfo, "ip", NET_AdrToString(net_from));
 
@@ -403,6 +412,7 @@ gotnewcl:
 	Netchan_Setup (NS_SERVER, &newcl->netchan , adr, qport);
 
 	newcl->state = cs_connected;
+	newcl->bitentities = (extensions & PROTOCOL_EXT_BITENTITIES) && sv_bitentities->value;
 	
 	SZ_Init (&newcl->datagram, newcl->datagram_buf, sizeof(newcl->datagram_buf) );
 	newcl->datagram.allowoverflow = true;
@@ -966,6 +976,11 @@ void SV_Init (void)
 	sv_paused = Cvar_Get ("paused", "0", 0);
 	sv_timedemo = Cvar_Get ("timedemo", "0", 0);
 	sv_enforcetime = Cvar_Get ("sv_enforcetime", "0", 0);
+	sv_broadphase = Cvar_Get ("sv_broadphase", "grid", 0);
+	sv_snapthreads = Cvar_Get ("sv_snapthreads", "4", 0);
+	sv_snapcheck = Cvar_Get ("sv_snapcheck", "0", 0);
+	sv_bitentities = Cvar_Get ("sv_bitentities", "1", 0);
+	sv_demokeyframes = Cvar_Get ("sv_demokeyframes", "50", 0);
 	allow_download = Cvar_Get ("allow_download", "1", CVAR_ARCHIVE);
 	allow_download_players  = Cvar_Get ("allow_download_players", "0", CVAR_ARCHIVE);
 	allow_download_models = Cvar_Get ("allow_download_models", "1", CVAR_ARCHIVE);
@@ -1041,8 +1056,7 @@ void SV_Shutdown ( const char *finalmsg, qboolean reconnect)
 	SV_ShutdownGameProgs ();
 
 	// free current level
-	if (sv.demofile)
-		fclose (sv.demofile);
+	SV_CloseDemo ();
 	memset (&sv, 0, sizeof(sv));
 	Com_SetServerState (sv.state);
 
@@ -1052,7 +1066,7 @@ void SV_Shutdown ( const char *finalmsg, qboolean reconnect)
 	if (svs.client_entities)
 		Z_Free (svs.client_entities);
 	if (svs.demofile)
-		fclose (svs.demofile);
+		SV_EndServerDemo ();
 	memset (&svs, 0, sizeof(svs));
 }
 
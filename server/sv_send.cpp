@@ -21,6 +21,11 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "server.h"
 
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
 /*
 =============================================================================
 
@@ -145,6 +150,225 @@ void SV_BroadcastCommand (const char *fmt, ...)
 }
 
 
+/*
+=============================================================================
+
+MULTICAST FAN-OUT
+
+An unreliable multicast is copied once into sv_mcframe, and each client
+it goes to just takes a reference that follows its datagram.  The
+references are only resolved when the datagram is sent, straight into
+the outgoing message.  Anything still holding one after
+SV_SendClientMessages (a rate dropped client) gets its multicasts copied
+into its datagram, so the buffer can start over every frame.
+
+Clients are kept sorted by the cluster they stand in, so a PVS or PHS
+multicast tests each occupied cluster once rather than every client.
+A client is only looked up in the map again when it has moved.
+
+=============================================================================
+*/
+
+#define	MULTICAST_FRAMESIZE	0x10000
+
+static byte		sv_mcframe[MULTICAST_FRAMESIZE];
+static int		sv_mcframesize;
+static int		sv_mcrefs;				// held by all clients together
+
+static qboolean	sv_mcdirty = true;		// the buckets need to be sorted again
+static int		sv_mcnumbuckets;
+static int		sv_mccluster[MAX_CLIENTS];		// of each bucket
+static int		sv_mcbucket[MAX_CLIENTS+1];		// first client in sv_mcclients
+static short	sv_mcclients[MAX_CLIENTS];
+
+/*
+=================
+SV_FlushMulticasts
+
+Copies the multicasts a client is holding into its datagram, before
+anything else gets written to the datagram
+=================
+*/
+void SV_FlushMulticasts (client_t *client)
+{
+	int			i;
+
+	for (i=0 ; i<client->numrefs ; i++)
+		SZ_Write (&client->datagram, sv_mcframe + client->refs[i].offset, client->refs[i].length);
+
+	sv_mcrefs -= client->numrefs;
+	client->numrefs = 0;
+	client->refbytes = 0;
+}
+
+/*
+=================
+SV_WriteClientDatagram
+
+Copies everything in a client's datagram out to the message
+=================
+*/
+static void SV_WriteClientDatagram (client_t *client, sizebuf_t *msg)
+{
+	int			i;
+
+	SZ_Write (msg, client->datagram.data, client->datagram.cursize);
+	for (i=0 ; i<client->numrefs ; i++)
+		SZ_Write (msg, sv_mcframe + client->refs[i].offset, client->refs[i].length);
+}
+
+/*
+=================
+SV_ClearClientDatagram
+=================
+*/
+static void SV_ClearClientDatagram (client_t *client)
+{
+	SZ_Clear (&client->datagram);
+	sv_mcrefs -= client->numrefs;
+	client->numrefs = 0;
+	client->refbytes = 0;
+}
+
+/*
+=================
+SV_ReleaseMulticasts
+
+Called once all of the frame's datagrams have been sent
+=================
+*/
+static void SV_ReleaseMulticasts (void)
+{
+	int			i;
+	client_t	*c;
+
+	if (sv_mcrefs)
+	{
+		for (i=0, c = svs.clients ; i<maxclients->value ; i++, c++)
+			if (c->numrefs)
+				SV_FlushMulticasts (c);
+		sv_mcrefs = 0;
+	}
+
+	sv_mcframesize = 0;
+}
+
+/*
+=================
+SV_MulticastToClient
+=================
+*/
+static void SV_MulticastToClient (client_t *client, qboolean reliable, int *offset)
+{
+	int			length;
+	multicastref_t	*ref;
+
+	length = sv.multicast.cursize;
+
+	if (reliable)
+	{
+		SZ_Write (&client->netchan.message, sv.multicast.data, length);
+		return;
+	}
+
+	// the first client it goes to stores it for the rest
+	if (*offset == -1 && sv_mcframesize + length <= MULTICAST_FRAMESIZE)
+	{
+		*offset = sv_mcframesize;
+		memcpy (sv_mcframe + sv_mcframesize, sv.multicast.data, length);
+		sv_mcframesize += length;
+	}
+
+	if (*offset == -1 || client->numrefs == MAX_CLIENT_MULTICASTS
+		|| client->datagram.cursize + client->refbytes + length > client->datagram.maxsize)
+	{
+		// let the datagram take it, and overflow, the usual way
+		SV_FlushMulticasts (client);
+		SZ_Write (&client->datagram, sv.multicast.data, length);
+		return;
+	}
+
+	ref = &client->refs[client->numrefs++];
+	ref->offset = *offset;
+	ref->length = length;
+	client->refbytes += length;
+	sv_mcrefs++;
+}
+
+/*
+=================
+SV_PlaceMulticastClients
+
+Looks up the clients that moved since the last multicast, and sorts
+them into cluster buckets if any of them changed cluster
+=================
+*/
+static void SV_PlaceMulticastClients (void)
+{
+	int			i, j, k;
+	int			leafnum;
+	int			count;
+	qboolean	inworld;
+	client_t	*c;
+
+	for (i=0, c = svs.clients ; i<maxclients->value ; i++, c++)
+	{
+		inworld = (qboolean)(c->state != cs_free && c->state != cs_zombie);
+		if (!inworld)
+		{
+			if (c->mcplaced)
+			{
+				c->mcplaced = false;
+				sv_mcdirty = true;
+			}
+			continue;
+		}
+
+		if (c->mcplaced && c->mcspawncount == svs.spawncount
+			&& VectorCompare (c->edict->s.origin, c->mcorigin))
+			continue;
+
+		leafnum = CM_PointLeafnum (c->edict->s.origin);
+		if (!c->mcplaced || c->mcspawncount != svs.spawncount
+			|| c->mccluster != CM_LeafCluster (leafnum))
+			sv_mcdirty = true;
+
+		c->mcplaced = true;
+		c->mcspawncount = svs.spawncount;
+		VectorCopy (c->edict->s.origin, c->mcorigin);
+		c->mccluster = CM_LeafCluster (leafnum);
+		c->mcarea = CM_LeafArea (leafnum);
+	}
+
+	if (!sv_mcdirty)
+		return;
+	sv_mcdirty = false;
+
+	// insertion sort by cluster, there are only ever a few clients
+	count = 0;
+	for (i=0, c = svs.clients ; i<maxclients->value ; i++, c++)
+	{
+		if (!c->mcplaced)
+			continue;
+		for (j=count ; j>0 && svs.clients[sv_mcclients[j-1]].mccluster > c->mccluster ; j--)
+			sv_mcclients[j] = sv_mcclients[j-1];
+		sv_mcclients[j] = i;
+		count++;
+	}
+
+	sv_mcnumbuckets = 0;
+	for (k=0 ; k<count ; k++)
+	{
+		c = &svs.clients[sv_mcclients[k]];
+		if (!k || c->mccluster != sv_mccluster[sv_mcnumbuckets-1])
+		{
+			sv_mccluster[sv_mcnumbuckets] = c->mccluster;
+			sv_mcbucket[sv_mcnumbuckets++] = k;
+		}
+	}
+	sv_mcbucket[sv_mcnumbuckets] = count;
+}
+
 /*
 =================
 SV_Multicast
@@ -160,11 +384,12 @@ MULTICAST_PHS	send to clients potentially hearable from org
 void SV_Multicast (vec3_t origin, multicast_t to)
 {
 	client_t	*client;
-	byte		*mask;
+	const byte	*mask;
 	int			leafnum, cluster;
-	int			j;
+	int			j, k, b;
 	qboolean	reliable;
-	int			area1, area2;
+	int			area1;
+	int			offset;
 
 	reliable = false;
 
@@ -195,7 +420,6 @@ void SV_Multicast (vec3_t origin, multicast_t to)
 	case MULTICAST_PHS_R:
 		reliable = true;	// intentional fallthrough
 	case MULTICAST_PHS:
-		leafnum = CM_PointLeafnum (origin);
 		cluster = CM_LeafCluster (leafnum);
 		mask = CM_ClusterPHS (cluster);
 		break;
@@ -203,7 +427,6 @@ void SV_Multicast (vec3_t origin, multicast_t to)
 	case MULTICAST_PVS_R:
 		reliable = true;	// intentional fallthrough
 	case MULTICAST_PVS:
-		leafnum = CM_PointLeafnum (origin);
 		cluster = CM_LeafCluster (leafnum);
 		mask = CM_ClusterPVS (cluster);
 		break;
@@ -213,29 +436,41 @@ void SV_Multicast (vec3_t origin, multicast_t to)
 		Com_Error (ERR_FATAL, "SV_Multicast: bad to:%i", to);
 	}
 
-	// send the data to all relevent clients
-	for (j = 0, client = svs.clients; j < maxclients->value; j++, client++)
+	offset = -1;
+	if (!mask)
 	{
-		if (client->state == cs_free || client->state == cs_zombie)
-			continue;
-		if (client->state != cs_spawned && !reliable)
-			continue;
-
-		if (mask)
+		// send the data to all relevent clients
+		for (j = 0, client = svs.clients; j < maxclients->value; j++, client++)
 		{
-			leafnum = CM_PointLeafnum (client->edict->s.origin);
-			cluster = CM_LeafCluster (leafnum);
-			area2 = CM_LeafArea (leafnum);
-			if (!CM_AreasConnected (area1, area2))
+			if (client->state == cs_free || client->state == cs_zombie)
 				continue;
-			if ( mask && (!(mask[cluster>>3] & (1<<(cluster&7)) ) ) )
+			if (client->state != cs_spawned && !reliable)
 				continue;
+
+			SV_MulticastToClient (client, reliable, &offset);
 		}
+	}
+	else
+	{
+		SV_PlaceMulticastClients ();
 
-		if (reliable)
-			SZ_Write (&client->netchan.message, sv.multicast.data, sv.multicast.cursize);
-		else
-			SZ_Write (&client->datagram, sv.multicast.data, sv.multicast.cursize);
+		// send the data to the relevent clients in each visible cluster
+		for (b = 0; b < sv_mcnumbuckets; b++)
+		{
+			if (!CM_VisTest (mask, sv_mccluster[b]))
+				continue;
+
+			for (k = sv_mcbucket[b]; k < sv_mcbucket[b+1]; k++)
+			{
+				client = &svs.clients[sv_mcclients[k]];
+				if (client->state != cs_spawned && !reliable)
+					continue;
+				if (!CM_AreasConnected (area1, client->mcarea))
+					continue;
+
+				SV_MulticastToClient (client, reliable, &offset);
+			}
+		}
 	}
 
 	SZ_Clear (&sv.multicast);
@@ -388,22 +623,18 @@ FRAME UPDATES
 
 /*
 =======================
-SV_SendClientDatagram
+SV_BuildClientDatagram
+
+Everything that goes into a client's datagram this frame
 =======================
 */
-qboolean SV_SendClientDatagram (client_t *client)
+static void SV_BuildClientDatagram (client_t *client, sizebuf_t *msg)
 {
-	byte		msg_buf[MAX_MSGLEN];
-	sizebuf_t	msg;
-
 	SV_BuildClientFrame (client);
 
-	SZ_Init (&msg, msg_buf, sizeof(msg_buf));
-	msg.allowoverflow = true;
-
 	// send over all the relevant entity_state_t
 	// and the player_state_t
-	SV_WriteFrameToClient (client, &msg);
+	SV_WriteFrameToClient (client, msg);
 
 	// copy the accumulated multicast datagram
 	// for this client out to the message
@@ -412,14 +643,30 @@ qboolean SV_SendClientDatagram (client_t *client)
 	if (client->datagram.overflowed)
 		Com_Printf ("WARNING: datagram overflowed for %s\n", client->name);
 	else
-		SZ_Write (&msg, client->datagram.data, client->datagram.cursize);
-	SZ_Clear (&client->datagram);
+		SV_WriteClientDatagram (client, msg);
+	SV_ClearClientDatagram (client);
 
-	if (msg.overflowed)
+	if (msg->overflowed)
 	{	// must have room left for the packet header
 		Com_Printf ("WARNING: msg overflowed for %s\n", client->name);
-		SZ_Clear (&msg);
+		SZ_Clear (msg);
 	}
+}
+
+/*
+=======================
+SV_SendClientDatagram
+=======================
+*/
+qboolean SV_SendClientDatagram (client_t *client)
+{
+	byte		msg_buf[MAX_MSGLEN];
+	sizebuf_t	msg;
+
+	SZ_Init (&msg, msg_buf, sizeof(msg_buf));
+	msg.allowoverflow = true;
+
+	SV_BuildClientDatagram (client, &msg);
 
 	// send the datagram
 	Netchan_Transmit (&client->netchan, msg.cursize, msg.data);
@@ -438,11 +685,7 @@ SV_DemoCompleted
 */
 void SV_DemoCompleted (void)
 {
-	if (sv.demofile)
-	{
-		fclose (sv.demofile);
-		sv.demofile = NULL;
-	}
+	SV_CloseDemo ();
 	SV_Nextserver ();
 }
 
@@ -481,6 +724,351 @@ qboolean SV_RateDrop (client_t *c)
 	return false;
 }
 
+/*
+===============================================================================
+
+PARALLEL CLIENT FRAMES
+
+With sv_snapthreads set, the clients' frames are built side by side:
+
+1. main thread: rate drops, each client's PVS, PHS and areabits
+2. workers: cull the edicts for each client, only reading shared state
+3. main thread: copy the visible entity_states into svs.client_entities,
+   in client order, so the slots come out as they would serially
+4. workers: delta encode each frame into the client's own buffer
+5. main thread: add the datagrams and transmit, in client order
+
+Nothing on the workers may print or error.
+===============================================================================
+*/
+
+#define	MAX_SNAP_THREADS	16
+
+typedef struct
+{
+	std::mutex				mutex;
+	std::condition_variable	work;
+	std::condition_variable	done;
+} snapsync_t;
+
+static snapsync_t		*sv_snapsync;	// never freed, the workers wait on it until exit
+static int				sv_numsnapthreads;
+
+// guarded by sv_snapsync->mutex
+static int				sv_snapgeneration;
+static int				sv_snapfinished;	// workers done with this generation
+static int				sv_snapworkers;		// workers taking part in this generation
+static void				(*sv_snapjob) (clientsnap_t *snap);
+static int				sv_numsnapjobs;
+
+static std::atomic<int>	sv_nextsnapjob;
+
+static clientsnap_t		*sv_snaps;
+static int				sv_maxsnaps;
+
+static int				sv_snapmatches, sv_snapmismatches;
+
+static void SV_RunSnapJobs (void (*job) (clientsnap_t *snap), int count)
+{
+	int		i;
+
+	while ((i = sv_nextsnapjob++) < count)
+		job (&sv_snaps[i]);
+}
+
+/*
+=======================
+SV_SnapWorker
+
+Starts from the generation current when it was spawned, so a worker
+added mid-game waits for the next batch rather than joining the last one
+=======================
+*/
+static void SV_SnapWorker (int generation)
+{
+	void	(*job) (clientsnap_t *snap);
+	int		count;
+
+	for ( ;; )
+	{
+		{
+			std::unique_lock<std::mutex> lock (sv_snapsync->mutex);
+			sv_snapsync->work.wait (lock, [&] { return sv_snapgeneration != generation; });
+			generation = sv_snapgeneration;
+			job = sv_snapjob;
+			count = sv_numsnapjobs;
+		}
+
+		SV_RunSnapJobs (job, count);
+
+		{
+			std::lock_guard<std::mutex> lock (sv_snapsync->mutex);
+			sv_snapfinished++;
+		}
+		sv_snapsync->done.notify_one ();
+	}
+}
+
+/*
+=======================
+SV_ParallelSnapJobs
+
+Runs the job on every snap, with the main thread helping out.  Every
+worker checks in before this returns, so none of them can still be
+looking at sv_nextsnapjob when the next batch starts.
+=======================
+*/
+static void SV_ParallelSnapJobs (void (*job) (clientsnap_t *snap), int count)
+{
+	int		i;
+
+	if (sv_numsnapthreads < 1 || count < 2)
+	{
+		for (i=0 ; i<count ; i++)
+			job (&sv_snaps[i]);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock (sv_snapsync->mutex);
+		sv_snapjob = job;
+		sv_numsnapjobs = count;
+		sv_snapfinished = 0;
+		sv_snapworkers = sv_numsnapthreads;
+		sv_nextsnapjob = 0;
+		sv_snapgeneration++;
+	}
+	sv_snapsync->work.notify_all ();
+
+	SV_RunSnapJobs (job, count);
+
+	std::unique_lock<std::mutex> lock (sv_snapsync->mutex);
+	sv_snapsync->done.wait (lock, [] { return sv_snapfinished >= sv_snapworkers; });
+}
+
+static void SV_StartSnapWorkers (int count)
+{
+	unsigned	cores;
+
+	// the main thread takes a share, so more workers than spare cores only adds switching
+	cores = std::thread::hardware_concurrency ();
+	if (cores && count > (int)cores - 1)
+		count = (int)cores - 1;
+	if (count > MAX_SNAP_THREADS)
+		count = MAX_SNAP_THREADS;
+	if (count <= sv_numsnapthreads)
+		return;
+
+	if (!sv_snapsync)
+		sv_snapsync = new snapsync_t;
+
+	// workers live for the lifetime of the process
+	std::lock_guard<std::mutex> lock (sv_snapsync->mutex);
+	for ( ; sv_numsnapthreads < count ; sv_numsnapthreads++)
+		std::thread (SV_SnapWorker, sv_snapgeneration).detach ();
+}
+
+static void SV_CullSnapJob (clientsnap_t *snap)
+{
+	if (snap->ingame)
+		SV_CullClientSnap (snap);
+}
+
+static void SV_EncodeSnapJob (clientsnap_t *snap)
+{
+	SZ_Init (&snap->msg, snap->msg_buf, sizeof(snap->msg_buf));
+	SV_WriteFrameToClient (snap->client, &snap->msg);
+}
+
+/*
+=======================
+SV_CheckSnaps
+
+Builds each client's datagram the serial way for sv_snapcheck to compare
+against, then puts back everything that did
+=======================
+*/
+static void SV_CheckSnaps (int count)
+{
+	int			i;
+	int			next_client_entities;
+	int			surpressCount, datagramsize;
+	int			numrefs, refbytes;
+	qboolean	datagramoverflowed;
+	clientsnap_t	*snap;
+	client_t	*c;
+	sizebuf_t	msg;
+
+	next_client_entities = svs.next_client_entities;
+
+	for (i=0 ; i<count ; i++)
+	{
+		snap = &sv_snaps[i];
+		c = snap->client;
+		surpressCount = c->surpressCount;
+		datagramsize = c->datagram.cursize;
+		datagramoverflowed = c->datagram.overflowed;
+		numrefs = c->numrefs;
+		refbytes = c->refbytes;
+
+		SZ_Init (&msg, snap->ref_buf, sizeof(snap->ref_buf));
+		msg.allowoverflow = true;
+		SV_BuildClientDatagram (c, &msg);
+		snap->refsize = msg.cursize;
+
+		c->surpressCount = surpressCount;
+		c->datagram.cursize = datagramsize;
+		c->datagram.overflowed = datagramoverflowed;
+		c->numrefs = numrefs;
+		c->refbytes = refbytes;
+		sv_mcrefs += numrefs;
+	}
+
+	svs.next_client_entities = next_client_entities;
+}
+
+/*
+=======================
+SV_TransmitSnap
+
+The end of SV_BuildClientDatagram and SV_SendClientDatagram for a frame
+that was encoded into the snap's own, bigger, buffer
+=======================
+*/
+static void SV_TransmitSnap (clientsnap_t *snap)
+{
+	client_t	*client;
+	sizebuf_t	*msg;
+	qboolean	overflowed;
+
+	client = snap->client;
+	msg = &snap->msg;
+
+	// the serial build would have overflowed as soon as it went past
+	// MAX_MSGLEN, and thrown the whole thing away at the end
+	overflowed = (qboolean)(msg->cursize > MAX_MSGLEN);
+
+	if (client->datagram.overflowed)
+		Com_Printf ("WARNING: datagram overflowed for %s\n", client->name);
+	else if (msg->cursize + client->datagram.cursize + client->refbytes > MAX_MSGLEN)
+		overflowed = true;
+	else
+		SV_WriteClientDatagram (client, msg);
+	SV_ClearClientDatagram (client);
+
+	if (overflowed)
+	{
+		Com_Printf ("WARNING: msg overflowed for %s\n", client->name);
+		SZ_Clear (msg);
+	}
+
+	if (sv_snapcheck->value)
+	{
+		if ((int)msg->cursize == snap->refsize && !memcmp (msg->data, snap->ref_buf, msg->cursize))
+			sv_snapmatches++;
+		else
+		{
+			sv_snapmismatches++;
+			Com_Printf ("sv_snapcheck: frame %i for %s is %i bytes, %i built serially\n",
+				sv.framenum, client->name, (int)msg->cursize, snap->refsize);
+		}
+	}
+
+	// send the datagram
+	Netchan_Transmit (&client->netchan, msg->cursize, msg->data);
+
+	// record the size for rate estimation
+	client->message_size[sv.framenum % RATE_MESSAGES] = msg->cursize;
+}
+
+/*
+=======================
+SV_SendClientSnaps
+
+Does the work of SV_SendClientMessages for an ordinary game frame with
+the frames built in parallel.  Returns false to have it done serially.
+=======================
+*/
+static qboolean SV_SendClientSnaps (void)
+{
+	int			i, count;
+	client_t	*c;
+
+	if (sv_snapthreads->value < 1)
+		return false;
+	if (sv.state == ss_cinematic || sv.state == ss_demo || sv.state == ss_pic)
+		return false;
+
+	for (i=0, c = svs.clients ; i<maxclients->value; i++, c++)
+		if (c->state && c->netchan.message.overflowed)
+			return false;	// dropping a client runs game code, which later frames could see
+
+	SV_StartSnapWorkers ((int)sv_snapthreads->value);
+
+	if (sv_maxsnaps < maxclients->value)
+	{
+		if (sv_snaps)
+			Z_Free (sv_snaps);
+		sv_maxsnaps = (int)maxclients->value;
+		sv_snaps = static_cast<clientsnap_t *>( Z_Malloc (sv_maxsnaps * sizeof(clientsnap_t)) );
+	}
+
+	count = 0;
+	for (i=0, c = svs.clients ; i<maxclients->value; i++, c++)
+	{
+		if (!c->state)
+			continue;
+
+		if (c->state == cs_spawned)
+		{
+			// don't overrun bandwidth
+			if (SV_RateDrop (c))
+				continue;
+
+			sv_snaps[count++].client = c;
+		}
+		else
+		{
+	// just update reliable	if needed
+			if (c->netchan.message.cursize	|| curtime - c->netchan.last_sent > 1000 )
+				Netchan_Transmit (&c->netchan, 0, NULL);
+		}
+	}
+
+	if (sv_snapcheck->value)
+		SV_CheckSnaps (count);
+
+	for (i=0 ; i<count ; i++)
+		SV_SetupClientSnap (&sv_snaps[i], sv_snaps[i].client);
+
+	SV_ParallelSnapJobs (SV_CullSnapJob, count);
+
+	for (i=0 ; i<count ; i++)
+		if (sv_snaps[i].ingame)
+			SV_StoreClientSnap (&sv_snaps[i]);
+
+	SV_ParallelSnapJobs (SV_EncodeSnapJob, count);
+
+	for (i=0 ; i<count ; i++)
+		SV_TransmitSnap (&sv_snaps[i]);
+
+	return true;
+}
+
+/*
+=======================
+SV_SnapStats_f
+
+Reports and resets the sv_snapcheck counts
+=======================
+*/
+void SV_SnapStats_f (void)
+{
+	Com_Printf ("%i frames matched the serial build, %i didn't\n", sv_snapmatches, sv_snapmismatches);
+	sv_snapmatches = sv_snapmismatches = 0;
+}
+
+
 /*
 =======================
 SV_SendClientMessages
@@ -492,7 +1080,6 @@ void SV_SendClientMessages (void)
 	client_t	*c;
 	int			msglen;
 	byte		msgbuf[MAX_MSGLEN];
-	int			r;
 
 	msglen = 0;
 
@@ -501,32 +1088,22 @@ void SV_SendClientMessages (void)
 	{
 		if (sv_paused->value)
 			msglen = 0;
-		else
+		else if (!SV_ReadDemoMessage (msgbuf, &msglen))
 		{
-			// get the next message
-			r = fread (&msglen, 4, 1, sv.demofile);
-			if (r != 1)
-			{
-				SV_DemoCompleted ();
-				return;
-			}
-			msglen = LittleLong (msglen);
-			if (msglen == -1)
-			{
-				SV_DemoCompleted ();
-				return;
-			}
-			if (msglen > MAX_MSGLEN)
-				Com_Error (ERR_DROP, "SV_SendClientMessages: msglen > MAX_MSGLEN");
-			r = fread (msgbuf, msglen, 1, sv.demofile);
-			if (r != 1)
-			{
-				SV_DemoCompleted ();
-				return;
-			}
+			SV_DemoCompleted ();
+			return;
 		}
 	}
 
+	if (sv.state == ss_game)
+		SV_BuildSnapEntities ();
+
+	if (SV_SendClientSnaps ())
+	{
+		SV_ReleaseMulticasts ();
+		return;
+	}
+
 	// send a message to each connected client
 	for (i=0, c = svs.clients ; i<maxclients->value; i++, c++)
 	{
@@ -537,9 +1114,11 @@ void SV_SendClientMessages (void)
 		if (c->netchan.message.overflowed)
 		{
 			SZ_Clear (&c->netchan.message);
-			SZ_Clear (&c->datagram);
+			SV_ClearClientDatagram (c);
 			SV_BroadcastPrintf (PRINT_HIGH, "%s overflowed\n", c->name);
 			SV_DropClient (c);
+			if (sv.state == ss_game)
+				SV_BuildSnapEntities ();	// the game may have changed its edicts
 		}
 
 		if (sv.state == ss_cinematic 
@@ -562,5 +1141,7 @@ void SV_SendClientMessages (void)
 				Netchan_Transmit (&c->netchan, 0, NULL);
 		}
 	}
+
+	SV_ReleaseMulticasts ();
 }
 
@@ -39,14 +39,11 @@ SV_BeginDemoServer
 */
 void SV_BeginDemoserver (void)
 {
-#if 0 /* todo: revisit */
 	char		name[MAX_OSPATH];
 
 	Com_sprintf (name, sizeof(name), "demos/%s", sv.name);
-	FS_FOpenFile (name, &sv.demofile);
-	if (!sv.demofile)
+	if (!SV_OpenDemo (name))
 		Com_Error (ERR_DROP, "Couldn't open %s\n", name);
-#endif
 }
 
 /*
@@ -600,7 +597,9 @@ void SV_ExecuteClientMessage (client_t *cl)
 
 			if ( cl->state != cs_spawned )
 			{
-				cl->lastframe = -1;
+				// demo viewers never spawn, but playback deltas from what they acknowledge
+				if (sv.state != ss_demo)
+					cl->lastframe = -1;
 				break;
 			}
 
@@ -35,27 +35,86 @@ FIXME: this use of "area" is different from the bsp file use
 // FIXME: remove this mess!
 #define	STRUCT_FROM_LINK(l,t,m) ((t *)((byte *)l - (long)&(((t *)0)->m)))
 
-#define	EDICT_FROM_AREA(l) STRUCT_FROM_LINK(l,edict_t,area)
+/*
+The broadphase knows edicts only by number, with the box and list (solid
+or trigger) they were last linked with, so a query never has to touch the
+edicts themselves.  ent->area is still what says whether an edict is
+linked.  sv_broadphase picks the implementation at the next map:
+
+"tree"	the original uniform tree, split on x/y down to AREA_DEPTH.  Anything
+		that straddles a split stays in that node's lists, so big open maps
+		pile most edicts up near the root
+"grid"	a loose 3D hash grid with a level for each power of two size from
+		GRID_MINSIZE up.  An edict is in the one cell holding its center at
+		the level big enough for it, so it never has to straddle anything
+*/
+
+typedef struct
+{
+	link_t	cell;			// in an area node or grid cell
+	link_t	level;			// grid: everything at the same size
+	vec3_t	mins, maxs;
+	int		type;			// AREA_SOLID or AREA_TRIGGERS, 0 when not linked
+	int		levelnum;		// grid
+	int		cellnum[3];
+} arealink_t;
 
 typedef struct areanode_s
 {
 	int		axis;		// -1 = leaf node
 	float	dist;
 	struct areanode_s	*children[2];
-	link_t	trigger_edicts;
-	link_t	solid_edicts;
+	link_t	edicts[2];	// solid, trigger
 } areanode_t;
 
 #define	AREA_DEPTH	4
 #define	AREA_NODES	32
 
-areanode_t	sv_areanodes[AREA_NODES];
-int			sv_numareanodes;
+#define	GRID_MINSIZE	64
+#define	GRID_LEVELS		8		// the last one holds everything too big for the rest
+#define	GRID_HASH		4096	// cells per list, a power of two
+#define	GRID_MAXCELLS	128		// scan the whole level rather than visit more cells
+
+typedef struct
+{
+	const float	*mins, *maxs;
+	int			type;
+	int			*list;
+	int			count, maxcount;
+	int			tested;
+	qboolean	(*Filter) (int num);	// optional, false skips the link
+} areaquery_t;
+
+typedef struct areaworld_s	areaworld_t;
 
-float	*area_mins, *area_maxs;
-edict_t	**area_list;
-int		area_count, area_maxcount;
-int		area_type;
+typedef struct
+{
+	const char	*name;
+	void		(*Clear) (areaworld_t *w, vec3_t mins, vec3_t maxs);
+	void		(*Insert) (areaworld_t *w, arealink_t *l);
+	void		(*Remove) (areaworld_t *w, arealink_t *l);
+	qboolean	(*Query) (areaworld_t *w, areaquery_t *q);	// false when the list filled up
+} broadphase_t;
+
+struct areaworld_s
+{
+	const broadphase_t	*bp;
+	arealink_t	*links;
+	int			maxents;
+
+	// tree
+	areanode_t	nodes[AREA_NODES];
+	int			numnodes;
+
+	// grid
+	link_t		cells[2][GRID_HASH];
+	link_t		levels[2][GRID_LEVELS];
+	int			levelcount[2][GRID_LEVELS];
+
+	int			queries, tested, hits;
+};
+
+static areaworld_t	sv_area;
 
 int SV_HullForEntity (edict_t *ent);
 
@@ -80,6 +139,14 @@ void InsertLinkBefore (link_t *l, link_t *before)
 	l->next->prev = l;
 }
 
+/*
+===============================================================================
+
+AREA TREE
+
+===============================================================================
+*/
+
 /*
 ===============
 SV_CreateAreaNode
@@ -87,17 +154,17 @@ SV_CreateAreaNode
 Builds a uniformly subdivided tree for the given world size
 ===============
 */
-areanode_t *SV_CreateAreaNode (int depth, vec3_t mins, vec3_t maxs)
+areanode_t *SV_CreateAreaNode (areaworld_t *w, int depth, vec3_t mins, vec3_t maxs)
 {
 	areanode_t	*anode;
 	vec3_t		size;
 	vec3_t		mins1, maxs1, mins2, maxs2;
 
-	anode = &sv_areanodes[sv_numareanodes];
-	sv_numareanodes++;
+	anode = &w->nodes[w->numnodes];
+	w->numnodes++;
 
-	ClearLink (&anode->trigger_edicts);
-	ClearLink (&anode->solid_edicts);
+	ClearLink (&anode->edicts[0]);
+	ClearLink (&anode->edicts[1]);
 	
 	if (depth == AREA_DEPTH)
 	{
@@ -120,12 +187,323 @@ areanode_t *SV_CreateAreaNode (int depth, vec3_t mins, vec3_t maxs)
 	
 	maxs1[anode->axis] = mins2[anode->axis] = anode->dist;
 	
-	anode->children[0] = SV_CreateAreaNode (depth+1, mins2, maxs2);
-	anode->children[1] = SV_CreateAreaNode (depth+1, mins1, maxs1);
+	anode->children[0] = SV_CreateAreaNode (w, depth+1, mins2, maxs2);
+	anode->children[1] = SV_CreateAreaNode (w, depth+1, mins1, maxs1);
 
 	return anode;
 }
 
+static void SV_TreeClear (areaworld_t *w, vec3_t mins, vec3_t maxs)
+{
+	memset (w->nodes, 0, sizeof(w->nodes));
+	w->numnodes = 0;
+	SV_CreateAreaNode (w, 0, mins, maxs);
+}
+
+static void SV_TreeInsert (areaworld_t *w, arealink_t *l)
+{
+	areanode_t	*node;
+
+	// find the first node that the box crosses
+	node = w->nodes;
+	while (1)
+	{
+		if (node->axis == -1)
+			break;
+		if (l->mins[node->axis] > node->dist)
+			node = node->children[0];
+		else if (l->maxs[node->axis] < node->dist)
+			node = node->children[1];
+		else
+			break;		// crosses the node
+	}
+
+	InsertLinkBefore (&l->cell, &node->edicts[l->type - AREA_SOLID]);
+}
+
+static void SV_TreeRemove (areaworld_t *w, arealink_t *l)
+{
+	RemoveLink (&l->cell);
+}
+
+/*
+====================
+SV_AreaCheck
+
+Adds the link to the query's list if its box touches the query's
+and the query's filter accepts it.  Returns false when the list is
+already full.
+====================
+*/
+static qboolean SV_AreaCheck (areaworld_t *w, areaquery_t *q, arealink_t *l)
+{
+	q->tested++;
+	if (l->mins[0] > q->maxs[0]
+	|| l->mins[1] > q->maxs[1]
+	|| l->mins[2] > q->maxs[2]
+	|| l->maxs[0] < q->mins[0]
+	|| l->maxs[1] < q->mins[1]
+	|| l->maxs[2] < q->mins[2])
+		return true;		// not touching
+
+	if (q->Filter && !q->Filter (l - w->links))
+		return true;
+
+	if (q->count == q->maxcount)
+		return false;
+
+	q->list[q->count++] = l - w->links;
+	return true;
+}
+
+static qboolean SV_TreeQuery_r (areaworld_t *w, areaquery_t *q, areanode_t *node)
+{
+	link_t		*l, *start;
+
+	start = &node->edicts[q->type - AREA_SOLID];
+	for (l=start->next ; l != start ; l = l->next)
+		if (!SV_AreaCheck (w, q, STRUCT_FROM_LINK(l, arealink_t, cell)))
+			return false;
+	
+	if (node->axis == -1)
+		return true;		// terminal node
+
+	// recurse down both sides
+	if ( q->maxs[node->axis] > node->dist && !SV_TreeQuery_r (w, q, node->children[0]) )
+		return false;
+	if ( q->mins[node->axis] < node->dist && !SV_TreeQuery_r (w, q, node->children[1]) )
+		return false;
+	return true;
+}
+
+static qboolean SV_TreeQuery (areaworld_t *w, areaquery_t *q)
+{
+	return SV_TreeQuery_r (w, q, w->nodes);
+}
+
+/*
+===============================================================================
+
+LOOSE GRID
+
+===============================================================================
+*/
+
+/*
+===============
+SV_GridLevel
+
+The smallest level whose cells are at least as big as the box.  Being in
+the cell that holds its center then keeps the box within half a cell of
+it on every side.
+===============
+*/
+static int SV_GridLevel (const float *mins, const float *maxs)
+{
+	float	size;
+	int		i;
+
+	size = 0;
+	for (i=0 ; i<3 ; i++)
+		if (maxs[i] - mins[i] > size)
+			size = maxs[i] - mins[i];
+	size += 1;		// so rounding the center can't push the box past the loose bound
+
+	for (i=0 ; i<GRID_LEVELS-1 ; i++)
+		if (size <= GRID_MINSIZE << i)
+			return i;
+	return GRID_LEVELS-1;
+}
+
+static unsigned SV_GridHash (int level, int x, int y, int z)
+{
+	return ((unsigned)x * 73856093u ^ (unsigned)y * 19349663u
+		^ (unsigned)z * 83492791u ^ (unsigned)level * 2654435761u) & (GRID_HASH-1);
+}
+
+static void SV_GridClear (areaworld_t *w, vec3_t mins, vec3_t maxs)
+{
+	int		t, i;
+
+	for (t=0 ; t<2 ; t++)
+	{
+		for (i=0 ; i<GRID_HASH ; i++)
+			ClearLink (&w->cells[t][i]);
+		for (i=0 ; i<GRID_LEVELS ; i++)
+		{
+			ClearLink (&w->levels[t][i]);
+			w->levelcount[t][i] = 0;
+		}
+	}
+}
+
+static void SV_GridInsert (areaworld_t *w, arealink_t *l)
+{
+	int		t, i;
+	float	size;
+
+	t = l->type - AREA_SOLID;
+	l->levelnum = SV_GridLevel (l->mins, l->maxs);
+	InsertLinkBefore (&l->level, &w->levels[t][l->levelnum]);
+	w->levelcount[t][l->levelnum]++;
+
+	if (l->levelnum == GRID_LEVELS-1)
+	{	// too big for any cell, only found by scanning the level
+		ClearLink (&l->cell);
+		return;
+	}
+
+	size = GRID_MINSIZE << l->levelnum;
+	for (i=0 ; i<3 ; i++)
+		l->cellnum[i] = (int)floor ((l->mins[i] + l->maxs[i]) * 0.5f / size);
+	InsertLinkBefore (&l->cell, &w->cells[t][SV_GridHash (l->levelnum, l->cellnum[0], l->cellnum[1], l->cellnum[2])]);
+}
+
+static void SV_GridRemove (areaworld_t *w, arealink_t *l)
+{
+	RemoveLink (&l->cell);
+	RemoveLink (&l->level);
+	w->levelcount[l->type - AREA_SOLID][l->levelnum]--;
+}
+
+static qboolean SV_GridQuery (areaworld_t *w, areaquery_t *q)
+{
+	int			t, level, i, x, y, z;
+	int			cells;
+	int			lo[3], hi[3];
+	float		size;
+	link_t		*l, *start;
+	arealink_t	*al;
+
+	t = q->type - AREA_SOLID;
+	for (level=0 ; level<GRID_LEVELS ; level++)
+	{
+		if (!w->levelcount[t][level])
+			continue;
+
+		cells = GRID_MAXCELLS + 1;
+		if (level < GRID_LEVELS-1)
+		{
+			size = GRID_MINSIZE << level;
+			cells = 1;
+			for (i=0 ; i<3 && cells <= GRID_MAXCELLS ; i++)
+			{
+				lo[i] = (int)floor ((q->mins[i] - size*0.5f) / size);
+				hi[i] = (int)floor ((q->maxs[i] + size*0.5f) / size);
+				cells *= hi[i] - lo[i] + 1;
+			}
+		}
+
+		if (cells > GRID_MAXCELLS || cells >= w->levelcount[t][level])
+		{	// cheaper to look at everything this size
+			start = &w->levels[t][level];
+			for (l=start->next ; l != start ; l = l->next)
+				if (!SV_AreaCheck (w, q, STRUCT_FROM_LINK(l, arealink_t, level)))
+					return false;
+			continue;
+		}
+
+		for (z=lo[2] ; z<=hi[2] ; z++)
+			for (y=lo[1] ; y<=hi[1] ; y++)
+				for (x=lo[0] ; x<=hi[0] ; x++)
+				{
+					start = &w->cells[t][SV_GridHash (level, x, y, z)];
+					for (l=start->next ; l != start ; l = l->next)
+					{
+						al = STRUCT_FROM_LINK(l, arealink_t, cell);
+						if (al->cellnum[0] != x || al->cellnum[1] != y || al->cellnum[2] != z
+						|| al->levelnum != level)
+							continue;	// another cell that shares the bucket
+						if (!SV_AreaCheck (w, q, al))
+							return false;
+					}
+				}
+	}
+
+	return true;
+}
+
+/*
+===============================================================================
+
+BROADPHASE
+
+===============================================================================
+*/
+
+static const broadphase_t	sv_broadphases[] =
+{
+	{ "grid", SV_GridClear, SV_GridInsert, SV_GridRemove, SV_GridQuery },
+	{ "tree", SV_TreeClear, SV_TreeInsert, SV_TreeRemove, SV_TreeQuery }
+};
+
+#define	NUM_BROADPHASES	(int)(sizeof(sv_broadphases)/sizeof(sv_broadphases[0]))
+
+static void SV_InitAreaWorld (areaworld_t *w, const broadphase_t *bp, vec3_t mins, vec3_t maxs, int maxents)
+{
+	if (w->links)
+		Z_Free (w->links);
+	w->links = static_cast<arealink_t *>( Z_Malloc (maxents * sizeof(arealink_t)) );
+	memset (w->links, 0, maxents * sizeof(arealink_t));
+	w->maxents = maxents;
+	w->bp = bp;
+	w->queries = w->tested = w->hits = 0;
+
+	bp->Clear (w, mins, maxs);
+}
+
+static void SV_AreaLink (areaworld_t *w, int num, int type, vec3_t mins, vec3_t maxs)
+{
+	arealink_t	*l;
+
+	if (num < 0 || num >= w->maxents)
+		Com_Error (ERR_DROP, "SV_LinkEdict: bad edict number %i", num);
+
+	l = &w->links[num];
+	if (l->type)
+		w->bp->Remove (w, l);
+	VectorCopy (mins, l->mins);
+	VectorCopy (maxs, l->maxs);
+	l->type = type;
+	w->bp->Insert (w, l);
+}
+
+static void SV_AreaUnlink (areaworld_t *w, int num)
+{
+	arealink_t	*l;
+
+	if (num < 0 || num >= w->maxents)
+		return;
+	l = &w->links[num];
+	if (!l->type)
+		return;
+	w->bp->Remove (w, l);
+	l->type = 0;
+}
+
+static int SV_AreaQuery (areaworld_t *w, const float *mins, const float *maxs, int type, int *list, int maxcount, qboolean (*filter) (int num))
+{
+	areaquery_t	q;
+
+	q.mins = mins;
+	q.maxs = maxs;
+	q.type = type;
+	q.list = list;
+	q.count = 0;
+	q.maxcount = maxcount;
+	q.tested = 0;
+	q.Filter = filter;
+
+	if (!w->bp->Query (w, &q))
+		Com_Printf ("SV_AreaEdicts: MAXCOUNT\n");
+
+	w->queries++;
+	w->tested += q.tested;
+	w->hits += q.count;
+
+	return q.count;
+}
+
 /*
 ===============
 SV_ClearWorld
@@ -134,9 +512,20 @@ SV_ClearWorld
 */
 void SV_ClearWorld (void)
 {
-	memset (sv_areanodes, 0, sizeof(sv_areanodes));
-	sv_numareanodes = 0;
-	SV_CreateAreaNode (0, sv.models[1]->mins, sv.models[1]->maxs);
+	const broadphase_t	*bp;
+	int			i;
+
+	bp = &sv_broadphases[0];
+	for (i=0 ; i<NUM_BROADPHASES ; i++)
+		if (!Q_stricmp (sv_broadphase->string, sv_broadphases[i].name))
+			break;
+	if (i == NUM_BROADPHASES)
+		Com_Printf ("Unknown sv_broadphase \"%s\", using %s\n", sv_broadphase->string, bp->name);
+	else
+		bp = &sv_broadphases[i];
+
+	SV_InitAreaWorld (&sv_area, bp, sv.models[1]->mins, sv.models[1]->maxs,
+		ge ? ge->max_edicts : MAX_EDICTS);
 }
 
 
@@ -150,7 +539,7 @@ void SV_UnlinkEdict (edict_t *ent)
 {
 	if (!ent->area.prev)
 		return;		// not linked in anywhere
-	RemoveLink (&ent->area);
+	SV_AreaUnlink (&sv_area, NUM_FOR_EDICT(ent));
 	ent->area.prev = ent->area.next = NULL;
 }
 
@@ -164,7 +553,6 @@ SV_LinkEdict
 #define MAX_TOTAL_ENT_LEAFS		128
 void SV_LinkEdict (edict_t *ent)
 {
-	areanode_t	*node;
 	int			leafs[MAX_TOTAL_ENT_LEAFS];
 	int			clusters[MAX_TOTAL_ENT_LEAFS];
 	int			num_leafs;
@@ -320,102 +708,180 @@ void SV_LinkEdict (edict_t *ent)
 	if (ent->solid == SOLID_NOT)
 		return;
 
-// find the first node that the ent's box crosses
-	node = sv_areanodes;
-	while (1)
-	{
-		if (node->axis == -1)
-			break;
-		if (ent->absmin[node->axis] > node->dist)
-			node = node->children[0];
-		else if (ent->absmax[node->axis] < node->dist)
-			node = node->children[1];
-		else
-			break;		// crosses the node
-	}
-	
-	// link it in	
-	if (ent->solid == SOLID_TRIGGER)
-		InsertLinkBefore (&ent->area, &node->trigger_edicts);
-	else
-		InsertLinkBefore (&ent->area, &node->solid_edicts);
-
+	SV_AreaLink (&sv_area, NUM_FOR_EDICT(ent), ent->solid == SOLID_TRIGGER ? AREA_TRIGGERS : AREA_SOLID,
+		ent->absmin, ent->absmax);
+	ClearLink (&ent->area);		// only says that it's linked
 }
 
 
 /*
-====================
-SV_AreaEdicts_r
+================
+SV_AreaEdictActive
 
-====================
+Edicts can be set SOLID_NOT without being unlinked
+================
+*/
+static qboolean SV_AreaEdictActive (int num)
+{
+	return EDICT_NUM(num)->solid != SOLID_NOT;
+}
+
+/*
+================
+SV_AreaEdicts
+================
 */
-void SV_AreaEdicts_r (areanode_t *node)
+int SV_AreaEdicts (vec3_t mins, vec3_t maxs, edict_t **list,
+	int maxcount, int areatype)
 {
-	link_t		*l, *next, *start;
-	edict_t		*check;
-	int			count;
+	int		nums[MAX_EDICTS];
+	int		i, num;
 
-	count = 0;
+	if (maxcount > MAX_EDICTS)
+		maxcount = MAX_EDICTS;
+	num = SV_AreaQuery (&sv_area, mins, maxs, areatype, nums, maxcount, SV_AreaEdictActive);
 
-	// touch linked edicts
-	if (area_type == AREA_SOLID)
-		start = &node->solid_edicts;
-	else
-		start = &node->trigger_edicts;
+	for (i=0 ; i<num ; i++)
+		list[i] = EDICT_NUM(nums[i]);
 
-	for (l=start->next  ; l != start ; l = next)
-	{
-		next = l->next;
-		check = EDICT_FROM_AREA(l);
-
-		if (check->solid == SOLID_NOT)
-			continue;		// deactivated
-		if (check->absmin[0] > area_maxs[0]
-		|| check->absmin[1] > area_maxs[1]
-		|| check->absmin[2] > area_maxs[2]
-		|| check->absmax[0] < area_mins[0]
-		|| check->absmax[1] < area_mins[1]
-		|| check->absmax[2] < area_mins[2])
-			continue;		// not touching
-
-		if (area_count == area_maxcount)
-		{
-			Com_Printf ("SV_AreaEdicts: MAXCOUNT\n");
-			return;
-		}
+	return num;
+}
 
-		area_list[area_count] = check;
-		area_count++;
+/*
+================
+SV_AreaStats_f
+
+Broadphase counters since the last map or the last time they were asked for
+================
+*/
+void SV_AreaStats_f (void)
+{
+	if (!sv_area.bp)
+	{
+		Com_Printf ("No map loaded.\n");
+		return;
 	}
-	
-	if (node->axis == -1)
-		return;		// terminal node
 
-	// recurse down both sides
-	if ( area_maxs[node->axis] > node->dist )
-		SV_AreaEdicts_r ( node->children[0] );
-	if ( area_mins[node->axis] < node->dist )
-		SV_AreaEdicts_r ( node->children[1] );
+	Com_Printf ("%s: %i queries, %i candidates tested, %i hits", sv_area.bp->name,
+		sv_area.queries, sv_area.tested, sv_area.hits);
+	if (sv_area.queries)
+		Com_Printf (", %.1f tested and %.1f hit per query",
+			(float)sv_area.tested / sv_area.queries, (float)sv_area.hits / sv_area.queries);
+	Com_Printf ("\n");
+
+	sv_area.queries = sv_area.tested = sv_area.hits = 0;
 }
 
 /*
 ================
-SV_AreaEdicts
+SV_AreaBench_f
+
+sv_areabench [boxes] [frames]
+
+Moves boxes around the current map (or an empty 8192x8192x2048 world) through
+each broadphase in turn, relinking every box and querying along its move
+each frame
 ================
 */
-int SV_AreaEdicts (vec3_t mins, vec3_t maxs, edict_t **list,
-	int maxcount, int areatype)
+void SV_AreaBench_f (void)
 {
-	area_mins = mins;
-	area_maxs = maxs;
-	area_list = list;
-	area_count = 0;
-	area_maxcount = maxcount;
-	area_type = areatype;
+	areaworld_t	*w;
+	vec3_t		worldmins, worldmaxs;
+	vec3_t		*org, *vel, *half;
+	vec3_t		mins, maxs;
+	int			*list;
+	int			numboxes, frames;
+	int			b, i, f, k;
+	int			hits, start, time;
+	unsigned	seed;
+
+	numboxes = Cmd_Argc() > 1 ? atoi (Cmd_Argv(1)) : 2000;
+	frames = Cmd_Argc() > 2 ? atoi (Cmd_Argv(2)) : 100;
+	if (numboxes < 1 || frames < 1)
+	{
+		Com_Printf ("Usage: sv_areabench [boxes] [frames]\n");
+		return;
+	}
+
+	if (sv.state != ss_dead && sv.models[1] && sv.models[1]->maxs[0] > sv.models[1]->mins[0])
+	{
+		VectorCopy (sv.models[1]->mins, worldmins);
+		VectorCopy (sv.models[1]->maxs, worldmaxs);
+	}
+	else
+	{
+		VectorSet (worldmins, -4096, -4096, -1024);
+		VectorSet (worldmaxs, 4096, 4096, 1024);
+	}
+
+	org = static_cast<vec3_t *>( Z_Malloc (numboxes * sizeof(vec3_t) * 3) );
+	vel = org + numboxes;
+	half = vel + numboxes;
+	list = static_cast<int *>( Z_Malloc (numboxes * sizeof(int)) );
+	w = static_cast<areaworld_t *>( Z_Malloc (sizeof(*w)) );
+
+	for (k=0 ; k<NUM_BROADPHASES ; k++)
+	{
+		memset (w, 0, sizeof(*w));
+		SV_InitAreaWorld (w, &sv_broadphases[k], worldmins, worldmaxs, numboxes);
+
+		// the same boxes and moves for each broadphase
+		seed = 1;
+#define	BENCH_RAND()	((seed = seed * 1103515245 + 12345) >> 16 & 0x7fff)
+		for (b=0 ; b<numboxes ; b++)
+		{
+			for (i=0 ; i<3 ; i++)
+			{
+				org[b][i] = worldmins[i] + (worldmaxs[i] - worldmins[i]) * BENCH_RAND() / 32768.0f;
+				vel[b][i] = (int)(BENCH_RAND() % 33) - 16;
+				half[b][i] = 16;
+			}
+			if (b % 10 == 0)	// a big trigger every so often
+				VectorSet (half[b], 32 + BENCH_RAND() % 256, 32 + BENCH_RAND() % 256, 32 + BENCH_RAND() % 64);
+		}
+#undef BENCH_RAND
 
-	SV_AreaEdicts_r (sv_areanodes);
+		hits = 0;
+		start = Sys_Milliseconds ();
+		for (f=0 ; f<frames ; f++)
+		{
+			for (b=0 ; b<numboxes ; b++)
+			{
+				for (i=0 ; i<3 ; i++)
+				{
+					org[b][i] += vel[b][i];
+					if (org[b][i] < worldmins[i] || org[b][i] > worldmaxs[i])
+						vel[b][i] = -vel[b][i];
+					mins[i] = org[b][i] - half[b][i] - 1;
+					maxs[i] = org[b][i] + half[b][i] + 1;
+				}
+				SV_AreaLink (w, b, b % 10 == 0 ? AREA_TRIGGERS : AREA_SOLID, mins, maxs);
+			}
 
-	return area_count;
+			for (b=0 ; b<numboxes ; b++)
+			{	// everything solid checks along its next move
+				if (b % 10 == 0)
+					continue;
+				for (i=0 ; i<3 ; i++)
+				{
+					mins[i] = org[b][i] - half[b][i] - 1 + (vel[b][i] < 0 ? vel[b][i] : 0);
+					maxs[i] = org[b][i] + half[b][i] + 1 + (vel[b][i] > 0 ? vel[b][i] : 0);
+				}
+				hits += SV_AreaQuery (w, mins, maxs, AREA_SOLID, list, numboxes, NULL);
+				hits += SV_AreaQuery (w, mins, maxs, AREA_TRIGGERS, list, numboxes, NULL);
+			}
+		}
+		time = Sys_Milliseconds () - start;
+
+		Com_Printf ("%s: %i boxes x %i frames in %i ms, %i queries, %i candidates tested, %i hits\n",
+			w->bp->name, numboxes, frames, time, w->queries, w->tested, hits);
+
+		Z_Free (w->links);
+	}
+
+	Z_Free (w);
+	Z_Free (list);
+	Z_Free (org);
 }
 
 
@@ -611,27 +1077,19 @@ boxmaxs[0] = boxmaxs[1] = boxmaxs[2] = 9999;
 
 /*
 ==================
-SV_Trace
-
-Moves the given mins/maxs volume through the world from start to end.
-
-Passedict and edicts owned by passedict are explicitly not checked.
+SV_TraceEntities
 
+Clips a trace that's already been clipped to the world against the
+solid entities along it
 ==================
 */
-trace_t SV_Trace (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, edict_t *passedict, int contentmask)
+static trace_t SV_TraceEntities (trace_t worldtrace, vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, edict_t *passedict, int contentmask)
 {
 	moveclip_t	clip;
 
-	if (!mins)
-		mins = vec3_origin;
-	if (!maxs)
-		maxs = vec3_origin;
-
 	memset ( &clip, 0, sizeof ( moveclip_t ) );
 
-	// clip to world
-	clip.trace = CM_BoxTrace (start, end, mins, maxs, 0, contentmask);
+	clip.trace = worldtrace;
 	clip.trace.ent = ge->edicts;
 	if (clip.trace.fraction == 0)
 		return clip.trace;		// blocked by the world
@@ -655,3 +1113,58 @@ trace_t SV_Trace (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, edict_t *p
 	return clip.trace;
 }
 
+/*
+==================
+SV_Trace
+
+Moves the given mins/maxs volume through the world from start to end.
+
+Passedict and edicts owned by passedict are explicitly not checked.
+
+==================
+*/
+trace_t SV_Trace (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, edict_t *passedict, int contentmask)
+{
+	if (!mins)
+		mins = vec3_origin;
+	if (!maxs)
+		maxs = vec3_origin;
+
+	// clip to world
+	return SV_TraceEntities (CM_BoxTrace (start, end, mins, maxs, 0, contentmask),
+		start, mins, maxs, end, passedict, contentmask);
+}
+
+/*
+==================
+SV_TraceBatch
+
+SV_Trace for each request, with the world clipping done as one batch.
+The requests' headnodes are ignored.
+==================
+*/
+void SV_TraceBatch (const trace_req_t *reqs, trace_t *out, int n)
+{
+	trace_req_t	world[64];
+	trace_req_t	*r;
+	int			i, j, count;
+
+	for (i=0 ; i<n ; i+=count)
+	{
+		count = n - i;
+		if (count > (int)(sizeof(world)/sizeof(world[0])))
+			count = sizeof(world)/sizeof(world[0]);
+
+		memcpy (world, reqs + i, count * sizeof(*world));
+		for (j=0 ; j<count ; j++)
+			world[j].headnode = 0;
+
+		CM_BoxTraceBatch (world, out + i, count);
+
+		for (j=0 ; j<count ; j++)
+		{
+			r = &world[j];
+			out[i+j] = SV_TraceEntities (out[i+j], r->start, r->mins, r->maxs, r->end, r->passent, r->contentmask);
+		}
+	}
+}
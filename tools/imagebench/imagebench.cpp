@@ -0,0 +1,132 @@
+/*
+Copyright (C) 1997-2001 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+/*
+ * imagebench: headless run of the texture upload path in gl_imageproc.cpp,
+ * the same work as the gl_imagebench console command, without the engine
+ * or a GL context.
+ *
+ *   imagebench [width] [height] [count]
+ *
+ * Times the C and SSE2 rows and exits with failure if they build
+ * different mips, so it can be run from a script.
+ */
+
+#include "gl_local.h"
+
+#include <chrono>
+#include <cstdarg>
+#include <cstdlib>
+
+/* a random palette stands in for pics/colormap.pcx, 255 is transparent */
+unsigned d_8to24table[ 256 ];
+
+/*
+=============================================================================
+
+ENGINE STUBS
+
+=============================================================================
+*/
+
+void *Z_Malloc( int size ) {
+	void *p = calloc( 1, size );
+	if( p == NULL ) {
+		fprintf( stderr, "Z_Malloc: failed on allocation of %i bytes\n", size );
+		exit( EXIT_FAILURE );
+	}
+	return p;
+}
+
+void Z_Free( void *ptr ) {
+	free( ptr );
+}
+
+void VID_Printf( int print_level, const char *fmt, ... ) {
+	va_list argptr;
+
+	va_start( argptr, fmt );
+	vprintf( fmt, argptr );
+	va_end( argptr );
+}
+
+void Com_Printf( const char *fmt, ... ) {
+	va_list argptr;
+
+	va_start( argptr, fmt );
+	vprintf( fmt, argptr );
+	va_end( argptr );
+}
+
+void Com_Error( int code, const char *fmt, ... ) {
+	va_list argptr;
+
+	va_start( argptr, fmt );
+	vfprintf( stderr, fmt, argptr );
+	va_end( argptr );
+	fputc( '\n', stderr );
+	exit( EXIT_FAILURE );
+}
+
+/* gl_imagebench is linked in but never run, main passes its own arguments */
+int Cmd_Argc( void ) {
+	return 0;
+}
+
+const char *Cmd_Argv( int arg ) {
+	return "";
+}
+
+int curtime;
+
+int Sys_Milliseconds() {
+	static const auto base = std::chrono::steady_clock::now();
+
+	curtime = (int)std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now() - base ).count();
+	return curtime;
+}
+
+/*
+=============================================================================
+
+MAIN
+
+=============================================================================
+*/
+
+int main( int argc, char **argv ) {
+	const int width = argc > 1 ? atoi( argv[ 1 ] ) : 320;
+	const int height = argc > 2 ? atoi( argv[ 2 ] ) : 240;
+	const int count = argc > 3 ? atoi( argv[ 3 ] ) : 200;
+
+	if( argc > 4 ) {
+		printf( "usage: imagebench [width] [height] [count]\n" );
+		return EXIT_FAILURE;
+	}
+
+	Swap_Init();
+
+	srand( 1 );
+	for( int i = 0; i < 255; i++ )
+		d_8to24table[ i ] = LittleLong( 0xff000000 | ( rand() & 0xffffff ) );
+	d_8to24table[ 255 ] = 0;
+
+	return GL_ImageBench( width, height, count ) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
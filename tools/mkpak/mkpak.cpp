@@ -0,0 +1,726 @@
+/*
+Copyright (C) 1997-2001 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+/*
+ * mkpak: offline tool that rebuilds an Anachronox .dat package as an
+ * .opk package (see qfiles.h), and verifies the result.
+ *
+ *   mkpak build <in.dat> <out.opk> [groups.txt]
+ *   mkpak verify <in.opk> [in.dat]
+ *   mkpak selftest
+ *
+ * The groups file lists the files each map uses, so they can be laid out
+ * together; a line of the form "[name]" starts a new group and every line
+ * after it names a file within the package. Files that aren't listed are
+ * grouped by their top level directory and placed after the listed ones.
+ */
+
+#include "../../qcommon/qcommon.h"
+#include "../../qcommon/crc.h"
+
+#include <miniz/miniz.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+typedef struct MkpakEntry {
+	std::string				name;
+	std::vector<uint8_t>	data;		/* decompressed */
+	std::vector<uint8_t>	stored;		/* as it'll be written, empty if stored raw */
+	uint32_t				group;
+	uint32_t				order;		/* position within the group file, if listed */
+	unsigned short			crc;
+} MkpakEntry;
+
+/*
+=============================================================================
+
+UTILITIES
+
+=============================================================================
+*/
+
+static int Mkpak_CompareNames( const char *a, const char *b ) {
+	for( ;; ++a, ++b ) {
+		int ca = *a, cb = *b;
+		if( ca >= 'A' && ca <= 'Z' ) {
+			ca += 'a' - 'A';
+		}
+		if( cb >= 'A' && cb <= 'Z' ) {
+			cb += 'a' - 'A';
+		}
+
+		if( ca != cb || ca == '\0' ) {
+			return ca - cb;
+		}
+	}
+}
+
+/**
+ * Matches FS_HashFileName, so the hash can be reused by anything mounting the package.
+ */
+static uint32_t Mkpak_HashName( const char *name ) {
+	uint32_t hash = 2166136261u;
+	for( ; *name != '\0'; ++name ) {
+		char c = *name;
+		if( c >= 'A' && c <= 'Z' ) {
+			c += 'a' - 'A';
+		}
+
+		hash ^= (uint8_t)c;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static void Mkpak_CanonicaliseName( char *name ) {
+	for( ; *name != '\0'; ++name ) {
+		if( *name == '\\' ) {
+			*name = '/';
+		}
+	}
+}
+
+static bool Mkpak_ReadFile( const char *path, std::vector<uint8_t> &buffer ) {
+	FILE *file = fopen( path, "rb" );
+	if( file == NULL ) {
+		fprintf( stderr, "Failed to open \"%s\"!\n", path );
+		return false;
+	}
+
+	fseek( file, 0, SEEK_END );
+	long length = ftell( file );
+	fseek( file, 0, SEEK_SET );
+
+	if( length <= 0 ) {
+		fprintf( stderr, "\"%s\" is empty!\n", path );
+		fclose( file );
+		return false;
+	}
+
+	buffer.resize( (size_t)length );
+	bool status = fread( buffer.data(), 1, buffer.size(), file ) == buffer.size();
+	fclose( file );
+
+	if( !status ) {
+		fprintf( stderr, "Failed to read \"%s\"!\n", path );
+	}
+
+	return status;
+}
+
+static unsigned short Mkpak_Crc( const std::vector<uint8_t> &data ) {
+	return CRC_Block( (byte *)data.data(), (int)data.size() );
+}
+
+static bool Mkpak_Inflate( const uint8_t *src, size_t srcLength, std::vector<uint8_t> &dst ) {
+	mz_ulong dstLength = (mz_ulong)dst.size();
+	if( mz_uncompress( dst.data(), &dstLength, src, (mz_ulong)srcLength ) != MZ_OK ) {
+		return false;
+	}
+
+	return dstLength == dst.size();
+}
+
+/*
+=============================================================================
+
+DAT
+
+=============================================================================
+*/
+
+/**
+ * Load and decompress every entry from an Anachronox .dat package.
+ */
+static bool Mkpak_LoadDat( const char *path, std::vector<MkpakEntry> &entries ) {
+	std::vector<uint8_t> buffer;
+	if( !Mkpak_ReadFile( path, buffer ) ) {
+		return false;
+	}
+
+	PackageHeader header;
+	if( buffer.size() < sizeof( header ) ) {
+		fprintf( stderr, "\"%s\" is too small to be a package!\n", path );
+		return false;
+	}
+
+	memcpy( &header, buffer.data(), sizeof( header ) );
+	if( strncmp( header.identifier, "ADAT", sizeof( header.identifier ) ) != 0 || header.version != 9 ) {
+		fprintf( stderr, "\"%s\" is not a valid .dat package!\n", path );
+		return false;
+	}
+
+	unsigned int numFiles = header.tocLength / sizeof( PackageIndex );
+	if( (size_t)header.tocOffset + sizeof( PackageIndex ) * numFiles > buffer.size() ) {
+		fprintf( stderr, "Failed to read entire table of contents from \"%s\"!\n", path );
+		return false;
+	}
+
+	entries.resize( numFiles );
+	for( unsigned int i = 0; i < numFiles; ++i ) {
+		PackageIndex index;
+		memcpy( &index, buffer.data() + header.tocOffset + sizeof( PackageIndex ) * i, sizeof( PackageIndex ) );
+		index.name[ sizeof( index.name ) - 1 ] = '\0';
+		Mkpak_CanonicaliseName( index.name );
+
+		if( (size_t)index.offset + index.compressedLength > buffer.size() ) {
+			fprintf( stderr, "Entry \"%s\" lies outside of \"%s\"!\n", index.name, path );
+			return false;
+		}
+
+		MkpakEntry *entry = &entries[ i ];
+		entry->name = index.name;
+		entry->data.resize( index.length );
+
+		const uint8_t *src = buffer.data() + index.offset;
+		if( index.compressedLength == index.length ) {
+			memcpy( entry->data.data(), src, index.length );
+		} else if( !Mkpak_Inflate( src, index.compressedLength, entry->data ) ) {
+			fprintf( stderr, "Failed to decompress \"%s\" from \"%s\"!\n", index.name, path );
+			return false;
+		}
+
+		entry->crc = Mkpak_Crc( entry->data );
+		entry->group = 0;
+		entry->order = 0;
+	}
+
+	return true;
+}
+
+/*
+=============================================================================
+
+BUILD
+
+=============================================================================
+*/
+
+/**
+ * Assign every entry a group, first from the groups file and then by
+ * top level directory, so that sorting by group keeps each map's assets
+ * contiguous.
+ */
+static bool Mkpak_AssignGroups( std::vector<MkpakEntry> &entries, const char *groupsPath ) {
+	uint32_t numGroups = 0;
+
+	if( groupsPath != NULL ) {
+		FILE *file = fopen( groupsPath, "r" );
+		if( file == NULL ) {
+			fprintf( stderr, "Failed to open \"%s\"!\n", groupsPath );
+			return false;
+		}
+
+		uint32_t order = 0;
+		char line[ 256 ];
+		while( fgets( line, sizeof( line ), file ) != NULL ) {
+			line[ strcspn( line, "\r\n" ) ] = '\0';
+			if( line[ 0 ] == '\0' || line[ 0 ] == '#' ) {
+				continue;
+			}
+
+			if( line[ 0 ] == '[' ) {
+				numGroups++;
+				continue;
+			}
+
+			if( numGroups == 0 ) {
+				fprintf( stderr, "\"%s\" is listed before any group in \"%s\"!\n", line, groupsPath );
+				fclose( file );
+				return false;
+			}
+
+			/* a file shared between maps stays with the first that uses it */
+			Mkpak_CanonicaliseName( line );
+			for( MkpakEntry &entry : entries ) {
+				if( entry.group == 0 && Mkpak_CompareNames( entry.name.c_str(), line ) == 0 ) {
+					entry.group = numGroups;
+					entry.order = order++;
+					break;
+				}
+			}
+		}
+
+		fclose( file );
+	}
+
+	std::vector<std::string> directories;
+	for( MkpakEntry &entry : entries ) {
+		if( entry.group != 0 ) {
+			continue;
+		}
+
+		size_t slash = entry.name.find( '/' );
+		std::string directory = ( slash == std::string::npos ) ? std::string() : entry.name.substr( 0, slash );
+
+		size_t i;
+		for( i = 0; i < directories.size(); ++i ) {
+			if( Mkpak_CompareNames( directories[ i ].c_str(), directory.c_str() ) == 0 ) {
+				break;
+			}
+		}
+
+		if( i == directories.size() ) {
+			directories.push_back( directory );
+		}
+
+		entry.group = numGroups + 1 + (uint32_t)i;
+	}
+
+	return true;
+}
+
+/**
+ * Pick the cheapest codec for an entry; deflate is only kept if it comes
+ * out smaller, and then only if it saves at least one alignment block's
+ * worth or an eighth of the file, as anything less isn't worth paying for
+ * on load.
+ */
+static void Mkpak_CompressEntry( MkpakEntry *entry ) {
+	entry->stored.clear();
+	if( entry->data.empty() ) {
+		return;
+	}
+
+	mz_ulong length = mz_compressBound( (mz_ulong)entry->data.size() );
+	entry->stored.resize( length );
+	if( mz_compress2( entry->stored.data(), &length, entry->data.data(), (mz_ulong)entry->data.size(), MZ_BEST_COMPRESSION ) != MZ_OK ) {
+		entry->stored.clear();
+		return;
+	}
+
+	/* the engine won't mount a deflated entry that isn't smaller than the original */
+	if( length >= entry->data.size() ) {
+		entry->stored.clear();
+		return;
+	}
+
+	size_t saving = entry->data.size() - length;
+	if( saving < OPK_ALIGNMENT && saving < entry->data.size() / 8 ) {
+		entry->stored.clear();
+		return;
+	}
+
+	entry->stored.resize( length );
+}
+
+static bool Mkpak_WritePadding( FILE *file, uint32_t *position ) {
+	static const uint8_t zeros[ OPK_ALIGNMENT ] = {};
+
+	uint32_t padding = ( OPK_ALIGNMENT - ( *position % OPK_ALIGNMENT ) ) % OPK_ALIGNMENT;
+	*position += padding;
+	return fwrite( zeros, 1, padding, file ) == padding;
+}
+
+static int Mkpak_Build( const char *datPath, const char *opkPath, const char *groupsPath ) {
+	std::vector<MkpakEntry> entries;
+	if( !Mkpak_LoadDat( datPath, entries ) ) {
+		return EXIT_FAILURE;
+	}
+
+	if( entries.empty() ) {
+		fprintf( stderr, "\"%s\" is empty!\n", datPath );
+		return EXIT_FAILURE;
+	}
+
+	if( !Mkpak_AssignGroups( entries, groupsPath ) ) {
+		return EXIT_FAILURE;
+	}
+
+	/* data is laid out by group, in the order the group file lists it */
+	std::vector<uint32_t> layout( entries.size() );
+	for( uint32_t i = 0; i < layout.size(); ++i ) {
+		layout[ i ] = i;
+	}
+
+	std::stable_sort( layout.begin(), layout.end(), [ &entries ]( uint32_t a, uint32_t b ) {
+		const MkpakEntry &ea = entries[ a ], &eb = entries[ b ];
+		if( ea.group != eb.group ) {
+			return ea.group < eb.group;
+		}
+		if( ea.order != eb.order ) {
+			return ea.order < eb.order;
+		}
+		return Mkpak_CompareNames( ea.name.c_str(), eb.name.c_str() ) < 0;
+	} );
+
+	FILE *file = fopen( opkPath, "wb" );
+	if( file == NULL ) {
+		fprintf( stderr, "Failed to open \"%s\" for writing!\n", opkPath );
+		return EXIT_FAILURE;
+	}
+
+	OpkHeader header;
+	memset( &header, 0, sizeof( header ) );
+
+	uint32_t position = sizeof( header );
+	bool status = fwrite( &header, sizeof( header ), 1, file ) == 1;
+
+	std::vector<OpkIndex> indices( entries.size() );
+	size_t numDeflated = 0, dataLength = 0, storedLength = 0;
+	for( uint32_t i = 0; i < layout.size() && status; ++i ) {
+		MkpakEntry *entry = &entries[ layout[ i ] ];
+		Mkpak_CompressEntry( entry );
+
+		const std::vector<uint8_t> &stored = entry->stored.empty() ? entry->data : entry->stored;
+		if( (uint64_t)position + OPK_ALIGNMENT + stored.size() > UINT32_MAX ) {
+			fprintf( stderr, "\"%s\" would be too large!\n", opkPath );
+			status = false;
+			break;
+		}
+
+		status = Mkpak_WritePadding( file, &position );
+
+		OpkIndex *index = &indices[ layout[ i ] ];
+		index->offset = position;
+		index->length = (uint32_t)entry->data.size();
+		index->storedLength = (uint32_t)stored.size();
+		index->crc = entry->crc;
+		index->codec = entry->stored.empty() ? OPK_CODEC_STORE : OPK_CODEC_DEFLATE;
+		index->group = entry->group;
+
+		status = status && fwrite( stored.data(), 1, stored.size(), file ) == stored.size();
+		position += (uint32_t)stored.size();
+
+		numDeflated += ( index->codec == OPK_CODEC_DEFLATE );
+		dataLength += entry->data.size();
+		storedLength += stored.size();
+
+		/* free as we go, some of these packages are large */
+		std::vector<uint8_t>().swap( entry->data );
+		std::vector<uint8_t>().swap( entry->stored );
+	}
+
+	/* the table of contents is sorted by name, so it can also be bisected */
+	std::vector<uint32_t> sorted( entries.size() );
+	for( uint32_t i = 0; i < sorted.size(); ++i ) {
+		sorted[ i ] = i;
+	}
+
+	std::sort( sorted.begin(), sorted.end(), [ &entries ]( uint32_t a, uint32_t b ) {
+		return Mkpak_CompareNames( entries[ a ].name.c_str(), entries[ b ].name.c_str() ) < 0;
+	} );
+
+	std::vector<char> names;
+	std::vector<OpkIndex> toc( entries.size() );
+	for( uint32_t i = 0; i < sorted.size(); ++i ) {
+		const MkpakEntry &entry = entries[ sorted[ i ] ];
+		if( i > 0 && Mkpak_CompareNames( entries[ sorted[ i - 1 ] ].name.c_str(), entry.name.c_str() ) == 0 ) {
+			fprintf( stderr, "Duplicate entry \"%s\" in \"%s\"!\n", entry.name.c_str(), datPath );
+			status = false;
+		}
+
+		toc[ i ] = indices[ sorted[ i ] ];
+		toc[ i ].nameOffset = (uint32_t)names.size();
+		toc[ i ].nameHash = Mkpak_HashName( entry.name.c_str() );
+		names.insert( names.end(), entry.name.c_str(), entry.name.c_str() + entry.name.size() + 1 );
+	}
+
+	/* keep the hash table at most half full */
+	uint32_t numHashSlots = 16;
+	while( numHashSlots < toc.size() * 2 ) {
+		numHashSlots <<= 1;
+	}
+
+	std::vector<uint32_t> slots( numHashSlots, 0 );
+	for( uint32_t i = 0; i < toc.size(); ++i ) {
+		uint32_t slot = toc[ i ].nameHash & ( numHashSlots - 1 );
+		while( slots[ slot ] != 0 ) {
+			slot = ( slot + 1 ) & ( numHashSlots - 1 );
+		}
+		slots[ slot ] = i + 1;
+	}
+
+	if( status ) {
+		status = Mkpak_WritePadding( file, &position );
+
+		memcpy( header.identifier, OPK_IDENTIFIER, sizeof( header.identifier ) );
+		header.version = OPK_VERSION;
+		header.numEntries = (uint32_t)toc.size();
+		header.tocOffset = position;
+		header.hashOffset = header.tocOffset + (uint32_t)( sizeof( OpkIndex ) * toc.size() );
+		header.numHashSlots = numHashSlots;
+		header.namesOffset = header.hashOffset + (uint32_t)( sizeof( uint32_t ) * slots.size() );
+		header.namesLength = (uint32_t)names.size();
+
+		status = status &&
+		         fwrite( toc.data(), sizeof( OpkIndex ), toc.size(), file ) == toc.size() &&
+		         fwrite( slots.data(), sizeof( uint32_t ), slots.size(), file ) == slots.size() &&
+		         fwrite( names.data(), 1, names.size(), file ) == names.size() &&
+		         fseek( file, 0, SEEK_SET ) == 0 &&
+		         fwrite( &header, sizeof( header ), 1, file ) == 1;
+	}
+
+	status = ( fclose( file ) == 0 ) && status;
+	if( !status ) {
+		fprintf( stderr, "Failed to write \"%s\"!\n", opkPath );
+		remove( opkPath );
+		return EXIT_FAILURE;
+	}
+
+	printf( "%s: %u entries, %u deflated, %u groups\n", opkPath, header.numEntries, (unsigned int)numDeflated,
+	        entries.empty() ? 0 : indices[ layout.back() ].group );
+	printf( "%u bytes of data stored in %u bytes, %u byte package\n", (unsigned int)dataLength, (unsigned int)storedLength,
+	        header.namesOffset + header.namesLength );
+
+	return EXIT_SUCCESS;
+}
+
+/*
+=============================================================================
+
+VERIFY
+
+=============================================================================
+*/
+
+typedef struct MkpakOpk {
+	std::vector<uint8_t>	buffer;
+	OpkHeader				header;
+	const char				*names;
+} MkpakOpk;
+
+static const OpkIndex *Mkpak_GetOpkIndex( const MkpakOpk *opk, uint32_t i ) {
+	return reinterpret_cast<const OpkIndex *>( opk->buffer.data() + opk->header.tocOffset ) + i;
+}
+
+static const OpkIndex *Mkpak_FindOpkIndex( const MkpakOpk *opk, const char *name ) {
+	const uint32_t *slots = reinterpret_cast<const uint32_t *>( opk->buffer.data() + opk->header.hashOffset );
+	uint32_t mask = opk->header.numHashSlots - 1;
+	for( uint32_t slot = Mkpak_HashName( name ) & mask, i = 0; i < opk->header.numHashSlots; slot = ( slot + 1 ) & mask, ++i ) {
+		if( slots[ slot ] == 0 || slots[ slot ] > opk->header.numEntries ) {
+			return NULL;
+		}
+
+		const OpkIndex *index = Mkpak_GetOpkIndex( opk, slots[ slot ] - 1 );
+		if( Mkpak_CompareNames( opk->names + index->nameOffset, name ) == 0 ) {
+			return index;
+		}
+	}
+
+	return NULL;
+}
+
+static bool Mkpak_LoadOpk( const char *path, MkpakOpk *opk ) {
+	if( !Mkpak_ReadFile( path, opk->buffer ) ) {
+		return false;
+	}
+
+	const size_t length = opk->buffer.size();
+	if( length < sizeof( OpkHeader ) ) {
+		fprintf( stderr, "\"%s\" is too small to be a package!\n", path );
+		return false;
+	}
+
+	OpkHeader *header = &opk->header;
+	memcpy( header, opk->buffer.data(), sizeof( OpkHeader ) );
+	if( strncmp( header->identifier, OPK_IDENTIFIER, sizeof( header->identifier ) ) != 0 || header->version != OPK_VERSION ) {
+		fprintf( stderr, "\"%s\" is not a valid .opk package!\n", path );
+		return false;
+	}
+
+	if( (size_t)header->tocOffset + sizeof( OpkIndex ) * header->numEntries > length ||
+	    (size_t)header->hashOffset + sizeof( uint32_t ) * header->numHashSlots > length ||
+	    (size_t)header->namesOffset + header->namesLength > length ||
+	    header->numHashSlots == 0 || ( header->numHashSlots & ( header->numHashSlots - 1 ) ) != 0 ||
+	    header->tocOffset % sizeof( uint32_t ) != 0 || header->hashOffset % sizeof( uint32_t ) != 0 ||
+	    header->namesLength == 0 || opk->buffer[ header->namesOffset + header->namesLength - 1 ] != '\0' ) {
+		fprintf( stderr, "\"%s\" has an invalid table of contents!\n", path );
+		return false;
+	}
+
+	opk->names = reinterpret_cast<const char *>( opk->buffer.data() + header->namesOffset );
+	return true;
+}
+
+/**
+ * Decode an entry the way the engine will, holding it to the same rules
+ * FS_ReadOpkIndices does.
+ */
+static bool Mkpak_DecodeEntry( const OpkIndex *index, const uint8_t *src, std::vector<uint8_t> &data ) {
+	data.resize( index->length );
+	switch( index->codec ) {
+		case OPK_CODEC_STORE:
+			if( index->storedLength != index->length ) {
+				return false;
+			}
+			memcpy( data.data(), src, index->length );
+			return true;
+		case OPK_CODEC_DEFLATE:
+			return index->storedLength < index->length && Mkpak_Inflate( src, index->storedLength, data );
+		default:
+			return false;
+	}
+}
+
+/**
+ * Round-trip every entry in the package, and optionally check that it
+ * matches the .dat it was built from.
+ */
+static int Mkpak_Verify( const char *opkPath, const char *datPath ) {
+	MkpakOpk opk;
+	if( !Mkpak_LoadOpk( opkPath, &opk ) ) {
+		return EXIT_FAILURE;
+	}
+
+	unsigned int numErrors = 0;
+	const OpkHeader *header = &opk.header;
+	for( uint32_t i = 0; i < header->numEntries; ++i ) {
+		const OpkIndex *index = Mkpak_GetOpkIndex( &opk, i );
+		if( index->nameOffset >= header->namesLength ) {
+			fprintf( stderr, "Entry %u has an invalid name!\n", i );
+			numErrors++;
+			continue;
+		}
+
+		const char *name = opk.names + index->nameOffset;
+		if( i > 0 && Mkpak_CompareNames( opk.names + Mkpak_GetOpkIndex( &opk, i - 1 )->nameOffset, name ) >= 0 ) {
+			fprintf( stderr, "\"%s\" is out of order!\n", name );
+			numErrors++;
+		}
+
+		if( index->nameHash != Mkpak_HashName( name ) || Mkpak_FindOpkIndex( &opk, name ) != index ) {
+			fprintf( stderr, "\"%s\" can't be found through the hash table!\n", name );
+			numErrors++;
+		}
+
+		if( index->offset % OPK_ALIGNMENT != 0 || (size_t)index->offset + index->storedLength > opk.buffer.size() ) {
+			fprintf( stderr, "\"%s\" is misplaced!\n", name );
+			numErrors++;
+			continue;
+		}
+
+		std::vector<uint8_t> data;
+		if( !Mkpak_DecodeEntry( index, opk.buffer.data() + index->offset, data ) ) {
+			fprintf( stderr, "Failed to decode \"%s\" (codec %u)!\n", name, index->codec );
+			numErrors++;
+		} else if( Mkpak_Crc( data ) != index->crc ) {
+			fprintf( stderr, "CRC mismatch for \"%s\"!\n", name );
+			numErrors++;
+		}
+	}
+
+	if( datPath != NULL ) {
+		std::vector<MkpakEntry> entries;
+		if( !Mkpak_LoadDat( datPath, entries ) ) {
+			return EXIT_FAILURE;
+		}
+
+		if( entries.size() != header->numEntries ) {
+			fprintf( stderr, "\"%s\" has %u entries, \"%s\" has %u!\n", datPath, (unsigned int)entries.size(), opkPath, header->numEntries );
+			numErrors++;
+		}
+
+		for( const MkpakEntry &entry : entries ) {
+			const OpkIndex *index = Mkpak_FindOpkIndex( &opk, entry.name.c_str() );
+			if( index == NULL ) {
+				fprintf( stderr, "\"%s\" is missing!\n", entry.name.c_str() );
+				numErrors++;
+			} else if( index->length != entry.data.size() || index->crc != entry.crc ) {
+				fprintf( stderr, "\"%s\" doesn't match the original!\n", entry.name.c_str() );
+				numErrors++;
+			}
+		}
+	}
+
+	if( numErrors > 0 ) {
+		fprintf( stderr, "%s: %u errors\n", opkPath, numErrors );
+		return EXIT_FAILURE;
+	}
+
+	printf( "%s: %u entries OK\n", opkPath, header->numEntries );
+	return EXIT_SUCCESS;
+}
+
+/**
+ * Round-trip entries of awkward sizes through the same compression and
+ * decoding that build and verify use, without needing a .dat to hand.
+ */
+static int Mkpak_SelfTest( void ) {
+	static const size_t sizes[] = { 1, 2, 7, 8, 9, 100, OPK_ALIGNMENT - 1, OPK_ALIGNMENT, 64 * 1024 };
+
+	unsigned int numErrors = 0, numTests = 0;
+	for( size_t size : sizes ) {
+		/* repetitive data deflates well, noise doesn't at all */
+		for( int pattern = 0; pattern < 2; ++pattern ) {
+			MkpakEntry entry;
+			entry.name = "selftest";
+			entry.data.resize( size );
+			for( size_t i = 0; i < size; ++i ) {
+				entry.data[ i ] = pattern ? (uint8_t)( ( i * 2654435761u ) >> 13 ) : (uint8_t)( i % 3 );
+			}
+			entry.crc = Mkpak_Crc( entry.data );
+
+			Mkpak_CompressEntry( &entry );
+
+			const std::vector<uint8_t> &stored = entry.stored.empty() ? entry.data : entry.stored;
+			OpkIndex index;
+			memset( &index, 0, sizeof( index ) );
+			index.length = (uint32_t)entry.data.size();
+			index.storedLength = (uint32_t)stored.size();
+			index.codec = entry.stored.empty() ? OPK_CODEC_STORE : OPK_CODEC_DEFLATE;
+
+			std::vector<uint8_t> data;
+			if( !Mkpak_DecodeEntry( &index, stored.data(), data ) ) {
+				fprintf( stderr, "Failed to decode %u byte entry (codec %u)!\n", (unsigned int)size, index.codec );
+				numErrors++;
+			} else if( data != entry.data || Mkpak_Crc( data ) != entry.crc ) {
+				fprintf( stderr, "%u byte entry didn't survive the round-trip!\n", (unsigned int)size );
+				numErrors++;
+			}
+
+			numTests++;
+		}
+	}
+
+	if( numErrors > 0 ) {
+		fprintf( stderr, "selftest: %u of %u failed\n", numErrors, numTests );
+		return EXIT_FAILURE;
+	}
+
+	printf( "selftest: %u entries OK\n", numTests );
+	return EXIT_SUCCESS;
+}
+
+static void Mkpak_Usage( void ) {
+	printf( "usage: mkpak build <in.dat> <out.opk> [groups.txt]\n"
+	        "       mkpak verify <in.opk> [in.dat]\n"
+	        "       mkpak selftest\n" );
+}
+
+int main( int argc, char **argv ) {
+	if( argc >= 4 && argc <= 5 && strcmp( argv[ 1 ], "build" ) == 0 ) {
+		return Mkpak_Build( argv[ 2 ], argv[ 3 ], ( argc == 5 ) ? argv[ 4 ] : NULL );
+	}
+
+	if( argc >= 3 && argc <= 4 && strcmp( argv[ 1 ], "verify" ) == 0 ) {
+		return Mkpak_Verify( argv[ 2 ], ( argc == 4 ) ? argv[ 3 ] : NULL );
+	}
+
+	if( argc == 2 && strcmp( argv[ 1 ], "selftest" ) == 0 ) {
+		return Mkpak_SelfTest();
+	}
+
+	Mkpak_Usage();
+	return EXIT_FAILURE;
+}
@@ -26,82 +26,132 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include <direct.h>
 #include <io.h>
 #include <conio.h>
+#include <malloc.h>
 
 //===============================================================================
 
 int		hunkcount;
 
+/*
+A hunk starts out as a single chunk sized from the caller's estimate, and
+grows by chaining on further chunks as needed, so a model that outgrows
+its estimate no longer brings the game down. Nothing is ever moved, so
+pointers into the hunk stay valid.
+*/
+
+#define	HUNK_MIN_GROW	0x40000		// smallest chunk added once the first is full
 
-byte	*membase;
-int		hunkmaxsize;
-int		cursize;
+typedef struct hunkchunk_s
+{
+	struct hunkchunk_s	*next;
+	size_t				size;		// usable bytes after the header
+	size_t				used;
+	size_t				reserved;	// first chunk only, bytes held by the whole hunk
+} hunkchunk_t;					// a multiple of 16 bytes, so allocations stay as aligned as malloc's
 
-//#define	VIRTUAL_ALLOC
+static hunkchunk_t	*hunkbase;
+static hunkchunk_t	*hunkcurrent;
+static size_t		cursize;
+
+static hunkchunk_t *Hunk_NewChunk (size_t size)
+{
+	hunkchunk_t *chunk = static_cast< hunkchunk_t* >( calloc (1, sizeof (hunkchunk_t) + size) );
+	if (!chunk)
+		Sys_Error ("Hunk_NewChunk: failed on allocation of %u bytes", (unsigned)size);
+	chunk->size = size;
+	return chunk;
+}
 
 void *Hunk_Begin (size_t maxsize)
 {
-	// reserve a huge chunk of memory, but don't commit any yet
+	// maxsize is only an estimate now, so start with a chunk that size
 	cursize = 0;
-	hunkmaxsize = maxsize;
-#ifdef VIRTUAL_ALLOC
-	membase = VirtualAlloc (NULL, maxsize, MEM_RESERVE, PAGE_NOACCESS);
-#else
-	membase = static_cast< byte* >( malloc (maxsize) );
-	memset (membase, 0, maxsize);
-#endif
-	if (!membase)
-		Sys_Error ("VirtualAlloc reserve failed");
-	return (void *)membase;
+	hunkbase = hunkcurrent = Hunk_NewChunk ((maxsize+31)&~31);
+	hunkbase->reserved = hunkbase->size;
+
+	if (mem_tracing)
+		Mem_Trace (MEM_TRACE_HUNK_BEGIN, MEM_TRACE_SITE, maxsize, 0);
+	return (void *)(hunkbase+1);
 }
 
 void *Hunk_Alloc (size_t size)
 {
+	if (!hunkcurrent)
+		Sys_Error ("Hunk_Alloc: no hunk begun");
+
 	// round to cacheline
 	size = (size+31)&~31;
 
-#ifdef VIRTUAL_ALLOC
-	// commit pages as needed
-//	buf = VirtualAlloc (membase+cursize, size, MEM_COMMIT, PAGE_READWRITE);
-	void *buf = VirtualAlloc (membase, cursize+size, MEM_COMMIT, PAGE_READWRITE);
-	if (!buf)
+	if (hunkcurrent->used + size > hunkcurrent->size)
 	{
-		FormatMessage(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM, NULL, GetLastError(), MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), (LPTSTR) &buf, 0, NULL);
-		Sys_Error ("VirtualAlloc commit failed.\n%s", buf);
+		// grow by at least a quarter of what's held so far, so big models don't end up with lots of chunks
+		size_t grow = hunkbase->reserved / 4;
+		if (grow < HUNK_MIN_GROW)
+			grow = HUNK_MIN_GROW;
+		if (grow < size)
+			grow = size;
+
+		hunkcurrent->next = Hunk_NewChunk (grow);
+		hunkcurrent = hunkcurrent->next;
+		hunkbase->reserved += grow;
 	}
-#endif
+
+	byte *buf = (byte *)(hunkcurrent+1) + hunkcurrent->used;
+	hunkcurrent->used += size;
 	cursize += size;
-	if (cursize > hunkmaxsize)
-		Sys_Error ("Hunk_Alloc overflow");
 
-	return (void *)(membase+cursize-size);
+	if (mem_tracing)
+		Mem_Trace (MEM_TRACE_HUNK_ALLOC, MEM_TRACE_SITE, size, 0);
+
+	return (void *)buf;
 }
 
 int Hunk_End (void)
 {
+	if (!hunkcurrent)
+		Sys_Error ("Hunk_End: no hunk begun");
 
-	// free the remaining unused virtual memory
-#if 0
-	void	*buf;
+	// hand back what the last chunk didn't use; _expand never moves the block
+	hunkbase->reserved -= hunkcurrent->size - hunkcurrent->used;
+	if (_expand (hunkcurrent, sizeof (hunkchunk_t) + hunkcurrent->used))
+		hunkcurrent->size = hunkcurrent->used;
+	else
+		hunkbase->reserved += hunkcurrent->size - hunkcurrent->used;
 
-	// write protect it
-	buf = VirtualAlloc (membase, cursize, MEM_COMMIT, PAGE_READONLY);
-	if (!buf)
-		Sys_Error ("VirtualAlloc commit failed");
-#endif
+	hunkbase = hunkcurrent = NULL;
 
 	hunkcount++;
 //Com_Printf ("hunkcount: %i\n", hunkcount);
-	return cursize;
+	return (int)cursize;
+}
+
+/*
+================
+Hunk_Reserved
+
+Bytes held by a finished hunk, including whatever it didn't use.
+================
+*/
+size_t Hunk_Reserved (void *base)
+{
+	if (!base)
+		return 0;
+
+	return ((hunkchunk_t *)base - 1)->reserved;
 }
 
 void Hunk_Free (void *base)
 {
 	if ( base )
-#ifdef VIRTUAL_ALLOC
-		VirtualFree (base, 0, MEM_RELEASE);
-#else
-		free (base);
-#endif
+	{
+		hunkchunk_t *chunk = (hunkchunk_t *)base - 1;
+		while (chunk)
+		{
+			hunkchunk_t *next = chunk->next;
+			free (chunk);
+			chunk = next;
+		}
+	}
 
 	hunkcount--;
 }